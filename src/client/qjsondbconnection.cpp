@@ -350,6 +350,30 @@ void QJsonDbConnectionPrivate::handleRequestQueue()
     }
 }
 
+bool QJsonDbConnectionPrivate::cancelStreamedRead(QJsonDbRequest *request)
+{
+    if (request != currentRequest.data())
+        return false;
+    QJsonDbReadRequest *readRequest = qobject_cast<QJsonDbReadRequest *>(request);
+    if (!readRequest || !readRequest->d_func()->cursorId)
+        return false;
+
+    // stop the server side cursor, chunks that are already on the way are ignored
+    QJsonObject cursor;
+    cursor.insert(JsonDbStrings::Protocol::cursor(), readRequest->d_func()->cursorId);
+    QJsonObject message;
+    message.insert(JsonDbStrings::Protocol::action(), JsonDbStrings::Protocol::closeCursor());
+    message.insert(JsonDbStrings::Protocol::object(), cursor);
+    message.insert(JsonDbStrings::Protocol::requestId(), readRequest->d_func()->requestId);
+    stream->send(message);
+
+    readRequest->d_func()->cursorId = 0;
+    currentRequest.clear();
+    readRequest->d_func()->setStatus(QJsonDbRequest::Canceled);
+    handleRequestQueue();
+    return true;
+}
+
 void QJsonDbConnectionPrivate::handlePrivatePartitionRequest(const QJsonObject &request)
 {
     Q_Q(QJsonDbConnection);
@@ -385,53 +409,88 @@ void QJsonDbConnectionPrivate::handlePrivatePartitionRequest(const QJsonObject &
     QMetaObject::invokeMethod(privatePartitionHandler, "handleRequest", Qt::QueuedConnection, Q_ARG(QJsonObject, request));
 }
 
+/*!
+    \internal
+    Hands one notification to the watcher known as \a notifyUuid. When
+    \a batched, the watcher does not signal it and is returned if it took
+    the notification, so that the caller signals once for the batch.
+*/
+QJsonDbWatcher *QJsonDbConnectionPrivate::handleNotify(const QString &notifyUuid, const QJsonObject &sub, bool batched)
+{
+    QString action = sub.value(JsonDbStrings::Protocol::action()).toString();
+    QJsonObject notificationObject = sub.value(JsonDbStrings::Protocol::object()).toObject();
+    quint32 stateNumber = sub.value(JsonDbStrings::Protocol::stateNumber()).toDouble();
+    QMap<QString, QPointer<QJsonDbWatcher> >::iterator it = watchers.find(notifyUuid);
+    if (it == watchers.end()) {
+        // received notification for unknown watcher, just ignore it.
+        return 0;
+    }
+    QJsonDbWatcher *watcher = it.value().data();
+    if (!watcher) {
+        qWarning("QJsonDbConnection: received notification for already deleted watcher");
+        watchers.erase(it);
+        return 0;
+    }
+    // initialize actionType to silence compiler warnings.
+    QJsonDbWatcher::Action actionType = QJsonDbWatcher::All;
+    bool stateChanged = false;
+    if (action == JsonDbStrings::Notification::actionCreate())
+        actionType = QJsonDbWatcher::Created;
+    else if (action == JsonDbStrings::Notification::actionUpdate())
+        actionType = QJsonDbWatcher::Updated;
+    else if (action == JsonDbStrings::Notification::actionRemove())
+        actionType = QJsonDbWatcher::Removed;
+    else if (action == JsonDbStrings::Notification::actionStateChange())
+        stateChanged = true;
+    else
+        qWarning() << "Unknown action" << action << "received for notification" << notifyUuid;
+
+    if (stateChanged)
+        watcher->d_func()->handleStateChange(stateNumber);
+    else if (actionType != QJsonDbWatcher::All
+             && watcher->d_func()->handleNotification(stateNumber, actionType, notificationObject, !batched))
+        return watcher;
+    return 0;
+}
+
 void QJsonDbConnectionPrivate::_q_onReceivedObject(const QJsonObject &object)
 {
     if (object.contains(JsonDbStrings::Property::notify())) {
-        QString notifyUuid = object.value(JsonDbStrings::Property::uuid()).toString();
-        QJsonObject sub = object.value(JsonDbStrings::Property::notify()).toObject();
-        QString action = sub.value(JsonDbStrings::Protocol::action()).toString();
-        QJsonObject notificationObject = sub.value(JsonDbStrings::Protocol::object()).toObject();
-        quint32 stateNumber = sub.value(JsonDbStrings::Protocol::stateNumber()).toDouble();
-        QMap<QString, QPointer<QJsonDbWatcher> >::iterator it = watchers.find(notifyUuid);
-        if (it != watchers.end()) {
-            QJsonDbWatcher *watcher = it.value().data();
-            if (!watcher) {
-                qWarning("QJsonDbConnection: received notification for already deleted watcher");
-                watchers.erase(it);
-                return;
+        QJsonValue notify = object.value(JsonDbStrings::Property::notify());
+        if (notify.isArray()) {
+            // a batch, each watcher is told once about what it got
+            QJsonArray batch = notify.toArray();
+            QList<QPointer<QJsonDbWatcher> > notified;
+            for (int i = 0; i < batch.size(); i++) {
+                QJsonObject sub = batch.at(i).toObject();
+                QJsonDbWatcher *watcher = handleNotify(sub.value(JsonDbStrings::Property::uuid()).toString(), sub, true);
+                if (watcher && !notified.contains(watcher))
+                    notified.append(watcher);
+            }
+            foreach (const QPointer<QJsonDbWatcher> &watcher, notified) {
+                if (watcher)
+                    watcher->d_func()->emitNotificationsAvailable();
             }
-            // initialize actionType to silence compiler warnings.
-            QJsonDbWatcher::Action actionType = QJsonDbWatcher::All;
-            bool stateChanged = false;
-            if (action == JsonDbStrings::Notification::actionCreate())
-                actionType = QJsonDbWatcher::Created;
-            else if (action == JsonDbStrings::Notification::actionUpdate())
-                actionType = QJsonDbWatcher::Updated;
-            else if (action == JsonDbStrings::Notification::actionRemove())
-                actionType = QJsonDbWatcher::Removed;
-            else if (action == JsonDbStrings::Notification::actionStateChange())
-                stateChanged = true;
-            else
-                qWarning() << "Unknown action" << action << "received for notification" << notifyUuid;
-
-            if (stateChanged)
-                watcher->d_func()->handleStateChange(stateNumber);
-            else if (actionType != QJsonDbWatcher::All)
-                watcher->d_func()->handleNotification(stateNumber, actionType, notificationObject);
         } else {
-            // received notification for unknown watcher, just ignore it.
+            handleNotify(object.value(JsonDbStrings::Property::uuid()).toString(), notify.toObject(), false);
         }
     } else if (currentRequest) {
         QJsonDbRequestPrivate *drequest = currentRequest.data()->d_func();
         int requestId = static_cast<int>(object.value(JsonDbStrings::Protocol::requestId()).toDouble());
         if (requestId != drequest->requestId)
             return;
-        currentRequest.clear();
         QJsonValue result = object.value(JsonDbStrings::Protocol::result());
         if (result.isObject()) {
-            drequest->handleResponse(result.toObject());
+            QJsonObject resultObject = result.toObject();
+            // streamed read results keep the request current until the last chunk
+            bool more = resultObject.value(JsonDbStrings::Protocol::more()).toBool();
+            if (!more)
+                currentRequest.clear();
+            drequest->handleResponse(resultObject);
+            if (more)
+                return;
         } else {
+            currentRequest.clear();
             QJsonObject error = object.value(JsonDbStrings::Protocol::error()).toObject();
             int code = static_cast<int>(error.value(JsonDbStrings::Protocol::errorCode()).toDouble());
             QString message = error.value(JsonDbStrings::Protocol::errorMessage()).toString();
@@ -713,7 +772,8 @@ bool QJsonDbConnection::send(QJsonDbRequest *request)
     Cancels the given \a request.
 
     It is only possible to cancel request that was queued, but not sent to the
-    server yet, i.e. a request in the QJsonDbRequest::Queued state.
+    server yet, i.e. a request in the QJsonDbRequest::Queued state, or a read
+    request that is still receiving its results in chunks.
 
     Returns true if the request was successfully canceled.
 
@@ -731,8 +791,11 @@ bool QJsonDbConnection::cancel(QJsonDbRequest *request)
     case QJsonDbRequest::Canceled:
         qWarning("QJsonDbConnection: cannot cancel request that was not added to connection.");
         return false;
-    case QJsonDbRequest::Sent:
     case QJsonDbRequest::Receiving:
+        if (d->cancelStreamedRead(request))
+            return true;
+        // fall through
+    case QJsonDbRequest::Sent:
         qWarning("QJsonDbConnection: cannot cancel request that was already sent.");
         return false;
     case QJsonDbRequest::Queued:
@@ -837,6 +900,7 @@ bool QJsonDbConnectionPrivate::initWatcher(QJsonDbWatcher *watcher)
     object.insert(JsonDbStrings::Property::actions(), actions);
     object.insert(JsonDbStrings::Protocol::partition(), QJsonValue(dwatcher->partition));
     object.insert(JsonDbStrings::Property::uuid(), QJsonValue(dwatcher->uuid));
+    object.insert(JsonDbStrings::Property::batched(), true);
 
     Q_ASSERT(!dwatcher->uuid.isEmpty());
     Q_ASSERT(!QUuid(dwatcher->uuid).isNull());
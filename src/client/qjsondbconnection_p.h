@@ -89,6 +89,7 @@ public:
     void _q_onError(QLocalSocket::LocalSocketError);
     void _q_onTimer();
     void _q_onReceivedObject(const QJsonObject &);
+    QJsonDbWatcher *handleNotify(const QString &notifyUuid, const QJsonObject &notify, bool batched);
     void _q_onAuthFinished();
 
     void _q_privateReadRequestStarted(int requesId, quint32, const QString &);
@@ -99,6 +100,7 @@ public:
     void _q_privateRequestResultsAvailable(int requestId, const QList<QJsonObject> &);
 
     void handleRequestQueue();
+    bool cancelStreamedRead(QJsonDbRequest *request);
     void handlePrivatePartitionRequest(const QJsonObject &);
     bool initWatcher(QJsonDbWatcher *);
     void removeWatcher(QJsonDbWatcher *);
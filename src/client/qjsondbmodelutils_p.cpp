@@ -40,6 +40,7 @@
 ****************************************************************************/
 
 #include "qjsondbmodelutils_p.h"
+#include "qjsondbreadrequest_p.h"
 #include <qdebug.h>
 #include <QJsonValue>
 #include <QJsonArray>
@@ -313,6 +314,7 @@ QJsonDbReadRequest* ModelRequest::newRequest(int newIndex)
 {
     resetRequest();
     index = newIndex;
+    lastContinuation.clear();
     request = new QJsonDbReadRequest();
     connect(request, SIGNAL(finished()), this, SLOT(onQueryFinished()));
     connect(request, SIGNAL(finished()), request, SLOT(deleteLater()));
@@ -333,6 +335,7 @@ void ModelRequest::resetRequest()
 
 void ModelRequest::onQueryFinished()
 {
+    lastContinuation = request->d_func()->continuation;
     emit finished(index, request->takeResults(), request->sortKey());
 }
 
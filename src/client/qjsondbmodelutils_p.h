@@ -105,6 +105,7 @@ public:
 
     QJsonDbReadRequest* newRequest(int newIndex);
     void resetRequest();
+    QString continuation() const { return lastContinuation; }
 Q_SIGNALS:
     void finished(int index, const QList<QJsonObject> &items, const QString &sortKey);
     void error(QtJsonDb::QJsonDbRequest::ErrorCode code, const QString &message);
@@ -115,6 +116,7 @@ private Q_SLOTS:
 private:
     QPointer<QJsonDbReadRequest> request;
     int index;
+    QString lastContinuation;
 };
 
 struct IndexInfo
@@ -151,12 +153,14 @@ struct RequestInfo
     int lastOffset;
     int lastSize;
     int requestCount;
+    QString continuation; // resumes after the last received item, preferred over lastOffset
     QPointer<QJsonDbWatcher> watcher;
 
     RequestInfo() { clear();}
     void clear()
     {
         lastOffset = 0;
+        continuation.clear();
         lastSize = -1;
         requestCount = 0;
         if (watcher) {
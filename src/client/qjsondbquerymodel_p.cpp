@@ -95,6 +95,27 @@ QJsonDbQueryModelPrivate::~QJsonDbQueryModelPrivate()
 
 }
 
+// items of a collated index are ordered by the collation sort key, their
+// _indexValue is the string itself
+static QVariant sortValue(const QJsonObject &item)
+{
+    QJsonValue sortKey = item.value(QLatin1String("_indexSortKey"));
+    if (sortKey.isString())
+        return sortKey.toVariant();
+    return item.value(QLatin1String("_indexValue")).toVariant();
+}
+
+// sort keys hold one byte per character, so they are compared by code unit
+// even when the index ignores case
+static SortIndexSpec sortSpec(const QJsonObject &item, const SortIndexSpec &spec)
+{
+    if (!item.value(QLatin1String("_indexSortKey")).isString())
+        return spec;
+    SortIndexSpec sortKeySpec(spec);
+    sortKeySpec.caseSensitive = true;
+    return sortKeySpec;
+}
+
 // insert item notification handler
 // + add items, for chunked read
 void QJsonDbQueryModelPrivate::addItem(const QJsonObject &newItem, int partitionIndex)
@@ -110,8 +131,8 @@ void QJsonDbQueryModelPrivate::addItem(const QJsonObject &newItem, int partition
 
     QVariantList vl;
     vl.append(uuid);
-    vl.append(item.value(QLatin1String("_indexValue")).toVariant());
-    SortingKey key(partitionIndex, vl, QList<bool>() << ascendingOrder, partitionIndexDetails[partitionIndex].spec);
+    vl.append(sortValue(item));
+    SortingKey key(partitionIndex, vl, QList<bool>() << ascendingOrder, sortSpec(item, partitionIndexDetails[partitionIndex].spec));
     QMap<SortingKey, QString>::const_iterator begin = objectUuids.constBegin();
     QMap<SortingKey, QString>::const_iterator end = objectUuids.constEnd();
     QMap<SortingKey, QString>::const_iterator i = objectUuids.upperBound(key);
@@ -170,8 +191,8 @@ void QJsonDbQueryModelPrivate::updateItem(const QJsonObject &changedItem, int pa
         SortingKey key = keyIndex.value();
         QVariantList vl;
         vl.append(uuid);
-        vl.append(item.value(QLatin1String("_indexValue")).toVariant());
-        SortingKey newKey(partitionIndex, vl, QList<bool>() << ascendingOrder, partitionIndexDetails[partitionIndex].spec);
+        vl.append(sortValue(item));
+        SortingKey newKey(partitionIndex, vl, QList<bool>() << ascendingOrder, sortSpec(item, partitionIndexDetails[partitionIndex].spec));
         QMap<SortingKey, QString>::const_iterator begin = objectUuids.constBegin();
         QMap<SortingKey, QString>::const_iterator end = objectUuids.constEnd();
         QMap<SortingKey, QString>::const_iterator oldPos = objectUuids.constFind(key);
@@ -308,6 +329,7 @@ void QJsonDbQueryModelPrivate::createObjectRequests(int startIndex, int maxItems
             }
 
             r.lastOffset = indexNSizes[i].index;
+            r.continuation.clear();
             r.lastSize = -1;
             r.requestCount = indexNSizes[i].count;
             QJsonDbReadRequest *request = valueRequests[i]->newRequest(i);
@@ -400,7 +422,7 @@ void QJsonDbQueryModelPrivate::fillKeys(const QList<QJsonObject> &items, int par
         const QJsonObject &item = items.at(i);
         QString uuidStr = item.value(QLatin1String("_uuid")).toString();
         QByteArray uuid = QUuid(uuidStr).toRfc4122();
-        SortingKey key(partitionIndex, uuid, item.value(QLatin1String("_indexValue")).toVariant(), ascendingOrder,  partitionIndexDetails[partitionIndex].spec);
+        SortingKey key(partitionIndex, uuid, sortValue(item), ascendingOrder, sortSpec(item, partitionIndexDetails[partitionIndex].spec));
         objectUuids.insert(key, uuidStr);
         partitionObjectUuids[partitionIndex].insert(key, uuidStr);
         objectSortValues.insert(uuidStr, key);
@@ -644,6 +666,7 @@ void QJsonDbQueryModelPrivate::fetchPartitionKeys(int index)
         QString partitionName = partitionObjects[index];
         r.lastSize = -1;
         r.lastOffset = 0;
+        r.continuation.clear();
         QJsonDbReadRequest *request = keyRequests[index]->newRequest(index);
         request->setQuery(queryForSortKeys);
         request->setQueryLimit(chunkSize);
@@ -703,7 +726,11 @@ void QJsonDbQueryModelPrivate::fetchNextKeyChunk(int partitionIndex)
     r.lastOffset += chunkSize;
     QJsonDbReadRequest *request = keyRequests[partitionIndex]->newRequest(partitionIndex);
     request->setQuery(queryForSortKeys);
-    request->setProperty("queryOffset", r.lastOffset);
+    // resume after the last key instead of skipping lastOffset items again
+    if (!r.continuation.isEmpty())
+        request->setProperty("queryContinuation", r.continuation);
+    else
+        request->setProperty("queryOffset", r.lastOffset);
     request->setQueryLimit(chunkSize);
     request->setPartition(partitionObjects[partitionIndex]);
     setQueryBindings(request, queryBindings);
@@ -716,7 +743,10 @@ void QJsonDbQueryModelPrivate::fetchNextChunk(int partitionIndex)
     RequestInfo &r = partitionObjectDetails[partitionIndex];
     QJsonDbReadRequest *request = valueRequests[partitionIndex]->newRequest(partitionIndex);
     request->setQuery(query+sortOrder);
-    request->setProperty("queryOffset", r.lastOffset);
+    if (!r.continuation.isEmpty())
+        request->setProperty("queryContinuation", r.continuation);
+    else
+        request->setProperty("queryOffset", r.lastOffset);
     request->setQueryLimit(qMin(r.requestCount, chunkSize));
     request->setPartition(partitionObjects[partitionIndex]);
     setQueryBindings(request, queryBindings);
@@ -848,7 +878,7 @@ void QJsonDbQueryModelPrivate::setQueryForSortKeys()
 {
     // Query to retrieve the sortKeys
     // TODO remove the "[= {}]" from query
-    queryForSortKeys = query + QLatin1String("[= { _uuid: _uuid, _indexValue: _indexValue }]");
+    queryForSortKeys = query + QLatin1String("[= { _uuid: _uuid, _indexValue: _indexValue, _indexSortKey: _indexSortKey }]");
     queryForSortKeys += sortOrder;
 }
 
@@ -996,6 +1026,7 @@ void QJsonDbQueryModelPrivate::_q_keyResponse(int index, const QList<QJsonObject
     elt.start();
 #endif
     Q_UNUSED(sortKey)
+    partitionKeyRequestDetails[index].continuation = keyRequests[index]->continuation();
     fillKeys(v, index);
 #ifdef JSONDB_LISTMODEL_BENCHMARK
     qint64 elap = elt.elapsed();
@@ -1010,6 +1041,7 @@ void QJsonDbQueryModelPrivate::_q_valueResponse(int index, const QList<QJsonObje
     QElapsedTimer elt;
     elt.start();
 #endif
+    partitionObjectDetails[index].continuation = valueRequests[index]->continuation();
     fillData(v, index);
 #ifdef JSONDB_LISTMODEL_BENCHMARK
     qint64 elap = elt.elapsed();
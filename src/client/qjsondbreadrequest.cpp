@@ -68,6 +68,14 @@ QT_BEGIN_NAMESPACE_JSONDB
         QJsonDbConnection *connection = new QJsonDbConnection;
         connection->send(request);
     \endcode
+
+    A request can ask the server to send a large result in chunks by setting
+    the "queryChunkSize" property to the number of objects per chunk.
+    resultsAvailable() is then emitted for every chunk and the results
+    received so far can be taken with takeResults() before finished() is
+    emitted. A read request that is still receiving chunks can be stopped
+    with QJsonDbConnection::cancel(). Results are only chunked when they
+    are read in the order of an index; other queries get a single response.
 */
 /*!
     \enum QJsonDbReadRequest::ErrorCode
@@ -89,7 +97,7 @@ QT_BEGIN_NAMESPACE_JSONDB
 */
 
 QJsonDbReadRequestPrivate::QJsonDbReadRequestPrivate(QJsonDbReadRequest *q)
-    : QJsonDbRequestPrivate(q), queryLimit(-1), stateNumber(0)
+    : QJsonDbRequestPrivate(q), queryLimit(-1), stateNumber(0), cursorId(0)
 {
 }
 
@@ -264,6 +272,12 @@ QJsonObject QJsonDbReadRequestPrivate::getRequest() const
     QVariant v = q->property("queryOffset");
     if (v.isValid())
         object.insert(JsonDbStrings::Property::queryOffset(), v.toInt());
+    v = q->property("queryContinuation");
+    if (v.isValid())
+        object.insert(JsonDbStrings::Property::queryContinuation(), v.toString());
+    v = q->property("queryChunkSize");
+    if (v.isValid() && v.toInt() > 0)
+        object.insert(JsonDbStrings::Property::queryChunkSize(), v.toInt());
     if (!bindings.isEmpty()) {
         QJsonObject b;
         QMap<QString, QJsonValue>::const_iterator it, e;
@@ -282,19 +296,26 @@ QJsonObject QJsonDbReadRequestPrivate::getRequest() const
 void QJsonDbReadRequestPrivate::handleResponse(const QJsonObject &response)
 {
     Q_Q(QJsonDbReadRequest);
-
-    stateNumber = static_cast<quint32>(response.value(JsonDbStrings::Property::state()).toDouble());
-    sortKey = response.value(JsonDbStrings::Property::sortKeys()).toArray().at(0).toString();
-
-    setStatus(QJsonDbRequest::Receiving);
-    emit q->started();
+    // large results arrive in several chunks, only the first one starts the request
+    if (status != QJsonDbRequest::Receiving) {
+        stateNumber = static_cast<quint32>(response.value(JsonDbStrings::Property::state()).toDouble());
+        sortKey = response.value(JsonDbStrings::Property::sortKeys()).toArray().at(0).toString();
+        setStatus(QJsonDbRequest::Receiving);
+        emit q->started();
+    }
 
     QJsonArray list = response.value(JsonDbStrings::Protocol::data()).toArray();
     results.reserve(results.size() + list.size());
     foreach (const QJsonValue &v, list)
         results.append(v.toObject());
-
+    continuation = response.value(JsonDbStrings::Property::queryContinuation()).toString();
     emit q->resultsAvailable(results.size());
+
+    if (response.value(JsonDbStrings::Protocol::more()).toBool()) {
+        cursorId = static_cast<int>(response.value(JsonDbStrings::Protocol::cursor()).toDouble());
+        return;
+    }
+    cursorId = 0;
     setStatus(QJsonDbRequest::Finished);
     emit q->finished();
 }
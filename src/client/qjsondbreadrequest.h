@@ -101,6 +101,7 @@ private:
     Q_DISABLE_COPY(QJsonDbReadRequest)
     Q_DECLARE_PRIVATE(QJsonDbReadRequest)
     friend class QJsonDbConnectionPrivate;
+    friend class ModelRequest;
 };
 
 class QJsonDbReadObjectRequestPrivate;
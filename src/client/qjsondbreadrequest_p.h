@@ -79,6 +79,8 @@ public:
     // query results
     quint32 stateNumber;
     QString sortKey;
+    int cursorId; // server side cursor while results are streamed, 0 otherwise
+    QString continuation; // resumes the query after the last result, empty if there are no more
 };
 
 class QJsonDbReadObjectRequestPrivate : public QJsonDbReadRequestPrivate
@@ -70,6 +70,7 @@ public:
     static inline const QString changesSince() { return QStringLiteral("changesSince"); }
     static inline const QString flush() { return QStringLiteral("flush"); }
     static inline const QString log() { return QStringLiteral("log"); }
+    static inline const QString closeCursor() { return QStringLiteral("closeCursor"); }
     static inline const QString object() { return QStringLiteral("object"); }
     static inline const QString partition() { return QStringLiteral("partition"); }
     static inline const QString requestId() { return QStringLiteral("id"); }
@@ -86,6 +87,8 @@ public:
     static inline const QString rejectStale() { return QStringLiteral("rejectStale"); }
     static inline const QString replace() { return QStringLiteral("replace"); }
     static inline const QString merge() { return QStringLiteral("merge"); }
+    static inline const QString cursor() { return QStringLiteral("cursor"); }
+    static inline const QString more() { return QStringLiteral("more"); }
 };
 
 class Property
@@ -99,8 +102,11 @@ public:
     static inline const QString query() { return QStringLiteral("query"); }
     static inline const QString queryLimit() { return QStringLiteral("limit"); }
     static inline const QString queryOffset() { return QStringLiteral("offset"); }
+    static inline const QString queryChunkSize() { return QStringLiteral("chunkSize"); }
+    static inline const QString queryContinuation() { return QStringLiteral("continuation"); }
     static inline const QString actions() { return QStringLiteral("actions"); }
     static inline const QString bindings() { return QStringLiteral("bindings"); }
+    static inline const QString batched() { return QStringLiteral("batched"); }
     static inline const QString state() { return QStringLiteral("state"); }
     static inline const QString sortKeys() { return QStringLiteral("sortKeys"); }
     static inline const QString initialStateNumber() { return QStringLiteral("initialStateNumber"); }
@@ -458,16 +458,24 @@ void QJsonDbWatcherPrivate::_q_onError(QtJsonDb::QJsonDbRequest::ErrorCode code,
     emit q->error(error, message);
 }
 
-void QJsonDbWatcherPrivate::handleNotification(quint32 stateNumber, QJsonDbWatcher::Action action, const QJsonObject &object)
+bool QJsonDbWatcherPrivate::handleNotification(quint32 stateNumber, QJsonDbWatcher::Action action, const QJsonObject &object,
+                                               bool emitAvailable)
 {
-    Q_Q(QJsonDbWatcher);
     if (!actions.testFlag(action))
-        return;
+        return false;
     Q_ASSERT(!object.isEmpty());
     if (initialStateNumber == static_cast<quint32>(QJsonDbWatcherPrivate::UnspecifiedInitialStateNumber))
         initialStateNumber = stateNumber;
     QJsonDbNotification n(object, action, stateNumber);
     notifications.append(n);
+    if (emitAvailable)
+        emitNotificationsAvailable();
+    return true;
+}
+
+void QJsonDbWatcherPrivate::emitNotificationsAvailable()
+{
+    Q_Q(QJsonDbWatcher);
     emit q->notificationsAvailable(notifications.size());
 }
 
@@ -74,7 +74,9 @@ public:
     void _q_onFinished();
     void _q_onError(QtJsonDb::QJsonDbRequest::ErrorCode code, const QString &message);
 
-    void handleNotification(quint32 stateNumber, QJsonDbWatcher::Action action, const QJsonObject &object);
+    bool handleNotification(quint32 stateNumber, QJsonDbWatcher::Action action, const QJsonObject &object,
+                            bool emitAvailable = true);
+    void emitNotificationsAvailable();
     void handleStateChange(quint32 stateNumber);
     void setStatus(QJsonDbWatcher::Status newStatus);
 
@@ -44,17 +44,29 @@
 #include "jsondbstrings.h"
 
 #include <QDebug>
+#include <QJsonArray>
+#include <QTimer>
 
 QT_USE_NAMESPACE_JSONDB_PARTITION
 
 ClientJsonStream::ClientJsonStream(QObject *parent) :
     QtJsonDbJsonStream::JsonStream(parent)
+  , mFlushTimer(new QTimer(this))
 {
+    mFlushTimer->setSingleShot(true);
+    connect(mFlushTimer, SIGNAL(timeout()), this, SLOT(flushNotifications()));
 }
 
-void ClientJsonStream::addNotification(const QString &uuid, JsonDbNotification *notification)
+/*!
+    Delivers the notifications of \a notification to the client, which
+    knows it as \a uuid. With \a batched, they are sent together with others
+    in one message, see flushNotifications().
+*/
+void ClientJsonStream::addNotification(const QString &uuid, JsonDbNotification *notification, bool batched)
 {
     mNotifications.insert(notification, uuid);
+    if (batched)
+        mBatched.insert(notification);
     connect(notification, SIGNAL(notified(QJsonObject,quint32,JsonDbNotification::Action)),
             this, SLOT(notified(QJsonObject,quint32,JsonDbNotification::Action)));
 }
@@ -63,6 +75,7 @@ void ClientJsonStream::removeNotification(JsonDbNotification *notification)
 {
     if (notification) {
         mNotifications.remove(notification);
+        mBatched.remove(notification);
         disconnect(notification, SIGNAL(notified(QJsonObject,quint32,JsonDbNotification::Action)),
                    this, SLOT(notified(QJsonObject,quint32,JsonDbNotification::Action)));
     }
@@ -85,6 +98,9 @@ QList<JsonDbNotification *> ClientJsonStream::takeAllNotifications()
     }
 
     mNotifications.clear();
+    mBatched.clear();
+    mPending.clear();
+    mPendingIndex.clear();
     return res;
 }
 
@@ -105,10 +121,32 @@ QList<JsonDbNotification *> ClientJsonStream::notificationsByPartition(JsonDbPar
 void ClientJsonStream::notified(const QJsonObject &object, quint32 stateNumber, JsonDbNotification::Action action)
 {
     JsonDbNotification *notification = qobject_cast<JsonDbNotification *>(sender());
-    if (!notification)
+    // delivery is queued from partition threads and may trail the removal
+    if (!notification || !mNotifications.contains(notification))
         return;
 
     QString uuid = mNotifications.value(notification);
+    if (mBatched.contains(notification) && jsondbSettings->notificationBatchSize() > 0) {
+        queueNotification(uuid, object, stateNumber, action);
+        return;
+    }
+
+    // keeps the notifications of the connection in order
+    flushNotifications();
+
+    QJsonObject map;
+    map.insert(JsonDbString::kNotifyStr, makeNotify(object, stateNumber, action));
+    map.insert(JsonDbString::kUuidStr, uuid);
+
+    if (device() && device()->isWritable()) {
+        if (jsondbSettings->debug())
+            qDebug() << "Sending notify" << map;
+        send(map);
+    }
+}
+
+QJsonObject ClientJsonStream::makeNotify(const JsonDbObject &object, quint32 stateNumber, JsonDbNotification::Action action)
+{
     QString actionString = JsonDbString::kCreateStr;
     if (action == JsonDbNotification::Update)
         actionString = JsonDbString::kUpdateStr;
@@ -117,19 +155,83 @@ void ClientJsonStream::notified(const QJsonObject &object, quint32 stateNumber,
     else if (action == JsonDbNotification::StateChange)
         actionString = QStringLiteral("stateChange");
 
-    if (jsondbSettings->debug())
-        qDebug() << "notificationId" << uuid << "object" << object << "action" << actionString;
-
-    QJsonObject map, obj;
+    QJsonObject obj;
     obj.insert(JsonDbString::kObjectStr, object);
     obj.insert(JsonDbString::kActionStr, actionString);
     obj.insert(JsonDbString::kStateNumberStr, static_cast<int>(stateNumber));
-    map.insert(JsonDbString::kNotifyStr, obj);
-    map.insert(JsonDbString::kUuidStr, uuid);
+    return obj;
+}
+
+/*!
+    Adds a notification to the next batch. Changes to one object for the
+    same notification are merged like JsonDbObjectTable::changesSince()
+    does, so that an object created and removed again within a batch is
+    not sent at all. Only the last state change of a notification is kept,
+    at the end of the batch.
+*/
+void ClientJsonStream::queueNotification(const QString &uuid, const QJsonObject &object, quint32 stateNumber,
+                                         JsonDbNotification::Action action)
+{
+    JsonDbUpdate change(JsonDbObject(), object, action);
+    QString key = action == JsonDbNotification::StateChange ? uuid
+                : uuid + QLatin1Char(':') + object.value(JsonDbString::kUuidStr).toString();
+
+    QHash<QString, int>::iterator it = mPendingIndex.find(key);
+    if (it != mPendingIndex.end()) {
+        PendingNotification &pending = mPending[it.value()];
+        if (action != JsonDbNotification::StateChange && pending.change.merge(change)) {
+            pending.stateNumber = stateNumber;
+            return;
+        }
+        pending.change.action = JsonDbNotification::None;
+        mPendingIndex.erase(it);
+        if (action != JsonDbNotification::StateChange)
+            return;
+    }
+
+    PendingNotification pending;
+    pending.uuid = uuid;
+    pending.change = change;
+    pending.stateNumber = stateNumber;
+    mPendingIndex.insert(key, mPending.size());
+    mPending.append(pending);
+
+    if (mPending.size() >= jsondbSettings->notificationBatchSize())
+        flushNotifications();
+    else if (!mFlushTimer->isActive())
+        mFlushTimer->start(jsondbSettings->notificationBatchLatency());
+}
+
+/*!
+    Sends the queued notifications as one message, whose "notify" property
+    is an array of notifications that each carry the uuid of their
+    notification.
+*/
+void ClientJsonStream::flushNotifications()
+{
+    mFlushTimer->stop();
+    if (mPending.isEmpty())
+        return;
+
+    QJsonArray notifications;
+    foreach (const PendingNotification &pending, mPending) {
+        if (pending.change.action == JsonDbNotification::None)
+            continue;
+        QJsonObject obj = makeNotify(pending.change.newObject, pending.stateNumber, pending.change.action);
+        obj.insert(JsonDbString::kUuidStr, pending.uuid);
+        notifications.append(obj);
+    }
+    mPending.clear();
+    mPendingIndex.clear();
+
+    if (notifications.isEmpty())
+        return;
+    if (jsondbSettings->debug())
+        qDebug() << "notifications" << notifications.size() << "batched";
 
     if (device() && device()->isWritable()) {
-        if (jsondbSettings->debug())
-            qDebug() << "Sending notify" << map;
+        QJsonObject map;
+        map.insert(JsonDbString::kNotifyStr, notifications);
         send(map);
     }
 }
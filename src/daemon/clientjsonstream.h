@@ -43,10 +43,16 @@
 #define CLIENTJSONSTREAM_H
 
 #include "jsondbnotification.h"
+#include "jsondbpartition.h"
 #include "jsonstream.h"
 
 #include <QHash>
 #include <QPointer>
+#include <QSet>
+
+QT_BEGIN_NAMESPACE
+class QTimer;
+QT_END_NAMESPACE
 
 QT_BEGIN_HEADER
 
@@ -57,7 +63,7 @@ class ClientJsonStream : public QtJsonDbJsonStream::JsonStream
     Q_OBJECT
 public:
     explicit ClientJsonStream(QObject *parent = 0);
-    void addNotification(const QString &uuid, JsonDbNotification *notification);
+    void addNotification(const QString &uuid, JsonDbNotification *notification, bool batched = false);
     void removeNotification(JsonDbNotification *notification);
     JsonDbNotification *takeNotification(const QString &uuid);
 
@@ -66,9 +72,27 @@ public:
 
 protected Q_SLOTS:
     void notified(const QJsonObject &object, quint32 stateNumber, JsonDbNotification::Action action);
+    void flushNotifications();
 
 private:
+    void queueNotification(const QString &uuid, const QJsonObject &object, quint32 stateNumber,
+                           JsonDbNotification::Action action);
+    static QJsonObject makeNotify(const JsonDbObject &object, quint32 stateNumber, JsonDbNotification::Action action);
+
     QHash<JsonDbNotification *, QString> mNotifications;
+    // notifications whose client takes them in batches
+    QSet<JsonDbNotification *> mBatched;
+
+    struct PendingNotification {
+        QString uuid;
+        JsonDbUpdate change;
+        quint32 stateNumber;
+    };
+    // a change merged away is left in place with action None
+    QList<PendingNotification> mPending;
+    // position in mPending of the last change per notification and object
+    QHash<QString, int> mPendingIndex;
+    QTimer *mFlushTimer;
 };
 
 QT_END_HEADER
@@ -17,6 +17,7 @@ INCLUDEPATH += $$PWD/../common
 HEADERS += \
     $$PWD/dbserver.h \
     $$PWD/jsondbephemeralpartition.h \
+    $$PWD/jsondbpartitionworker.h \
     $$PWD/jsondbsignals.h \
     $$PWD/../common/jsondbsocketname_p.h \
     $$PWD/clientjsonstream.h
@@ -25,6 +26,7 @@ SOURCES += \
     $$PWD/main.cpp \
     $$PWD/dbserver.cpp \
     $$PWD/jsondbephemeralpartition.cpp \
+    $$PWD/jsondbpartitionworker.cpp \
     $$PWD/jsondbsignals.cpp \
     $$PWD/clientjsonstream.cpp
 
@@ -42,6 +42,7 @@
 #include <QtNetwork>
 #include <QDir>
 #include <QElapsedTimer>
+#include <QThread>
 
 #include "jsondbstrings.h"
 #include "jsondberrors.h"
@@ -65,6 +66,324 @@ QT_USE_NAMESPACE_JSONDB_PARTITION
 
 static const int gReadBufferSize = 65536;
 
+static QJsonObject makeReadResult(const JsonDbQueryResult &queryResult)
+{
+    QJsonObject result;
+    QJsonArray data;
+    for (int i = 0; i < queryResult.data.size(); i++)
+        data.append(queryResult.data.at(i));
+
+    QJsonArray sortKeys;
+    foreach (const QString &sortKey, queryResult.sortKeys)
+        sortKeys.append(sortKey);
+
+    result.insert(JsonDbString::kDataStr, data);
+    result.insert(JsonDbString::kLengthStr, data.size());
+    result.insert(JsonDbString::kOffsetStr, queryResult.offset);
+    result.insert("sortKeys", sortKeys);
+    result.insert("state", static_cast<qint32>(queryResult.state));
+    if (!queryResult.continuation.isEmpty())
+        result.insert(JsonDbString::kContinuationStr, QString::fromLatin1(queryResult.continuation.toBase64()));
+    return result;
+}
+
+/*
+  Partitions may live on threads of their own, see JsonDbPartitionWorker.
+  Calls from the server thread then block until the partition thread is done
+  with whatever request it is serving and has run the call.
+*/
+static Qt::ConnectionType partitionConnection(JsonDbPartition *partition)
+{
+    return partition->thread() == QThread::currentThread() ? Qt::DirectConnection : Qt::BlockingQueuedConnection;
+}
+
+static bool invokePartition(JsonDbPartition *partition, const char *method)
+{
+    bool result = false;
+    QMetaObject::invokeMethod(partition, method, partitionConnection(partition), Q_RETURN_ARG(bool, result));
+    return result;
+}
+
+static void invokePartition(JsonDbPartition *partition, const char *method, JsonDbNotification *notification)
+{
+    QMetaObject::invokeMethod(partition, method, partitionConnection(partition), Q_ARG(JsonDbNotification*, notification));
+}
+
+// finds the state of the table a notification would watch, on the partition thread
+class NotificationTableLookup : public JsonDbPartitionJob
+{
+public:
+    NotificationTableLookup(const QSet<QString> &types)
+        : matchedTypes(types), available(false), multipleTables(false), stateNumber(0) {}
+
+    void run(JsonDbPartition *partition)
+    {
+        available = partition->isOpen();
+        if (!available)
+            return;
+        JsonDbObjectTable *table = 0;
+        foreach (const QString &type, matchedTypes) {
+            JsonDbObjectTable *viewtable = partition->findObjectTable(type);
+            if (table && viewtable && table != viewtable) {
+                multipleTables = true;
+                return;
+            }
+            table = viewtable;
+        }
+        if (!table)
+            table = partition->mainObjectTable();
+        stateNumber = table->stateNumber();
+    }
+
+    QSet<QString> matchedTypes;
+    bool available;
+    bool multipleTables;
+    quint32 stateNumber;
+};
+
+DBServer::PartitionRequest::PartitionRequest(Kind kind, JsonDbPartition *partition, ClientJsonStream *stream, JsonDbOwner *owner, int id)
+    : kind(kind)
+    , partition(partition)
+    , stream(stream)
+    , owner(owner)
+    , id(id)
+    , writeMode(JsonDbPartition::RejectStale)
+    , limit(-1)
+    , offset(0)
+    , chunkSize(0)
+    , streamed(false)
+    , stateNumber(0)
+    , cursorId(0)
+    , useSnapshot(false)
+    , errorCode(JsonDbError::NoError)
+    , more(false)
+    , elapsed(0)
+    , snapshot(0)
+{
+}
+
+void DBServer::PartitionRequest::run(JsonDbPartition *partition)
+{
+    QElapsedTimer timer;
+    QHash<QString, qint64> fileSizes;
+    if (jsondbSettings->performanceLog()) {
+        if (jsondbSettings->verbose())
+            fileSizes = partition->fileSizes();
+        stats = partition->stat();
+        timer.start();
+    }
+
+    switch (kind) {
+    case Write:
+    case RemoveByQuery:
+        write(partition);
+        break;
+    case Read:
+        read(partition);
+        break;
+    case QueryChunk:
+        readChunk(partition);
+        break;
+    case ChangesSince:
+        changesSince(partition);
+        break;
+    case Flush:
+        flush(partition);
+        break;
+    }
+
+    if (jsondbSettings->performanceLog()) {
+        elapsed = timer.elapsed();
+        JsonDbStat endStats = partition->stat();
+        endStats -= stats;
+        stats = endStats;
+        if (jsondbSettings->verbose()) {
+            QHash<QString, qint64> newSizes = partition->fileSizes();
+            QHashIterator<QString, qint64> files(fileSizes);
+            while (files.hasNext()) {
+                files.next();
+                if (newSizes[files.key()] != files.value())
+                    fileSizeChanges.insert(files.key(), newSizes[files.key()] - files.value());
+            }
+        }
+    }
+}
+
+bool DBServer::PartitionRequest::mayRunOnSnapshot() const
+{
+    return useSnapshot && (kind == Read || kind == QueryChunk);
+}
+
+/*!
+    Serves a read from \a snapshot on a reader thread. The partition's
+    statistics and file sizes belong to its own thread, so the performance
+    log only gets the time taken.
+*/
+bool DBServer::PartitionRequest::runOnSnapshot(JsonDbPartitionSnapshot *snapshot)
+{
+    if (!snapshot->canQuery(query))
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    this->snapshot = snapshot;
+    bool served = kind == Read ? read(partition) : readChunk(partition);
+    this->snapshot = 0;
+
+    elapsed = timer.elapsed();
+    return served;
+}
+
+bool DBServer::PartitionRequest::queryObjects(JsonDbPartition *partition, int limit, int offset,
+                                              const QByteArray &continuation, JsonDbQueryResult *result)
+{
+    if (snapshot)
+        return snapshot->queryObjects(owner, query, limit, offset, continuation, result);
+    *result = partition->queryObjects(owner, query, limit, offset, continuation);
+    return true;
+}
+
+void DBServer::PartitionRequest::write(JsonDbPartition *partition)
+{
+    // TODO: remove at the same time that clientcompat is dropped
+    if (kind == RemoveByQuery) {
+        JsonDbQueryResult res = partition->queryObjects(owner, query);
+        QJsonArray toRemove;
+        foreach (const QJsonValue &value, res.data)
+            toRemove.append(value);
+        objects = prepareWriteData(JsonDbString::kRemoveStr, toRemove);
+    }
+
+    JsonDbWriteResult res = partition->updateObjects(owner, objects, writeMode);
+    if (res.code != JsonDbError::NoError) {
+        errorCode = res.code;
+        errorMessage = res.message;
+        return;
+    }
+
+    QJsonArray data;
+    foreach (const JsonDbObject &object, res.objectsWritten) {
+        QJsonObject written = object;
+        written.insert(JsonDbString::kUuidStr, object.uuid().toString());
+        written.insert(JsonDbString::kVersionStr, object.version());
+        data.append(written);
+    }
+
+    QJsonObject result;
+    result.insert(JsonDbString::kDataStr, data);
+    result.insert(JsonDbString::kCountStr, data.count());
+    result.insert(JsonDbString::kStateNumberStr, static_cast<int>(res.state));
+    response.insert(JsonDbString::kResultStr, result);
+    response.insert(JsonDbString::kErrorStr, QJsonValue());
+}
+
+bool DBServer::PartitionRequest::read(JsonDbPartition *partition)
+{
+    // chunks resume after the index key of the last result, so results that
+    // are sorted after the index scan are sent at once
+    if (streamed && !query.orderTerms.isEmpty()) {
+        bool indexOrdered = false;
+        if (!snapshot)
+            indexOrdered = partition->isIndexOrdered(owner, query);
+        else if (!snapshot->isIndexOrdered(owner, query, &indexOrdered))
+            return false;
+        streamed = indexOrdered;
+    }
+
+    JsonDbQueryResult queryResult;
+    if (!queryObjects(partition, streamed ? chunkSize : limit, offset, continuation, &queryResult))
+        return false;
+
+    if (jsondbSettings->debug())
+        debugQuery(partition->partitionSpec().name, query, limit, offset, queryResult);
+
+    if (queryResult.code != JsonDbError::NoError) {
+        errorCode = queryResult.code;
+        errorMessage = queryResult.message;
+        return true;
+    }
+
+    streamed = streamed && !queryResult.continuation.isEmpty();
+    continuation = queryResult.continuation;
+    response.insert(JsonDbString::kResultStr, makeReadResult(queryResult));
+    response.insert(JsonDbString::kErrorStr, QJsonValue());
+    return true;
+}
+
+bool DBServer::PartitionRequest::readChunk(JsonDbPartition *partition)
+{
+    int chunkLimit = limit < 0 ? chunkSize : qMin(limit, chunkSize);
+    JsonDbQueryResult queryResult;
+    if (!queryObjects(partition, chunkLimit, 0, continuation, &queryResult))
+        return false;
+    if (queryResult.code != JsonDbError::NoError) {
+        errorCode = queryResult.code;
+        errorMessage = queryResult.message;
+        return true;
+    }
+
+    continuation = queryResult.continuation;
+    if (limit > 0)
+        limit -= queryResult.data.size();
+    more = !continuation.isEmpty() && limit != 0;
+
+    QJsonObject result = makeReadResult(queryResult);
+    result.insert(JsonDbString::kCursorStr, cursorId);
+    result.insert(JsonDbString::kMoreStr, more);
+    response.insert(JsonDbString::kResultStr, result);
+    response.insert(JsonDbString::kErrorStr, QJsonValue());
+    return true;
+}
+
+void DBServer::PartitionRequest::changesSince(JsonDbPartition *partition)
+{
+    JsonDbChangesSinceResult csResult = partition->changesSince(stateNumber, limitTypes);
+    if (csResult.code == JsonDbError::NoError) {
+        QJsonObject resultMap;
+
+        resultMap.insert(QStringLiteral("count"), csResult.changes.count());
+        resultMap.insert(QStringLiteral("startingStateNumber"), static_cast<qint32>(csResult.startingStateNumber));
+        resultMap.insert(QStringLiteral("currentStateNumber"), static_cast<qint32>(csResult.currentStateNumber));
+
+        QJsonArray changeArray;
+        foreach (const JsonDbUpdate &update, csResult.changes) {
+            QJsonObject change;
+            change.insert(QStringLiteral("before"), update.oldObject);
+            change.insert(QStringLiteral("after"), update.newObject);
+            changeArray.append(change);
+        }
+
+        resultMap.insert(QStringLiteral("changes"), changeArray);
+        response.insert(JsonDbString::kResultStr, resultMap);
+        response.insert(JsonDbString::kErrorStr, QJsonValue());
+    } else {
+        QJsonObject errorMap;
+        errorMap.insert(JsonDbString::kCodeStr, csResult.code);
+        errorMap.insert(JsonDbString::kMessageStr, csResult.message);
+        response.insert(JsonDbString::kResultStr, QJsonValue());
+        response.insert(JsonDbString::kErrorStr, errorMap);
+    }
+}
+
+void DBServer::PartitionRequest::flush(JsonDbPartition *partition)
+{
+    QJsonObject resultmap, errormap;
+
+    bool ok;
+    int state = partition->flush(&ok);
+
+    if (ok) {
+        resultmap.insert(JsonDbString::kStateNumberStr, state);
+    } else {
+        errormap.insert(JsonDbString::kCodeStr, JsonDbError::FlushFailed);
+        errormap.insert(JsonDbString::kMessageStr, QStringLiteral("Unable to flush partition"));
+    }
+
+    response.insert(JsonDbString::kResultStr, resultmap);
+    response.insert(JsonDbString::kErrorStr, errormap);
+}
+
 void DBServer::sendError(ClientJsonStream *stream, JsonDbError::ErrorCode code,
                          const QString& message, int id)
 {
@@ -95,6 +414,8 @@ DBServer::DBServer(const QString &searchPath, QObject *parent) :
   , mServer(0)
   , mTcpServer(0)
   , mOwner(new JsonDbOwner(this))
+  , mNextCursorId(1)
+  , mQueryCursorsScheduled(false)
 {
     // If a search path has been provided, then search that for partitions.json files
     // Otherwise search whatever's been specified in JSONDB_CONFIG_SEARCH_PATH
@@ -124,6 +445,9 @@ DBServer::DBServer(const QString &searchPath, QObject *parent) :
 DBServer::~DBServer()
 {
     close();
+    // the partitions use mOwner, stop their threads before it is deleted
+    qDeleteAll(mWorkers);
+    mWorkers.clear();
 }
 
 void DBServer::sigHUP()
@@ -151,6 +475,8 @@ void DBServer::sigUSR1()
 {
     if (jsondbSettings->debug())
         qDebug() << JSONDB_INFO << "SIGUSR1 received";
+    if (jsondbSettings->performanceLog())
+        logViewStats();
     reduceMemoryUsage();
     closeIndexes();
 }
@@ -221,17 +547,19 @@ bool DBServer::clear()
 {
     bool fail = false;
     foreach (JsonDbPartition *partition, mPartitions.values())
-        fail = !partition->clear() || fail;
+        fail = !invokePartition(partition, "clear") || fail;
     return !fail;
 }
 
 void DBServer::close()
 {
+    if (jsondbSettings->performanceLog())
+        logViewStats();
     foreach (JsonDbPartition *partition, mPartitions.values()) {
         removeNotificationsByPartition(partition);
         if (mCompactOnClose)
-            partition->compact();
-        partition->close();
+            invokePartition(partition, "compact");
+        invokePartition(partition, "close");
     }
     QCoreApplication::exit();
 }
@@ -267,13 +595,13 @@ bool DBServer::loadPartitions()
                 // main file exists to make sure it's still available
                 // 2. if the partition isn't open, call open on it to see
                 // if it can be made available
-                if (removablePartition->isOpen()) {
+                if (invokePartition(removablePartition, "isOpen")) {
                     if (jsondbSettings->verbose())
                         qDebug() << JSONDB_INFO << "determining if partition" << removablePartition->partitionSpec().name << "is still available";
                     if (!QFile::exists(removablePartition->filename())) {
                         if (jsondbSettings->debug())
                             qDebug() << JSONDB_INFO << "marking partition" << removablePartition->partitionSpec().name << "as unavailable";
-                        removablePartition->close();
+                        invokePartition(removablePartition, "close");
                         updateDefinition = true;
                     } else if (jsondbSettings->debug()) {
                         qDebug() << JSONDB_INFO << "marking partition" << removablePartition->partitionSpec().name << "as available";
@@ -281,7 +609,7 @@ bool DBServer::loadPartitions()
                 } else {
                     if (jsondbSettings->verbose())
                         qDebug() << JSONDB_INFO << "determining if partition" << removablePartition->partitionSpec().name << "has become available";
-                    if (removablePartition->open()) {
+                    if (invokePartition(removablePartition, "open")) {
                         if (jsondbSettings->debug())
                             qDebug() << JSONDB_INFO << "marking partition" << removablePartition->partitionSpec().name << "as available";
                         updateDefinition = true;
@@ -297,16 +625,26 @@ bool DBServer::loadPartitions()
         } else {
             Q_ASSERT(!partitions.contains(name));
 
-            JsonDbPartition *partition = new JsonDbPartition(this);
+            // no parent, the partition is handed to a thread of its own
+            JsonDbPartition *partition = new JsonDbPartition;
             partition->setPartitionSpec(definition);
             partition->setDefaultOwner(mOwner);
+            connect(partition, SIGNAL(indexBuildProgress(QString,quint64,quint64)),
+                    this, SLOT(indexBuildProgress(QString,quint64,quint64)));
+            connect(partition, SIGNAL(indexBuildFinished(QString,bool)),
+                    this, SLOT(indexBuildFinished(QString,bool)));
 
             if (jsondbSettings->debug())
                 qDebug() << JSONDB_INFO << "creating partition" << name;
 
+            JsonDbPartitionWorker *worker = new JsonDbPartitionWorker(partition, jsondbSettings->partitionThreads(),
+                                                                      jsondbSettings->snapshotReadThreads());
+            connect(worker, SIGNAL(finished(JsonDbPartitionJob*)), this, SLOT(requestFinished(JsonDbPartitionJob*)));
+            mWorkers.insert(partition, worker);
+
             partitions[name] = partition;
 
-            if (!(partition->open() || removable)) {
+            if (!(invokePartition(partition, "open") || removable)) {
                 close();
                 return false;
             }
@@ -325,8 +663,8 @@ bool DBServer::loadPartitions()
         // remove any notifications for the partition being closed
         removeNotificationsByPartition(partition);
 
-        partition->close();
-        delete partition;
+        invokePartition(partition, "close");
+        delete mWorkers.take(partition);
     }
 
     mPartitions = partitions;
@@ -342,23 +680,60 @@ bool DBServer::loadPartitions()
 void DBServer::reduceMemoryUsage()
 {
     foreach (JsonDbPartition *partition, mPartitions.values())
-        partition->flushCaches();
+        QMetaObject::invokeMethod(partition, "flushCaches", partitionConnection(partition));
 }
 
 void DBServer::closeIndexes()
 {
     foreach (JsonDbPartition *partition, mPartitions.values())
-        partition->closeIndexes();
+        QMetaObject::invokeMethod(partition, "closeIndexes", partitionConnection(partition));
 }
 
 JsonDbStat DBServer::stat() const
 {
     JsonDbStat result;
-    foreach (JsonDbPartition *partition, mPartitions.values())
-        result += partition->stat();
+    foreach (JsonDbPartition *partition, mPartitions.values()) {
+        JsonDbStat partitionStat;
+        QMetaObject::invokeMethod(partition, "stat", partitionConnection(partition), Q_RETURN_ARG(JsonDbStat, partitionStat));
+        result += partitionStat;
+    }
     return result;
 }
 
+/*!
+    Returns the update statistics of the views of each partition, keyed by
+    partition name and then by view type.
+*/
+QJsonObject DBServer::viewStats() const
+{
+    QJsonObject result;
+    foreach (JsonDbPartition *partition, mPartitions.values()) {
+        QJsonObject partitionStats;
+        QMetaObject::invokeMethod(partition, "viewStats", partitionConnection(partition), Q_RETURN_ARG(QJsonObject, partitionStats));
+        if (!partitionStats.isEmpty())
+            result.insert(partition->partitionSpec().name, partitionStats);
+    }
+    return result;
+}
+
+void DBServer::logViewStats() const
+{
+    QJsonObject stats = viewStats();
+    for (QJsonObject::const_iterator partition = stats.constBegin(); partition != stats.constEnd(); ++partition) {
+        QJsonObject views = partition.value().toObject();
+        for (QJsonObject::const_iterator view = views.constBegin(); view != views.constEnd(); ++view) {
+            QJsonObject viewStats = view.value().toObject();
+            qDebug().nospace() << "+ JsonDB Perf: " << "[action]" << "viewStats" << "[action]"
+                               << ":[partition]" << partition.key() << "[partition]"
+                               << ":[view]" << view.key() << "[view]"
+                               << ":[updates]" << (qint64)viewStats.value(QStringLiteral("updates")).toDouble() << "[updates]"
+                               << ":[lastUsecs]" << (qint64)viewStats.value(QStringLiteral("lastUsecs")).toDouble() << "[lastUsecs]"
+                               << ":[maxUsecs]" << (qint64)viewStats.value(QStringLiteral("maxUsecs")).toDouble() << "[maxUsecs]"
+                               << ":[totalUsecs]" << (qint64)viewStats.value(QStringLiteral("totalUsecs")).toDouble() << "[totalUsecs]";
+        }
+    }
+}
+
 void DBServer::handleConnection()
 {
     if (QIODevice *connection = mServer->nextPendingConnection()) {
@@ -474,41 +849,45 @@ JsonDbOwner *DBServer::createDummyOwner(ClientJsonStream *stream)
     return owner;
 }
 
-void DBServer::processWrite(ClientJsonStream *stream, JsonDbOwner *owner, const JsonDbObjectList &objects,
-                            JsonDbPartition::ConflictResolutionMode mode, const QString &partitionName,  int id)
+DBServer::PartitionRequest *DBServer::processWrite(ClientJsonStream *stream, JsonDbOwner *owner, const JsonDbObjectList &objects,
+                                                   JsonDbPartition::ConflictResolutionMode mode, const QString &partitionName,  int id)
 {
+    if (partitionName != mEphemeralPartition->name()) {
+        PartitionRequest *request = new PartitionRequest(PartitionRequest::Write, mPartitions.value(partitionName, mDefaultPartition),
+                                                         stream, owner, id);
+        request->objects = objects;
+        request->writeMode = mode;
+        return request;
+    }
+
     QJsonObject response;
     response.insert(JsonDbString::kIdStr, id);
 
     JsonDbError::ErrorCode errorCode = JsonDbError::NoError;
     QString errorMsg;
 
-    if (partitionName == mEphemeralPartition->name()) {
-        // prevent objects of type Partition from being created
-        foreach (const JsonDbObject &object, objects) {
-            if (object.type() == JsonDbString::kPartitionTypeStr && !object.isDeleted()) {
-                errorCode = JsonDbError::OperationNotPermitted;
-                errorMsg = QStringLiteral("Cannot create object of type 'Partition' in the ephemeral partition");
-                break;
-            }
+    // prevent objects of type Partition from being created
+    foreach (const JsonDbObject &object, objects) {
+        if (object.type() == JsonDbString::kPartitionTypeStr && !object.isDeleted()) {
+            errorCode = JsonDbError::OperationNotPermitted;
+            errorMsg = QStringLiteral("Cannot create object of type 'Partition' in the ephemeral partition");
+            break;
         }
+    }
 
-        if (errorCode == JsonDbError::NoError) {
-            // validate any notification objects before sending them off to be created
-            foreach (const JsonDbObject &object, objects) {
-                if (object.type() == JsonDbString::kNotificationTypeStr && !object.isDeleted()) {
-                    errorCode = validateNotification(object, errorMsg);
-                    if (errorCode != JsonDbError::NoError)
-                        break;
-                }
+    if (errorCode == JsonDbError::NoError) {
+        // validate any notification objects before sending them off to be created
+        foreach (const JsonDbObject &object, objects) {
+            if (object.type() == JsonDbString::kNotificationTypeStr && !object.isDeleted()) {
+                errorCode = validateNotification(object, errorMsg);
+                if (errorCode != JsonDbError::NoError)
+                    break;
             }
         }
     }
 
     if (errorCode == JsonDbError::NoError) {
-        JsonDbWriteResult res = partitionName == mEphemeralPartition->name() ?
-                    mEphemeralPartition->updateObjects(owner, objects, mode) :
-                    mPartitions.value(partitionName, mDefaultPartition)->updateObjects(owner, objects, mode);
+        JsonDbWriteResult res = mEphemeralPartition->updateObjects(owner, objects, mode);
         errorCode = res.code;
         errorMsg = res.message;
         if (errorCode == JsonDbError::NoError) {
@@ -538,17 +917,18 @@ void DBServer::processWrite(ClientJsonStream *stream, JsonDbOwner *owner, const
 
     if (errorCode != JsonDbError::NoError) {
         sendError(stream, errorCode, errorMsg, id);
-        return;
+        return 0;
     }
 
     stream->send(response);
+    return 0;
 }
 
-void DBServer::processRead(ClientJsonStream *stream, JsonDbOwner *owner, const QJsonValue &object, const QString &partitionName, int id)
+DBServer::PartitionRequest *DBServer::processRead(ClientJsonStream *stream, JsonDbOwner *owner, const QJsonValue &object, const QString &partitionName, int id)
 {
     if (object.type() != QJsonValue::Object) {
         sendError(stream, JsonDbError::InvalidRequest, "Invalid read request", id);
-        return;
+        return 0;
     }
 
     QJsonObject response;
@@ -559,6 +939,7 @@ void DBServer::processRead(ClientJsonStream *stream, JsonDbOwner *owner, const Q
 
     int limit = request.contains(JsonDbString::kLimitStr) ? request.value(JsonDbString::kLimitStr).toDouble() : -1;
     int offset = request.value(JsonDbString::kOffsetStr).toDouble();
+    QByteArray continuation = QByteArray::fromBase64(request.value(JsonDbString::kContinuationStr).toString().toLatin1());
 
     JsonDbError::ErrorCode errorCode = JsonDbError::NoError;
     QString errorMessage;
@@ -585,117 +966,227 @@ void DBServer::processRead(ClientJsonStream *stream, JsonDbOwner *owner, const Q
     // response should only contain the id at this point
     if (errorCode != JsonDbError::NoError) {
         sendError(stream, errorCode, errorMessage, id);
-        return;
+        return 0;
+    }
+
+    // Large results are streamed in chunks when the client asks for it. Each
+    // chunk is a separate query resuming after the last index key of the
+    // previous one, so no transaction is held open between chunks and
+    // writes in between neither repeat nor skip results.
+    int chunkSize = request.value(JsonDbString::kChunkSizeStr).toDouble();
+    bool streamed = chunkSize > 0
+            && partitionName != mEphemeralPartition->name()
+            && parsedQuery.aggregateOperation.isEmpty()
+            && parsedQuery.orderTerms.size() <= 1
+            && (limit < 0 || limit > chunkSize);
+
+    if (partitionName != mEphemeralPartition->name()) {
+        PartitionRequest *read = new PartitionRequest(PartitionRequest::Read, mPartitions.value(partitionName, mDefaultPartition),
+                                                      stream, owner, id);
+        read->query = parsedQuery;
+        read->limit = limit;
+        read->offset = offset;
+        read->continuation = continuation;
+        read->chunkSize = chunkSize;
+        read->streamed = streamed;
+        return read;
     }
 
-    JsonDbPartition *partition = mPartitions.value(partitionName, mDefaultPartition);
-    JsonDbQueryResult queryResult = partitionName == mEphemeralPartition->name() ?
-                mEphemeralPartition->queryObjects(owner, parsedQuery, limit, offset) :
-                partition->queryObjects(owner, parsedQuery, limit, offset);
+    JsonDbQueryResult queryResult = mEphemeralPartition->queryObjects(owner, parsedQuery, limit, offset);
 
     if (jsondbSettings->debug())
         debugQuery(partitionName, parsedQuery, limit, offset, queryResult);
 
     if (queryResult.code != JsonDbError::NoError) {
         sendError(stream, queryResult.code, queryResult.message, id);
-        return;
-    } else {
-        QJsonObject result;
-        QJsonArray data;
-        for (int i = 0; i < queryResult.data.size(); i++)
-            data.append(queryResult.data.at(i));
-
-        QJsonArray sortKeys;
-        foreach (const QString &sortKey, queryResult.sortKeys)
-            sortKeys.append(sortKey);
-
-        result.insert(JsonDbString::kDataStr, data);
-        result.insert(JsonDbString::kLengthStr, data.size());
-        result.insert(JsonDbString::kOffsetStr, queryResult.offset);
-        result.insert("sortKeys", sortKeys);
-        result.insert("state", static_cast<qint32>(queryResult.state));
-        response.insert(JsonDbString::kResultStr, result);
-        response.insert(JsonDbString::kErrorStr, QJsonValue());
+        return 0;
     }
 
+    response.insert(JsonDbString::kResultStr, makeReadResult(queryResult));
+    response.insert(JsonDbString::kErrorStr, QJsonValue());
     response.insert(JsonDbString::kIdStr, id);
     stream->send(response);
+    return 0;
 }
 
-void DBServer::processChangesSince(ClientJsonStream *stream, JsonDbOwner *owner, const QJsonValue &object, const QString &partitionName, int id)
+void DBServer::processCloseCursor(ClientJsonStream *stream, const QJsonValue &object, int id)
 {
-    Q_UNUSED(owner);
-    QJsonObject result;
+    Q_UNUSED(id);
+    int cursorId = object.toObject().value(JsonDbString::kCursorStr).toDouble();
+    QMap<int, QueryCursor>::iterator it = mQueryCursors.find(cursorId);
+    if (it != mQueryCursors.end() && it.value().stream.data() == stream)
+        mQueryCursors.erase(it);
+}
 
-    if (object.type() == QJsonValue::Object) {
-        QJsonObject request(object.toObject());
-        int stateNumber = request.value(JsonDbString::kStateNumberStr).toDouble();
-        QSet<QString> limitTypes;
+void DBServer::scheduleQueryCursors()
+{
+    if (mQueryCursorsScheduled || mQueryCursors.isEmpty())
+        return;
+    mQueryCursorsScheduled = true;
+    QMetaObject::invokeMethod(this, "serviceQueryCursors", Qt::QueuedConnection);
+}
+
+/*!
+    Reads the next chunk of every open cursor whose connection is not backed
+    up. Cursors of slow clients are resumed from the bytesWritten() signal of
+    their connection. Only one chunk per cursor is read per call so that other
+    requests get served in between.
+*/
+void DBServer::serviceQueryCursors()
+{
+    mQueryCursorsScheduled = false;
 
-        if (request.contains(JsonDbString::kTypesStr)) {
-            QJsonArray l = request.value(JsonDbString::kTypesStr).toArray();
-            for (int i = 0; i < l.size(); i++)
-                limitTypes.insert(l.at(i).toString());
+    // a chunk read on the server thread finishes before sendQueryChunk() returns
+    foreach (int cursorId, mQueryCursors.keys()) {
+        QMap<int, QueryCursor>::iterator it = mQueryCursors.find(cursorId);
+        if (it == mQueryCursors.end())
+            continue;
+        QueryCursor &cursor = it.value();
+        ClientJsonStream *stream = cursor.stream.data();
+        if (!stream || !stream->device() || !stream->device()->isWritable()) {
+            mQueryCursors.erase(it);
+            continue;
         }
+        if (cursor.busy || stream->bytesToWrite() > jsondbSettings->queryStreamBufferSize())
+            continue;
+        sendQueryChunk(cursor, cursorId);
+    }
+}
 
-        JsonDbPartition *partition = mPartitions.value(partitionName, mDefaultPartition);
-        JsonDbChangesSinceResult csResult = partition->changesSince(stateNumber, limitTypes);
-        if (csResult.code == JsonDbError::NoError) {
-            QJsonObject resultMap;
-
-            resultMap.insert(QStringLiteral("count"), csResult.changes.count());
-            resultMap.insert(QStringLiteral("startingStateNumber"), static_cast<qint32>(csResult.startingStateNumber));
-            resultMap.insert(QStringLiteral("currentStateNumber"), static_cast<qint32>(csResult.currentStateNumber));
-
-            QJsonArray changeArray;
-            foreach (const JsonDbUpdate &update, csResult.changes) {
-                QJsonObject change;
-                change.insert(QStringLiteral("before"), update.oldObject);
-                change.insert(QStringLiteral("after"), update.newObject);
-                changeArray.append(change);
-            }
+/*!
+    Reads the next chunk of results for \a cursor on the partition thread.
+    requestFinished() sends it and drops the cursor after the last chunk.
+*/
+void DBServer::sendQueryChunk(QueryCursor &cursor, int cursorId)
+{
+    JsonDbPartition *partition = mPartitions.value(cursor.partitionName, mDefaultPartition);
+    if (!partition) {
+        sendError(cursor.stream.data(), JsonDbError::InvalidPartition,
+                  QString("Invalid partition '%1'").arg(cursor.partitionName), cursor.requestId);
+        mQueryCursors.remove(cursorId);
+        return;
+    }
 
-            resultMap.insert(QStringLiteral("changes"), changeArray);
-            result.insert(JsonDbString::kResultStr, resultMap);
-            result.insert(JsonDbString::kErrorStr, QJsonValue());
-        } else {
-            QJsonObject errorMap;
-            errorMap.insert(JsonDbString::kCodeStr, csResult.code);
-            errorMap.insert(JsonDbString::kMessageStr, csResult.message);
-            result.insert(JsonDbString::kResultStr, QJsonValue());
-            result.insert(JsonDbString::kErrorStr, errorMap);
-        }
-     } else {
+    PartitionRequest *request = new PartitionRequest(PartitionRequest::QueryChunk, partition,
+                                                     cursor.stream.data(), cursor.owner, cursor.requestId);
+    request->cursorId = cursorId;
+    request->query = cursor.query;
+    request->limit = cursor.limit;
+    request->continuation = cursor.continuation;
+    request->chunkSize = cursor.chunkSize;
+    cursor.busy = true;
+    post(request);
+}
+
+DBServer::PartitionRequest *DBServer::processChangesSince(ClientJsonStream *stream, JsonDbOwner *owner, const QJsonValue &object, const QString &partitionName, int id)
+{
+    if (object.type() != QJsonValue::Object) {
         sendError(stream, JsonDbError::InvalidRequest, "Invalid changes since request", id);
-        return;
+        return 0;
     }
 
-    result.insert(JsonDbString::kIdStr, id);
-    stream->send(result);
+    PartitionRequest *request = new PartitionRequest(PartitionRequest::ChangesSince, mPartitions.value(partitionName, mDefaultPartition),
+                                                     stream, owner, id);
+    QJsonObject changesRequest(object.toObject());
+    request->stateNumber = changesRequest.value(JsonDbString::kStateNumberStr).toDouble();
+    if (changesRequest.contains(JsonDbString::kTypesStr)) {
+        QJsonArray l = changesRequest.value(JsonDbString::kTypesStr).toArray();
+        for (int i = 0; i < l.size(); i++)
+            request->limitTypes.insert(l.at(i).toString());
+    }
+    return request;
 }
 
-void DBServer::processFlush(ClientJsonStream *stream, JsonDbOwner *owner, const QString &partitionName, int id)
+DBServer::PartitionRequest *DBServer::processFlush(ClientJsonStream *stream, JsonDbOwner *owner, const QString &partitionName, int id)
 {
-    Q_UNUSED(owner);
-    JsonDbPartition *partition = mPartitions.value(partitionName, mDefaultPartition);
+    return new PartitionRequest(PartitionRequest::Flush, mPartitions.value(partitionName, mDefaultPartition), stream, owner, id);
+}
 
-    QJsonObject resultmap, errormap;
+/*!
+    Hands \a request to the thread of its partition. Requests to one partition
+    are served in the order they are posted, except reads that are served
+    from a snapshot. An owner's reads only go to a snapshot while none of its
+    writes are in flight, so the owner always reads what it wrote.
+*/
+void DBServer::post(PartitionRequest *request)
+{
+    JsonDbPartitionWorker *worker = mWorkers.value(request->partition);
+    Q_ASSERT(worker);
+    mOwnerRequests[request->owner]++;
+    if (request->kind == PartitionRequest::Write || request->kind == PartitionRequest::RemoveByQuery)
+        mOwnerWrites[request->owner]++;
+    else
+        request->useSnapshot = !mOwnerWrites.contains(request->owner);
+    worker->post(request);
+}
 
-    bool ok;
-    int stateNumber = partition->flush(&ok);
+void DBServer::requestFinished(JsonDbPartitionJob *job)
+{
+    PartitionRequest *request = static_cast<PartitionRequest *>(job);
+    ClientJsonStream *stream = request->stream.data();
+
+    if (request->kind == PartitionRequest::QueryChunk) {
+        QMap<int, QueryCursor>::iterator it = mQueryCursors.find(request->cursorId);
+        if (it != mQueryCursors.end()) {
+            QueryCursor &cursor = it.value();
+            cursor.busy = false;
+            cursor.limit = request->limit;
+            cursor.continuation = request->continuation;
+            if (request->errorCode != JsonDbError::NoError || !request->more)
+                mQueryCursors.erase(it);
+            else
+                scheduleQueryCursors();
+        } else {
+            // the cursor was closed while the chunk was read
+            stream = 0;
+        }
+    }
 
-    if (ok) {
-        resultmap.insert(JsonDbString::kStateNumberStr, stateNumber);
-    } else {
-        errormap.insert(JsonDbString::kCodeStr, JsonDbError::FlushFailed);
-        errormap.insert(JsonDbString::kMessageStr, QStringLiteral("Unable to flush partition"));
+    if (stream && request->errorCode != JsonDbError::NoError) {
+        sendError(stream, request->errorCode, request->errorMessage, request->id);
+    } else if (stream) {
+        QJsonObject response = request->response;
+        if (request->kind == PartitionRequest::Read && request->streamed) {
+            QueryCursor cursor;
+            cursor.stream = stream;
+            cursor.owner = request->owner;
+            cursor.partitionName = request->partition->partitionSpec().name;
+            cursor.query = request->query;
+            cursor.limit = request->limit < 0 ? -1 : request->limit - request->chunkSize;
+            cursor.continuation = request->continuation;
+            cursor.chunkSize = request->chunkSize;
+            cursor.requestId = request->id;
+
+            int cursorId = mNextCursorId++;
+            mQueryCursors.insert(cursorId, cursor);
+            QJsonObject result = response.value(JsonDbString::kResultStr).toObject();
+            result.insert(JsonDbString::kCursorStr, cursorId);
+            result.insert(JsonDbString::kMoreStr, true);
+            response.insert(JsonDbString::kResultStr, result);
+
+            connect(stream->device(), SIGNAL(bytesWritten(qint64)),
+                    this, SLOT(scheduleQueryCursors()), Qt::UniqueConnection);
+            scheduleQueryCursors();
+        }
+        response.insert(JsonDbString::kIdStr, request->id);
+        stream->send(response);
     }
 
-    QJsonObject result;
-    result.insert(JsonDbString::kResultStr, resultmap);
-    result.insert(JsonDbString::kErrorStr, errormap);
-    result.insert(JsonDbString::kIdStr, id);
-    stream->send(result);
+    if (stream && jsondbSettings->performanceLog() && request->kind != PartitionRequest::QueryChunk)
+        logPerformance(stream, request->id, request->action, request->details, request->partition->partitionSpec().name,
+                       request->elapsed, request->stats, request->fileSizeChanges);
+
+    JsonDbOwner *owner = request->owner;
+    if ((request->kind == PartitionRequest::Write || request->kind == PartitionRequest::RemoveByQuery)
+            && --mOwnerWrites[owner] == 0)
+        mOwnerWrites.remove(owner);
+    if (--mOwnerRequests[owner] == 0) {
+        mOwnerRequests.remove(owner);
+        if (mRetiredOwners.remove(owner))
+            owner->deleteLater();
+    }
+
+    delete request;
 }
 
 void DBServer::processLog(ClientJsonStream *stream, const QString &message, int id)
@@ -819,7 +1310,7 @@ void DBServer::createNotification(const JsonDbObject &object, ClientJsonStream *
     if (object.value("initialStateNumber").isDouble())
          n->setInitialStateNumber(static_cast<qint32>(object.value("initialStateNumber").toDouble()));
 
-    stream->addNotification(uuid, n);
+    stream->addNotification(uuid, n, object.value(JsonDbString::kBatchedStr).toBool());
 
     if (partitionName.isEmpty())
         partitionName = mDefaultPartition->partitionSpec().name;
@@ -828,8 +1319,8 @@ void DBServer::createNotification(const JsonDbObject &object, ClientJsonStream *
     if (partition) {
         n->setPartition(partition);
 
-        if (partition->isOpen())
-            partition->addNotification(n);
+        if (invokePartition(partition, "isOpen"))
+            invokePartition(partition, "addNotification", n);
     } else {
         mEphemeralPartition->addNotification(n);
     }
@@ -843,11 +1334,12 @@ void DBServer::removeNotification(const JsonDbObject &object, ClientJsonStream *
         return;
 
     if (n->partition())
-        n->partition()->removeNotification(n);
+        invokePartition(n->partition(), "removeNotification", n);
     else
         mEphemeralPartition->removeNotification(n);
 
-    delete n;
+    // notified() may still be queued from the partition thread
+    n->deleteLater();
 }
 
 JsonDbError::ErrorCode DBServer::validateNotification(const JsonDbObject &notificationDef, QString &message)
@@ -886,26 +1378,18 @@ JsonDbError::ErrorCode DBServer::validateNotification(const JsonDbObject &notifi
             message = QStringLiteral("Invalid partition specified: %1").arg(partitionName);
             return JsonDbError::InvalidPartition;
         }
-        if (!partition->isOpen()) {
+        NotificationTableLookup lookup(query.matchedTypes());
+        mWorkers.value(partition)->call(&lookup);
+        if (!lookup.available) {
             message = QStringLiteral("Partition '%1' is not currently available").arg(partitionName);
             return JsonDbError::InvalidPartition;
         }
-        JsonDbObjectTable *table = 0;
-        QSet<QString> matchedTypes = query.matchedTypes();
-        if (!matchedTypes.isEmpty()) {
-            foreach (const QString &type, matchedTypes) {
-                JsonDbObjectTable *viewtable = partition->findObjectTable(type);
-                if (table && viewtable && table != viewtable) {
-                    message = QStringLiteral("Cannot create a watcher for multiple object tables");
-                    return JsonDbError::MissingQuery;
-                }
-                table = viewtable;
-            }
+        if (lookup.multipleTables) {
+            message = QStringLiteral("Cannot create a watcher for multiple object tables");
+            return JsonDbError::MissingQuery;
         }
-        if (!table)
-            table = partition->mainObjectTable();
         if (initialStateNumber != static_cast<quint32>(-1)) {
-            if (initialStateNumber > table->stateNumber()) {
+            if (initialStateNumber > lookup.stateNumber) {
                 message = QStringLiteral("Too new state number specified");
                 return JsonDbError::InvalidStateNumber;
             }
@@ -940,7 +1424,8 @@ void DBServer::removeNotificationsByPartition(JsonDbPartition *partition)
     foreach (ClientJsonStream *stream, mConnections.values()) {
         foreach (JsonDbNotification *n, stream->notificationsByPartition(partition)) {
             stream->removeNotification(n);
-            delete n;
+            invokePartition(partition, "removeNotification", n);
+            n->deleteLater();
         }
     }
 }
@@ -950,7 +1435,7 @@ void DBServer::enableNotificationsByPartition(JsonDbPartition *partition)
     // re-install the notifications from each of the connections
     foreach (ClientJsonStream *stream, mConnections.values()) {
         foreach (JsonDbNotification *n, stream->notificationsByPartition(partition))
-            partition->addNotification(n);
+            invokePartition(partition, "addNotification", n);
     }
 }
 
@@ -1123,7 +1608,7 @@ void DBServer::updatePartitionDefinition(JsonDbPartition *partition, bool remove
     partitionRecord.insert(JsonDbString::kTypeStr, JsonDbString::kPartitionTypeStr);
     partitionRecord.insert(JsonDbString::kNameStr, partition->partitionSpec().name);
     partitionRecord.insert(JsonDbString::kPathStr, QFileInfo(partition->filename()).absolutePath());
-    partitionRecord.insert(JsonDbString::kAvailableStr, partition->isOpen());
+    partitionRecord.insert(JsonDbString::kAvailableStr, invokePartition(partition, "isOpen"));
 
     if (isDefault)
         partitionRecord.insert(JsonDbString::kDefaultStr, true);
@@ -1134,6 +1619,45 @@ void DBServer::updatePartitionDefinition(JsonDbPartition *partition, bool remove
     mEphemeralPartition->updateObjects(mOwner, JsonDbObjectList() << partitionRecord, JsonDbPartition::Replace);
 }
 
+/*!
+    Publishes the progress of a background index build as an IndexBuild
+    object in the ephemeral partition, so clients can query or watch it.
+*/
+void DBServer::updateIndexBuildStatus(JsonDbPartition *partition, const QString &indexName, quint64 processedCount, quint64 totalCount, bool building, bool remove)
+{
+    QString partitionName = partition->partitionSpec().name;
+    QUuid uuid = JsonDbObject::createUuidFromString(QStringLiteral("IndexBuild:%1:%2").arg(partitionName).arg(indexName));
+    JsonDbObject status;
+    status.insert(JsonDbString::kUuidStr, uuid.toString());
+    status.insert(JsonDbString::kTypeStr, QStringLiteral("IndexBuild"));
+    status.insert(JsonDbString::kNameStr, indexName);
+    status.insert(JsonDbString::kPartitionStr, partitionName);
+    status.insert(QStringLiteral("state"), building ? QStringLiteral("building") : QStringLiteral("ready"));
+    if (building) {
+        status.insert(QStringLiteral("processedCount"), double(processedCount));
+        status.insert(QStringLiteral("totalCount"), double(totalCount));
+    }
+
+    if (remove)
+        status.markDeleted();
+
+    mEphemeralPartition->updateObjects(mOwner, JsonDbObjectList() << status, JsonDbPartition::Replace);
+}
+
+void DBServer::indexBuildProgress(const QString &indexName, quint64 processedCount, quint64 totalCount)
+{
+    JsonDbPartition *partition = qobject_cast<JsonDbPartition *>(sender());
+    if (partition)
+        updateIndexBuildStatus(partition, indexName, processedCount, totalCount, true);
+}
+
+void DBServer::indexBuildFinished(const QString &indexName, bool built)
+{
+    JsonDbPartition *partition = qobject_cast<JsonDbPartition *>(sender());
+    if (partition)
+        updateIndexBuildStatus(partition, indexName, 0, 0, false, !built);
+}
+
 void DBServer::receiveMessage(const QJsonObject &message)
 {
     ClientJsonStream *stream = qobject_cast<ClientJsonStream *>(sender());
@@ -1150,15 +1674,8 @@ void DBServer::receiveMessage(const QJsonObject &message)
     }
 
     QElapsedTimer timer;
-    QHash<QString, qint64> fileSizes;
-
-    JsonDbStat startStat;
-    if (jsondbSettings->performanceLog()) {
-        if (jsondbSettings->verbose() && partitionName != mEphemeralPartition->name())
-            fileSizes = partition->fileSizes();
-        startStat = stat();
+    if (jsondbSettings->performanceLog())
         timer.start();
-    }
 
     JsonDbOwner *owner = getOwner(stream);
     if (!owner) {
@@ -1175,6 +1692,7 @@ void DBServer::receiveMessage(const QJsonObject &message)
         return;
     }
 
+    PartitionRequest *request = 0;
     if (action == JsonDbString::kCreateStr || action == JsonDbString::kRemoveStr || action == JsonDbString::kUpdateStr) {
         JsonDbPartition::ConflictResolutionMode writeMode = JsonDbPartition::RejectStale;
         QString conflictModeRequested = message.value(JsonDbString::kConflictResolutionModeStr).toString();
@@ -1190,55 +1708,59 @@ void DBServer::receiveMessage(const QJsonObject &message)
             parser.setQuery(object.toObject().value(JsonDbString::kQueryStr).toString());
             parser.parse();
             JsonDbQuery parsedQuery = parser.result();
-            JsonDbQueryResult res;
-            if (partition)
-                res = partition->queryObjects(owner, parsedQuery);
-            else
-                res = mEphemeralPartition->queryObjects(owner, parsedQuery);
-
-            QJsonArray toRemove;
-            foreach (const QJsonValue &value, res.data)
-                toRemove.append(value);
-            object = toRemove;
+            if (partition) {
+                // queried and removed in one go on the partition thread
+                request = new PartitionRequest(PartitionRequest::RemoveByQuery, partition, stream, owner, id);
+                request->query = parsedQuery;
+                request->writeMode = writeMode;
+            } else {
+                JsonDbQueryResult res = mEphemeralPartition->queryObjects(owner, parsedQuery);
+                QJsonArray toRemove;
+                foreach (const QJsonValue &value, res.data)
+                    toRemove.append(value);
+                object = toRemove;
+            }
         }
 
-        JsonDbObjectList toWrite = prepareWriteData(action, object);
-
-        // check if the objects to write contain any notifications. If the specified partition
-        // is not the ephemeral one, then switch the ephemeral partition provided that all of the
-        // objects to write are notifications.
-        if (partitionName != mEphemeralPartition->name()) {
-            JsonDbObjectList notifications = checkForNotifications(toWrite);
-            if (!notifications.isEmpty()) {
-                if (notifications.count() == toWrite.count()) {
-                    partitionName = mEphemeralPartition->name();
-                } else {
-                    sendError(stream, JsonDbError::InvalidRequest,
-                              QStringLiteral("Mixing objects of type Notification with others can only be done in the ephemeral partition"), id);
-                    return;
+        if (!request) {
+            JsonDbObjectList toWrite = prepareWriteData(action, object);
+
+            // check if the objects to write contain any notifications. If the specified partition
+            // is not the ephemeral one, then switch the ephemeral partition provided that all of the
+            // objects to write are notifications.
+            if (partitionName != mEphemeralPartition->name()) {
+                JsonDbObjectList notifications = checkForNotifications(toWrite);
+                if (!notifications.isEmpty()) {
+                    if (notifications.count() == toWrite.count()) {
+                        partitionName = mEphemeralPartition->name();
+                    } else {
+                        sendError(stream, JsonDbError::InvalidRequest,
+                                  QStringLiteral("Mixing objects of type Notification with others can only be done in the ephemeral partition"), id);
+                        return;
+                    }
                 }
             }
+            request = processWrite(stream, owner, toWrite, writeMode, partitionName, id);
         }
-        processWrite(stream, owner, toWrite, writeMode, partitionName, id);
     } else if (action == JsonDbString::kFindStr) {
-        processRead(stream, owner, object, partitionName, id);
+        request = processRead(stream, owner, object, partitionName, id);
     } else if (action == JsonDbString::kChangesSinceStr) {
         if (partitionName == mEphemeralPartition->name()) {
             sendError(stream, JsonDbError::InvalidRequest,
                       QString("Invalid partition for changesSince '%1'").arg(partitionName), id);
             return;
         }
-        processChangesSince(stream, owner, object, partitionName, id);
+        request = processChangesSince(stream, owner, object, partitionName, id);
     } else if (action == JsonDbString::kFlushStr) {
-        processFlush(stream, owner, partitionName, id);
+        request = processFlush(stream, owner, partitionName, id);
     } else if (action == JsonDbString::kLogStr) {
         processLog(stream, object.toObject().value(JsonDbString::kMessageStr).toString(), id);
+    } else if (action == JsonDbString::kCloseCursorStr) {
+        processCloseCursor(stream, object, id);
     }
 
+    QString additionalInfo;
     if (jsondbSettings->performanceLog()) {
-        QString additionalInfo;
-        JsonDbStat stats = stat();
-        stats -= startStat;
         if ( action == JsonDbString::kFindStr ) {
             additionalInfo = object.toObject().value("query").toString();
         } else if (object.type() == QJsonValue::Array) {
@@ -1250,26 +1772,34 @@ void DBServer::receiveMessage(const QJsonObject &message)
         } else {
             additionalInfo = object.toObject().value(JsonDbString::kTypeStr).toString();
         }
-        qDebug().nospace() << "+ JsonDB Perf: [id]" << id << "[id]";
-        if (mOwners.contains(stream->device())) {
-            const OwnerInfo &ownerInfo = mOwners[stream->device()];
-            qDebug().nospace() << ":[pid]" << ownerInfo.pid << "[pid]:[process]" << ownerInfo.processName << "[process]";
-        }
-        qDebug().nospace() << ":[action]" << action
-                           << "[action]:[ms]" << timer.elapsed() << "[ms]:[details]" << additionalInfo << "[details]"
-                           << ":[partition]" << partitionName << "[partition]"
-                           << ":[reads]" << stats.reads << "[reads]:[hits]" << stats.hits << "[hits]:[writes]" << stats  .writes << "[writes]";
-        if (jsondbSettings->verbose() && partitionName != mEphemeralPartition->name()) {
-            QHash<QString, qint64> newSizes = partition->fileSizes();
-            QHashIterator<QString, qint64> files(fileSizes);
+    }
 
-            while (files.hasNext()) {
-                files.next();
-                if (newSizes[files.key()] != files.value())
-                    qDebug().nospace() << "\t [file]" << files.key() << "[file]:[size]" << (newSizes[files.key()] - files.value()) << "[size]";
+    // requests served on a partition thread are logged once they are done
+    if (request) {
+        request->action = action;
+        request->details = additionalInfo;
+        post(request);
+    } else if (jsondbSettings->performanceLog()) {
+        logPerformance(stream, id, action, additionalInfo, partitionName, timer.elapsed(), JsonDbStat(), QHash<QString, qint64>());
+    }
+}
 
-            }
-        }
+void DBServer::logPerformance(ClientJsonStream *stream, int id, const QString &action, const QString &details, const QString &partitionName,
+                              qint64 elapsed, const JsonDbStat &stats, const QHash<QString, qint64> &fileSizeChanges)
+{
+    qDebug().nospace() << "+ JsonDB Perf: [id]" << id << "[id]";
+    if (mOwners.contains(stream->device())) {
+        const OwnerInfo &ownerInfo = mOwners[stream->device()];
+        qDebug().nospace() << ":[pid]" << ownerInfo.pid << "[pid]:[process]" << ownerInfo.processName << "[process]";
+    }
+    qDebug().nospace() << ":[action]" << action
+                       << "[action]:[ms]" << elapsed << "[ms]:[details]" << details << "[details]"
+                       << ":[partition]" << partitionName << "[partition]"
+                       << ":[reads]" << stats.reads << "[reads]:[hits]" << stats.hits << "[hits]:[writes]" << stats.writes << "[writes]";
+    QHashIterator<QString, qint64> files(fileSizeChanges);
+    while (files.hasNext()) {
+        files.next();
+        qDebug().nospace() << "\t [file]" << files.key() << "[file]:[size]" << files.value() << "[size]";
     }
 }
 
@@ -1289,13 +1819,21 @@ void DBServer::removeConnection()
         QList<JsonDbNotification *>  notifications = stream->takeAllNotifications();
         foreach (JsonDbNotification *n, notifications) {
             if (n->partition()) {
-                n->partition()->removeNotification(n);
+                invokePartition(n->partition(), "removeNotification", n);
             } else {
                 mEphemeralPartition->removeNotification(n);
             }
             n->deleteLater();
         }
 
+        QMap<int, QueryCursor>::iterator it = mQueryCursors.begin();
+        while (it != mQueryCursors.end()) {
+            if (it.value().stream.data() == stream)
+                it = mQueryCursors.erase(it);
+            else
+                ++it;
+        }
+
         if (stream)
             stream->deleteLater();
 
@@ -1303,7 +1841,9 @@ void DBServer::removeConnection()
     }
     if (mOwners.contains(connection)) {
         JsonDbOwner *owner = mOwners.value(connection).owner;
-        if (owner)
+        if (owner && mOwnerRequests.contains(owner))
+            mRetiredOwners.insert(owner);
+        else if (owner)
             owner->deleteLater();
         mOwners.remove(connection);
     }
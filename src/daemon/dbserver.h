@@ -43,6 +43,7 @@
 #define DBSERVER_H
 
 #include <QObject>
+#include <QPointer>
 #include <QVariant>
 #include <QAbstractSocket>
 
@@ -50,6 +51,7 @@
 #include "jsondbnotification.h"
 #include "jsondbpartition.h"
 #include "jsondbpartitionspec.h"
+#include "jsondbpartitionworker.h"
 
 QT_BEGIN_HEADER
 
@@ -93,21 +95,36 @@ protected slots:
     void receiveMessage(const QJsonObject &document);
     void handleConnectionError();
     void removeConnection();
+    void scheduleQueryCursors();
+    void serviceQueryCursors();
+    void requestFinished(JsonDbPartitionJob *job);
+    void indexBuildProgress(const QString &indexName, quint64 processedCount, quint64 totalCount);
+    void indexBuildFinished(const QString &indexName, bool built);
 
 private:
+    class PartitionRequest;
+
     bool loadPartitions();
     void reduceMemoryUsage();
     void closeIndexes();
     JsonDbStat stat() const;
-
-    void processWrite(ClientJsonStream *stream, JsonDbOwner *owner, const JsonDbObjectList &objects, JsonDbPartition::ConflictResolutionMode mode, const QString &partitionName, int id);
-    void processRead(ClientJsonStream *stream, JsonDbOwner *owner, const QJsonValue &object, const QString &partitionName, int id);
-    void processChangesSince(ClientJsonStream *stream, JsonDbOwner *owner, const QJsonValue &object, const QString &partitionName, int id);
-    void processFlush(ClientJsonStream *stream, JsonDbOwner *owner, const QString &partitionName, int id);
+    QJsonObject viewStats() const;
+    void logViewStats() const;
+
+    // requests for a partition other than the ephemeral one are returned
+    // unserved, to be run on the thread of the partition
+    PartitionRequest *processWrite(ClientJsonStream *stream, JsonDbOwner *owner, const JsonDbObjectList &objects, JsonDbPartition::ConflictResolutionMode mode, const QString &partitionName, int id);
+    PartitionRequest *processRead(ClientJsonStream *stream, JsonDbOwner *owner, const QJsonValue &object, const QString &partitionName, int id);
+    PartitionRequest *processChangesSince(ClientJsonStream *stream, JsonDbOwner *owner, const QJsonValue &object, const QString &partitionName, int id);
+    PartitionRequest *processFlush(ClientJsonStream *stream, JsonDbOwner *owner, const QString &partitionName, int id);
     void processLog(ClientJsonStream *stream, const QString &message, int id);
+    void processCloseCursor(ClientJsonStream *stream, const QJsonValue &object, int id);
+    void post(PartitionRequest *request);
+    void logPerformance(ClientJsonStream *stream, int id, const QString &action, const QString &details, const QString &partitionName,
+                        qint64 elapsed, const JsonDbStat &stats, const QHash<QString, qint64> &fileSizeChanges);
 
-    void debugQuery(const QString partitionName, const JsonDbQuery &query, int limit, int offset, const JsonDbQueryResult &result);
-    JsonDbObjectList prepareWriteData(const QString &action, const QJsonValue &object);
+    static void debugQuery(const QString partitionName, const JsonDbQuery &query, int limit, int offset, const JsonDbQueryResult &result);
+    static JsonDbObjectList prepareWriteData(const QString &action, const QJsonValue &object);
     JsonDbObjectList checkForNotifications(const JsonDbObjectList &objects);
     void createNotification(const JsonDbObject &object, ClientJsonStream *stream);
     void removeNotification(const JsonDbObject &object, ClientJsonStream *stream);
@@ -118,6 +135,7 @@ private:
     JsonDbPartition* findPartition(const QString &partitionName);
     QList<JsonDbPartitionSpec> findPartitionDefinitions() const;
     void updatePartitionDefinition(JsonDbPartition *partition, bool remove = false, bool isDefault = false);
+    void updateIndexBuildStatus(JsonDbPartition *partition, const QString &indexName, quint64 processedCount, quint64 totalCount, bool building, bool remove = false);
 
     JsonDbOwner *getOwner(ClientJsonStream *stream);
     JsonDbOwner *createDummyOwner(ClientJsonStream *stream);
@@ -125,6 +143,7 @@ private:
                    const QString& message, int id);
 
     QHash<QString, JsonDbPartition *> mPartitions;
+    QHash<JsonDbPartition *, JsonDbPartitionWorker *> mWorkers;
     JsonDbPartition *mDefaultPartition;
     JsonDbEphemeralPartition *mEphemeralPartition;
 
@@ -143,7 +162,88 @@ private:
         QString      processName;
     };
     QMap<QIODevice*,OwnerInfo>       mOwners;
+    // owners of closed connections are kept until their last request is served
+    QHash<JsonDbOwner*, int>         mOwnerRequests;
+    // reads of an owner with writes in flight wait for them on the partition thread
+    QHash<JsonDbOwner*, int>         mOwnerWrites;
+    QSet<JsonDbOwner*>               mRetiredOwners;
     bool mCompactOnClose;
+
+    // server side state of a streamed read request
+    class QueryCursor {
+    public:
+        QueryCursor() : owner(0), limit(-1), chunkSize(0), requestId(0), busy(false) {}
+        QPointer<ClientJsonStream> stream;
+        JsonDbOwner *owner;
+        QString      partitionName;
+        JsonDbQuery  query;
+        int          limit; // remaining number of results, -1 if unlimited
+        QByteArray   continuation; // the index key the next chunk starts after
+        int          chunkSize;
+        int          requestId;
+        bool         busy; // a chunk is being read on the partition thread
+    };
+    void sendQueryChunk(QueryCursor &cursor, int cursorId);
+
+    QMap<int, QueryCursor>           mQueryCursors;
+    int                              mNextCursorId;
+    bool                             mQueryCursorsScheduled;
+
+    // a request served on the thread of the partition it addresses; the
+    // stream is only touched on the server thread, once the request is done
+    class PartitionRequest : public JsonDbPartitionJob {
+    public:
+        enum Kind { Write, RemoveByQuery, Read, ChangesSince, Flush, QueryChunk };
+
+        PartitionRequest(Kind kind, JsonDbPartition *partition, ClientJsonStream *stream, JsonDbOwner *owner, int id);
+        void run(JsonDbPartition *partition);
+        bool mayRunOnSnapshot() const;
+        bool runOnSnapshot(JsonDbPartitionSnapshot *snapshot);
+
+        Kind kind;
+        JsonDbPartition *partition;
+        QPointer<ClientJsonStream> stream;
+        JsonDbOwner *owner;
+        int id;
+
+        // arguments
+        JsonDbObjectList objects;
+        JsonDbPartition::ConflictResolutionMode writeMode;
+        JsonDbQuery query;
+        int limit;
+        int offset;
+        QByteArray continuation;
+        int chunkSize;
+        bool streamed;
+        int stateNumber;
+        QSet<QString> limitTypes;
+        int cursorId;
+        bool useSnapshot;
+
+        // results, the response lacks the request id
+        JsonDbError::ErrorCode errorCode;
+        QString errorMessage;
+        QJsonObject response;
+        bool more;
+
+        // performance log
+        QString action;
+        QString details;
+        qint64 elapsed;
+        JsonDbStat stats;
+        QHash<QString, qint64> fileSizeChanges;
+
+    private:
+        bool queryObjects(JsonDbPartition *partition, int limit, int offset, const QByteArray &continuation,
+                          JsonDbQueryResult *result);
+        void write(JsonDbPartition *partition);
+        bool read(JsonDbPartition *partition);
+        bool readChunk(JsonDbPartition *partition);
+        void changesSince(JsonDbPartition *partition);
+        void flush(JsonDbPartition *partition);
+
+        JsonDbPartitionSnapshot *snapshot;
+    };
 };
 
 QT_END_HEADER
@@ -152,55 +152,12 @@ JsonDbWriteResult JsonDbEphemeralPartition::updateObjects(const JsonDbOwner *own
 void JsonDbEphemeralPartition::addNotification(JsonDbNotification *notification)
 {
     notification->setPartition(0);
-    const JsonDbQuery &parsedQuery = notification->parsedQuery();
-    const QList<JsonDbOrQueryTerm> &orQueryTerms = parsedQuery.queryTerms;
-
-    bool generic = true;
-    for (int i = 0; i < orQueryTerms.size(); i++) {
-        const JsonDbOrQueryTerm &orQueryTerm = orQueryTerms[i];
-        const QList<JsonDbQueryTerm> &terms = orQueryTerm.terms();
-        if (terms.size() == 1) {
-            const JsonDbQueryTerm &term = terms[0];
-            if (term.op() == QLatin1Char('=')) {
-                if (term.propertyName() == JsonDbString::kUuidStr) {
-                    mKeyedNotifications.insert(parsedQuery.termValue(term).toString(), notification);
-                    generic = false;
-                    break;
-                } else if (term.propertyName() == JsonDbString::kTypeStr) {
-                    QString objectType = parsedQuery.termValue(term).toString();
-                    mKeyedNotifications.insert(objectType, notification);
-                    generic = false;
-                    break;
-                }
-            }
-        }
-    }
-
-    if (generic)
-        mKeyedNotifications.insert(QStringLiteral("__generic_notification__"), notification);
+    mNotifications.insert(notification);
 }
 
 void JsonDbEphemeralPartition::removeNotification(JsonDbNotification *notification)
 {
-    const JsonDbQuery &parsedQuery = notification->parsedQuery();
-    const QList<JsonDbOrQueryTerm> &orQueryTerms = parsedQuery.queryTerms;
-    for (int i = 0; i < orQueryTerms.size(); i++) {
-        const JsonDbOrQueryTerm &orQueryTerm = orQueryTerms[i];
-        const QList<JsonDbQueryTerm> &terms = orQueryTerm.terms();
-        if (terms.size() == 1) {
-            const JsonDbQueryTerm &term = terms[0];
-            if (term.op() == QLatin1Char('=')) {
-                if (term.propertyName() == JsonDbString::kTypeStr) {
-                    mKeyedNotifications.remove(parsedQuery.termValue(term).toString(), notification);
-                } else if (term.propertyName() == JsonDbString::kUuidStr) {
-                    QString objectType = parsedQuery.termValue(term).toString();
-                    mKeyedNotifications.remove(objectType, notification);
-                }
-            }
-        }
-    }
-
-    mKeyedNotifications.remove(QStringLiteral("__generic_notification__"), notification);
+    mNotifications.remove(notification);
 }
 
 void JsonDbEphemeralPartition::objectsUpdated(const JsonDbUpdateList &changes)
@@ -214,27 +171,9 @@ void JsonDbEphemeralPartition::objectsUpdated(const JsonDbUpdateList &changes)
         QString oldObjectType = oldObject.type();
         QString objectType = object.type();
 
-        QStringList notificationKeys;
         if (!oldObjectType.isEmpty() || !objectType.isEmpty()) {
-            notificationKeys << objectType;
-            if (!oldObjectType.isEmpty() && objectType.compare(oldObjectType))
-                notificationKeys << oldObjectType;
-
-            if (object.contains(JsonDbString::kUuidStr))
-                notificationKeys << object.value(JsonDbString::kUuidStr).toString();
-            notificationKeys << QStringLiteral("__generic_notification__");
-
-            QHash<QString, JsonDbObject> objectCache;
-            for (int i = 0; i < notificationKeys.size(); i++) {
-                QString key = notificationKeys[i];
-                for (QMultiHash<QString, QPointer<JsonDbNotification> >::const_iterator it = mKeyedNotifications.find(key);
-                     (it != mKeyedNotifications.end()) && (it.key() == key);
-                     ++it) {
-                    JsonDbNotification *n = it.value();
-                    if (n)
-                        n->notifyIfMatches(0, oldObject, object, action, 0);
-                }
-            }
+            foreach (JsonDbNotification *n, mNotifications.candidates(oldObject, object))
+                n->notifyIfMatches(0, oldObject, object, action, 0);
         }
     }
 }
@@ -47,6 +47,7 @@
 #include <QObject>
 #include <qjsonobject.h>
 #include "jsondbnotification.h"
+#include "jsondbnotificationindex.h"
 #include "jsondbobject.h"
 #include "jsondbpartition.h"
 #include "jsondbquery.h"
@@ -82,7 +83,7 @@ private:
     typedef QMap<QUuid, JsonDbObject> ObjectMap;
     ObjectMap mObjects;
     QString mName;
-    QMultiHash<QString, QPointer<JsonDbNotification> > mKeyedNotifications;
+    JsonDbNotificationIndex mNotifications;
 };
 
 QT_END_HEADER
@@ -0,0 +1,209 @@
+/****************************************************************************
+**
+** Copyright (C) 2012 Digia Plc and/or its subsidiary(-ies).
+** Contact: http://www.qt-project.org/legal
+**
+** This file is part of the QtAddOn.JsonDb module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "jsondbpartitionworker.h"
+
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+QT_USE_NAMESPACE_JSONDB_PARTITION
+
+class JsonDbSnapshotRead : public QRunnable
+{
+public:
+    JsonDbSnapshotRead(JsonDbPartitionWorker *worker, JsonDbPartitionJob *job,
+                       const QSharedPointer<JsonDbPartitionSnapshot> &snapshot)
+        : mWorker(worker), mJob(job), mSnapshot(snapshot)
+    {}
+
+    void run()
+    {
+        if (mJob->runOnSnapshot(mSnapshot.data()))
+            emit mWorker->finished(mJob);
+        else
+            mWorker->postToPartition(mJob);
+    }
+
+private:
+    JsonDbPartitionWorker *mWorker;
+    JsonDbPartitionJob *mJob;
+    QSharedPointer<JsonDbPartitionSnapshot> mSnapshot;
+};
+
+JsonDbPartitionExecutor::~JsonDbPartitionExecutor()
+{
+    // the partition is deleted right after the executor, and the snapshot with it
+    mWorker->releaseSnapshot();
+}
+
+void JsonDbPartitionExecutor::execute(JsonDbPartitionJob *job)
+{
+    job->run(mPartition);
+    // reads posted once the job is finished see what it wrote
+    mWorker->refreshSnapshot();
+    emit executed(job);
+}
+
+void JsonDbPartitionExecutor::run(JsonDbPartitionJob *job)
+{
+    job->run(mPartition);
+}
+
+/*!
+    Takes ownership of \a partition. When \a threaded is true the partition is
+    moved to a thread of its own and every job posted to the worker runs there,
+    one at a time and in the order posted. Otherwise jobs run synchronously on
+    the calling thread. finished() is always delivered on the thread that
+    created the worker.
+
+    With \a readThreads, a threaded worker runs the jobs that only read on a
+    pool of that many threads instead, against a snapshot of the partition
+    taken after the last job that ran on the partition's thread. Such jobs
+    may finish before jobs posted earlier.
+
+    The partition must not have a parent, since it is moved to another thread.
+*/
+JsonDbPartitionWorker::JsonDbPartitionWorker(JsonDbPartition *partition, bool threaded, int readThreads, QObject *parent) :
+    QObject(parent)
+  , mPartition(partition)
+  , mExecutor(new JsonDbPartitionExecutor(this, partition))
+  , mThread(0)
+  , mReaders(0)
+{
+    Q_ASSERT(!partition->parent());
+    qRegisterMetaType<JsonDbPartitionJob*>("JsonDbPartitionJob*");
+
+    connect(mExecutor, SIGNAL(executed(JsonDbPartitionJob*)), this, SIGNAL(finished(JsonDbPartitionJob*)));
+
+    if (threaded) {
+        mThread = new QThread;
+        mThread->setObjectName(QStringLiteral("JsonDbPartition:%1").arg(partition->partitionSpec().name));
+        mPartition->moveToThread(mThread);
+        mExecutor->moveToThread(mThread);
+        mThread->start();
+
+        if (readThreads > 0) {
+            mReaders = new QThreadPool(this);
+            mReaders->setMaxThreadCount(readThreads);
+        }
+    }
+}
+
+JsonDbPartitionWorker::~JsonDbPartitionWorker()
+{
+    // reads that fall back to the partition thread are posted before it stops
+    if (mReaders)
+        mReaders->waitForDone();
+
+    if (mThread) {
+        // jobs already posted are served first, the partition is deleted
+        // with the other deferred deletes when the thread finishes
+        connect(mExecutor, SIGNAL(destroyed()), mThread, SLOT(quit()), Qt::DirectConnection);
+        mExecutor->deleteLater();
+        mPartition->deleteLater();
+        mThread->wait();
+        delete mThread;
+    } else {
+        delete mExecutor;
+        delete mPartition;
+    }
+}
+
+void JsonDbPartitionWorker::post(JsonDbPartitionJob *job)
+{
+    if (mReaders && job->mayRunOnSnapshot()) {
+        QSharedPointer<JsonDbPartitionSnapshot> snapshot;
+        {
+            QMutexLocker locker(&mSnapshotMutex);
+            snapshot = mSnapshot;
+        }
+        if (snapshot) {
+            mReaders->start(new JsonDbSnapshotRead(this, job, snapshot));
+            return;
+        }
+    }
+    postToPartition(job);
+}
+
+void JsonDbPartitionWorker::postToPartition(JsonDbPartitionJob *job)
+{
+    if (mThread)
+        QMetaObject::invokeMethod(mExecutor, "execute", Qt::QueuedConnection, Q_ARG(JsonDbPartitionJob*, job));
+    else
+        mExecutor->execute(job);
+}
+
+/*!
+    Runs \a job on the partition thread and waits for it, without emitting
+    finished(). The job stays owned by the caller.
+*/
+void JsonDbPartitionWorker::call(JsonDbPartitionJob *job)
+{
+    QMetaObject::invokeMethod(mExecutor, "run", mThread ? Qt::BlockingQueuedConnection : Qt::DirectConnection,
+                              Q_ARG(JsonDbPartitionJob*, job));
+}
+
+/*!
+    Replaces the snapshot that reads are served from, unless nothing was
+    committed since it was taken.
+*/
+void JsonDbPartitionWorker::refreshSnapshot()
+{
+    if (!mReaders)
+        return;
+    // only this thread changes mSnapshot
+    if (mSnapshot && mSnapshot->isCurrent())
+        return;
+    QSharedPointer<JsonDbPartitionSnapshot> snapshot(mPartition->createSnapshot());
+    {
+        QMutexLocker locker(&mSnapshotMutex);
+        mSnapshot.swap(snapshot);
+    }
+    // the previous snapshot goes once the reads still using it are done
+}
+
+void JsonDbPartitionWorker::releaseSnapshot()
+{
+    QSharedPointer<JsonDbPartitionSnapshot> snapshot;
+    QMutexLocker locker(&mSnapshotMutex);
+    mSnapshot.swap(snapshot);
+}
@@ -0,0 +1,136 @@
+/****************************************************************************
+**
+** Copyright (C) 2012 Digia Plc and/or its subsidiary(-ies).
+** Contact: http://www.qt-project.org/legal
+**
+** This file is part of the QtAddOn.JsonDb module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef JSONDB_PARTITION_WORKER_H
+#define JSONDB_PARTITION_WORKER_H
+
+#include <QObject>
+#include <QMetaType>
+#include <QMutex>
+#include <QSharedPointer>
+
+#include "jsondbpartition.h"
+#include "jsondbpartitionsnapshot.h"
+
+QT_BEGIN_HEADER
+
+QT_BEGIN_NAMESPACE
+class QThread;
+class QThreadPool;
+QT_END_NAMESPACE
+
+QT_USE_NAMESPACE_JSONDB_PARTITION
+
+class JsonDbPartitionJob
+{
+public:
+    virtual ~JsonDbPartitionJob() {}
+
+    // called on the thread that owns the partition
+    virtual void run(JsonDbPartition *partition) = 0;
+
+    // A job that only reads may run on a reader thread against a snapshot of
+    // the partition instead. runOnSnapshot() returns false when the job has to
+    // run on the partition's thread after all.
+    virtual bool mayRunOnSnapshot() const { return false; }
+    virtual bool runOnSnapshot(JsonDbPartitionSnapshot *snapshot) { Q_UNUSED(snapshot); return false; }
+};
+
+Q_DECLARE_METATYPE(JsonDbPartitionJob*)
+
+class JsonDbPartitionWorker;
+
+class JsonDbPartitionExecutor : public QObject
+{
+    Q_OBJECT
+public:
+    JsonDbPartitionExecutor(JsonDbPartitionWorker *worker, JsonDbPartition *partition)
+        : mWorker(worker), mPartition(partition) {}
+    ~JsonDbPartitionExecutor();
+
+public Q_SLOTS:
+    void execute(JsonDbPartitionJob *job);
+    void run(JsonDbPartitionJob *job);
+
+Q_SIGNALS:
+    void executed(JsonDbPartitionJob *job);
+
+private:
+    JsonDbPartitionWorker *mWorker;
+    JsonDbPartition *mPartition;
+};
+
+class JsonDbPartitionWorker : public QObject
+{
+    Q_OBJECT
+public:
+    JsonDbPartitionWorker(JsonDbPartition *partition, bool threaded, int readThreads = 0, QObject *parent = 0);
+    ~JsonDbPartitionWorker();
+
+    inline JsonDbPartition *partition() const { return mPartition; }
+    inline bool isThreaded() const { return mThread != 0; }
+
+    void post(JsonDbPartitionJob *job);
+    void call(JsonDbPartitionJob *job);
+
+    // called on the partition thread
+    void refreshSnapshot();
+    void releaseSnapshot();
+
+Q_SIGNALS:
+    void finished(JsonDbPartitionJob *job);
+
+private:
+    friend class JsonDbSnapshotRead;
+    void postToPartition(JsonDbPartitionJob *job);
+
+    JsonDbPartition *mPartition;
+    JsonDbPartitionExecutor *mExecutor;
+    QThread *mThread;
+    QThreadPool *mReaders;
+    // what reads posted now see, replaced on the partition thread
+    QMutex mSnapshotMutex;
+    QSharedPointer<JsonDbPartitionSnapshot> mSnapshot;
+};
+
+QT_END_HEADER
+
+#endif // JSONDB_PARTITION_WORKER_H
@@ -165,6 +165,7 @@ HBtreePrivate::HBtreePrivate(HBtree *q, const QString &name)
     : q_ptr(q), fileName_(name), fd_(-1), openMode_(HBtree::ReadOnly), size_(0), lastSyncedId_(0), cacheSize_(20),
       compareFunction_(0),
       writeTransaction_(0), readTransaction_(0), lastPage_(PageInfo::INVALID_PAGE), cursorDisrupted_(false),
+      snapshotSource_(0),
 #ifdef QT_TESTLIB_LIB
       forceCommitFail_(0),
 #endif
@@ -300,15 +301,41 @@ bool HBtreePrivate::open(int fd)
     return true;
 }
 
+void HBtreePrivate::openSnapshot(int fd, const PinnedCommit &commit)
+{
+    Q_ASSERT(fd_ == -1);
+    Q_ASSERT(fd != -1);
+
+    // The source btree holds the file lock and does all the writing, a
+    // snapshot only reads the pages reachable from the pinned root
+    fd_ = fd;
+    spec_ = commit.spec;
+    pageBuffer_.resize(spec_.pageSize);
+    marker_ = MarkerPage(0);
+    marker_.meta = commit.meta;
+    synced_ = marker_;
+    lastSyncedId_ = commit.meta.syncId;
+    size_ = commit.size;
+    lastPage_ = size_ / spec_.pageSize;
+
+    HBTREE_DEBUG("opened snapshot with"
+                 << "[spec:" << spec_
+                 << ", marker:" << marker_
+                 << ", size_:" << size_
+                 << "]");
+    lastReadError_ = 0;
+}
+
 void HBtreePrivate::close(bool doSync)
 {
     HBTREE_ASSERT(!readTransaction_ && !writeTransaction_);
 
     if (fd_ != -1) {
         HBTREE_DEBUG("closing btree with fd:" << fd_);
-        if (doSync)
+        quint32 revision = marker_.meta.revision;
+        if (doSync && !snapshotSource_)
             sync();
-        if (::flock(fd_, LOCK_UN) != 0) {
+        if (!snapshotSource_ && ::flock(fd_, LOCK_UN) != 0) {
             lastErrorMessage_ = QLatin1String("failed to unlock file - ") + QLatin1String(strerror(errno));
             HBTREE_ERROR("failed to unlock file");
         }
@@ -328,6 +355,12 @@ void HBtreePrivate::close(bool doSync)
         synced_ = MarkerPage(0);
         cursorDisrupted_ = false;
         spec_ = Spec();
+
+        // pins outlive closing, snapshots keep reading through their own file descriptor
+        if (snapshotSource_) {
+            snapshotSource_->unpinSnapshot(revision);
+            snapshotSource_ = 0;
+        }
     }
 }
 
@@ -1331,12 +1364,25 @@ bool HBtreePrivate::del(HBtreeTransaction *transaction, const QByteArray &keyDat
     return ok;
 }
 
+/*!
+    Returns true while a snapshot is pinned at a commit older than the
+    current one. Collectible pages may still be reachable from that commit,
+    so new pages are appended to the file rather than reused.
+*/
+bool HBtreePrivate::pagesPinned() const
+{
+    if (!numPinned_.load())
+        return false;
+    QMutexLocker locker(&pinMutex_);
+    return !pinned_.isEmpty() && pinned_.firstKey() < marker_.meta.revision;
+}
+
 HBtreePrivate::Page *HBtreePrivate::newPage(HBtreePrivate::PageInfo::Type type)
 {
     int pageNumber = PageInfo::INVALID_PAGE;
 
     bool collected = false;
-    if (collectiblePages_.size()) {
+    if (collectiblePages_.size() && !pagesPinned()) {
         quint32 n = *collectiblePages_.constBegin();
         collectiblePages_.erase(collectiblePages_.begin());
         pageNumber = n;
@@ -3028,6 +3074,12 @@ bool HBtree::clearData()
 {
     Q_D(HBtree);
     d->close(false);
+    {
+        // the pinned commits go with the file, open snapshots keep reading it
+        QMutexLocker locker(&d->pinMutex_);
+        d->pinned_.clear();
+        d->numPinned_.store(0);
+    }
     if (QFile::exists(d->fileName_))
         QFile::remove(d->fileName_);
     return open();
@@ -3057,6 +3109,101 @@ HBtreeTransaction *HBtree::writeTransaction() const
     return d->writeTransaction_;
 }
 
+HBtreeTransaction *HBtree::readTransaction() const
+{
+    const Q_D(HBtree);
+    return d->readTransaction_;
+}
+
+/*!
+    Pins the last commit so that its pages are not reused by later commits
+    and returns its revision. Another thread can then read the commit through
+    openSnapshot() while this btree keeps writing. Call from the thread that
+    writes, outside a write transaction, and balance with unpinSnapshot().
+*/
+quint32 HBtree::pinSnapshot()
+{
+    Q_D(HBtree);
+    HBTREE_ASSERT(isOpen() && !d->writeTransaction_);
+
+    QMutexLocker locker(&d->pinMutex_);
+    HBtreePrivate::PinnedCommit &commit = d->pinned_[d->marker_.meta.revision];
+    commit.meta = d->marker_.meta;
+    commit.size = d->size_;
+    commit.fileName = d->fileName_;
+    commit.spec = d->spec_;
+    commit.compareFunction = d->compareFunction_;
+    commit.cacheSize = d->cacheSize_;
+    commit.numEntries = stats_.numEntries;
+    commit.refs++;
+    d->numPinned_.store(d->pinned_.size());
+    return d->marker_.meta.revision;
+}
+
+/*!
+    Releases a pin taken by pinSnapshot(). Safe to call from any thread.
+*/
+void HBtree::unpinSnapshot(quint32 revision)
+{
+    Q_D(HBtree);
+    QMutexLocker locker(&d->pinMutex_);
+    QMap<quint32, HBtreePrivate::PinnedCommit>::iterator it = d->pinned_.find(revision);
+    if (it == d->pinned_.end())
+        return;
+    if (--it->refs == 0) {
+        d->pinned_.erase(it);
+        d->numPinned_.store(d->pinned_.size());
+    }
+}
+
+/*!
+    Opens this btree as a read-only view of the commit of \a source pinned at
+    \a revision, with a file descriptor and page cache of its own. The view
+    holds its own pin until it is closed. \a source may be closed and reopened
+    meanwhile, but must not be deleted.
+*/
+bool HBtree::openSnapshot(HBtree *source, quint32 revision)
+{
+    Q_D(HBtree);
+    HBTREE_ASSERT(!isOpen());
+
+    HBtreePrivate *s = source->d_func();
+    HBtreePrivate::PinnedCommit commit;
+    // only the pins are shared with the source's thread
+    {
+        QMutexLocker locker(&s->pinMutex_);
+        QMap<quint32, HBtreePrivate::PinnedCommit>::iterator it = s->pinned_.find(revision);
+        if (it == s->pinned_.end()) {
+            d->lastErrorMessage_ = QString(QLatin1String("no snapshot pinned at revision %1")).arg(revision);
+            return false;
+        }
+        it->refs++;
+        commit = *it;
+    }
+
+    int oflags = O_RDONLY;
+#ifdef Q_OS_WIN32
+    oflags |= _O_BINARY;
+#endif
+    int fd = ::open(commit.fileName.toLatin1(), oflags);
+    if (fd == -1) {
+        d->lastErrorMessage_ = QString(QLatin1String("failed to open file. Error = %1. Filename = %2"))
+                                       .arg(QLatin1String(strerror(errno))).arg(commit.fileName);
+        source->unpinSnapshot(revision);
+        return false;
+    }
+
+    d->fileName_ = commit.fileName;
+    d->openMode_ = ReadOnly;
+    d->compareFunction_ = commit.compareFunction;
+    d->cacheSize_ = commit.cacheSize;
+    d->snapshotSource_ = source;
+    d->openSnapshot(fd, commit);
+    stats_ = Stat();
+    stats_.numEntries = commit.numEntries;
+    return true;
+}
+
 QString HBtree::errorMessage() const
 {
     const Q_D(HBtree);
@@ -160,6 +160,11 @@ public:
     quint32 tag() const;
     bool isWriting() const;
     HBtreeTransaction *writeTransaction() const;
+    HBtreeTransaction *readTransaction() const;
+
+    quint32 pinSnapshot();
+    void unpinSnapshot(quint32 revision);
+    bool openSnapshot(HBtree *source, quint32 revision);
 
     QString errorMessage() const;
 
@@ -50,6 +50,8 @@
 
 #include <QDebug>
 #include <QMap>
+#include <QMutex>
+#include <QAtomicInt>
 #include <QList>
 #include <QSharedPointer>
 #include <QStack>
@@ -232,6 +234,22 @@ public:
         quint32 overflowPage;
     };
 
+    // A commit that snapshots may still read, see HBtree::pinSnapshot()
+    struct PinnedCommit {
+        PinnedCommit()
+            : size(0), compareFunction(0), cacheSize(0), numEntries(0), refs(0)
+        {}
+        MarkerPage::Meta meta;
+        quint32 size;
+        // what a snapshot needs of the source, which may be closed and reopened meanwhile
+        QString fileName;
+        Spec spec;
+        HBtree::CompareFunction compareFunction;
+        quint32 cacheSize;
+        int numEntries;
+        int refs;
+    };
+
     struct NodePage : Page {
         NodePage()
             : Page(PageInfo::Type(0)), parent(0),
@@ -285,6 +303,7 @@ public:
     ~HBtreePrivate();
 
     bool open(int fd);
+    void openSnapshot(int fd, const PinnedCommit &commit);
     void close(bool doSync = true);
     bool readSpec(const QByteArray &binaryData);
     bool writeSpec();
@@ -328,6 +347,7 @@ public:
     bool rollback();
 
     Page *newPage(PageInfo::Type type);
+    bool pagesPinned() const;
     Page *getPage(quint32 pageNumber);
     void deletePage(Page *page) const;
     void destructPage(Page *page) const;
@@ -410,6 +430,10 @@ public:
     QList<Page *> lru_;
     bool cursorDisrupted_;
     mutable QByteArray pageBuffer_;
+    mutable QMutex pinMutex_;
+    QMap<quint32, PinnedCommit> pinned_; // revision -> commit
+    QAtomicInt numPinned_;
+    HBtree *snapshotSource_;
     bool verifyIntegrity(const Page *pPage) const;
 #ifdef QT_TESTLIB_LIB
     int forceCommitFail_;
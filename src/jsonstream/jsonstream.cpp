@@ -105,6 +105,14 @@ bool JsonStream::send(const QJsonObject &object)
     return true;
 }
 
+/** Returns the number of bytes queued in the stream and the device
+    that have not been written yet.
+*/
+qint64 JsonStream::bytesToWrite() const
+{
+    return mWriteBuffer.size() + (mDevice ? mDevice->bytesToWrite() : 0);
+}
+
 void JsonStream::deviceReadyRead()
 {
     struct JsonHeader
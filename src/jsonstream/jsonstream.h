@@ -72,6 +72,7 @@ public:
     void setDevice(QIODevice *device, bool queued = false);
 
     bool send(const QJsonObject &document);
+    qint64 bytesToWrite() const;
 
 Q_SIGNALS:
     void receive(const QJsonObject &data);
@@ -41,6 +41,7 @@
 
 #include <QDebug>
 #include <QFile>
+#include <QThreadStorage>
 #include <errno.h>
 
 #include "jsondbbtree.h"
@@ -50,6 +51,22 @@ QT_BEGIN_NAMESPACE_JSONDB_PARTITION
 
 QT_USE_NAMESPACE_HBTREE
 
+namespace {
+
+struct SnapshotReadState
+{
+    SnapshotReadState() : valid(true) {}
+    QHash<const JsonDbBtree *, quint32> revisions;
+    QHash<const JsonDbBtree *, HBtree *> btrees;
+    bool valid;
+};
+
+}
+
+static QThreadStorage<SnapshotReadState *> sSnapshotReads;
+// number of SnapshotRead scopes in any thread, so that btrees skip the thread local lookup when there are none
+static QAtomicInt sSnapshotReaders;
+
 JsonDbBtree::JsonDbBtree()
     : mBtree(new Btree())
 {
@@ -92,10 +109,29 @@ bool JsonDbBtree::isOpen() const
     return mBtree->isOpen();
 }
 
+JsonDbBtree::Transaction *JsonDbBtree::beginWrite()
+{
+    Btree *btree = current();
+    return btree == mBtree ? btree->beginWrite() : btree->beginRead();
+}
+
+bool JsonDbBtree::isWriting() const
+{
+    Btree *btree = current();
+    return btree == mBtree ? btree->isWriting() : btree->readTransaction() != 0;
+}
+
+JsonDbBtree::Transaction *JsonDbBtree::writeTransaction()
+{
+    // in a snapshot read, the open read transaction takes the place of the write transaction
+    Btree *btree = current();
+    return btree == mBtree ? btree->writeTransaction() : btree->readTransaction();
+}
+
 bool JsonDbBtree::putOne(const QByteArray &key, const QByteArray &value)
 {
-    bool inTransaction = mBtree->isWriting();
-    Transaction *txn = inTransaction ? mBtree->writeTransaction() : mBtree->beginWrite();
+    bool inTransaction = isWriting();
+    Transaction *txn = inTransaction ? writeTransaction() : beginWrite();
     bool ok = txn->put(key, value);
     if (!inTransaction) {
         qWarning() << "JsonDbBtree::putOne" << "auto commiting tag 0";
@@ -106,8 +142,8 @@ bool JsonDbBtree::putOne(const QByteArray &key, const QByteArray &value)
 
 bool JsonDbBtree::getOne(const QByteArray &key, QByteArray *value)
 {
-    bool inTransaction = mBtree->isWriting();
-    Transaction *txn = inTransaction ? mBtree->writeTransaction() : mBtree->beginWrite();
+    bool inTransaction = isWriting();
+    Transaction *txn = inTransaction ? writeTransaction() : beginWrite();
     bool ok = txn->get(key, value);
     if (!inTransaction)
         txn->abort();
@@ -116,8 +152,8 @@ bool JsonDbBtree::getOne(const QByteArray &key, QByteArray *value)
 
 bool JsonDbBtree::removeOne(const QByteArray &key)
 {
-    bool inTransaction = mBtree->isWriting();
-    Transaction *txn = inTransaction ? mBtree->writeTransaction() : mBtree->beginWrite();
+    bool inTransaction = isWriting();
+    Transaction *txn = inTransaction ? writeTransaction() : beginWrite();
     bool ok = txn->remove(key);
     if (!inTransaction){
         qWarning() << "JsonDbBtree::removeOne" << "auto commiting tag 0";
@@ -150,6 +186,85 @@ void JsonDbBtree::setAutoCompactRate(int rate) const
     Q_UNUSED(rate);
 }
 
+/*!
+    Pins the last commit for readers on other threads, see SnapshotRead.
+    Returns the revision to pass to unpinSnapshot().
+*/
+quint32 JsonDbBtree::pinSnapshot()
+{
+    Q_ASSERT(mBtree && !mBtree->isWriting());
+    return mBtree->pinSnapshot();
+}
+
+void JsonDbBtree::unpinSnapshot(quint32 revision)
+{
+    Q_ASSERT(mBtree);
+    mBtree->unpinSnapshot(revision);
+}
+
+JsonDbBtree::Btree *JsonDbBtree::current() const
+{
+    Q_ASSERT(mBtree);
+    if (!sSnapshotReaders.load() || !sSnapshotReads.hasLocalData())
+        return mBtree;
+    SnapshotReadState *state = sSnapshotReads.localData();
+    if (!state)
+        return mBtree;
+
+    Btree *btree = state->btrees.value(this);
+    if (btree)
+        return btree;
+    btree = new Btree();
+    QHash<const JsonDbBtree *, quint32>::const_iterator it = state->revisions.constFind(this);
+    if (it == state->revisions.constEnd()) {
+        // the live btree belongs to the writer's thread, read nothing instead
+        state->valid = false;
+    } else if (!btree->openSnapshot(mBtree, it.value())) {
+        qWarning() << "JsonDbBtree: failed to open snapshot of" << fileName() << btree->errorMessage();
+        state->valid = false;
+    }
+    state->btrees.insert(this, btree);
+    return btree;
+}
+
+/*!
+    \class JsonDbBtree::SnapshotRead
+    Makes the btrees in \a revisions read the pinned revision on the calling
+    thread until the SnapshotRead goes out of scope. Each btree is opened
+    again read-only on first use. Any other btree reads as empty and
+    invalidates the scope.
+*/
+JsonDbBtree::SnapshotRead::SnapshotRead(const QHash<const JsonDbBtree *, quint32> &revisions)
+{
+    Q_ASSERT(!isSnapshotRead());
+    SnapshotReadState *state = new SnapshotReadState;
+    state->revisions = revisions;
+    sSnapshotReads.setLocalData(state);
+    sSnapshotReaders.ref();
+}
+
+JsonDbBtree::SnapshotRead::~SnapshotRead()
+{
+    SnapshotReadState *state = sSnapshotReads.localData();
+    qDeleteAll(state->btrees);
+    sSnapshotReaders.deref();
+    sSnapshotReads.setLocalData(0);
+}
+
+/*!
+    Returns false if a btree outside the snapshot was read or a snapshot
+    could not be opened, in which case the results must be discarded.
+*/
+bool JsonDbBtree::SnapshotRead::isValid() const
+{
+    return sSnapshotReads.localData()->valid;
+}
+
+bool JsonDbBtree::isSnapshotRead()
+{
+    return sSnapshotReaders.load() && sSnapshotReads.hasLocalData() && sSnapshotReads.localData();
+}
+
 JsonDbBtree::Stat JsonDbBtree::stats() const
 {
     if (mBtree)
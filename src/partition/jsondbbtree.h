@@ -50,6 +50,8 @@
 #include "hbtreecursor.h"
 #include "hbtreetransaction.h"
 
+#include <QHash>
+
 QT_BEGIN_HEADER
 
 QT_BEGIN_NAMESPACE_JSONDB_PARTITION
@@ -83,23 +85,20 @@ public:
     bool isOpen() const;
 
     Transaction *beginRead()
-    { Q_ASSERT(mBtree); return mBtree->beginRead(); }
-    Transaction *beginWrite()
-    { Q_ASSERT(mBtree); return mBtree->beginWrite(); }
+    { return current()->beginRead(); }
+    Transaction *beginWrite();
 
-    bool isWriting() const
-    { Q_ASSERT(mBtree); return mBtree->isWriting(); }
+    bool isWriting() const;
 
-    Transaction *writeTransaction()
-    { Q_ASSERT(mBtree); return mBtree->writeTransaction(); }
+    Transaction *writeTransaction();
 
     QString errorMessage() const
     { Q_ASSERT(mBtree); return mBtree->errorMessage(); }
 
     quint64 count() const
-    { Q_ASSERT(mBtree); return mBtree->count(); }
+    { return current()->count(); }
     quint32 tag() const
-    { Q_ASSERT(mBtree); return mBtree->tag(); }
+    { return current()->tag(); }
     void setCompareFunction(CompareFunction cmp)
     { Q_ASSERT(mBtree); mBtree->setCompareFunction(cmp); }
     void setCacheSize(int size)
@@ -124,7 +123,25 @@ public:
     bool rollback();
     void setAutoCompactRate(int rate) const;
 
+    quint32 pinSnapshot();
+    void unpinSnapshot(quint32 revision);
+
+    // Within a SnapshotRead the btrees it names read the pinned revision
+    // instead, from a view private to the calling thread
+    class SnapshotRead
+    {
+    public:
+        explicit SnapshotRead(const QHash<const JsonDbBtree *, quint32> &revisions);
+        ~SnapshotRead();
+        bool isValid() const;
+    private:
+        Q_DISABLE_COPY(SnapshotRead)
+    };
+    static bool isSnapshotRead();
+
 private:
+    Btree *current() const;
+
     Btree *mBtree;
     JsonDbBtree(const JsonDbBtree&);
 };
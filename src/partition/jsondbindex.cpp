@@ -46,6 +46,10 @@
 #include <QFileInfo>
 #include <QDir>
 #include <QLocale>
+#include <QSet>
+#include <QVector>
+#include <QtAlgorithms>
+#include <QJsonDocument>
 
 #include "jsondbindex.h"
 #include "jsondbindex_p.h"
@@ -66,6 +70,8 @@ JsonDbIndexPrivate::JsonDbIndexPrivate(JsonDbIndex *q)
     : q_ptr(q)
     , mObjectTable(0)
     , mCacheSize(0)
+    , mOffsetCacheTag(0)
+    , mUpdateFailed(false)
 {
 }
 
@@ -75,6 +81,10 @@ JsonDbIndexPrivate::~JsonDbIndexPrivate()
 
 QString JsonDbIndexPrivate::fileName() const
 {
+    // collated indexes used to hold hex encoded sort keys under the plain
+    // name, the new name has them rebuilt in the current format
+    if (mSpec.isCollated())
+        return QString::fromLatin1("%1/%2-%3-CollatedIndex.db").arg(mPath, mBaseName, mSpec.name);
     return QString::fromLatin1("%1/%2-%3-Index.db").arg(mPath, mBaseName, mSpec.name);
 }
 
@@ -170,6 +180,13 @@ void JsonDbIndexPrivate::addOffsetToCache (const QString &query, int &offset, QB
     }
 }
 
+void JsonDbIndexPrivate::clearOffsetCache()
+{
+    QMutexLocker locker(&mOffsetCacheMutex);
+    mOffsetCache.clear();
+    mOffsetCacheTag = 0;
+}
+
 static const int collationStringsCount = 13;
 static const char * const collationStrings[collationStringsCount] = {
     "default",
@@ -224,24 +241,24 @@ int _q_correctCasePreferenceString(const QString &s)
 }
 #endif //NO_COLLATION_SUPPORT
 
-QString _q_bytesToHexString(const QByteArray &ba)
+/*
+    Returns the collation sort key \a ba as a string holding one character
+    per byte. Index keys compare strings by UTF-16 code unit, so entries
+    are ordered as a memcmp() of their sort keys would order them, without
+    calling the collator, and take half the room of a hex encoding.
+*/
+QString _q_sortKeyToString(const QByteArray &ba)
 {
-    static const ushort digits[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+    const uchar *data = (const uchar *)ba.constData();
+    int len = ba.size();
+    // drop the terminating zero byte of ICU sort keys
+    if (len && !data[len - 1])
+        --len;
 
-    uint len = ba.size();
-    const char *data = ba.constData();
-    uint idx = 0;
-
-    QString result(len*2, Qt::Uninitialized);
+    QString result(len, Qt::Uninitialized);
     QChar *resultData = result.data();
-
-    for (uint i = 0; i < len; ++i, idx += 2) {
-        uint j = (data[i] >> 4) & 0xf;
-        resultData[idx] = QChar(digits[j]);
-        j = data[i] & 0xf;
-        resultData[idx+1] = QChar(digits[j]);
-    }
-
+    for (int i = 0; i < len; ++i)
+        resultData[i] = QChar(ushort(data[i]));
     return result;
 }
 
@@ -302,7 +319,13 @@ bool JsonDbIndex::open()
     if (d->mCacheSize)
         d->mBdb.setCacheSize(d->mCacheSize);
 
-    d->mBdb.setFileName(d->fileName());
+    // a collated index in the old format is dropped when its file in the
+    // new format is first created, and rebuilt from there
+    QString fileName = d->fileName();
+    if (d->mSpec.isCollated() && !QFile::exists(fileName))
+        QFile::remove(QString::fromLatin1("%1/%2-%3-Index.db").arg(d->mPath, d->mBaseName, d->mSpec.name));
+
+    d->mBdb.setFileName(fileName);
     if (!d->mBdb.open(JsonDbBtree::Default)) {
         qCritical() << "mBdb.open" << d->mBdb.errorMessage();
         return false;
@@ -342,6 +365,24 @@ bool JsonDbIndex::validateIndex(const JsonDbObject &newIndex, const JsonDbObject
         message = QStringLiteral("Index object must have one of propertyName or propertyFunction set");
     else if (containsPropertyFunction && !newIndex.contains(JsonDbString::kNameStr))
         message = QStringLiteral("Index object with propertyFunction must have name");
+    else if (newIndex.value(JsonDbString::kPropertyTypeStr).toString() == QLatin1String("text")
+             && newIndex.contains(JsonDbString::kCollationStr))
+        message = QStringLiteral("Index with propertyType text does not support collation");
+    else if (newIndex.contains(JsonDbString::kIncludeStr)) {
+        QJsonValue includeValue = newIndex.value(JsonDbString::kIncludeStr);
+        QJsonArray includes;
+        if (includeValue.isArray())
+            includes = includeValue.toArray();
+        else
+            includes.append(includeValue);
+        foreach (const QJsonValue &include, includes) {
+            if (!include.isString() || include.toString().isEmpty()
+                    || include.toString().contains(QLatin1Char('.')) || include.toString().contains(QLatin1String("->"))) {
+                message = QStringLiteral("Index include must be a top level property name or a list of them");
+                break;
+            }
+        }
+    }
 
     if (!newIndex.isEmpty() && !oldIndex.isEmpty() && oldIndex.type() == JsonDbString::kIndexTypeStr) {
         if (oldIndex.value(JsonDbString::kPropertyNameStr).toString() != newIndex.value(JsonDbString::kPropertyNameStr).toString())
@@ -360,6 +401,8 @@ bool JsonDbIndex::validateIndex(const JsonDbObject &newIndex, const JsonDbObject
             message = QString::fromLatin1("Changing old index propertyFunction from '%1' to '%2' not supported")
                              .arg(oldIndex.value(JsonDbString::kPropertyFunctionStr).toString())
                              .arg(newIndex.value(JsonDbString::kPropertyFunctionStr).toString());
+        else if (oldIndex.value(JsonDbString::kIncludeStr) != newIndex.value(JsonDbString::kIncludeStr))
+            message = QStringLiteral("Changing old index include not supported");
     }
 
     return message.isEmpty();
@@ -380,14 +423,20 @@ JsonDbBtree *JsonDbIndex::bdb()
     Q_D(JsonDbIndex);
     if (d->mSpec.propertyName == JsonDbString::kUuidStr)
         return 0;
+    // a reader on a partition snapshot leaves the live index to the partition thread
+    if (JsonDbBtree::isSnapshotRead())
+        return &d->mBdb;
     if (!d->mBdb.isOpen())
         open();
+    // whoever looks at the btree gets to see the updates of the transaction
+    if (!d->mPendingUpdates.isEmpty())
+        applyPendingUpdates();
     return &d->mBdb;
 }
 
 QJsonValue JsonDbIndexPrivate::indexValue(const QJsonValue &v)
 {
-    if (!v.isString())
+    if (!v.isString() || mSpec.isText())
         return v;
 
     QJsonValue result;
@@ -397,8 +446,8 @@ QJsonValue JsonDbIndexPrivate::indexValue(const QJsonValue &v)
         result = v;
 
 #ifndef NO_COLLATION_SUPPORT
-    if (!mSpec.collation.isEmpty() && !mSpec.locale.isEmpty())
-        result = _q_bytesToHexString(mCollator.sortKey(v.toString()));
+    if (mSpec.isCollated())
+        result = _q_sortKeyToString(mCollator.sortKey(v.toString()));
 #endif
 
     return result;
@@ -433,111 +482,312 @@ QList<QJsonValue> JsonDbIndex::indexValues(JsonDbObject &object)
         if (result.isError())
             qDebug() << "Error calling index propertyFunction" << d->mSpec.name << result.toString();
     }
+
+    if (d->mSpec.isText()) {
+        // a text index holds one entry per distinct word rather than one per value
+        QList<QJsonValue> values = d->mFieldValues;
+        QSet<QString> seen;
+        d->mFieldValues.clear();
+        foreach (const QJsonValue &value, values) {
+            foreach (const QString &token, JsonDbIndexPrivate::textTokens(value)) {
+                if (seen.contains(token))
+                    continue;
+                seen.insert(token);
+                d->mFieldValues.append(token);
+            }
+        }
+    }
     return d->mFieldValues;
 }
 
+/*!
+    Returns the property value of \a object that this index holds as
+    \a fieldValue, before collation. Collated indexes hold sort keys, which
+    are of no use to clients, so this is what queries report as _indexValue.
+*/
+QJsonValue JsonDbIndex::propertyValue(const JsonDbObject &object, const QJsonValue &fieldValue)
+{
+    Q_D(JsonDbIndex);
+    if (!d->mSpec.isCollated() || d->mSpec.hasPropertyFunction() || !fieldValue.isString())
+        return fieldValue;
+
+    int size = d->mPropertyNamePath.size();
+    if (d->mPropertyNamePath.at(size-1) != QLatin1Char('*'))
+        return object.valueByPath(d->mPropertyNamePath);
+
+    // a multikey index has an entry per element, find the one at hand
+    QJsonArray array = object.valueByPath(d->mPropertyNamePath.mid(0, size-1)).toArray();
+    for (int i = 0; i < array.size(); ++i) {
+        QJsonValue candidate = d->indexValue(array.at(i));
+        JsonDbIndexPrivate::truncateFieldValue(&candidate, d->mSpec.propertyType);
+        if (candidate == fieldValue)
+            return array.at(i);
+    }
+    return fieldValue;
+}
+
 void JsonDbIndexPrivate::_q_propertyValueEmitted(QJSValue value)
 {
     if (!value.isUndefined())
         mFieldValues.append(mScriptEngine->fromScriptValue<QJsonValue>(value));
 }
 
-bool JsonDbIndex::indexObject(JsonDbObject &object, quint32 objectStateNumber)
+/*!
+    Computes the forward keys \a object has in this index and the value
+    stored with each of them. Returns false if the object has no entries.
+*/
+bool JsonDbIndex::forwardEntries(JsonDbObject &object, QList<QByteArray> *forwardKeys, QByteArray *forwardValue)
 {
     Q_D(JsonDbIndex);
     if (d->mSpec.propertyName == JsonDbString::kUuidStr)
-        return true;
+        return false;
 
     if (!d->mSpec.objectTypes.isEmpty() && !d->mSpec.objectTypes.contains(object.value(JsonDbString::kTypeStr).toString()))
-        return true;
+        return false;
 
-    Q_ASSERT(!object.contains(JsonDbString::kDeletedStr)
-             && !object.value(JsonDbString::kDeletedStr).toBool());
     QList<QJsonValue> fieldValues = indexValues(object);
     if (!fieldValues.size())
-        return true;
+        return false;
 
     QUuid objectKey = object.uuid();
 
-    if (!d->mBdb.isOpen())
-        open();
-    if (!d->mBdb.isWriting())
-        d->mObjectTable->begin(this);
-    JsonDbBtree::Transaction *txn = d->mBdb.writeTransaction();
+    if (forwardValue) {
+        // included properties let queries be answered without reading the object
+        QJsonObject included;
+        if (!d->mSpec.includes.isEmpty()) {
+            included.insert(JsonDbString::kTypeStr, object.value(JsonDbString::kTypeStr));
+            foreach (const QString &include, d->mSpec.includes) {
+                if (object.contains(include))
+                    included.insert(include, object.value(include));
+            }
+        }
+        *forwardValue = JsonDbIndexPrivate::makeForwardValue(objectKey, included);
+    }
+
     for (int i = 0; i < fieldValues.size(); i++) {
         QJsonValue fieldValue = fieldValues.at(i);
         fieldValue = d->makeFieldValue(fieldValue, d->mSpec.propertyType);
         if (fieldValue.isUndefined())
             continue;
         d->truncateFieldValue(&fieldValue, d->mSpec.propertyType);
-        QByteArray forwardKey = JsonDbIndexPrivate::makeForwardKey(fieldValue, objectKey);
-        QByteArray forwardValue = JsonDbIndexPrivate::makeForwardValue(objectKey);
+        if (jsondbSettings->debugIndexes())
+            qDebug() << "forward key" << objectKey.toString() << d->mSpec.propertyName << fieldValue;
+        forwardKeys->append(JsonDbIndexPrivate::makeForwardKey(fieldValue, objectKey));
+    }
+    return !forwardKeys->isEmpty();
+}
 
+bool JsonDbIndex::indexObject(JsonDbObject &object, quint32 objectStateNumber)
+{
+    Q_D(JsonDbIndex);
+    Q_ASSERT(!object.contains(JsonDbString::kDeletedStr)
+             && !object.value(JsonDbString::kDeletedStr).toBool());
+    QList<QByteArray> forwardKeys;
+    QByteArray forwardValue;
+    if (!forwardEntries(object, &forwardKeys, &forwardValue))
+        return true;
+
+    if (!d->mBdb.isOpen())
+        open();
+    if (!d->mBdb.isWriting())
+        d->mObjectTable->begin(this);
+    JsonDbBtree::Transaction *txn = d->mBdb.writeTransaction();
+    for (int i = 0; i < forwardKeys.size(); i++) {
         if (jsondbSettings->debugIndexes())
-            qDebug() << "indexing" << objectKey.toString() << d->mSpec.propertyName << fieldValue
-                     << "forwardIndex" << "key" << forwardKey.toHex()
+            qDebug() << "indexing" << d->mSpec.propertyName
+                     << "forwardIndex" << "key" << forwardKeys.at(i).toHex()
                      << "forwardIndex" << "value" << forwardValue.toHex()
                      << object;
-        if (!txn->put(forwardKey, forwardValue)) {
+        if (!txn->put(forwardKeys.at(i), forwardValue)) {
             qCritical() << d->mSpec.name << "indexing failed" << d->mBdb.errorMessage();
             return false;
         }
     }
     if (jsondbSettings->debug() && (objectStateNumber < stateNumber()))
         qDebug() << "JsonDbIndex::indexObject" << "stale update" << objectStateNumber << stateNumber() << d->mBdb.fileName();
-    d->mOffsetCache.clear();
+    d->clearOffsetCache();
     return true;
 }
 
 bool JsonDbIndex::deindexObject(JsonDbObject &object, quint32 objectStateNumber)
 {
     Q_D(JsonDbIndex);
-
-    if (d->mSpec.propertyName == JsonDbString::kUuidStr)
-        return true;
-
-    if (!d->mSpec.objectTypes.isEmpty() && !d->mSpec.objectTypes.contains(object.value(JsonDbString::kTypeStr).toString()))
-        return true;
-
-    QList<QJsonValue> fieldValues = indexValues(object);
-    if (!fieldValues.size())
+    QList<QByteArray> forwardKeys;
+    if (!forwardEntries(object, &forwardKeys, 0))
         return true;
 
-    QUuid objectKey = object.uuid();
-
     if (!d->mBdb.isOpen())
         open();
     if (!d->mBdb.isWriting())
         d->mObjectTable->begin(this);
     JsonDbBtree::Transaction *txn = d->mBdb.writeTransaction();
-    for (int i = 0; i < fieldValues.size(); i++) {
-        QJsonValue fieldValue = fieldValues.at(i);
-        fieldValue = d->makeFieldValue(fieldValue, d->mSpec.propertyType);
-        if (fieldValue.isUndefined())
-            continue;
-        d->truncateFieldValue(&fieldValue, d->mSpec.propertyType);
+    for (int i = 0; i < forwardKeys.size(); i++) {
         if (jsondbSettings->debugIndexes())
-            qDebug() << "deindexing" << objectKey.toString() << d->mSpec.propertyName << fieldValue;
-        QByteArray forwardKey = JsonDbIndexPrivate::makeForwardKey(fieldValue, objectKey);
-        if (!txn->remove(forwardKey)) {
+            qDebug() << "deindexing" << d->mSpec.propertyName << forwardKeys.at(i).toHex();
+        if (!txn->remove(forwardKeys.at(i))) {
             qCritical() << d->mSpec.name << "deindexing failed" << d->mBdb.errorMessage();
             return false;
         }
     }
     if (jsondbSettings->verbose() && (objectStateNumber < stateNumber()))
         qDebug() << "JsonDbIndex::deindexObject" << "stale update" << objectStateNumber << stateNumber() << d->mBdb.fileName();
-    d->mOffsetCache.clear();
+    d->clearOffsetCache();
     return true;
 }
 
+/*!
+    Queues indexing \a object until applyPendingUpdates() is called, which
+    happens at the latest when the transaction commits or when the index is
+    read through bdb().
+*/
+void JsonDbIndex::deferIndexObject(const JsonDbObject &object, quint32 stateNumber)
+{
+    Q_D(JsonDbIndex);
+    JsonDbIndexPrivate::PendingUpdate update;
+    update.object = object;
+    update.stateNumber = stateNumber;
+    update.remove = false;
+    d->mPendingUpdates.append(update);
+}
+
+/*!
+    Queues removing the entries of \a object, see deferIndexObject().
+*/
+void JsonDbIndex::deferDeindexObject(const JsonDbObject &object, quint32 stateNumber)
+{
+    Q_D(JsonDbIndex);
+    JsonDbIndexPrivate::PendingUpdate update;
+    update.object = object;
+    update.stateNumber = stateNumber;
+    update.remove = true;
+    d->mPendingUpdates.append(update);
+}
+
+bool JsonDbIndex::hasPendingUpdates() const
+{
+    Q_D(const JsonDbIndex);
+    return !d->mPendingUpdates.isEmpty();
+}
+
+int JsonDbIndex::pendingUpdateCount() const
+{
+    Q_D(const JsonDbIndex);
+    return d->mPendingUpdates.size();
+}
+
+/*!
+    Returns true if applying the updates queued in the current transaction
+    failed, whether at commit or when the index was read. The transaction
+    then has to be aborted.
+*/
+bool JsonDbIndex::hasFailedUpdates() const
+{
+    Q_D(const JsonDbIndex);
+    return d->mUpdateFailed;
+}
+
+static bool keyMutationLessThan(const JsonDbIndexPrivate::KeyMutation &a, const JsonDbIndexPrivate::KeyMutation &b)
+{
+    return JsonDbIndexPrivate::indexCompareFunction(a.key, b.key) < 0;
+}
+
+/*!
+    Applies the queued updates as one pass over the btree. The updates are
+    turned into key puts and removes, which are sorted by forward key so
+    that consecutive keys landing on the same leaf share one copy of the
+    page. The sort is stable, so updates of the same key keep their order,
+    and a run of them that ends with a put is written as that put alone.
+
+    The index has to be open and in a write transaction already when this
+    is called from another thread, since that is done through the object
+    table.
+*/
+bool JsonDbIndex::applyPendingUpdates()
+{
+    Q_D(JsonDbIndex);
+    QList<JsonDbIndexPrivate::PendingUpdate> updates;
+    updates.swap(d->mPendingUpdates);
+
+    QVector<JsonDbIndexPrivate::KeyMutation> mutations;
+    for (int i = 0; i < updates.size(); i++) {
+        JsonDbObject object = updates.at(i).object;
+        JsonDbIndexPrivate::KeyMutation mutation;
+        mutation.remove = updates.at(i).remove;
+        QList<QByteArray> forwardKeys;
+        if (!forwardEntries(object, &forwardKeys, mutation.remove ? 0 : &mutation.value))
+            continue;
+        foreach (const QByteArray &forwardKey, forwardKeys) {
+            mutation.key = forwardKey;
+            mutations.append(mutation);
+        }
+    }
+    if (mutations.isEmpty())
+        return true;
+    qStableSort(mutations.begin(), mutations.end(), keyMutationLessThan);
+
+    if (!d->mBdb.isOpen())
+        open();
+    if (!d->mBdb.isWriting())
+        d->mObjectTable->begin(this);
+    JsonDbBtree::Transaction *txn = d->mBdb.writeTransaction();
+    int count = mutations.size();
+    for (int i = 0; i < count; i++) {
+        // find the run of mutations of this key
+        int end = i + 1;
+        while (end < count && JsonDbIndexPrivate::indexCompareFunction(mutations.at(i).key, mutations.at(end).key) == 0)
+            end++;
+        // a put replaces whatever the earlier mutations left behind
+        if (!mutations.at(end - 1).remove)
+            i = end - 1;
+        for (; i < end; i++) {
+            const JsonDbIndexPrivate::KeyMutation &mutation = mutations.at(i);
+            bool ok = mutation.remove ? txn->remove(mutation.key) : txn->put(mutation.key, mutation.value);
+            if (!ok) {
+                qCritical() << d->mSpec.name << (mutation.remove ? "deindexing failed" : "indexing failed") << d->mBdb.errorMessage();
+                d->clearOffsetCache();
+                d->mUpdateFailed = true;
+                return false;
+            }
+        }
+        i = end - 1;
+    }
+    if (jsondbSettings->debugIndexes())
+        qDebug() << "JsonDbIndex::applyPendingUpdates" << d->mSpec.name << updates.size() << "updates" << count << "keys";
+    d->clearOffsetCache();
+    return true;
+}
+
+void JsonDbIndex::discardPendingUpdates()
+{
+    Q_D(JsonDbIndex);
+    d->mPendingUpdates.clear();
+    d->mUpdateFailed = false;
+}
+
 QByteArray JsonDbIndex::lowerBoundKey (const QString &query, int &offset) const
 {
-    return d_func()->lowerBoundKey (query, offset);
+    Q_D(const JsonDbIndex);
+    QMutexLocker locker(&d->mOffsetCacheMutex);
+    if (d->mOffsetCacheTag != d->mBdb.tag())
+        return QByteArray();
+    return d->lowerBoundKey (query, offset);
 }
 
 void JsonDbIndex::addOffsetToCache (const QString &query, int &offset, QByteArray &key)
 {
     Q_D(JsonDbIndex);
+    // offsets taken inside a write transaction may count uncommitted keys
+    if (d->mBdb.isWriting())
+        return;
+    quint32 tag = d->mBdb.tag();
+    QMutexLocker locker(&d->mOffsetCacheMutex);
+    if (tag != d->mOffsetCacheTag) {
+        // a reader on an older snapshot leaves the newer offsets alone
+        if (tag < d->mOffsetCacheTag)
+            return;
+        d->mOffsetCache.clear();
+        d->mOffsetCacheTag = tag;
+    }
     d->addOffsetToCache (query, offset, key);
 }
 
@@ -558,9 +808,16 @@ JsonDbBtree::Transaction *JsonDbIndex::begin()
         open();
     return d->mBdb.beginWrite();
 }
+bool JsonDbIndex::isWriting() const
+{
+    Q_D(const JsonDbIndex);
+    return d->mBdb.isOpen() && d->mBdb.isWriting();
+}
 bool JsonDbIndex::commit(quint32 stateNumber)
 {
     Q_D(JsonDbIndex);
+    if (d->mUpdateFailed)
+        return false;
     if (d->mBdb.isWriting())
         return d->mBdb.writeTransaction()->commit(stateNumber);
     return false;
@@ -576,6 +833,7 @@ bool JsonDbIndex::clearData()
 {
     Q_D(JsonDbIndex);
     d->mBdb.setFileName(d->fileName());
+    d->clearOffsetCache();
     return d->mBdb.clearData();
 }
 
@@ -608,6 +866,13 @@ JsonDbIndexSpec JsonDbIndexSpec::fromIndexObject(const QJsonObject &indexObject)
         foreach (const QJsonValue &objectType, objectTypeValue.toArray())
             indexSpec.objectTypes.append(objectType.toString());
     }
+    QJsonValue includeValue = indexObject.value(JsonDbString::kIncludeStr);
+    if (includeValue.isString()) {
+        indexSpec.includes.append(includeValue.toString());
+    } else if (includeValue.isArray()) {
+        foreach (const QJsonValue &include, includeValue.toArray())
+            indexSpec.includes.append(include.toString());
+    }
     indexSpec.caseSensitivity = Qt::CaseSensitive;
     if (indexObject.contains(JsonDbString::kCaseSensitiveStr))
         indexSpec.caseSensitivity = indexObject.value(JsonDbString::kCaseSensitiveStr).toBool() ? Qt::CaseSensitive : Qt::CaseInsensitive;
@@ -791,7 +1056,8 @@ static void deserializeFieldValue(QJsonValue::Type vt, QJsonValue &fieldValue, c
 void JsonDbIndexPrivate::truncateFieldValue(QJsonValue *value, const QString &type)
 {
     Q_ASSERT(value);
-    if ((type.isEmpty() || type == QLatin1String("string")) && value->type() == QJsonValue::String) {
+    if ((type.isEmpty() || type == QLatin1String("string") || type == QLatin1String("text"))
+            && value->type() == QJsonValue::String) {
         QString str = value->toString();
         int maxSize = JsonDbSettings::instance()->indexFieldValueSize() / 2;
         if (str.size() > maxSize)
@@ -842,12 +1108,85 @@ QJsonValue JsonDbIndexPrivate::makeFieldValue(const QJsonValue &value, const QSt
         case QJsonValue::Object: break;
         case QJsonValue::Undefined: break;
         }
+    } else if (type == QLatin1String("text")) {
+        // text index entries are words produced by textTokens()
+        if (value.isString())
+            return value;
     } else {
         qWarning() << "qtjsondb: makeFieldValue: unsupported index type" << type;
     }
     return QJsonValue(QJsonValue::Undefined);
 }
 
+/*!
+    Splits \a text into the words stored in a text index: the text is decomposed
+    and case folded, combining marks are dropped and the remaining letters and
+    digits are split at every other character. Each word is returned once.
+*/
+QStringList JsonDbIndexPrivate::textTokens(const QString &text)
+{
+    QString folded = text.normalized(QString::NormalizationForm_KD).toCaseFolded();
+    QStringList tokens;
+    QSet<QString> seen;
+    QString token;
+    for (int i = 0; i <= folded.size(); ++i) {
+        QChar c = i < folded.size() ? folded.at(i) : QChar();
+        if (c.isMark())
+            continue;
+        if (c.isLetterOrNumber()) {
+            token.append(c);
+            continue;
+        }
+        if (!token.isEmpty() && !seen.contains(token)) {
+            seen.insert(token);
+            tokens.append(token);
+        }
+        token.clear();
+    }
+    return tokens;
+}
+
+/*!
+    Returns the words of \a value, which may be a string or an array of strings.
+*/
+QStringList JsonDbIndexPrivate::textTokens(const QJsonValue &value)
+{
+    if (value.isString())
+        return textTokens(value.toString());
+    QStringList tokens;
+    if (value.isArray()) {
+        QJsonArray array = value.toArray();
+        for (int i = 0; i < array.size(); ++i) {
+            if (array.at(i).isString())
+                tokens.append(textTokens(array.at(i).toString()));
+        }
+    }
+    return tokens;
+}
+
+/*!
+    Returns true if every word in \a queryTokens is a prefix of some word of
+    \a value. An empty list of query words matches nothing.
+*/
+bool JsonDbIndexPrivate::textMatches(const QJsonValue &value, const QStringList &queryTokens)
+{
+    if (queryTokens.isEmpty())
+        return false;
+    QStringList tokens = textTokens(value);
+    foreach (const QString &queryToken, queryTokens) {
+        bool found = false;
+        foreach (const QString &token, tokens) {
+            if (token.startsWith(queryToken)) {
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
 QByteArray JsonDbIndexPrivate::makeForwardKey(const QJsonValue &fieldValue, const ObjectKey &objectKey)
 {
     QJsonValue::Type vt = fieldValue.type();
@@ -882,11 +1221,13 @@ void JsonDbIndexPrivate::forwardKeySplit(const QByteArray &forwardKey, QJsonValu
     objectKey = qFromBigEndian<ObjectKey>((const uchar *)&data[4+fvSize]);
 }
 
-QByteArray JsonDbIndexPrivate::makeForwardValue(const ObjectKey &objectKey)
+QByteArray JsonDbIndexPrivate::makeForwardValue(const ObjectKey &objectKey, const QJsonObject &included)
 {
     QByteArray forwardValue(16, 0);
     char *data = forwardValue.data();
     qToBigEndian(objectKey,  (uchar *)&data[0]);
+    if (!included.isEmpty())
+        forwardValue.append(QJsonDocument(included).toBinaryData());
     return forwardValue;
 }
 
@@ -896,6 +1237,15 @@ void JsonDbIndexPrivate::forwardValueSplit(const QByteArray &forwardValue, Objec
     objectKey = qFromBigEndian<ObjectKey>(&data[0]);
 }
 
+void JsonDbIndexPrivate::forwardValueSplit(const QByteArray &forwardValue, ObjectKey &objectKey, QJsonObject *included)
+{
+    forwardValueSplit(forwardValue, objectKey);
+    if (forwardValue.size() > 16)
+        *included = QJsonDocument::fromBinaryData(forwardValue.mid(16)).object();
+    else
+        *included = QJsonObject();
+}
+
 #include "moc_jsondbindex.cpp"
 
 QT_END_NAMESPACE_JSONDB_PARTITION
@@ -73,11 +73,18 @@ public:
     QString casePreference;
     Qt::CaseSensitivity caseSensitivity;
     QStringList objectTypes;
+    QStringList includes; // top level properties stored with each entry
 
     inline JsonDbIndexSpec()
         : caseSensitivity(Qt::CaseSensitive)
     { }
     inline bool hasPropertyFunction() const { return !propertyFunction.isEmpty(); }
+    // a "field.*" index holds one entry per element of the array in field
+    inline bool isMultiKey() const { return propertyName.endsWith(QLatin1String(".*")); }
+    // a "text" index holds one entry per word of the indexed strings
+    inline bool isText() const { return propertyType == QLatin1String("text"); }
+    // a collated index stores collation sort keys instead of the strings
+    inline bool isCollated() const { return !collation.isEmpty() && !locale.isEmpty(); }
     static JsonDbIndexSpec fromIndexObject(const QJsonObject &indexObject);
 };
 
@@ -99,10 +106,20 @@ public:
     bool indexObject(JsonDbObject &object, quint32 stateNumber);
     bool deindexObject(JsonDbObject &object, quint32 stateNumber);
     QList<QJsonValue> indexValues(JsonDbObject &object);
+    QJsonValue propertyValue(const JsonDbObject &object, const QJsonValue &fieldValue);
+
+    void deferIndexObject(const JsonDbObject &object, quint32 stateNumber);
+    void deferDeindexObject(const JsonDbObject &object, quint32 stateNumber);
+    bool hasPendingUpdates() const;
+    int pendingUpdateCount() const;
+    bool hasFailedUpdates() const;
+    bool applyPendingUpdates();
+    void discardPendingUpdates();
 
     quint32 stateNumber() const;
 
     JsonDbBtree::Transaction *begin();
+    bool isWriting() const;
     bool commit(quint32);
     bool abort();
     bool clearData();
@@ -121,6 +138,8 @@ public:
     void addOffsetToCache (const QString &query, int &offset, QByteArray &key);
 
 private:
+    bool forwardEntries(JsonDbObject &object, QList<QByteArray> *forwardKeys, QByteArray *forwardValue);
+
     Q_DECLARE_PRIVATE(JsonDbIndex)
     Q_DISABLE_COPY(JsonDbIndex)
     QScopedPointer<JsonDbIndexPrivate> d_ptr;
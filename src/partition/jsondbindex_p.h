@@ -47,6 +47,7 @@
 #include <QPointer>
 #include <QStringList>
 #include <QHash>
+#include <QMutex>
 
 #include <qjsonarray.h>
 #include <qjsonobject.h>
@@ -87,11 +88,32 @@ public:
     QList<QJsonValue> mFieldValues;
     quint32 mCacheSize;
 
+    // index updates deferred until commit or until the index is read
+    struct PendingUpdate {
+        JsonDbObject object;
+        quint32 stateNumber;
+        bool remove;
+    };
+    QList<PendingUpdate> mPendingUpdates;
+    // an update of the current transaction could not be written
+    bool mUpdateFailed;
+    // one put or remove of a forward key, see JsonDbIndex::applyPendingUpdates()
+    struct KeyMutation {
+        QByteArray key;
+        QByteArray value;
+        bool remove;
+    };
+
     // query --> {offset, key} cache to speed up offset queries
     typedef QMap<int, QByteArray> OffsetCacheMap; // offset -> key
     QHash<QString, OffsetCacheMap> mOffsetCache; // query -> offset map
+    // readers on partition snapshots share the cache, which only holds
+    // offsets into the commit tagged mOffsetCacheTag
+    mutable QMutex mOffsetCacheMutex;
+    quint32 mOffsetCacheTag;
     QByteArray lowerBoundKey (const QString &query, int &offset) const;
     void addOffsetToCache (const QString &query, int &offset, QByteArray &key);
+    void clearOffsetCache();
 
     QString fileName() const;
     bool initScriptEngine();
@@ -102,12 +124,16 @@ public:
 
     static int indexCompareFunction(const QByteArray &ab, const QByteArray &bb);
     static QByteArray makeForwardKey(const QJsonValue &fieldValue, const ObjectKey &objectKey);
-    static QByteArray makeForwardValue(const ObjectKey &objectKey);
+    static QByteArray makeForwardValue(const ObjectKey &objectKey, const QJsonObject &included = QJsonObject());
     static void truncateFieldValue(QJsonValue *value, const QString &type);
     static QJsonValue makeFieldValue(const QJsonValue &value, const QString &type);
+    static QStringList textTokens(const QString &text);
+    static QStringList textTokens(const QJsonValue &value);
+    static bool textMatches(const QJsonValue &value, const QStringList &queryTokens);
     static void forwardKeySplit(const QByteArray &forwardKey, QJsonValue &fieldValue);
     static void forwardKeySplit(const QByteArray &forwardKey, QJsonValue &fieldValue, ObjectKey &objectKey);
     static void forwardValueSplit(const QByteArray &forwardValue, ObjectKey &objectKey);
+    static void forwardValueSplit(const QByteArray &forwardValue, ObjectKey &objectKey, QJsonObject *included);
 };
 
 QT_END_NAMESPACE_JSONDB_PARTITION
@@ -0,0 +1,263 @@
+/****************************************************************************
+**
+** Copyright (C) 2012 Digia Plc and/or its subsidiary(-ies).
+** Contact: http://www.qt-project.org/legal
+**
+** This file is part of the QtAddOn.JsonDb module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include <QJsonDocument>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
+#include <QtAlgorithms>
+
+#include "jsondbindexbuilder.h"
+#include "jsondbindex.h"
+#include "jsondbobjecttable.h"
+#include "jsondbsettings.h"
+#include "jsondbstrings.h"
+#include "jsondbutils_p.h"
+
+QT_BEGIN_NAMESPACE_JSONDB_PARTITION
+
+// number of object table entries read per event loop iteration
+static const int kIndexBuildChunkSize = 1000;
+
+class JsonDbIndexBuildTask : public QRunnable
+{
+public:
+    JsonDbIndexBuildTask(JsonDbIndexBuilder *builder)
+        : mBuilder(builder)
+    { }
+    void run()
+    {
+        mBuilder->indexChunk();
+    }
+private:
+    JsonDbIndexBuilder *mBuilder;
+};
+
+JsonDbIndexBuilder::JsonDbIndexBuilder(JsonDbObjectTable *table, JsonDbIndex *index)
+    : QObject(table)
+    , mTable(table)
+    , mIndex(index)
+    , mAtEnd(false)
+    , mStartStateNumber(0)
+    , mProcessedCount(0)
+    , mTotalCount(0)
+    , mChunkStateNumber(0)
+    , mCancelled(0)
+    , mIdle(1)
+{
+}
+
+JsonDbIndexBuilder::~JsonDbIndexBuilder()
+{
+    cancel();
+    // wait for the chunk being indexed, if any
+    mIdle.acquire();
+    mIdle.release();
+    if (mIndex->isWriting())
+        mIndex->abort();
+}
+
+/*!
+    Clears the index and starts filling it from the object table as of its
+    current state number. The index stays in a write transaction of its own
+    until the build finishes.
+*/
+void JsonDbIndexBuilder::start()
+{
+    mStartStateNumber = mTable->stateNumber();
+    mTotalCount = mTable->bdb()->count();
+    if (!mIndex->isOpen())
+        mIndex->open();
+    mIndex->clearData();
+    mIndex->begin();
+
+    if (jsondbSettings->verbose())
+        qDebug() << JSONDB_INFO << "building index" << mIndex->indexSpec().name << "in the background from stateNumber" << mStartStateNumber;
+    emit progress(mIndex->indexSpec().name, 0, mTotalCount);
+    QTimer::singleShot(0, this, SLOT(readChunk()));
+}
+
+void JsonDbIndexBuilder::cancel()
+{
+    mCancelled.fetchAndStoreOrdered(1);
+}
+
+void JsonDbIndexBuilder::readChunk()
+{
+    if (mCancelled.load())
+        return;
+    // the object table is only read between its transactions
+    if (mTable->bdb()->isWriting()) {
+        QTimer::singleShot(0, this, SLOT(readChunk()));
+        return;
+    }
+
+    JsonDbBtree::Transaction *txn = mTable->bdb()->beginRead();
+    JsonDbBtree::Cursor cursor(txn);
+    bool ok = mLastKey.isEmpty() ? cursor.first() : cursor.seekRange(mLastKey);
+    QByteArray baKey, baObject;
+    if (ok && !mLastKey.isEmpty() && cursor.current(&baKey, 0) && baKey == mLastKey)
+        ok = cursor.next();
+
+    mChunk.clear();
+    QVector<ObjectKey> &scannedKeys = mScannedKeys[mTable->stateNumber()];
+    int count = 0;
+    for (; ok && count < kIndexBuildChunkSize; ok = cursor.next(), count++) {
+        if (!cursor.current(&baKey, &baObject))
+            continue;
+        mLastKey = baKey;
+        if (baKey.size() != 16) // state key is 5 bytes, or history key is 5 + 16 bytes
+            continue;
+        JsonDbObject object = QJsonDocument::fromBinaryData(baObject).object();
+        if (object.isDeleted())
+            continue;
+        scannedKeys.append(ObjectKey(baKey));
+        mChunk.append(object);
+    }
+    txn->abort();
+
+    mAtEnd = !ok;
+    mChunkStateNumber = mTable->stateNumber();
+    // only objects count, not the state log and deleted objects read with them
+    mProcessedCount += mChunk.size();
+    if (mChunk.isEmpty()) {
+        chunkIndexed();
+        return;
+    }
+    mIdle.acquire();
+    QThreadPool::globalInstance()->start(new JsonDbIndexBuildTask(this));
+}
+
+void JsonDbIndexBuilder::indexChunk()
+{
+    for (int i = 0; i < mChunk.size() && !mCancelled.load(); i++)
+        mIndex->indexObject(mChunk[i], mChunkStateNumber);
+    QMetaObject::invokeMethod(this, "chunkIndexed", Qt::QueuedConnection);
+    mIdle.release();
+}
+
+void JsonDbIndexBuilder::chunkIndexed()
+{
+    if (mCancelled.load())
+        return;
+    mChunk.clear();
+    // the total is the number of table entries, an upper bound of the number of objects
+    emit progress(mIndex->indexSpec().name, mProcessedCount, mAtEnd ? mProcessedCount : qMax(mProcessedCount, mTotalCount));
+    if (mAtEnd)
+        finish();
+    else
+        QTimer::singleShot(0, this, SLOT(readChunk()));
+}
+
+void JsonDbIndexBuilder::finish()
+{
+    if (mCancelled.load())
+        return;
+    if (mTable->bdb()->isWriting()) {
+        QTimer::singleShot(0, this, SLOT(finish()));
+        return;
+    }
+
+    QString indexName = mIndex->indexSpec().name;
+    bool ok = catchUp() && mIndex->commit(mTable->stateNumber());
+    if (!ok) {
+        qCritical() << JSONDB_ERROR << "background build of index" << indexName << "failed";
+        mIndex->abort();
+    } else if (jsondbSettings->verbose()) {
+        qDebug() << JSONDB_INFO << "built index" << indexName << "at stateNumber" << mTable->stateNumber();
+    }
+    emit finished(indexName, ok);
+}
+
+/*!
+    Brings the index up to the current state of the object table. Each
+    object was indexed as it was when its chunk was read, so the changes
+    since that state are applied to it. Objects the scan did not see at all
+    were created after the scan passed their key, and are indexed as they
+    are now.
+*/
+bool JsonDbIndexBuilder::catchUp()
+{
+    quint32 stateNumber = mTable->stateNumber();
+    if (stateNumber == mStartStateNumber)
+        return true;
+
+    bool ok = true;
+    QMap<quint32, QVector<ObjectKey> >::iterator it;
+    for (it = mScannedKeys.begin(); it != mScannedKeys.end(); ++it)
+        qSort(it.value());
+
+    for (it = mScannedKeys.begin(); it != mScannedKeys.end(); ++it) {
+        if (it.key() == stateNumber)
+            continue;
+        const QVector<ObjectKey> &scannedKeys = it.value();
+        QMap<ObjectKey,JsonDbUpdate> changes;
+        mTable->changesSince(it.key(), &changes);
+        for (QMap<ObjectKey,JsonDbUpdate>::const_iterator change = changes.constBegin(); change != changes.constEnd(); ++change) {
+            if (qBinaryFind(scannedKeys, change.key()) == scannedKeys.constEnd())
+                continue;
+            JsonDbObject oldObject = change.value().oldObject;
+            JsonDbObject newObject = change.value().newObject;
+            if (!oldObject.isEmpty() && !oldObject.isDeleted())
+                ok &= mIndex->deindexObject(oldObject, stateNumber);
+            if (!newObject.isEmpty() && !newObject.isDeleted())
+                ok &= mIndex->indexObject(newObject, stateNumber);
+        }
+    }
+
+    QMap<ObjectKey,JsonDbUpdate> changes;
+    mTable->changesSince(mStartStateNumber, &changes);
+    for (QMap<ObjectKey,JsonDbUpdate>::const_iterator change = changes.constBegin(); change != changes.constEnd(); ++change) {
+        bool scanned = false;
+        for (it = mScannedKeys.begin(); it != mScannedKeys.end() && !scanned; ++it)
+            scanned = qBinaryFind(it.value(), change.key()) != it.value().constEnd();
+        if (scanned)
+            continue;
+        JsonDbObject newObject = change.value().newObject;
+        if (!newObject.isEmpty() && !newObject.isDeleted())
+            ok &= mIndex->indexObject(newObject, stateNumber);
+    }
+    return ok;
+}
+
+QT_END_NAMESPACE_JSONDB_PARTITION
+
+#include "moc_jsondbindexbuilder.cpp"
@@ -0,0 +1,122 @@
+/****************************************************************************
+**
+** Copyright (C) 2012 Digia Plc and/or its subsidiary(-ies).
+** Contact: http://www.qt-project.org/legal
+**
+** This file is part of the QtAddOn.JsonDb module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef JSONDB_INDEXBUILDER_H
+#define JSONDB_INDEXBUILDER_H
+
+#include <QAtomicInt>
+#include <QMap>
+#include <QObject>
+#include <QSemaphore>
+#include <QVector>
+
+#include "jsondbobject.h"
+#include "jsondbobjectkey.h"
+#include "jsondbpartitionglobal.h"
+
+QT_BEGIN_HEADER
+
+QT_BEGIN_NAMESPACE_JSONDB_PARTITION
+
+class JsonDbIndex;
+class JsonDbObjectTable;
+
+/*
+    Fills a new index without blocking the event loop. The objects are read
+    from the object table in chunks between events, and each chunk is
+    indexed on a thread pool thread while the next events are handled.
+    Writes made in the meantime are caught up from changesSince() before
+    the object table puts the index in use.
+*/
+class Q_JSONDB_PARTITION_EXPORT JsonDbIndexBuilder : public QObject
+{
+    Q_OBJECT
+public:
+    JsonDbIndexBuilder(JsonDbObjectTable *table, JsonDbIndex *index);
+    ~JsonDbIndexBuilder();
+
+    JsonDbIndex *index() const { return mIndex; }
+    quint64 processedCount() const { return mProcessedCount; }
+    quint64 totalCount() const { return mTotalCount; }
+
+    void start();
+    void cancel();
+
+    // called on the thread pool thread
+    void indexChunk();
+
+Q_SIGNALS:
+    void progress(const QString &indexName, quint64 processedCount, quint64 totalCount);
+    void finished(const QString &indexName, bool ok);
+
+private Q_SLOTS:
+    void readChunk();
+    void chunkIndexed();
+    void finish();
+
+private:
+    bool catchUp();
+
+    JsonDbObjectTable *mTable;
+    JsonDbIndex *mIndex;
+    QByteArray mLastKey;
+    bool mAtEnd;
+    quint32 mStartStateNumber;
+    quint64 mProcessedCount;
+    quint64 mTotalCount;
+
+    // the chunk being indexed and the table state it was read at
+    QList<JsonDbObject> mChunk;
+    quint32 mChunkStateNumber;
+    // keys of the objects read so far, sorted, by the state they were read at
+    QMap<quint32, QVector<ObjectKey> > mScannedKeys;
+
+    QAtomicInt mCancelled;
+    QSemaphore mIdle;
+
+    Q_DISABLE_COPY(JsonDbIndexBuilder)
+};
+
+QT_END_NAMESPACE_JSONDB_PARTITION
+
+QT_END_HEADER
+
+#endif // JSONDB_INDEXBUILDER_H
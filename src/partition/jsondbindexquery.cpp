@@ -43,6 +43,7 @@
 #include "jsondbindex.h"
 #include "jsondbindex_p.h"
 #include "jsondbobjecttable.h"
+#include "jsondbowner.h"
 #include "jsondbpartition.h"
 #include "jsondbpartition_p.h"
 #include "jsondbsettings.h"
@@ -109,18 +110,20 @@ public:
 };
 class QueryConstraintIn: public JsonDbQueryConstraint {
 public:
-    QueryConstraintIn(const QJsonValue &v) { mList = v.toArray();}
+    QueryConstraintIn(const JsonDbQueryTerm &term, const QJsonValue &v) : mTerm(term) { mList = v.toArray();}
     inline bool sparseMatchPossible() const { return true; }
-    inline bool matches(const QJsonValue &v) { return mList.contains(v); }
+    inline bool matches(const QJsonValue &v) { return mTerm.hasValueSet() ? mTerm.valueSetContains(v) : mList.contains(v); }
 private:
+    JsonDbQueryTerm mTerm;
     QJsonArray mList;
 };
 class QueryConstraintNotIn: public JsonDbQueryConstraint {
 public:
-    QueryConstraintNotIn(const QJsonValue &v) { mList = v.toArray();}
+    QueryConstraintNotIn(const JsonDbQueryTerm &term, const QJsonValue &v) : mTerm(term) { mList = v.toArray();}
     inline bool sparseMatchPossible() const { return true; }
-    inline bool matches(const QJsonValue &v) { return !mList.contains(v); }
+    inline bool matches(const QJsonValue &v) { return mTerm.hasValueSet() ? !mTerm.valueSetContains(v) : !mList.contains(v); }
 private:
+    JsonDbQueryTerm mTerm;
     QJsonArray mList;
 };
 class QueryConstraintStartsWith: public JsonDbQueryConstraint {
@@ -149,6 +152,8 @@ JsonDbIndexQuery *JsonDbIndexQuery::indexQuery(JsonDbPartition *partition, JsonD
 {
     if (propertyName == JsonDbString::kUuidStr)
         return new JsonDbUuidQuery(partition, table, propertyName, owner, query);
+    else if (propertyType == QLatin1String("text"))
+        return new JsonDbTextQuery(partition, table, propertyName, owner, query);
     else
         return new JsonDbIndexQuery(partition, table, propertyName, propertyType, owner, query);
 }
@@ -160,26 +165,51 @@ JsonDbUuidQuery::JsonDbUuidQuery(JsonDbPartition *partition, JsonDbObjectTable *
 {
 }
 
+JsonDbTextQuery::JsonDbTextQuery(JsonDbPartition *partition, JsonDbObjectTable *table,
+                                 const QString &propertyName, const JsonDbOwner *owner,
+                                 const JsonDbQuery &query)
+    : JsonDbIndexQuery(partition, table, propertyName, QStringLiteral("text"), owner, query)
+    , mMatchesFound(false)
+    , mPosition(0)
+{
+}
+
 JsonDbIndexQuery::JsonDbIndexQuery(JsonDbPartition *partition, JsonDbObjectTable *table,
                        const QString &propertyName, const QString &propertyType,
                        const JsonDbOwner *owner, const JsonDbQuery &query)
     : mPartition(partition)
     , mObjectTable(table)
     , mBdbIndex(0)
+    , mCollatedIndex(0)
     , mCursor(0)
     , mOwner(owner)
     , mMin(QJsonValue::Undefined)
     , mMax(QJsonValue::Undefined)
+    , mHasPrefixRange(false)
+    , mEmptyPrefixRange(false)
+    , mPointIndex(0)
+    , mJoinsCompiled(false)
+    , mBatchJoins(false)
+    , mBatchPos(0)
+    , mBatchPending(false)
+    , mBatchFoundAny(false)
+    , mScanEnded(false)
     , mPropertyName(propertyName)
     , mPropertyType(propertyType)
     , mSparseMatchPossible(false)
+    , mIndexOnly(false)
+    , mTypeFromKey(false)
+    , mNeedsIncluded(false)
     , mQuery(query)
 {
     mResidualQuery.query = mQuery.query;
     mResidualQuery.bindings = mQuery.bindings;
 
     if (propertyName != JsonDbString::kUuidStr) {
-        mBdbIndex = table->index(propertyName)->bdb();
+        JsonDbIndex *index = table->index(propertyName);
+        mBdbIndex = index->bdb();
+        if (index->indexSpec().isCollated())
+            mCollatedIndex = index;
         isOwnTransaction = !mBdbIndex->writeTransaction();
         mTxn = isOwnTransaction ? mBdbIndex->beginWrite() : mBdbIndex->writeTransaction();
         mCursor = new JsonDbBtree::Cursor(mTxn);
@@ -224,6 +254,124 @@ void JsonDbIndexQuery::setMin(const QJsonValue &value)
         JsonDbIndexPrivate::truncateFieldValue(&mMin, mPropertyType);
 }
 
+/*!
+    Restricts the scan to index keys starting with \a prefix. Keys are
+    ordered by UTF-16 code units, so these form the contiguous range from
+    \a prefix up to, but excluding, the prefix with its last code unit
+    incremented.
+*/
+void JsonDbIndexQuery::setPrefixRange(const QString &prefix)
+{
+    QString truncated = prefix;
+    int maxSize = jsondbSettings->indexFieldValueSize() / 2;
+    if (truncated.size() > maxSize)
+        truncated.truncate(maxSize);
+    if (truncated.isEmpty())
+        return;
+
+    if (mHasPrefixRange) {
+        if (mPrefix.startsWith(truncated))
+            return;
+        if (!truncated.startsWith(mPrefix)) {
+            mEmptyPrefixRange = true;
+            return;
+        }
+    }
+    mHasPrefixRange = true;
+    mPrefix = truncated;
+    mPrefixEnd = truncated;
+    while (!mPrefixEnd.isEmpty()) {
+        QChar last = mPrefixEnd.at(mPrefixEnd.size() - 1);
+        if (last.unicode() != 0xffff) {
+            mPrefixEnd[mPrefixEnd.size() - 1] = QChar(last.unicode() + 1);
+            break;
+        }
+        mPrefixEnd.chop(1);
+    }
+}
+
+static bool pointKeyLessThan(const QByteArray &a, const QByteArray &b)
+{
+    return JsonDbIndexPrivate::indexCompareFunction(a, b) < 0;
+}
+
+static bool pointKeyGreaterThan(const QByteArray &a, const QByteArray &b)
+{
+    return JsonDbIndexPrivate::indexCompareFunction(a, b) > 0;
+}
+
+/*!
+    Restricts the scan to the index entries holding one of \a values. The
+    scan seeks from one value to the next instead of walking the keys in
+    between.
+*/
+void JsonDbIndexQuery::setPointValues(const QJsonArray &values)
+{
+    // further in terms are left to their constraints
+    if (!mPointKeys.isEmpty())
+        return;
+
+    for (int i = 0; i < values.size(); i++) {
+        QJsonValue value = JsonDbIndexPrivate::makeFieldValue(values.at(i), mPropertyType);
+        if (value.isUndefined())
+            continue;
+        JsonDbIndexPrivate::truncateFieldValue(&value, mPropertyType);
+        QByteArray pointKey = JsonDbIndexPrivate::makeForwardKey(value, ObjectKey());
+        if (!mPointKeys.contains(pointKey))
+            mPointKeys.append(pointKey);
+    }
+    if (mQuery.isAscending())
+        qSort(mPointKeys.begin(), mPointKeys.end(), pointKeyLessThan);
+    else
+        qSort(mPointKeys.begin(), mPointKeys.end(), pointKeyGreaterThan);
+    mPointIndex = 0;
+}
+
+/*!
+    Moves the cursor from the entry at \a key to the first entry, in scan
+    order, holding one of the point values. Returns false when there is none.
+*/
+bool JsonDbIndexQuery::skipToPointValue(bool ok, QJsonValue &fieldValue, QByteArray *key)
+{
+    bool ascending = mQuery.isAscending();
+    while (ok) {
+        // compare values only, a null object key sorts before every object
+        QByteArray valueKey = *key;
+        valueKey.replace(valueKey.size() - 16, 16, QByteArray(16, '\0'));
+        while (mPointIndex < mPointKeys.size()) {
+            int cmp = JsonDbIndexPrivate::indexCompareFunction(valueKey, mPointKeys.at(mPointIndex));
+            if (cmp == 0)
+                return true;
+            if (ascending ? cmp < 0 : cmp > 0)
+                break;
+            mPointIndex++;
+        }
+        if (mPointIndex == mPointKeys.size())
+            return false;
+
+        // descending scans enter a value at its last entry, so seek to the largest object key
+        QByteArray seekKey = mPointKeys.at(mPointIndex);
+        if (!ascending)
+            seekKey.replace(seekKey.size() - 16, 16, QByteArray(16, '\xff'));
+        ok = mCursor->seekRange(seekKey, ascending ? JsonDbBtree::Cursor::EqualOrGreater : JsonDbBtree::Cursor::EqualOrLess);
+        if (ok) {
+            mCursor->current(key, 0);
+            JsonDbIndexPrivate::forwardKeySplit(*key, fieldValue);
+        }
+    }
+    return false;
+}
+
+bool JsonDbIndexQuery::pastPrefixRange(const QJsonValue &fieldValue) const
+{
+    // keys are ordered by value type first, see JsonDbIndexPrivate::indexCompareFunction
+    if (fieldValue.type() != QJsonValue::String)
+        return mQuery.isAscending() ? fieldValue.type() > QJsonValue::String : fieldValue.type() < QJsonValue::String;
+    if (mQuery.isAscending())
+        return !mPrefixEnd.isEmpty() && !(fieldValue.toString() < mPrefixEnd);
+    return fieldValue.toString() < mPrefix;
+}
+
 void JsonDbIndexQuery::setMax(const QJsonValue &value)
 {
     mMax = JsonDbIndexPrivate::makeFieldValue(value, mPropertyType);
@@ -233,20 +381,28 @@ void JsonDbIndexQuery::setMax(const QJsonValue &value)
 
 bool JsonDbIndexQuery::seekToStart(QJsonValue &fieldValue, QByteArray *key)
 {
+    if (mEmptyPrefixRange)
+        return false;
+
+    QJsonValue start = mQuery.isAscending() ? mMin : mMax;
+    if (mHasPrefixRange && mQuery.isAscending()
+            && (start.isUndefined() || start.type() != QJsonValue::String || start.toString() < mPrefix))
+        start = mPrefix;
+
     QByteArray forwardKey;
     if (mQuery.isAscending()) {
-        forwardKey = JsonDbIndexPrivate::makeForwardKey(mMin, ObjectKey());
+        forwardKey = JsonDbIndexPrivate::makeForwardKey(start, ObjectKey());
         if (jsondbSettings->debugQuery())
-            qDebug() << __FUNCTION__ << __LINE__ << "mMin" << mMin << "key" << forwardKey.toHex();
+            qDebug() << __FUNCTION__ << __LINE__ << "mMin" << start << "key" << forwardKey.toHex();
     } else {
-        forwardKey = JsonDbIndexPrivate::makeForwardKey(mMax, ObjectKey());
+        forwardKey = JsonDbIndexPrivate::makeForwardKey(start, ObjectKey());
         if (jsondbSettings->debugQuery())
-            qDebug() << __FUNCTION__ << __LINE__ << "mMax" << mMin << "key" << forwardKey.toHex();
+            qDebug() << __FUNCTION__ << __LINE__ << "mMax" << start << "key" << forwardKey.toHex();
     }
 
     bool ok = false;
     if (mQuery.isAscending()) {
-        if (!mMin.isUndefined()) {
+        if (!start.isUndefined()) {
             ok = mCursor->seekRange(forwardKey);
             if (jsondbSettings->debugQuery())
                 qDebug() << "IndexQuery::first" << __LINE__ << "ok after seekRange" << ok;
@@ -254,6 +410,10 @@ bool JsonDbIndexQuery::seekToStart(QJsonValue &fieldValue, QByteArray *key)
         if (!ok) {
             ok = mCursor->first();
         }
+    } else if (mHasPrefixRange && !mPrefixEnd.isEmpty()) {
+        // start at the last key before the end of the prefix range
+        ok = mCursor->seekRange(JsonDbIndexPrivate::makeForwardKey(mPrefixEnd, ObjectKey()));
+        ok = ok ? mCursor->previous() : mCursor->last();
     } else {
         // need a seekDescending
         ok = mCursor->last();
@@ -261,6 +421,10 @@ bool JsonDbIndexQuery::seekToStart(QJsonValue &fieldValue, QByteArray *key)
     if (ok) {
         mCursor->current(key, 0);
         JsonDbIndexPrivate::forwardKeySplit(*key, fieldValue);
+        if (!mPointKeys.isEmpty()) {
+            mPointIndex = 0;
+            ok = skipToPointValue(ok, fieldValue, key);
+        }
     }
     //qDebug() << "IndexQuery::seekToStart" << (mAscending ? mMin : mMax) << "ok" << ok << fieldValue;
     return ok;
@@ -278,6 +442,8 @@ bool JsonDbIndexQuery::seekToNext(QJsonValue &fieldValue, QByteArray *key)
     if (ok) {
         mCursor->current(key, 0);
         JsonDbIndexPrivate::forwardKeySplit(*key, fieldValue);
+        if (!mPointKeys.isEmpty())
+            ok = skipToPointValue(ok, fieldValue, key);
     }
     //qDebug() << "IndexQuery::seekToNext" << "ok" << ok << fieldValue;
     return ok;
@@ -300,10 +466,53 @@ bool JsonDbIndexQuery::seekTo(const QByteArray &key, QJsonValue &fieldValue)
    return ok;
 }
 
+/*!
+    Positions the cursor on the first index entry that comes strictly after
+    \a key in the direction of the query. \a key does not need to be
+    present in the index any more.
+*/
+bool JsonDbIndexQuery::seekPast(const QByteArray &key, QJsonValue &fieldValue, QByteArray *foundKey)
+{
+    bool ok = mCursor->seekRange(key);
+    if (mQuery.isAscending()) {
+        if (ok) {
+            mCursor->current(foundKey, 0);
+            if (*foundKey == key)
+                ok = mCursor->next();
+        }
+    } else {
+        ok = ok ? mCursor->previous() : mCursor->last();
+    }
+    if (ok) {
+        mCursor->current(foundKey, 0);
+        JsonDbIndexPrivate::forwardKeySplit(*foundKey, fieldValue);
+        if (!mPointKeys.isEmpty())
+            ok = skipToPointValue(ok, fieldValue, foundKey);
+    }
+    return ok;
+}
+
 JsonDbObject JsonDbIndexQuery::currentObjectAndTypeNumber(ObjectKey &objectKey)
 {
     QByteArray baValue;
     mCursor->current(0, &baValue);
+    if (mIndexOnly) {
+        QJsonObject included;
+        if (mNeedsIncluded)
+            JsonDbIndexPrivate::forwardValueSplit(baValue, objectKey, &included);
+        else
+            JsonDbIndexPrivate::forwardValueSplit(baValue, objectKey);
+        JsonDbObject object(included);
+        object.insert(JsonDbString::kUuidStr, objectKey.key.toString());
+        if (mTypeFromKey) {
+            // a type name at the size limit may have been truncated in the key
+            if (mFieldValue.toString().size() >= jsondbSettings->indexFieldValueSize() / 2)
+                mObjectTable->get(objectKey, &object);
+            else
+                object.insert(JsonDbString::kTypeStr, mFieldValue);
+        }
+        return object;
+    }
     JsonDbIndexPrivate::forwardValueSplit(baValue, objectKey);
 
     if (jsondbSettings->debugQuery())
@@ -315,10 +524,19 @@ JsonDbObject JsonDbIndexQuery::currentObjectAndTypeNumber(ObjectKey &objectKey)
 
 quint32 JsonDbUuidQuery::stateNumber() const
 {
+    // the table commits with its state number as tag, which a snapshot read also sees
+    if (JsonDbBtree::isSnapshotRead())
+        return mObjectTable->bdb()->tag();
     return mObjectTable->stateNumber();
 }
 
 bool JsonDbUuidQuery::seekToStart(QJsonValue &fieldValue)
+{
+    QByteArray baKey;
+    return seekToStart(fieldValue, &baKey);
+}
+
+bool JsonDbUuidQuery::seekToStart(QJsonValue &fieldValue, QByteArray *key)
 {
     bool ok;
     if (mQuery.isAscending()) {
@@ -340,33 +558,44 @@ bool JsonDbUuidQuery::seekToStart(QJsonValue &fieldValue)
             ok = mCursor->last();
         }
     }
-    QByteArray baKey;
-    while (ok) {
-        mCursor->current(&baKey, 0);
-        if (baKey.size() == 16)
-            break;
-        if (mQuery.isAscending())
-            ok = mCursor->next();
-        else
-            ok = mCursor->previous();
-    }
-    if (ok) {
-        QUuid quuid(QUuid::fromRfc4122(baKey));
-        ObjectKey objectKey(quuid);
-        fieldValue = objectKey.key.toString();
-    }
-    return ok;
+    return skipToObject(ok, fieldValue, key);
 }
 
-bool JsonDbUuidQuery::seekToStart(QJsonValue &fieldValue, QByteArray *key)
+bool JsonDbUuidQuery::seekToNext(QJsonValue &fieldValue)
 {
-    *key = QByteArray();
-    return seekToStart (fieldValue);
+    QByteArray baKey;
+    return seekToNext(fieldValue, &baKey);
 }
 
-bool JsonDbUuidQuery::seekToNext(QJsonValue &fieldValue)
+bool JsonDbUuidQuery::seekToNext(QJsonValue &fieldValue, QByteArray *key)
 {
     bool ok = mQuery.isAscending() ? mCursor->next() : mCursor->previous();
+    return skipToObject(ok, fieldValue, key);
+}
+
+bool JsonDbUuidQuery::seekPast(const QByteArray &key, QJsonValue &fieldValue, QByteArray *foundKey)
+{
+    bool ok = mCursor->seekRange(key);
+    if (mQuery.isAscending()) {
+        if (ok) {
+            mCursor->current(foundKey, 0);
+            if (*foundKey == key)
+                ok = mCursor->next();
+        }
+    } else {
+        ok = ok ? mCursor->previous() : mCursor->last();
+    }
+    return skipToObject(ok, fieldValue, foundKey);
+}
+
+/*!
+    The object table also holds state change records and old object versions,
+    whose keys are not 16 bytes long. Steps over those, starting at the
+    current cursor position, and returns the uuid of the object found in
+    \a fieldValue and its key in \a key.
+*/
+bool JsonDbUuidQuery::skipToObject(bool ok, QJsonValue &fieldValue, QByteArray *key)
+{
     QByteArray baKey;
     while (ok) {
         mCursor->current(&baKey, 0);
@@ -381,16 +610,13 @@ bool JsonDbUuidQuery::seekToNext(QJsonValue &fieldValue)
         QUuid quuid(QUuid::fromRfc4122(baKey));
         ObjectKey objectKey(quuid);
         fieldValue = objectKey.key.toString();
+        *key = baKey;
+    } else {
+        *key = QByteArray();
     }
     return ok;
 }
 
-bool JsonDbUuidQuery::seekToNext(QJsonValue &fieldValue, QByteArray *key)
-{
-    *key = QByteArray();
-    return seekToNext (fieldValue);
-}
-
 JsonDbObject JsonDbUuidQuery::currentObjectAndTypeNumber(ObjectKey &objectKey)
 {
     QByteArray baKey, baValue;
@@ -403,6 +629,143 @@ JsonDbObject JsonDbUuidQuery::currentObjectAndTypeNumber(ObjectKey &objectKey)
     return object;
 }
 
+/*!
+    Orders text matches by descending score, then by object key.
+*/
+bool JsonDbTextQuery::textMatchLessThan(const TextMatch &a, const TextMatch &b)
+{
+    if (a.score != b.score)
+        return a.score > b.score;
+    return a.objectKey < b.objectKey;
+}
+
+/*!
+    Looks up the objects matching every word of the query. The entries of
+    each word are the range of index keys starting with it; an entry equal
+    to the word scores 2 and one that merely starts with it scores 1. The
+    score of an object is the sum over the words of its best entry.
+*/
+void JsonDbTextQuery::findMatches()
+{
+    if (mMatchesFound)
+        return;
+    mMatchesFound = true;
+    mMatches.clear();
+
+    QHash<QUuid, int> scores;
+    for (int i = 0; i < mTextTokens.size(); i++) {
+        const QString &token = mTextTokens.at(i);
+        QHash<QUuid, int> tokenScores;
+        bool ok = mCursor->seekRange(JsonDbIndexPrivate::makeForwardKey(token, ObjectKey()));
+        for (; ok; ok = mCursor->next()) {
+            QByteArray baKey;
+            QJsonValue word;
+            ObjectKey objectKey;
+            mCursor->current(&baKey, 0);
+            JsonDbIndexPrivate::forwardKeySplit(baKey, word, objectKey);
+            if (word.type() != QJsonValue::String || !word.toString().startsWith(token))
+                break;
+            if (i > 0 && !scores.contains(objectKey.key))
+                continue;
+            int score = (word.toString() == token) ? 2 : 1;
+            if (score > tokenScores.value(objectKey.key))
+                tokenScores.insert(objectKey.key, score);
+        }
+        for (QHash<QUuid, int>::iterator it = tokenScores.begin(); it != tokenScores.end(); ++it)
+            it.value() += scores.value(it.key());
+        scores = tokenScores;
+        if (scores.isEmpty())
+            break;
+    }
+
+    mMatches.reserve(scores.size());
+    for (QHash<QUuid, int>::const_iterator it = scores.constBegin(); it != scores.constEnd(); ++it) {
+        TextMatch match;
+        match.objectKey = ObjectKey(it.key());
+        match.score = it.value();
+        mMatches.append(match);
+    }
+    qSort(mMatches.begin(), mMatches.end(), textMatchLessThan);
+    if (jsondbSettings->debugQuery())
+        qDebug() << "TextQuery::findMatches" << mTextTokens << mMatches.size();
+}
+
+/*!
+    Reports the match at mPosition: its score in \a fieldValue and a key,
+    made of the score and the object key, that seekPast() can resume from.
+*/
+bool JsonDbTextQuery::setCurrent(QJsonValue &fieldValue, QByteArray *key)
+{
+    if (mPosition >= mMatches.size()) {
+        *key = QByteArray();
+        return false;
+    }
+    const TextMatch &match = mMatches.at(mPosition);
+    fieldValue = match.score;
+    *key = JsonDbIndexPrivate::makeForwardKey(fieldValue, match.objectKey);
+    return true;
+}
+
+bool JsonDbTextQuery::seekToStart(QJsonValue &fieldValue)
+{
+    QByteArray baKey;
+    return seekToStart(fieldValue, &baKey);
+}
+
+bool JsonDbTextQuery::seekToStart(QJsonValue &fieldValue, QByteArray *key)
+{
+    findMatches();
+    mPosition = 0;
+    return setCurrent(fieldValue, key);
+}
+
+bool JsonDbTextQuery::seekToNext(QJsonValue &fieldValue)
+{
+    QByteArray baKey;
+    return seekToNext(fieldValue, &baKey);
+}
+
+bool JsonDbTextQuery::seekToNext(QJsonValue &fieldValue, QByteArray *key)
+{
+    if (mPosition < mMatches.size())
+        mPosition++;
+    return setCurrent(fieldValue, key);
+}
+
+bool JsonDbTextQuery::seekTo(const QByteArray &key, QJsonValue &fieldValue)
+{
+    findMatches();
+    QJsonValue score;
+    ObjectKey objectKey;
+    JsonDbIndexPrivate::forwardKeySplit(key, score, objectKey);
+    for (mPosition = 0; mPosition < mMatches.size(); mPosition++) {
+        if (mMatches.at(mPosition).objectKey == objectKey) {
+            QByteArray baKey;
+            return setCurrent(fieldValue, &baKey);
+        }
+    }
+    return false;
+}
+
+bool JsonDbTextQuery::seekPast(const QByteArray &key, QJsonValue &fieldValue, QByteArray *foundKey)
+{
+    findMatches();
+    QJsonValue score;
+    TextMatch last;
+    JsonDbIndexPrivate::forwardKeySplit(key, score, last.objectKey);
+    last.score = score.toDouble();
+    mPosition = qUpperBound(mMatches.begin(), mMatches.end(), last, textMatchLessThan) - mMatches.begin();
+    return setCurrent(fieldValue, foundKey);
+}
+
+JsonDbObject JsonDbTextQuery::currentObjectAndTypeNumber(ObjectKey &objectKey)
+{
+    objectKey = mMatches.at(mPosition).objectKey;
+    JsonDbObject object;
+    mObjectTable->get(objectKey, &object);
+    return object;
+}
+
 void JsonDbIndexQuery::setResultExpressionList(const QStringList &resultExpressionList)
 {
     mResultExpressionList = resultExpressionList;
@@ -432,44 +795,152 @@ JsonDbObject JsonDbIndexQuery::first(QByteArray *key)
     bool ok = seekToStart(fieldValue, key);
     if (jsondbSettings->debugQuery())
         qDebug() << "IndexQuery::first" << __LINE__ << "ok after first/last()" << ok;
+    return firstMatch(ok, fieldValue, key);
+}
+
+/*!
+    Resumes the query after \a key, the key returned with the last object of
+    a previous page, and returns the next matching object and its key in
+    \a foundKey. Unlike an offset, this stays correct when objects before
+    \a key are added or removed in the meantime.
+*/
+JsonDbObject JsonDbIndexQuery::seekAfter(const QByteArray &key, QByteArray *foundKey)
+{
+    mSparseMatchPossible = false;
+    for (int i = 0; i < mQueryConstraints.size(); i++) {
+        mSparseMatchPossible |= mQueryConstraints[i]->sparseMatchPossible();
+    }
+
+    QJsonValue fieldValue;
+    bool ok = seekPast(key, fieldValue, foundKey);
+    if (jsondbSettings->debugQuery())
+        qDebug() << "IndexQuery::seekAfter" << __LINE__ << "ok after seekPast()" << ok;
+    return firstMatch(ok, fieldValue, foundKey);
+}
+
+/*!
+    Walks the index from the cursor position, if \a ok says there is one,
+    to the next entry that passes the index constraints and whose object is
+    live and of one of the queried types. The object is returned in
+    \a object. Entries failing the constraints are skipped when \a sparse
+    is true and end the scan otherwise. Returns false at the end of the scan.
+*/
+bool JsonDbIndexQuery::nextCandidate(bool ok, bool sparse, QJsonValue &fieldValue, QByteArray *key, JsonDbObject *object)
+{
     for (; ok; ok = seekToNext(fieldValue, key)) {
         mFieldValue = fieldValue;
-        if (jsondbSettings->debugQuery())
-            qDebug() << "IndexQuery::first()"
-                     << "mPropertyName" << mPropertyName
+        if (mHasPrefixRange && pastPrefixRange(fieldValue))
+            return false;
+        if (jsondbSettings->debugQuery()) {
+            qDebug() << "IndexQuery::nextCandidate()" << "mPropertyName" << mPropertyName
                      << "fieldValue" << fieldValue
                      << (mQuery.isAscending() ? "ascending" : "descending");
+            qDebug() << "IndexQuery::nextCandidate()" << "matches(fieldValue)" << matches(fieldValue);
+        }
 
-        if (jsondbSettings->debugQuery())
-            qDebug() << "IndexQuery::first()" << "matches(fieldValue)" << matches(fieldValue);
-
-        if (!matches(fieldValue))
-            continue;
+        if (!matches(fieldValue)) {
+            if (sparse)
+                continue;
+            return false;
+        }
 
         ObjectKey objectKey;
-        JsonDbObject object(currentObjectAndTypeNumber(objectKey));
+        *object = currentObjectAndTypeNumber(objectKey);
         if (jsondbSettings->debugQuery())
-            qDebug() << "IndexQuery::first()" << __LINE__ << "objectKey" << objectKey << object.value(JsonDbString::kDeletedStr).toBool();
-        if (object.contains(JsonDbString::kDeletedStr) && object.value(JsonDbString::kDeletedStr).toBool())
+            qDebug() << "IndexQuery::nextCandidate()" << __LINE__ << "objectKey" << objectKey << object->value(JsonDbString::kDeletedStr).toBool();
+        if (object->contains(JsonDbString::kDeletedStr) && object->value(JsonDbString::kDeletedStr).toBool())
             continue;
 
-        if (!mTypeNames.isEmpty() && !mTypeNames.contains(object.value(JsonDbString::kTypeStr).toString()))
+        if (!mTypeNames.isEmpty() && !mTypeNames.contains(object->value(JsonDbString::kTypeStr).toString()))
             continue;
-        if (jsondbSettings->debugQuery())
-            qDebug() << "mTypeName" << mTypeNames << "!contains" << object << "->" << object.value(JsonDbString::kTypeStr);
+        return true;
+    }
+    return false;
+}
+
+JsonDbObject JsonDbIndexQuery::firstMatch(bool ok, QJsonValue &fieldValue, QByteArray *key)
+{
+    compileJoins();
+    if (mBatchJoins) {
+        mBatch.clear();
+        mBatchPos = 0;
+        mBatchFoundAny = false;
+        mBatchPending = ok;
+        mScanEnded = !ok;
+        mBatchKey = *key;
+        mBatchFieldValue = fieldValue;
+        return nextBatchedMatch(key);
+    }
 
+    JsonDbObject object;
+    for (; nextCandidate(ok, true, fieldValue, key, &object); ok = seekToNext(fieldValue, key)) {
+        if (!passesJoinFilters(object))
+            continue;
         if (!mResidualQuery.isEmpty() && !mResidualQuery.match(object, &mObjectCache, mPartition))
             continue;
 
         if (jsondbSettings->debugQuery())
-            qDebug() << "IndexQuery::first()" << "returning objectKey" << objectKey;
-
+            qDebug() << "IndexQuery::first()" << "returning object" << object.value(JsonDbString::kUuidStr);
         return object;
     }
     mUuid.clear();
     return QJsonObject();
 }
 
+/*!
+    Returns the next match when the query joins other objects. Candidates
+    are gathered joinBatchSize() at a time, their joined objects are read
+    together by prefetchJoinedObjects(), and only then is the residual
+    query, which follows the joins through the object cache, checked.
+*/
+JsonDbObject JsonDbIndexQuery::nextBatchedMatch(QByteArray *key)
+{
+    forever {
+        while (mBatchPos < mBatch.size()) {
+            const JoinCandidate &candidate = mBatch.at(mBatchPos++);
+            if (!mResidualQuery.isEmpty() && !mResidualQuery.match(candidate.object, &mObjectCache, mPartition))
+                continue;
+            mFieldValue = candidate.fieldValue;
+            *key = candidate.key;
+            return candidate.object;
+        }
+        if (mScanEnded)
+            break;
+
+        mBatch.clear();
+        mBatchPos = 0;
+        QJsonValue fieldValue = mBatchFieldValue;
+        QByteArray batchKey = mBatchKey;
+        bool ok = mBatchPending ? true : seekToNext(fieldValue, &batchKey);
+        int batchSize = qMax(1, jsondbSettings->joinBatchSize());
+        JsonDbObject object;
+        while (mBatch.size() < batchSize) {
+            // like first() and next(), be sparse until the first candidate
+            ok = nextCandidate(ok, mSparseMatchPossible || !mBatchFoundAny, fieldValue, &batchKey, &object);
+            if (!ok)
+                break;
+            mBatchFoundAny = true;
+            if (passesJoinFilters(object)) {
+                JoinCandidate candidate;
+                candidate.key = batchKey;
+                candidate.fieldValue = fieldValue;
+                candidate.object = object;
+                mBatch.append(candidate);
+            }
+            ok = seekToNext(fieldValue, &batchKey);
+            if (!ok)
+                break;
+        }
+        mScanEnded = !ok;
+        mBatchPending = ok;
+        mBatchKey = batchKey;
+        mBatchFieldValue = fieldValue;
+        prefetchJoinedObjects();
+    }
+    mUuid.clear();
+    return QJsonObject();
+}
+
 JsonDbObject JsonDbIndexQuery::first()
 {
     QByteArray key;
@@ -483,6 +954,14 @@ JsonDbObject JsonDbIndexQuery::seek(const QByteArray &key)
         mSparseMatchPossible |= mQueryConstraints[i]->sparseMatchPossible();
     }
 
+    // next() carries on from the cursor, not from an earlier batch
+    compileJoins();
+    mBatch.clear();
+    mBatchPos = 0;
+    mBatchFoundAny = true;
+    mBatchPending = false;
+    mScanEnded = false;
+
     QJsonValue fieldValue;
     bool ok = seekTo(key, fieldValue);
     if (jsondbSettings->debugQuery())
@@ -510,6 +989,8 @@ JsonDbObject JsonDbIndexQuery::seek(const QByteArray &key)
         if (jsondbSettings->debugQuery())
             qDebug() << "mTypeName" << mTypeNames << "!contains" << object << "->" << object.value(JsonDbString::kTypeStr);
 
+        if (!passesJoinFilters(object))
+            break;
         if (!mResidualQuery.isEmpty() && !mResidualQuery.match(object, &mObjectCache, mPartition))
             break;
 
@@ -524,36 +1005,20 @@ JsonDbObject JsonDbIndexQuery::seek(const QByteArray &key)
 
 JsonDbObject JsonDbIndexQuery::next(QByteArray *key)
 {
-    QJsonValue fieldValue;
-    while (seekToNext(fieldValue, key)) {
-        mFieldValue = fieldValue;
-        if (jsondbSettings->debugQuery()) {
-            qDebug() << "IndexQuery::next()" << "mPropertyName" << mPropertyName
-                     << "fieldValue" << fieldValue
-                     << (mQuery.isAscending() ? "ascending" : "descending");
-            qDebug() << "IndexQuery::next()" << "matches(fieldValue)" << matches(fieldValue);
-        }
-        if (!matches(fieldValue)) {
-            if (mSparseMatchPossible)
-                continue;
-            else
-                break;
-        }
-
-        ObjectKey objectKey;
-        JsonDbObject object(currentObjectAndTypeNumber(objectKey));
-        if (object.contains(JsonDbString::kDeletedStr) && object.value(JsonDbString::kDeletedStr).toBool())
-            continue;
+    if (mBatchJoins)
+        return nextBatchedMatch(key);
 
-        if (!mTypeNames.isEmpty() && !mTypeNames.contains(object.value(JsonDbString::kTypeStr).toString()))
+    QJsonValue fieldValue;
+    JsonDbObject object;
+    bool ok = seekToNext(fieldValue, key);
+    for (; nextCandidate(ok, mSparseMatchPossible, fieldValue, key, &object); ok = seekToNext(fieldValue, key)) {
+        if (!passesJoinFilters(object))
             continue;
-
-        if (jsondbSettings->debugQuery())
-            qDebug() << "IndexQuery::next()" << "objectKey" << objectKey;
-
         if (!mResidualQuery.isEmpty() && !mResidualQuery.match(object, &mObjectCache, mPartition))
             continue;
 
+        if (jsondbSettings->debugQuery())
+            qDebug() << "IndexQuery::next()" << "returning object" << object.value(JsonDbString::kUuidStr);
         return object;
     }
     mUuid.clear();
@@ -566,9 +1031,61 @@ JsonDbObject JsonDbIndexQuery::next()
     return next (&key);
 }
 
-void JsonDbIndexQuery::compileOrQueryTerm(const JsonDbQueryTerm &queryTerm)
+/*!
+    Returns the literal text every string matched by \a re has to start
+    with, or an empty string if there is none.
+*/
+static QString regExpLiteralPrefix(const QRegExp &re)
 {
     static const QRegExp wildCardPrefixRegExp(QStringLiteral("([^*?\\[\\]\\\\]+).*"));
+    static const QString regExpSpecials(QStringLiteral("\\^$.|?*+()[]{}"));
+
+    if (re.caseSensitivity() != Qt::CaseSensitive)
+        return QString();
+
+    QString pattern = re.pattern();
+    switch (re.patternSyntax()) {
+    case QRegExp::FixedString:
+        return pattern;
+    case QRegExp::Wildcard:
+    case QRegExp::WildcardUnix: {
+        QRegExp wildCard(wildCardPrefixRegExp);
+        if (wildCard.exactMatch(pattern))
+            return wildCard.cap(1);
+        return QString();
+    }
+    case QRegExp::RegExp:
+    case QRegExp::RegExp2: {
+        // an alternative anywhere may bypass the prefix
+        if (pattern.contains(QLatin1Char('|')))
+            return QString();
+        int i = pattern.startsWith(QLatin1Char('^')) ? 1 : 0;
+        int start = i;
+        while (i < pattern.size() && !regExpSpecials.contains(pattern.at(i)))
+            i++;
+        QString prefix = pattern.mid(start, i - start);
+        // a quantifier makes the last literal character optional
+        if (i < pattern.size()
+                && (pattern.at(i) == QLatin1Char('?') || pattern.at(i) == QLatin1Char('*') || pattern.at(i) == QLatin1Char('{')))
+            prefix.chop(1);
+        return prefix;
+    }
+    default:
+        return QString();
+    }
+}
+
+void JsonDbIndexQuery::compileOrQueryTerm(const JsonDbQueryTerm &queryTerm)
+{
+    // prefix ranges rely on the raw string being the key, ordered by code
+    // unit, which collation sort keys and lowercased values are not
+    bool prefixRangePossible = propertyName() != JsonDbString::kUuidStr
+            && (propertyType().isEmpty() || propertyType() == QLatin1String("string"));
+    if (prefixRangePossible) {
+        JsonDbIndex *index = mObjectTable->index(propertyName());
+        prefixRangePossible = index && index->indexSpec().collation.isEmpty()
+                && index->indexSpec().caseSensitivity == Qt::CaseSensitive;
+    }
 
     QString op = queryTerm.op();
     QJsonValue fieldValue = mQuery.termValue(queryTerm);
@@ -595,20 +1112,12 @@ void JsonDbIndexQuery::compileOrQueryTerm(const JsonDbQueryTerm &queryTerm)
     } else if (op == QLatin1String("=~")
                || op == QLatin1String("!=~")) {
         const QRegExp &re = queryTerm.regExpConst();
-        QRegExp::PatternSyntax syntax = re.patternSyntax();
-        Qt::CaseSensitivity cs = re.caseSensitivity();
-        QString pattern = re.pattern();
         addConstraint(new QueryConstraintRegExp(re, (op == QLatin1String("=~") ? false : true)));
-        if (cs == Qt::CaseSensitive) {
-            QString prefix;
-            if ((syntax == QRegExp::Wildcard)
-                && wildCardPrefixRegExp.exactMatch(pattern)) {
-                prefix = wildCardPrefixRegExp.cap(1);
-                if (jsondbSettings->debug())
-                    qDebug() << "wildcard regexp prefix" << pattern << prefix;
-            }
-            setMin(prefix);
-            setMax(prefix);
+        if (op == QLatin1String("=~") && prefixRangePossible) {
+            QString prefix = regExpLiteralPrefix(re);
+            if (jsondbSettings->debug())
+                qDebug() << "regexp prefix" << re.pattern() << prefix;
+            setPrefixRange(prefix);
         }
     } else if (op == QLatin1String("!=")) {
         addConstraint(new QueryConstraintNe(fieldValue));
@@ -621,11 +1130,197 @@ void JsonDbIndexQuery::compileOrQueryTerm(const JsonDbQueryTerm &queryTerm)
         if (value.size() == 1)
             addConstraint(new QueryConstraintEq(value.at(0)));
         else
-            addConstraint(new QueryConstraintIn(mQuery.termValue(queryTerm)));
+            addConstraint(new QueryConstraintIn(queryTerm, mQuery.termValue(queryTerm)));
+        if (propertyName() != JsonDbString::kUuidStr)
+            setPointValues(value);
+    } else if (op == QLatin1String("contains")) {
+        // only compiled for multikey indexes, which hold one entry per array element
+        QJsonValue elementValue = JsonDbIndexPrivate::makeFieldValue(fieldValue, propertyType());
+        JsonDbIndexPrivate::truncateFieldValue(&elementValue, propertyType());
+        addConstraint(new QueryConstraintEq(elementValue));
+        setMin(elementValue);
+        setMax(elementValue);
     } else if (op == QLatin1String("notIn")) {
-        addConstraint(new QueryConstraintNotIn(mQuery.termValue(queryTerm)));
+        addConstraint(new QueryConstraintNotIn(queryTerm, mQuery.termValue(queryTerm)));
     } else if (op == QLatin1String("startsWith")) {
-        addConstraint(new QueryConstraintStartsWith(mQuery.termValue(queryTerm).toString()));
+        QString prefix = mQuery.termValue(queryTerm).toString();
+        addConstraint(new QueryConstraintStartsWith(prefix));
+        if (prefixRangePossible)
+            setPrefixRange(prefix);
+    } else if (op == QLatin1String("matches")) {
+        // only compiled for text indexes, see JsonDbTextQuery
+        foreach (const QString &token, JsonDbIndexPrivate::textTokens(mQuery.termValue(queryTerm).toString())) {
+            QJsonValue tokenValue(token);
+            JsonDbIndexPrivate::truncateFieldValue(&tokenValue, propertyType());
+            mTextTokens.append(tokenValue.toString());
+        }
+    }
+}
+
+/*!
+    Decides whether the query can be answered from the index alone, without
+    reading the objects from the object table. Index entries hold the uuid,
+    the indexed value and the properties listed in the index's \c include
+    list (plus \c _type when there are any). That is enough when no access
+    control filtering applies, the query counts or projects only covered
+    properties, and every remaining filter and sort term is on a covered
+    property.
+*/
+void JsonDbIndexQuery::compileIndexOnly(const JsonDbIndexSpec &indexSpec)
+{
+    mIndexOnly = false;
+    if (mPropertyName == JsonDbString::kUuidStr || indexSpec.hasPropertyFunction() || indexSpec.isText())
+        return;
+    if (mOwner && !mOwner->allowAll() && jsondbSettings->enforceAccessControl())
+        return;
+    bool countOnly = (mAggregateOperation == QLatin1String("count"));
+    if (!countOnly && mResultKeyList.isEmpty())
+        return;
+
+    QSet<QString> covered = indexSpec.includes.toSet();
+    covered.insert(JsonDbString::kUuidStr);
+    bool typeFromKey = (indexSpec.propertyName == JsonDbString::kTypeStr);
+    if (typeFromKey || !indexSpec.includes.isEmpty())
+        covered.insert(JsonDbString::kTypeStr);
+
+    if (!mTypeNames.isEmpty() && !covered.contains(JsonDbString::kTypeStr))
+        return;
+    foreach (const JsonDbOrQueryTerm &orQueryTerm, mResidualQuery.queryTerms) {
+        foreach (const JsonDbQueryTerm &term, orQueryTerm.terms()) {
+            // terms on a %variable property have no field path
+            if (!term.hasPropertyName() || term.fieldPath().isEmpty())
+                return;
+            if (!term.joinField().isEmpty() || !covered.contains(term.fieldPath().first()))
+                return;
+        }
+    }
+    foreach (const JsonDbOrderTerm &orderTerm, mResidualQuery.orderTerms) {
+        if (!covered.contains(orderTerm.propertyName.section(QLatin1Char('.'), 0, 0)))
+            return;
+    }
+    if (!countOnly) {
+        foreach (const QVector<QStringList> &joinPath, mJoinPaths) {
+            if (joinPath.size() != 1 || !covered.contains(joinPath.first().first()))
+                return;
+        }
+    }
+
+    mIndexOnly = true;
+    mTypeFromKey = typeFromKey;
+    mNeedsIncluded = !indexSpec.includes.isEmpty()
+            && (!countOnly || !mResidualQuery.queryTerms.isEmpty() || !mResidualQuery.orderTerms.isEmpty()
+                || (!mTypeNames.isEmpty() && !typeFromKey));
+}
+
+/*!
+    Prepares the execution of join terms (\c{->}) in the residual query and
+    in the result expressions.
+
+    An equality term on a joined object is pushed down to the index on that
+    property when there is one: the uuids of the objects matching it are
+    collected before the scan, and candidates whose join does not lead to
+    one of them are dropped without reading the joined object. The term
+    stays in the residual query to check the remaining candidates.
+
+    The join chains are recorded so that the joined objects of a batch of
+    candidates can be read together, see prefetchJoinedObjects().
+*/
+void JsonDbIndexQuery::compileJoins()
+{
+    if (mJoinsCompiled)
+        return;
+    mJoinsCompiled = true;
+
+    foreach (const JsonDbOrQueryTerm &orQueryTerm, mResidualQuery.queryTerms) {
+        const QList<JsonDbQueryTerm> &terms = orQueryTerm.terms();
+        foreach (const JsonDbQueryTerm &term, terms) {
+            const QVector<QStringList> &joinPaths = term.joinPaths();
+            if (joinPaths.isEmpty())
+                continue;
+            if (!mPrefetchPaths.contains(joinPaths))
+                mPrefetchPaths.append(joinPaths);
+
+            if (terms.size() != 1 || joinPaths.size() != 1 || term.opCode() != JsonDbQueryTerm::EqualsOp
+                    || !term.hasPropertyName())
+                continue;
+            QJsonValue value = term.isBound() ? term.boundValue() : mResidualQuery.termValue(term);
+            if (!(value.isString() || value.isDouble() || value.isBool()))
+                continue;
+            QSet<QUuid> objectKeys;
+            if (!mPartition->d_func()->findObjectKeys(term.fieldPath().join(QStringLiteral(".")), value,
+                                                      jsondbSettings->joinCacheSize(), &objectKeys))
+                continue;
+            if (jsondbSettings->debugQuery())
+                qDebug() << "IndexQuery::compileJoins()" << "pushed down" << term.joinField() << term.propertyName()
+                         << value << objectKeys.size() << "objects";
+            mJoinFilters.append(qMakePair(joinPaths.at(0), objectKeys));
+        }
+    }
+
+    for (int i = 0; i < mJoinPaths.size(); i++) {
+        if (mJoinPaths.at(i).size() < 2)
+            continue;
+        QVector<QStringList> joinPaths = mJoinPaths.at(i).mid(0, mJoinPaths.at(i).size() - 1);
+        if (!mPrefetchPaths.contains(joinPaths))
+            mPrefetchPaths.append(joinPaths);
+    }
+
+    mBatchJoins = !mPrefetchPaths.isEmpty() && jsondbSettings->joinBatchSize() > 1;
+}
+
+bool JsonDbIndexQuery::passesJoinFilters(const JsonDbObject &object) const
+{
+    for (int i = 0; i < mJoinFilters.size(); i++) {
+        const QPair<QStringList, QSet<QUuid> > &filter = mJoinFilters.at(i);
+        if (!filter.second.contains(QUuid(object.valueByPath(filter.first).toString())))
+            return false;
+    }
+    return true;
+}
+
+/*!
+    Reads the objects joined by the candidates in the current batch, one
+    join step at a time, with a single pass over their sorted keys per step.
+    They land in the object cache, where the residual query and the result
+    expressions look them up.
+*/
+void JsonDbIndexQuery::prefetchJoinedObjects()
+{
+    for (int p = 0; p < mPrefetchPaths.size(); p++) {
+        const QVector<QStringList> &joinPaths = mPrefetchPaths.at(p);
+        QList<JsonDbObject> objects;
+        for (int i = 0; i < mBatch.size(); i++)
+            objects.append(mBatch.at(i).object);
+
+        for (int j = 0; j < joinPaths.size() && !objects.isEmpty(); j++) {
+            QSet<QString> seen;
+            QStringList missingUuids;
+            QList<ObjectKey> missingKeys;
+            QList<JsonDbObject> joinedObjects;
+            foreach (const JsonDbObject &object, objects) {
+                QString uuid = object.valueByPath(joinPaths.at(j)).toString();
+                if (uuid.isEmpty() || seen.contains(uuid))
+                    continue;
+                seen.insert(uuid);
+                if (mObjectCache.contains(uuid)) {
+                    joinedObjects.append(mObjectCache.value(uuid));
+                } else {
+                    missingUuids.append(uuid);
+                    missingKeys.append(ObjectKey(uuid));
+                }
+            }
+
+            QList<JsonDbObject> fetched;
+            mPartition->d_func()->getObjects(missingKeys, &fetched);
+            for (int k = 0; k < fetched.size(); k++) {
+                // objects that are not found are left to the residual query
+                if (fetched.at(k).isEmpty())
+                    continue;
+                JsonDbQuery::cacheObject(&mObjectCache, missingUuids.at(k), fetched.at(k));
+                joinedObjects.append(fetched.at(k));
+            }
+            objects = joinedObjects;
+        }
     }
 }
 
@@ -634,8 +1329,14 @@ JsonDbObject JsonDbIndexQuery::resultObject(const JsonDbObject &object)
     QJsonObject result;
     JsonDbObject baseObject(object);
 
-    // insert the computed index value
-    baseObject.insert(JsonDbString::kIndexValueStr, mFieldValue);
+    // insert the computed index value, a collated index reports the property
+    // value and the sort key it is ordered by separately
+    if (mCollatedIndex) {
+        baseObject.insert(JsonDbString::kIndexValueStr, mCollatedIndex->propertyValue(object, mFieldValue));
+        baseObject.insert(JsonDbString::kIndexSortKeyStr, mFieldValue);
+    } else {
+        baseObject.insert(JsonDbString::kIndexValueStr, mFieldValue);
+    }
 
     Q_ASSERT(mResultKeyList.size() == mResultExpressionList.size());
     if (mResultKeyList.isEmpty())
@@ -653,7 +1354,7 @@ JsonDbObject JsonDbIndexQuery::resultObject(const JsonDbObject &object)
                 obj = mObjectCache.value(uuid);
             } else {
                  if (mPartition->d_func()->getObject(ObjectKey(uuid), obj))
-                    mObjectCache.insert(uuid, obj);
+                    JsonDbQuery::cacheObject(&mObjectCache, uuid, obj);
             }
         }
         QJsonValue v = obj.valueByPath(joinPath.last());
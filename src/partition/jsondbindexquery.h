@@ -46,6 +46,7 @@
 #include <QSet>
 #include <QVector>
 #include <QStringList>
+#include <QUuid>
 
 #include "jsondbpartitionglobal.h"
 #include "jsondbobject.h"
@@ -58,6 +59,8 @@ QT_BEGIN_HEADER
 
 QT_BEGIN_NAMESPACE_JSONDB_PARTITION
 
+class JsonDbIndex;
+class JsonDbIndexSpec;
 class JsonDbObjectTable;
 class JsonDbOwner;
 class JsonDbPartition;
@@ -90,16 +93,21 @@ public:
     void setTypeNames(const QSet<QString> typeNames) { mTypeNames = typeNames; }
     void setMin(const QJsonValue &minv);
     void setMax(const QJsonValue &maxv);
+    void setPrefixRange(const QString &prefix);
+    void setPointValues(const QJsonArray &values);
     QString aggregateOperation() const { return mAggregateOperation; }
     void setAggregateOperation(QString op) { mAggregateOperation = op; }
     void setResultExpressionList(const QStringList &resultExpressionList);
     void setResultKeyList(QStringList resultKeyList) { mResultKeyList = resultKeyList; }
+    void compileIndexOnly(const JsonDbIndexSpec &indexSpec);
+    bool isIndexOnly() const { return mIndexOnly; }
 
     JsonDbObject first(); // returns first matching object
     JsonDbObject next(); // returns next matching object
     JsonDbObject first(QByteArray *key); // returns first matching object and its key
     JsonDbObject next(QByteArray *key); // returns next matching object and its keyb
     JsonDbObject seek(const QByteArray &key); // returns the object matching key
+    JsonDbObject seekAfter(const QByteArray &key, QByteArray *foundKey); // returns first matching object after key
     bool matches(const QJsonValue &value);
     QJsonValue fieldValue() const { return mFieldValue; }
 
@@ -107,7 +115,7 @@ public:
 
     const JsonDbQuery &residualQuery() const { return mResidualQuery; }
     void setResidualQuery(const JsonDbQuery &residualQuery)
-    { Q_ASSERT(!residualQuery.query.isEmpty()); mResidualQuery = residualQuery; }
+    { Q_ASSERT(!residualQuery.query.isEmpty()); mResidualQuery = residualQuery; mResidualQuery.compile(); }
 
     virtual quint32 stateNumber() const;
 
@@ -123,17 +131,41 @@ protected:
     virtual bool seekToNext(QJsonValue &fieldValue);
     virtual bool seekToNext(QJsonValue &fieldValue, QByteArray *key);
     virtual bool seekTo(const QByteArray &key, QJsonValue &fieldValue);
+    virtual bool seekPast(const QByteArray &key, QJsonValue &fieldValue, QByteArray *foundKey);
     virtual JsonDbObject currentObjectAndTypeNumber(ObjectKey &objectKey);
 
+private:
+    bool nextCandidate(bool ok, bool sparse, QJsonValue &fieldValue, QByteArray *key, JsonDbObject *object);
+    JsonDbObject firstMatch(bool ok, QJsonValue &fieldValue, QByteArray *key);
+    JsonDbObject nextBatchedMatch(QByteArray *key);
+    void compileJoins();
+    bool passesJoinFilters(const JsonDbObject &object) const;
+    void prefetchJoinedObjects();
+    bool pastPrefixRange(const QJsonValue &fieldValue) const;
+    bool skipToPointValue(bool ok, QJsonValue &fieldValue, QByteArray *key);
+
 protected:
     JsonDbPartition *mPartition;
     JsonDbObjectTable   *mObjectTable;
     JsonDbBtree *mBdbIndex;
+    JsonDbIndex *mCollatedIndex; // the index when it holds collation sort keys, 0 otherwise
     bool isOwnTransaction;
     JsonDbBtree::Transaction *mTxn;
     JsonDbBtree::Cursor *mCursor;
     const JsonDbOwner *mOwner;
     QJsonValue      mMin, mMax;
+    // keys starting with mPrefix lie in [mPrefix, mPrefixEnd), mPrefixEnd is
+    // empty when there is no upper bound
+    bool            mHasPrefixRange;
+    bool            mEmptyPrefixRange;
+    QString         mPrefix;
+    QString         mPrefixEnd;
+    // words of the "matches" terms, only used by JsonDbTextQuery
+    QStringList     mTextTokens;
+    // keys (with a null object key) of the only values the scan visits, in
+    // scan order; mPointIndex is the next one not yet passed
+    QList<QByteArray> mPointKeys;
+    int             mPointIndex;
     QSet<QString> mTypeNames;
     QString       mUuid;
     QVector<JsonDbQueryConstraint*> mQueryConstraints;
@@ -142,7 +174,29 @@ protected:
     QString       mPropertyType;
     QJsonValue     mFieldValue; // value of field for the object the cursor is pointing at
     bool          mSparseMatchPossible;
-    QHash<QString, JsonDbObject> mObjectCache;
+    bool          mIndexOnly; // objects are built from index entries, see compileIndexOnly()
+    bool          mTypeFromKey;
+    bool          mNeedsIncluded;
+    QHash<QString, JsonDbObject> mObjectCache; // joined objects, bounded by joinCacheSize()
+
+    // queries with joins gather candidates in batches so that the joined
+    // objects of a whole batch are read together
+    struct JoinCandidate {
+        QByteArray key;
+        QJsonValue fieldValue;
+        JsonDbObject object;
+    };
+    bool          mJoinsCompiled;
+    bool          mBatchJoins;
+    QList<QVector<QStringList> > mPrefetchPaths; // join steps to read ahead
+    QList<QPair<QStringList, QSet<QUuid> > > mJoinFilters; // join path and the uuids it may lead to
+    QList<JoinCandidate> mBatch;
+    int           mBatchPos;
+    bool          mBatchPending; // the cursor is on an entry not gathered yet
+    bool          mBatchFoundAny;
+    bool          mScanEnded;
+    QByteArray    mBatchKey;
+    QJsonValue    mBatchFieldValue;
     QStringList  mResultExpressionList;
     QStringList  mResultKeyList;
     QVector<QVector<QStringList> > mJoinPaths;
@@ -162,8 +216,40 @@ protected:
     virtual bool seekToNext(QJsonValue &fieldValue);
     virtual bool seekToNext(QJsonValue &fieldValue, QByteArray *key);
     virtual bool seekTo(const QByteArray &key, QJsonValue &fieldValue) { return false; }
+    virtual bool seekPast(const QByteArray &key, QJsonValue &fieldValue, QByteArray *foundKey);
     virtual JsonDbObject currentObjectAndTypeNumber(ObjectKey &objectKey);
     virtual quint32 stateNumber() const;
+
+private:
+    bool skipToObject(bool ok, QJsonValue &fieldValue, QByteArray *key);
+    friend class JsonDbIndexQuery;
+};
+
+class JsonDbTextQuery : public JsonDbIndexQuery {
+protected:
+    JsonDbTextQuery(JsonDbPartition *partition, JsonDbObjectTable *table,
+                    const QString &propertyName, const JsonDbOwner *owner,
+                    const JsonDbQuery &query);
+    virtual bool seekToStart(QJsonValue &fieldValue);
+    virtual bool seekToStart(QJsonValue &fieldValue, QByteArray *key);
+    virtual bool seekToNext(QJsonValue &fieldValue);
+    virtual bool seekToNext(QJsonValue &fieldValue, QByteArray *key);
+    virtual bool seekTo(const QByteArray &key, QJsonValue &fieldValue);
+    virtual bool seekPast(const QByteArray &key, QJsonValue &fieldValue, QByteArray *foundKey);
+    virtual JsonDbObject currentObjectAndTypeNumber(ObjectKey &objectKey);
+
+private:
+    struct TextMatch {
+        ObjectKey objectKey;
+        int score;
+    };
+    static bool textMatchLessThan(const TextMatch &a, const TextMatch &b);
+    void findMatches();
+    bool setCurrent(QJsonValue &fieldValue, QByteArray *key);
+
+    bool mMatchesFound;
+    QList<TextMatch> mMatches; // best matches first
+    int mPosition;
     friend class JsonDbIndexQuery;
 };
 
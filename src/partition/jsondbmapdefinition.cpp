@@ -44,7 +44,11 @@
 #include <QRegExp>
 #include <QJSValue>
 #include <QJSValueIterator>
+#include <QRunnable>
+#include <QSemaphore>
 #include <QStringList>
+#include <QThreadPool>
+#include <QVector>
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -64,6 +68,38 @@
 
 QT_BEGIN_NAMESPACE_JSONDB_PARTITION
 
+// below this many source objects per thread, handing them to other threads
+// costs more than it saves
+static const int kMinParallelMapObjects = 64;
+
+Q_GLOBAL_STATIC(QThreadPool, mapThreadPool)
+
+class JsonDbMapTask : public QRunnable
+{
+public:
+    JsonDbMapTask(JsonDbMapDefinition *definition, const JsonDbObjectList &objects,
+                  JsonDbObjectList *emittedObjects, QString *errorMessage, QSemaphore *done)
+        : mDefinition(definition), mDefinitionObject(definition->definition()), mObjects(objects)
+        , mEmittedObjects(emittedObjects), mErrorMessage(errorMessage), mDone(done)
+    { }
+    void run()
+    {
+        {
+            JsonDbMapWorker worker(mDefinition);
+            worker.mapObjects(mDefinitionObject, mObjects, mEmittedObjects, mErrorMessage);
+        }
+        mDone->release();
+    }
+private:
+    JsonDbMapDefinition *mDefinition;
+    // copied on the partition thread, which may mark the definition inactive meanwhile
+    QJsonObject mDefinitionObject;
+    JsonDbObjectList mObjects;
+    JsonDbObjectList *mEmittedObjects;
+    QString *mErrorMessage;
+    QSemaphore *mDone;
+};
+
 JsonDbMapDefinition::JsonDbMapDefinition(const JsonDbOwner *owner, JsonDbPartition *partition, QJsonObject definition, QObject *parent) :
     QObject(parent)
     , mPartition(partition)
@@ -82,6 +118,13 @@ JsonDbMapDefinition::JsonDbMapDefinition(const JsonDbOwner *owner, JsonDbPartiti
     for (int i = 0; i < mSourceTypes.size(); i++) {
         const QString &sourceType = mSourceTypes[i];
         mSourceTables[sourceType] = mPartition->findObjectTable(sourceType);
+        if (sourceFunctions.value(sourceType).isObject() && !mDefinition.contains(QStringLiteral("join"))) {
+            // a declarative projection of source property paths, mapped without the script engine
+            QJsonObject projection = sourceFunctions.value(sourceType).toObject();
+            QList<QPair<QString, QStringList> > &paths = mProjections[sourceType];
+            for (QJsonObject::const_iterator it = projection.begin(); it != projection.end(); ++it)
+                paths.append(qMakePair(it.key(), it.value().toString().split(QLatin1Char('.'))));
+        }
     }
     if (mDefinition.contains(QStringLiteral("targetKeyName")))
         mTargetKeyName = mDefinition.value(QStringLiteral("targetKeyName")).toString();
@@ -102,12 +145,16 @@ void JsonDbMapDefinition::definitionCreated()
         }
         JsonDbObjectList objects = getObjectResponse.data;
         bool isJoin = mDefinition.contains(JsonDbString::kJoinStr);
+        JsonDbUpdateList changes;
         for (int i = 0; i < objects.size(); i++) {
-            JsonDbObject object(objects.at(i));
+            // a join may already have view objects derived from this source, so remap it in place
+            const JsonDbObject &object = objects.at(i);
             if (isJoin)
-                unmapObject(object);
-            updateObject(JsonDbObject(), objects.at(i));
+                changes.append(JsonDbUpdate(object, object, JsonDbNotification::Update));
+            else
+                changes.append(JsonDbUpdate(JsonDbObject(), object, JsonDbNotification::Create));
         }
+        updateObjects(changes);
     }
 }
 
@@ -151,6 +198,8 @@ bool JsonDbMapDefinition::compileMapFunctions(QJSEngine *scriptEngine, QJsonObje
                                 : definition.value(QStringLiteral("map")).toObject());
     QJSValue svJoinProxyValue = joinProxy ? scriptEngine->newQObject(joinProxy) : QJSValue(QJSValue::UndefinedValue);
     for (QJsonObject::const_iterator it = sourceFunctions.begin(); it != sourceFunctions.end(); ++it) {
+        if (it.value().isObject())
+            continue;
         const QString &sourceType = it.key();
         const QString &script = it.value().toString();
         QString jsonDbBinding;
@@ -200,61 +249,98 @@ void JsonDbMapDefinition::initIndexes()
 }
 
 void JsonDbMapDefinition::updateObject(const JsonDbObject &beforeObject, const JsonDbObject &afterObject, JsonDbUpdateList *changeList)
+{
+    JsonDbUpdateList changes;
+    changes.append(JsonDbUpdate(beforeObject, afterObject, JsonDbNotification::Update));
+    updateObjects(changes, changeList);
+}
+
+/*!
+    Maps the source object \a changes in batches of viewUpdateBatchSize. The
+    view objects derived from each batch are looked up together, the new
+    versions are mapped in one pass and the resulting view objects are
+    written with a single updateObjects call.
+*/
+void JsonDbMapDefinition::updateObjects(const JsonDbUpdateList &changes, JsonDbUpdateList *changeList)
 {
     initScriptEngine();
-    QHash<QString, JsonDbObject> unmappedObjects;
-    mEmittedObjects.clear();
+    int batchSize = qMax(1, jsondbSettings->viewUpdateBatchSize());
+
+    for (int start = 0; start < changes.size(); start += batchSize) {
+        // fold repeated changes to one source object together
+        QList<QString> sourceUuids;
+        QHash<QString, JsonDbUpdate> batch;
+        for (int i = start; i < changes.size() && i < start + batchSize; i++) {
+            const JsonDbUpdate &change = changes.at(i);
+            QString uuid = (change.newObject.isEmpty() ? change.oldObject : change.newObject).value(JsonDbString::kUuidStr).toString();
+            if (!batch.contains(uuid)) {
+                sourceUuids.append(uuid);
+                batch.insert(uuid, change);
+            } else if (!batch[uuid].merge(change)) {
+                sourceUuids.removeOne(uuid);
+                batch.remove(uuid);
+            }
+        }
 
-    if (!beforeObject.isEmpty()) {
-        QJsonValue uuid = beforeObject.value(JsonDbString::kUuidStr);
-        GetObjectsResult getObjectResponse = mTargetTable->getObjects(QStringLiteral("_sourceUuids.*"), uuid, mTargetType);
+        QList<QJsonValue> unmappedUuids;
+        foreach (const QString &uuid, sourceUuids) {
+            if (!batch.value(uuid).oldObject.isEmpty())
+                unmappedUuids.append(uuid);
+        }
+        QHash<QString, JsonDbObject> unmappedObjects;
+        GetObjectsResult getObjectResponse = mTargetTable->getObjects(QStringLiteral("_sourceUuids.*"), unmappedUuids, mTargetType);
         foreach (const JsonDbObject &unmappedObject, getObjectResponse.data) {
             QString uuid = unmappedObject.value(JsonDbString::kUuidStr).toString();
             unmappedObjects[uuid] = unmappedObject;
         }
-    }
-
-    if (!afterObject.isDeleted()) {
-        if (jsondbSettings->verbose())
-            qDebug() << "Mapping object" << afterObject;
-        mapObject(afterObject);
-    }
 
-    JsonDbObjectList objectsToUpdate;
-    for (QHash<QString, JsonDbObject>::const_iterator it = unmappedObjects.begin();
-         it != unmappedObjects.end();
-         ++it) {
-        JsonDbObject unmappedObject = it.value();
-        QString uuid = unmappedObject.value(JsonDbString::kUuidStr).toString();
-        if (mEmittedObjects.contains(uuid)) {
-            JsonDbObject emittedObject(mEmittedObjects.value(uuid));
-            emittedObject.insert(JsonDbString::kVersionStr, unmappedObject.value(JsonDbString::kVersionStr));
-            emittedObject.insert(JsonDbString::kOwnerStr, unmappedObject.value(JsonDbString::kOwnerStr));
-            if (emittedObject == it.value())
-                // skip duplicates
-                continue;
-            else
-                // update changed view objects
-                objectsToUpdate.append(emittedObject);
+        JsonDbObjectList afterObjects;
+        foreach (const QString &uuid, sourceUuids) {
+            const JsonDbObject &afterObject = batch.value(uuid).newObject;
+            if (!afterObject.isEmpty() && !afterObject.isDeleted())
+                afterObjects.append(afterObject);
+        }
+        mapObjects(afterObjects);
 
-            mEmittedObjects.remove(uuid);
-        } else {
-            // remove unmatched objects
-            unmappedObject.markDeleted();
-            if (jsondbSettings->verbose())
-                qDebug() << "Unmapping object" << unmappedObject;
-            objectsToUpdate.append(unmappedObject);
+        JsonDbObjectList objectsToUpdate;
+        for (QHash<QString, JsonDbObject>::const_iterator it = unmappedObjects.begin();
+             it != unmappedObjects.end();
+             ++it) {
+            JsonDbObject unmappedObject = it.value();
+            QString uuid = unmappedObject.value(JsonDbString::kUuidStr).toString();
+            if (mEmittedObjects.contains(uuid)) {
+                JsonDbObject emittedObject(mEmittedObjects.value(uuid));
+                emittedObject.insert(JsonDbString::kVersionStr, unmappedObject.value(JsonDbString::kVersionStr));
+                emittedObject.insert(JsonDbString::kOwnerStr, unmappedObject.value(JsonDbString::kOwnerStr));
+                if (emittedObject == it.value())
+                    // skip duplicates
+                    continue;
+                else
+                    // update changed view objects
+                    objectsToUpdate.append(emittedObject);
+
+                mEmittedObjects.remove(uuid);
+            } else {
+                // remove unmatched objects
+                unmappedObject.markDeleted();
+                if (jsondbSettings->verbose())
+                    qDebug() << "Unmapping object" << unmappedObject;
+                objectsToUpdate.append(unmappedObject);
+            }
         }
-    }
 
-    for (QHash<QString, JsonDbObject>::const_iterator it = mEmittedObjects.begin();
-         it != mEmittedObjects.end();
-         ++it)
-        objectsToUpdate.append(JsonDbObject(it.value()));
+        for (QHash<QString, JsonDbObject>::const_iterator it = mEmittedObjects.begin();
+             it != mEmittedObjects.end();
+             ++it)
+            objectsToUpdate.append(JsonDbObject(it.value()));
+        mEmittedObjects.clear();
 
-    JsonDbWriteResult res = mPartition->updateObjects(mOwner, objectsToUpdate, JsonDbPartition::ViewObject, changeList);
-    if (res.code != JsonDbError::NoError)
-        setError(QString::fromLatin1("Error creating view object: %1").arg(res.message));
+        if (objectsToUpdate.isEmpty())
+            continue;
+        JsonDbWriteResult res = mPartition->updateObjects(mOwner, objectsToUpdate, JsonDbPartition::ViewObject, changeList);
+        if (res.code != JsonDbError::NoError)
+            setError(QString::fromLatin1("Error creating view object: %1").arg(res.message));
+    }
 }
 
 QJSValue JsonDbMapDefinition::mapFunction(const QString &sourceType) const
@@ -265,15 +351,71 @@ QJSValue JsonDbMapDefinition::mapFunction(const QString &sourceType) const
         return QJSValue();
 }
 
+/*!
+    Maps \a objects into mEmittedObjects. Unless the definition is a join,
+    whose lookups read the partition, large sets are split into contiguous
+    shards mapped on the map thread pool. The shards are merged back in
+    order, so the result is the same as mapping the objects one by one.
+*/
+void JsonDbMapDefinition::mapObjects(const JsonDbObjectList &objects)
+{
+    mEmittedObjects.clear();
+
+    int threadCount = jsondbSettings->mapThreadCount();
+    int shardCount = qMin(threadCount, objects.size() / kMinParallelMapObjects);
+    // projections are cheaper to map here than to hand to another thread
+    if (mDefinition.contains(JsonDbString::kJoinStr) || mProjections.size() == mSourceTypes.size() || shardCount < 2) {
+        foreach (const JsonDbObject &object, objects) {
+            if (jsondbSettings->verbose())
+                qDebug() << "Mapping object" << object;
+            mapObject(object);
+        }
+        return;
+    }
+
+    if (jsondbSettings->verbose())
+        qDebug() << "Mapping" << objects.size() << "objects on" << shardCount << "threads";
+    QThreadPool *pool = mapThreadPool();
+    if (pool->maxThreadCount() != threadCount)
+        pool->setMaxThreadCount(threadCount);
+    // keep the threads, and the script engines they made
+    pool->setExpiryTimeout(-1);
+
+    QVector<JsonDbObjectList> emittedObjects(shardCount);
+    QVector<QString> errorMessages(shardCount);
+    QSemaphore done;
+    int shardSize = (objects.size() + shardCount - 1) / shardCount;
+    for (int i = 1; i < shardCount; i++)
+        pool->start(new JsonDbMapTask(this, objects.mid(i * shardSize, shardSize),
+                                      &emittedObjects[i], &errorMessages[i], &done));
+    for (int i = 0; i < shardSize; i++)
+        mapObject(objects.at(i));
+    done.acquire(shardCount - 1);
+
+    for (int i = 1; i < shardCount; i++) {
+        foreach (const JsonDbObject &emittedObject, emittedObjects.at(i))
+            mEmittedObjects.insert(emittedObject.value(JsonDbString::kUuidStr).toString(), emittedObject);
+        if (!errorMessages.at(i).isEmpty())
+            setError(errorMessages.at(i));
+    }
+}
+
 void JsonDbMapDefinition::mapObject(JsonDbObject object)
 {
     const QString &sourceType = object.value(JsonDbString::kTypeStr).toString();
 
-    QJSValue sv = mScriptEngine->toScriptValue(static_cast<QJsonObject>(object));
     QString uuid = object.value(JsonDbString::kUuidStr).toString();
     mSourceUuids.clear();
     mSourceUuids.append(mUuid); // depends on the map definition object
     mSourceUuids.append(uuid);  // depends on the source object
+
+    if (mProjections.contains(sourceType)) {
+        JsonDbObject newItem(viewObject(projectObject(sourceType, object), mSourceUuids));
+        mEmittedObjects.insert(newItem.value(JsonDbString::kUuidStr).toString(), newItem);
+        return;
+    }
+
+    QJSValue sv = mScriptEngine->toScriptValue(static_cast<QJsonObject>(object));
     QJSValue mapped;
 
     QJSValueList mapArgs;
@@ -284,21 +426,16 @@ void JsonDbMapDefinition::mapObject(JsonDbObject object)
         setError(QString::fromLatin1("Error executing map function: %1").arg(mapped.toString()));
 }
 
-void JsonDbMapDefinition::unmapObject(const JsonDbObject &object)
+QJsonObject JsonDbMapDefinition::projectObject(const QString &sourceType, const JsonDbObject &object) const
 {
-    Q_ASSERT(object.value(JsonDbString::kUuidStr).type() == QJsonValue::String);
-    QJsonValue uuid = object.value(JsonDbString::kUuidStr);
-    GetObjectsResult getObjectResponse = mTargetTable->getObjects(QStringLiteral("_sourceUuids.*"), uuid, mTargetType);
-    JsonDbObjectList dependentObjects = getObjectResponse.data;
-
-    for (int i = 0; i < dependentObjects.size(); i++) {
-        JsonDbObject dependentObject = dependentObjects.at(i);
-        if (dependentObject.value(JsonDbString::kTypeStr).toString() != mTargetType)
-            continue;
-
-        dependentObject.markDeleted();
-        mPartition->updateObject(mOwner, dependentObject, JsonDbPartition::ViewObject);
+    QJsonObject projected;
+    const QList<QPair<QString, QStringList> > paths = mProjections.value(sourceType);
+    for (int i = 0; i < paths.size(); i++) {
+        QJsonValue value = object.valueByPath(paths.at(i).second);
+        if (!value.isUndefined())
+            projected.insert(paths.at(i).first, value);
     }
+    return projected;
 }
 
 void JsonDbMapDefinition::lookupRequested(const QJSValue &query, const QJSValue &context)
@@ -352,11 +489,18 @@ void JsonDbMapDefinition::lookupRequested(const QJSValue &query, const QJSValue
 
 void JsonDbMapDefinition::viewObjectEmitted(const QJSValue &value)
 {
-    JsonDbObject newItem(mScriptEngine->fromScriptValue<QJsonObject>(value));
+    JsonDbObject newItem(viewObject(mScriptEngine->fromScriptValue<QJsonObject>(value), mSourceUuids));
+    QString uuid = newItem.value(JsonDbString::kUuidStr).toString();
+    mEmittedObjects.insert(uuid, newItem);
+}
+
+JsonDbObject JsonDbMapDefinition::viewObject(const QJsonObject &emitted, QStringList sourceUuids) const
+{
+    JsonDbObject newItem(emitted);
     newItem.insert(JsonDbString::kTypeStr, mTargetType);
-    mSourceUuids.sort();
+    sourceUuids.sort();
     QJsonArray sourceUuidArray;
-    foreach (const QString &sourceUuid, mSourceUuids)
+    foreach (const QString &sourceUuid, sourceUuids)
         sourceUuidArray.append(sourceUuid);
     newItem.insert(QStringLiteral("_sourceUuids"), sourceUuidArray);
 
@@ -369,7 +513,7 @@ void JsonDbMapDefinition::viewObjectEmitted(const QJSValue &value)
                 targetKeyString = JsonDbObject(newItem).valueByPath(mTargetKeyName).toString();
 
             // colon separated sorted source uuids
-            QString sourceUuidString = mSourceUuids.join(QStringLiteral(":"));
+            QString sourceUuidString = sourceUuids.join(QStringLiteral(":"));
             QString identifier =
                 QString::fromLatin1("%1:%2%3%4")
                 .arg(mTargetType)
@@ -380,9 +524,7 @@ void JsonDbMapDefinition::viewObjectEmitted(const QJSValue &value)
                            JsonDbObject::createUuidFromString(identifier).toString());
         }
     }
-
-    QString uuid = newItem.value(JsonDbString::kUuidStr).toString();
-    mEmittedObjects.insert(uuid, newItem);
+    return newItem;
 }
 
 bool JsonDbMapDefinition::isActive() const
@@ -450,8 +592,19 @@ bool JsonDbMapDefinition::validateDefinition(const JsonDbObject &map, JsonDbPart
             sourceTypes = sourceFunctions.keys();
 
             foreach (const QString &sourceType, sourceTypes) {
-                if (sourceFunctions.value(sourceType).toString().isEmpty())
+                QJsonValue function = sourceFunctions.value(sourceType);
+                if (function.isObject()) {
+                    QJsonObject projection = function.toObject();
+                    if (projection.isEmpty())
+                        message = QString::fromLatin1("projection for source type '%1' has no properties").arg(sourceType);
+                    for (QJsonObject::const_iterator it = projection.begin(); it != projection.end(); ++it) {
+                        if (it.value().toString().isEmpty())
+                            message = QString::fromLatin1("projection property '%1' for source type '%2' must be a source property path")
+                                    .arg(it.key()).arg(sourceType);
+                    }
+                } else if (function.toString().isEmpty()) {
                     message = QString::fromLatin1("map function for source type '%1' not specified for Map").arg(sourceType);
+                }
                 if (view->mMapDefinitionsBySource.contains(sourceType)
                     && view->mMapDefinitionsBySource.value(sourceType)->uuid() != uuid)
                     message = QString::fromLatin1("duplicate Map definition on source %1 and target %2")
@@ -470,6 +623,56 @@ bool JsonDbMapDefinition::validateDefinition(const JsonDbObject &map, JsonDbPart
     return message.isEmpty();
 }
 
+JsonDbMapWorker::JsonDbMapWorker(const JsonDbMapDefinition *definition)
+    : mDefinition(definition)
+    , mScriptEngine(0)
+    , mEmittedObjects(0)
+{
+}
+
+bool JsonDbMapWorker::initScriptEngine(const QJsonObject &definition, QString *errorMessage)
+{
+    mScriptEngine = JsonDbScriptEngine::scriptEngine();
+    // owned by the worker rather than the engine, which outlives it
+    JsonDbJoinProxy *joinProxy = new JsonDbJoinProxy(mDefinition->mOwner, mDefinition->mPartition, this);
+    connect(joinProxy, SIGNAL(viewObjectEmitted(QJSValue)),
+            this, SLOT(viewObjectEmitted(QJSValue)), Qt::DirectConnection);
+    return JsonDbMapDefinition::compileMapFunctions(mScriptEngine, definition, joinProxy, mMapFunctions, *errorMessage);
+}
+
+void JsonDbMapWorker::mapObjects(const QJsonObject &definition, const JsonDbObjectList &objects,
+                                 JsonDbObjectList *emittedObjects, QString *errorMessage)
+{
+    if (!initScriptEngine(definition, errorMessage))
+        return;
+
+    mEmittedObjects = emittedObjects;
+    foreach (const JsonDbObject &object, objects) {
+        const QString &sourceType = object.value(JsonDbString::kTypeStr).toString();
+        mSourceUuids.clear();
+        mSourceUuids.append(mDefinition->mUuid);
+        mSourceUuids.append(object.value(JsonDbString::kUuidStr).toString());
+
+        if (mDefinition->mProjections.contains(sourceType)) {
+            emittedObjects->append(mDefinition->viewObject(mDefinition->projectObject(sourceType, object), mSourceUuids));
+            continue;
+        }
+
+        QJSValueList mapArgs;
+        mapArgs << mScriptEngine->toScriptValue(static_cast<QJsonObject>(object));
+        QJSValue mapped = mMapFunctions.value(sourceType).call(mapArgs);
+        if (mapped.isError())
+            *errorMessage = QString::fromLatin1("Error executing map function: %1").arg(mapped.toString());
+    }
+    mEmittedObjects = 0;
+}
+
+void JsonDbMapWorker::viewObjectEmitted(const QJSValue &value)
+{
+    if (mEmittedObjects)
+        mEmittedObjects->append(mDefinition->viewObject(mScriptEngine->fromScriptValue<QJsonObject>(value), mSourceUuids));
+}
+
 #include "moc_jsondbmapdefinition.cpp"
 
 QT_END_NAMESPACE_JSONDB_PARTITION
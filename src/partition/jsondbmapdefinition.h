@@ -62,6 +62,7 @@ class JsonDbOwner;
 class JsonDbJoinProxy;
 class JsonDbMapProxy;
 class JsonDbObjectTable;
+class JsonDbMapWorker;
 
 class JsonDbMapDefinition : public QObject
 {
@@ -85,6 +86,7 @@ public:
 
     void setError(const QString &errorMsg);
     void updateObject(const JsonDbObject &before, const JsonDbObject &after, JsonDbUpdateList *changeList = 0);
+    void updateObjects(const JsonDbUpdateList &changes, JsonDbUpdateList *changeList = 0);
     static bool validateDefinition(const JsonDbObject &map, JsonDbPartition *partition, QString &message);
     static bool compileMapFunctions(QJSEngine *scriptEngine, QJsonObject definition, JsonDbJoinProxy *joinProxy, QMap<QString,QJSValue> &mapFunctions, QString &message);
 
@@ -94,7 +96,11 @@ public slots:
 
 private:
     void mapObject(JsonDbObject object);
-    void unmapObject(const JsonDbObject &object);
+    void mapObjects(const JsonDbObjectList &objects);
+    JsonDbObject viewObject(const QJsonObject &emitted, QStringList sourceUuids) const;
+    QJsonObject projectObject(const QString &sourceType, const JsonDbObject &object) const;
+
+    friend class JsonDbMapWorker;
 
 public slots:
     void initScriptEngine();
@@ -113,10 +119,38 @@ private:
     QStringList    mSourceTypes;
     JsonDbObjectTable   *mTargetTable;
     QMap<QString,JsonDbObjectTable *> mSourceTables;
+    // target property and source property path for each declarative source type
+    QHash<QString,QList<QPair<QString,QStringList> > > mProjections;
     QStringList    mSourceUuids; // a set of uuids with sorted elements
     QHash<QString,JsonDbObject> mEmittedObjects;
 };
 
+// Maps a shard of source objects for a JsonDbMapDefinition on a thread of
+// the map thread pool. It lives for one task and compiles the map functions
+// into that thread's engine, so they and its join proxy are released on the
+// thread that made them.
+class JsonDbMapWorker : public QObject
+{
+    Q_OBJECT
+public:
+    JsonDbMapWorker(const JsonDbMapDefinition *definition);
+
+    void mapObjects(const QJsonObject &definition, const JsonDbObjectList &objects,
+                    JsonDbObjectList *emittedObjects, QString *errorMessage);
+
+public slots:
+    void viewObjectEmitted(const QJSValue &value);
+
+private:
+    bool initScriptEngine(const QJsonObject &definition, QString *errorMessage);
+
+    const JsonDbMapDefinition *mDefinition;
+    QJSEngine     *mScriptEngine;
+    QMap<QString,QJSValue> mMapFunctions;
+    QStringList    mSourceUuids;
+    JsonDbObjectList *mEmittedObjects;
+};
+
 QT_END_NAMESPACE_JSONDB_PARTITION
 
 QT_END_HEADER
@@ -115,8 +115,11 @@ void JsonDbNotification::notifyIfMatches(JsonDbObjectTable *objectTable, const J
             JsonDbIndex *index = objectTable->index(indexName);
             if (index) {
                 QList<QJsonValue> indexValues = index->indexValues(r);
-                if (!indexValues.isEmpty())
-                    r.insert(JsonDbString::kIndexValueStr, indexValues.at(0));
+                if (!indexValues.isEmpty()) {
+                    r.insert(JsonDbString::kIndexValueStr, index->propertyValue(r, indexValues.at(0)));
+                    if (index->indexSpec().isCollated())
+                        r.insert(JsonDbString::kIndexSortKeyStr, indexValues.at(0));
+                }
             }
         }
 
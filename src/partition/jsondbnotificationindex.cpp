@@ -0,0 +1,415 @@
+/****************************************************************************
+**
+** Copyright (C) 2012 Digia Plc and/or its subsidiary(-ies).
+** Contact: http://www.qt-project.org/legal
+**
+** This file is part of the QtAddOn.JsonDb module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include <QJsonArray>
+#include <QtAlgorithms>
+#include <qnumeric.h>
+
+#include "jsondbindexquery.h"
+#include "jsondbnotificationindex.h"
+#include "jsondbquery.h"
+#include "jsondbstrings.h"
+
+QT_BEGIN_NAMESPACE_JSONDB_PARTITION
+
+static inline bool isRangeOp(JsonDbQueryTerm::Op op)
+{
+    return op == JsonDbQueryTerm::LessThanOp || op == JsonDbQueryTerm::LessEqualOp
+            || op == JsonDbQueryTerm::GreaterThanOp || op == JsonDbQueryTerm::GreaterEqualOp;
+}
+
+static inline bool isPlainTerm(const JsonDbQueryTerm &term)
+{
+    return term.hasPropertyName() && term.joinField().isEmpty();
+}
+
+/*!
+    Returns true if \a value passes the bounds, with the same comparisons as
+    JsonDbQuery::match().
+*/
+bool JsonDbNotificationIndex::Range::contains(const QJsonValue &value) const
+{
+    if (!lower.isUndefined()
+            && !(JsonDbIndexQuery::greaterThan(value, lower) || (lowerInclusive && value == lower)))
+        return false;
+    if (!upper.isUndefined()
+            && !(JsonDbIndexQuery::lessThan(value, upper) || (upperInclusive && value == upper)))
+        return false;
+    return true;
+}
+
+/*!
+    Works out where \a notification is filed. Only conjuncts that every
+    matching object has to satisfy are used, so that the lookup never misses
+    a notification whose query matches.
+*/
+JsonDbNotificationIndex::Registration JsonDbNotificationIndex::plan(JsonDbNotification *notification)
+{
+    Registration registration;
+    registration.notification = notification;
+
+    const JsonDbQuery &query = notification->parsedQuery();
+    const QList<JsonDbOrQueryTerm> &conjuncts = query.queryTerms;
+
+    // the bucket: a uuid, or the types the query is limited to
+    int keyed = -1;
+    for (int i = 0; i < conjuncts.size() && keyed < 0; i++) {
+        const QList<JsonDbQueryTerm> &terms = conjuncts.at(i).terms();
+        if (terms.size() == 1 && isPlainTerm(terms.at(0)) && terms.at(0).opCode() == JsonDbQueryTerm::EqualsOp
+                && terms.at(0).propertyName() == JsonDbString::kUuidStr && query.termValue(terms.at(0)).isString()) {
+            registration.uuid = query.termValue(terms.at(0)).toString();
+            keyed = i;
+            break;
+        }
+
+        QStringList types;
+        foreach (const JsonDbQueryTerm &term, terms) {
+            if (!isPlainTerm(term) || term.propertyName() != JsonDbString::kTypeStr) {
+                types.clear();
+                break;
+            }
+            QJsonValue value = query.termValue(term);
+            if (term.opCode() == JsonDbQueryTerm::EqualsOp && value.isString()) {
+                types.append(value.toString());
+            } else if (term.opCode() == JsonDbQueryTerm::InOp && value.isArray()) {
+                QJsonArray array = value.toArray();
+                int j = 0;
+                for (; j < array.size() && array.at(j).isString(); j++)
+                    types.append(array.at(j).toString());
+                if (j < array.size()) {
+                    types.clear();
+                    break;
+                }
+            } else {
+                types.clear();
+                break;
+            }
+        }
+        if (!types.isEmpty()) {
+            types.removeDuplicates();
+            registration.types = types;
+            keyed = i;
+        }
+    }
+    registration.generic = keyed < 0;
+
+    // the filter: a property compared for equality ...
+    for (int i = 0; i < conjuncts.size(); i++) {
+        if (i == keyed)
+            continue;
+        const QList<JsonDbQueryTerm> &terms = conjuncts.at(i).terms();
+        QString propertyName = terms.isEmpty() ? QString() : terms.at(0).propertyName();
+        QStringList valueKeys;
+        foreach (const JsonDbQueryTerm &term, terms) {
+            bool ok = isPlainTerm(term) && term.propertyName() == propertyName;
+            QJsonValue value = query.termValue(term);
+            QString key;
+            if (ok && term.opCode() == JsonDbQueryTerm::EqualsOp) {
+                ok = JsonDbQueryTerm::makeValueSetKey(value, &key);
+                valueKeys.append(key);
+            } else if (ok && term.opCode() == JsonDbQueryTerm::InOp && value.isArray()) {
+                QJsonArray array = value.toArray();
+                for (int j = 0; j < array.size() && ok; j++) {
+                    ok = JsonDbQueryTerm::makeValueSetKey(array.at(j), &key);
+                    valueKeys.append(key);
+                }
+            } else {
+                ok = false;
+            }
+            if (!ok) {
+                valueKeys.clear();
+                break;
+            }
+        }
+        if (!valueKeys.isEmpty()) {
+            valueKeys.removeDuplicates();
+            registration.propertyName = propertyName;
+            registration.valueKeys = valueKeys;
+            return registration;
+        }
+    }
+
+    // ... or else a range of numbers or strings
+    for (int i = 0; i < conjuncts.size(); i++) {
+        const QList<JsonDbQueryTerm> &terms = conjuncts.at(i).terms();
+        if (i == keyed || terms.size() != 1 || !isPlainTerm(terms.at(0)) || !isRangeOp(terms.at(0).opCode()))
+            continue;
+        QJsonValue value = query.termValue(terms.at(0));
+        if (!value.isDouble() && !value.isString())
+            continue;
+
+        registration.propertyName = terms.at(0).propertyName();
+        Range &range = registration.range;
+        // take the other bound from another conjunct if there is one
+        for (int j = i; j < conjuncts.size(); j++) {
+            const QList<JsonDbQueryTerm> &boundTerms = conjuncts.at(j).terms();
+            if (boundTerms.size() != 1)
+                continue;
+            const JsonDbQueryTerm &term = boundTerms.at(0);
+            if (!isPlainTerm(term) || term.propertyName() != registration.propertyName)
+                continue;
+            QJsonValue bound = query.termValue(term);
+            if (bound.type() != value.type())
+                continue;
+            switch (term.opCode()) {
+            case JsonDbQueryTerm::GreaterThanOp:
+            case JsonDbQueryTerm::GreaterEqualOp:
+                if (range.lower.isUndefined()) {
+                    range.lower = bound;
+                    range.lowerInclusive = term.opCode() == JsonDbQueryTerm::GreaterEqualOp;
+                }
+                break;
+            case JsonDbQueryTerm::LessThanOp:
+            case JsonDbQueryTerm::LessEqualOp:
+                if (range.upper.isUndefined()) {
+                    range.upper = bound;
+                    range.upperInclusive = term.opCode() == JsonDbQueryTerm::LessEqualOp;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+        return registration;
+    }
+
+    return registration;
+}
+
+void JsonDbNotificationIndex::insert(Bucket &bucket, JsonDbNotification *notification, const Registration &registration)
+{
+    if (registration.propertyName.isEmpty()) {
+        bucket.unfiltered.append(notification);
+        return;
+    }
+
+    Filter &filter = bucket.filters[registration.propertyName];
+    if (filter.fieldPath.isEmpty())
+        filter.fieldPath = registration.propertyName.split(QLatin1Char('.'));
+
+    if (!registration.valueKeys.isEmpty()) {
+        foreach (const QString &key, registration.valueKeys)
+            filter.values.insert(key, notification);
+        return;
+    }
+
+    Range range = registration.range;
+    range.notification = notification;
+    if (range.lower.isDouble() || range.upper.isDouble())
+        filter.numberRanges.insert(range.lower.isUndefined() ? -qInf() : range.lower.toDouble(), range);
+    else
+        filter.stringRanges.insert(range.lower.toString(), range);
+}
+
+void JsonDbNotificationIndex::remove(Bucket &bucket, JsonDbNotification *notification, const Registration &registration)
+{
+    if (registration.propertyName.isEmpty()) {
+        bucket.unfiltered.removeOne(notification);
+        return;
+    }
+
+    QHash<QString, Filter>::iterator it = bucket.filters.find(registration.propertyName);
+    if (it == bucket.filters.end())
+        return;
+    Filter &filter = it.value();
+
+    if (!registration.valueKeys.isEmpty()) {
+        foreach (const QString &key, registration.valueKeys)
+            filter.values.remove(key, notification);
+    } else {
+        const Range &range = registration.range;
+        if (range.lower.isDouble() || range.upper.isDouble()) {
+            double key = range.lower.isUndefined() ? -qInf() : range.lower.toDouble();
+            QMultiMap<double, Range>::iterator rt = filter.numberRanges.find(key);
+            while (rt != filter.numberRanges.end() && rt.key() == key) {
+                if (rt.value().notification == notification)
+                    rt = filter.numberRanges.erase(rt);
+                else
+                    ++rt;
+            }
+        } else {
+            QString key = range.lower.toString();
+            QMultiMap<QString, Range>::iterator rt = filter.stringRanges.find(key);
+            while (rt != filter.stringRanges.end() && rt.key() == key) {
+                if (rt.value().notification == notification)
+                    rt = filter.stringRanges.erase(rt);
+                else
+                    ++rt;
+            }
+        }
+    }
+
+    if (filter.values.isEmpty() && filter.numberRanges.isEmpty() && filter.stringRanges.isEmpty())
+        bucket.filters.erase(it);
+}
+
+void JsonDbNotificationIndex::insert(JsonDbNotification *notification)
+{
+    // a notification at the address of one deleted without being removed
+    if (mRegistrations.contains(notification))
+        remove(notification);
+
+    Registration registration = plan(notification);
+    if (registration.generic)
+        insert(mGeneric, notification, registration);
+    else if (registration.types.isEmpty())
+        insert(mUuids[registration.uuid], notification, registration);
+    foreach (const QString &type, registration.types)
+        insert(mTypes[type], notification, registration);
+    mRegistrations.insert(notification, registration);
+}
+
+void JsonDbNotificationIndex::remove(JsonDbNotification *notification)
+{
+    QHash<JsonDbNotification *, Registration>::iterator it = mRegistrations.find(notification);
+    if (it == mRegistrations.end())
+        return;
+    const Registration &registration = it.value();
+
+    if (registration.generic) {
+        remove(mGeneric, notification, registration);
+    } else if (registration.types.isEmpty()) {
+        QHash<QString, Bucket>::iterator bt = mUuids.find(registration.uuid);
+        if (bt != mUuids.end()) {
+            remove(bt.value(), notification, registration);
+            if (bt.value().unfiltered.isEmpty() && bt.value().filters.isEmpty())
+                mUuids.erase(bt);
+        }
+    }
+    foreach (const QString &type, registration.types) {
+        QHash<QString, Bucket>::iterator bt = mTypes.find(type);
+        if (bt != mTypes.end()) {
+            remove(bt.value(), notification, registration);
+            if (bt.value().unfiltered.isEmpty() && bt.value().filters.isEmpty())
+                mTypes.erase(bt);
+        }
+    }
+    mRegistrations.erase(it);
+}
+
+void JsonDbNotificationIndex::clear()
+{
+    mTypes.clear();
+    mUuids.clear();
+    mGeneric = Bucket();
+    mRegistrations.clear();
+}
+
+QList<JsonDbNotification *> JsonDbNotificationIndex::notifications() const
+{
+    QList<JsonDbNotification *> result;
+    foreach (const Registration &registration, mRegistrations) {
+        if (registration.notification)
+            result.append(registration.notification.data());
+    }
+    return result;
+}
+
+void JsonDbNotificationIndex::collect(const Bucket &bucket, const JsonDbObject &object,
+                                      QVector<JsonDbNotification *> *result)
+{
+    foreach (JsonDbNotification *notification, bucket.unfiltered)
+        result->append(notification);
+
+    QHash<QString, Filter>::const_iterator it = bucket.filters.constBegin();
+    for (; it != bucket.filters.constEnd(); ++it) {
+        const Filter &filter = it.value();
+        QJsonValue value = object.valueByPath(filter.fieldPath);
+
+        QString key;
+        if (!filter.values.isEmpty() && JsonDbQueryTerm::makeValueSetKey(value, &key)) {
+            QMultiHash<QString, JsonDbNotification *>::const_iterator vt = filter.values.constFind(key);
+            for (; vt != filter.values.constEnd() && vt.key() == key; ++vt)
+                result->append(vt.value());
+        }
+
+        if (value.isDouble()) {
+            QMultiMap<double, Range>::const_iterator end = filter.numberRanges.upperBound(value.toDouble());
+            for (QMultiMap<double, Range>::const_iterator rt = filter.numberRanges.constBegin(); rt != end; ++rt) {
+                if (rt.value().contains(value))
+                    result->append(rt.value().notification);
+            }
+        } else if (value.isString()) {
+            QMultiMap<QString, Range>::const_iterator end = filter.stringRanges.upperBound(value.toString());
+            for (QMultiMap<QString, Range>::const_iterator rt = filter.stringRanges.constBegin(); rt != end; ++rt) {
+                if (rt.value().contains(value))
+                    result->append(rt.value().notification);
+            }
+        }
+    }
+}
+
+void JsonDbNotificationIndex::collect(const JsonDbObject &object, QVector<JsonDbNotification *> *result) const
+{
+    QHash<QString, Bucket>::const_iterator it = mTypes.constFind(object.type());
+    if (it != mTypes.constEnd())
+        collect(it.value(), object, result);
+    if (!mUuids.isEmpty() && object.contains(JsonDbString::kUuidStr)) {
+        it = mUuids.constFind(object.value(JsonDbString::kUuidStr).toString());
+        if (it != mUuids.constEnd())
+            collect(it.value(), object, result);
+    }
+    collect(mGeneric, object, result);
+}
+
+QVector<JsonDbNotification *> JsonDbNotificationIndex::candidates(const JsonDbObject &oldObject,
+                                                                  const JsonDbObject &newObject) const
+{
+    QVector<JsonDbNotification *> result;
+    if (!oldObject.isEmpty())
+        collect(oldObject, &result);
+    collect(newObject, &result);
+
+    // drop duplicates and notifications that were deleted without being removed
+    qSort(result);
+    int live = 0;
+    for (int i = 0; i < result.size(); i++) {
+        if (i > 0 && result.at(i) == result.at(i - 1))
+            continue;
+        QHash<JsonDbNotification *, Registration>::const_iterator it = mRegistrations.constFind(result.at(i));
+        if (it != mRegistrations.constEnd() && it.value().notification)
+            result[live++] = result.at(i);
+    }
+    result.resize(live);
+    return result;
+}
+
+QT_END_NAMESPACE_JSONDB_PARTITION
@@ -0,0 +1,137 @@
+/****************************************************************************
+**
+** Copyright (C) 2012 Digia Plc and/or its subsidiary(-ies).
+** Contact: http://www.qt-project.org/legal
+**
+** This file is part of the QtAddOn.JsonDb module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef JSONDB_NOTIFICATIONINDEX_H
+#define JSONDB_NOTIFICATIONINDEX_H
+
+#include <QHash>
+#include <QMap>
+#include <QPointer>
+#include <QStringList>
+#include <QVector>
+
+#include "jsondbnotification.h"
+#include "jsondbpartitionglobal.h"
+
+QT_BEGIN_HEADER
+
+QT_BEGIN_NAMESPACE_JSONDB_PARTITION
+
+/*
+    Finds the notifications whose queries may match an updated object
+    without evaluating each query. A notification is filed under the types
+    or the uuid its query requires, or as generic, and within that under one
+    conjunct of its query that compares a property with constants: by value
+    for "=" and "in", by lower bound for a range. An object then only visits
+    the notifications filed under its own type, its uuid and its property
+    values, plus those for which no such conjunct was found.
+*/
+class Q_JSONDB_PARTITION_EXPORT JsonDbNotificationIndex
+{
+public:
+    void insert(JsonDbNotification *notification);
+    void remove(JsonDbNotification *notification);
+    void clear();
+
+    inline bool isEmpty() const { return mRegistrations.isEmpty(); }
+    QList<JsonDbNotification *> notifications() const;
+
+    // notifications whose queries may match oldObject or newObject, each once
+    QVector<JsonDbNotification *> candidates(const JsonDbObject &oldObject, const JsonDbObject &newObject) const;
+
+private:
+    struct Range {
+        Range() : lowerInclusive(false), upperInclusive(false), notification(0) {}
+        bool contains(const QJsonValue &value) const;
+
+        QJsonValue lower;
+        QJsonValue upper;
+        bool lowerInclusive;
+        bool upperInclusive;
+        JsonDbNotification *notification;
+    };
+
+    struct Filter {
+        QStringList fieldPath;
+        QMultiHash<QString, JsonDbNotification *> values;
+        // by lower bound, so that a lookup stops at the first range above the value
+        QMultiMap<double, Range> numberRanges;
+        QMultiMap<QString, Range> stringRanges;
+    };
+
+    struct Bucket {
+        QList<JsonDbNotification *> unfiltered;
+        QHash<QString, Filter> filters;
+    };
+
+    // the buckets hold plain pointers, a notification deleted without being
+    // removed is recognized by its registration
+    struct Registration {
+        Registration() : generic(false) {}
+
+        QPointer<JsonDbNotification> notification;
+        // filed under the types, or else the uuid unless generic
+        QStringList types;
+        QString uuid;
+        bool generic;
+        // the filtering conjunct, if any
+        QString propertyName;
+        QStringList valueKeys;
+        Range range;
+    };
+
+    static Registration plan(JsonDbNotification *notification);
+    static void insert(Bucket &bucket, JsonDbNotification *notification, const Registration &registration);
+    static void remove(Bucket &bucket, JsonDbNotification *notification, const Registration &registration);
+    static void collect(const Bucket &bucket, const JsonDbObject &object, QVector<JsonDbNotification *> *result);
+    void collect(const JsonDbObject &object, QVector<JsonDbNotification *> *result) const;
+
+    QHash<QString, Bucket> mTypes;
+    QHash<QString, Bucket> mUuids;
+    Bucket mGeneric;
+    QHash<JsonDbNotification *, Registration> mRegistrations;
+};
+
+QT_END_NAMESPACE_JSONDB_PARTITION
+
+QT_END_HEADER
+
+#endif // JSONDB_NOTIFICATIONINDEX_H
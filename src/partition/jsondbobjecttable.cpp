@@ -42,12 +42,18 @@
 #include <QFileInfo>
 #include <QDir>
 #include <QElapsedTimer>
+#include <QJsonArray>
 #include <QJsonDocument>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QVector>
 
 #include "jsondbobjecttable.h"
 #include "jsondbpartition_p.h"
 #include "jsondbindex.h"
 #include "jsondbindex_p.h"
+#include "jsondbindexbuilder.h"
 #include "jsondbstrings.h"
 #include "jsondbbtree.h"
 #include "jsondbobject.h"
@@ -70,16 +76,95 @@ bool isStateKey(const QByteArray &baStateKey)
         && (baStateKey.constData()[4] == 'S');
 }
 
+/*
+  The version an update replaced is stored in the state log as a delta
+  against the version that replaced it when that is smaller: a 'D' followed
+  by a binary JSON object holding the properties the update changed or
+  removed, as they were, and the names of the properties it added. Other
+  versions are stored as binary JSON documents, which start with "qbjs".
+*/
+static const char kVersionDeltaTag = 'D';
+
+static QByteArray encodeReplacedVersion(const QJsonObject &oldObject, const QJsonObject &newObject)
+{
+    QByteArray full = QJsonDocument(oldObject).toBinaryData();
+
+    QJsonObject replaced;
+    for (QJsonObject::const_iterator it = oldObject.constBegin(); it != oldObject.constEnd(); ++it) {
+        if (newObject.value(it.key()) != it.value())
+            replaced.insert(it.key(), it.value());
+    }
+    QJsonArray added;
+    for (QJsonObject::const_iterator it = newObject.constBegin(); it != newObject.constEnd(); ++it) {
+        if (!oldObject.contains(it.key()))
+            added.append(it.key());
+    }
+    QJsonObject delta;
+    delta.insert(QStringLiteral("replaced"), replaced);
+    delta.insert(QStringLiteral("added"), added);
+    QByteArray baDelta = kVersionDeltaTag + QJsonDocument(delta).toBinaryData();
+    return baDelta.size() < full.size() ? baDelta : full;
+}
+
+static QJsonObject decodeReplacedVersion(const QByteArray &baVersion, const QJsonObject &nextVersion)
+{
+    if (baVersion.isEmpty() || baVersion.at(0) != kVersionDeltaTag)
+        return QJsonDocument::fromBinaryData(baVersion).object();
+
+    QJsonObject delta = QJsonDocument::fromBinaryData(baVersion.mid(1)).object();
+    QJsonObject version(nextVersion);
+    QJsonArray added = delta.value(QStringLiteral("added")).toArray();
+    for (int i = 0; i < added.size(); i++)
+        version.remove(added.at(i).toString());
+    QJsonObject replaced = delta.value(QStringLiteral("replaced")).toObject();
+    for (QJsonObject::const_iterator it = replaced.constBegin(); it != replaced.constEnd(); ++it)
+        version.insert(it.key(), it.value());
+    return version;
+}
+
+// below this many deferred index updates per commit, handing them to other
+// threads costs more than it saves
+static const int kMinParallelIndexUpdates = 32;
+
+Q_GLOBAL_STATIC(QThreadPool, indexThreadPool)
+
+class JsonDbIndexUpdateTask : public QRunnable
+{
+public:
+    JsonDbIndexUpdateTask(JsonDbIndex *index, bool *ok, QSemaphore *done)
+        : mIndex(index), mOk(ok), mDone(done)
+    { }
+    void run()
+    {
+        *mOk = mIndex->applyPendingUpdates();
+        mDone->release();
+    }
+private:
+    JsonDbIndex *mIndex;
+    bool *mOk;
+    QSemaphore *mDone;
+};
+
 JsonDbObjectTable::JsonDbObjectTable(JsonDbPartition *partition) :
     QObject(partition)
   , mPartition(partition)
   , mBdb(0)
+  , mChangeCacheStart(0)
 {
     mBdb = new JsonDbBtree();
+    if (partition) {
+        connect(this, SIGNAL(indexBuildProgress(QString,quint64,quint64)),
+                partition, SIGNAL(indexBuildProgress(QString,quint64,quint64)));
+        connect(this, SIGNAL(indexBuildFinished(QString,bool)),
+                partition, SIGNAL(indexBuildFinished(QString,bool)));
+    }
 }
 
 JsonDbObjectTable::~JsonDbObjectTable()
 {
+    // the builders use their indexes until they are gone
+    qDeleteAll(mIndexBuilders);
+    mIndexBuilders.clear();
     delete mBdb;
     mBdb = 0;
 }
@@ -99,6 +184,14 @@ bool JsonDbObjectTable::open(const QString &fileName)
 
 void JsonDbObjectTable::close()
 {
+    foreach (JsonDbIndexBuilder *builder, mIndexBuilders) {
+        JsonDbIndex *index = builder->index();
+        delete builder;
+        delete index;
+    }
+    mIndexBuilders.clear();
+    mTypeCounts.clear();
+    mTypeCountChanges.clear();
     mBdb->close();
     closeIndexes();
 }
@@ -112,14 +205,71 @@ bool JsonDbObjectTable::begin()
 
 void JsonDbObjectTable::begin(JsonDbIndex *index)
 {
-    if (!index->bdb()->isWriting())
+    if (!index->isWriting())
         mBdbTransactions.append(index->begin());
 }
 
+/*!
+    Applies the index updates deferred by indexObject() and deindexObject(),
+    one task per index. Each index is a btree file with a transaction of its
+    own, so with enough updates the tasks run in parallel on a thread pool
+    and the commit takes about as long as the busiest index.
+
+    Returns false if an index could not be updated, now or when it was read
+    earlier in the transaction.
+*/
+bool JsonDbObjectTable::applyPendingIndexUpdates()
+{
+    bool ok = true;
+    QList<JsonDbIndex *> pending;
+    int updateCount = 0;
+    foreach (JsonDbIndex *index, mIndexes) {
+        if (index->hasFailedUpdates())
+            ok = false;
+        if (!index->hasPendingUpdates())
+            continue;
+        // the tasks must not touch the object table, so their transactions start here
+        begin(index);
+        updateCount += index->pendingUpdateCount();
+        pending.append(index);
+    }
+    if (pending.isEmpty())
+        return ok;
+
+    int threadCount = jsondbSettings->indexThreadCount();
+    if (pending.size() == 1 || threadCount < 1 || updateCount < kMinParallelIndexUpdates) {
+        foreach (JsonDbIndex *index, pending)
+            ok &= index->applyPendingUpdates();
+        return ok;
+    }
+
+    if (jsondbSettings->debugIndexes())
+        qDebug() << "ObjectTable::applyPendingIndexUpdates" << updateCount << "updates to" << pending.size() << "indexes";
+    QThreadPool *pool = indexThreadPool();
+    if (pool->maxThreadCount() != threadCount)
+        pool->setMaxThreadCount(threadCount);
+    QSemaphore done;
+    QVector<bool> results(pending.size(), true);
+    for (int i = 1; i < pending.size(); i++)
+        pool->start(new JsonDbIndexUpdateTask(pending.at(i), &results[i], &done));
+    results[0] = pending.at(0)->applyPendingUpdates();
+    done.acquire(pending.size() - 1);
+    for (int i = 0; i < results.size(); i++)
+        ok &= results.at(i);
+    return ok;
+}
+
 bool JsonDbObjectTable::commit(quint32 stateNumber)
 {
     Q_ASSERT(mBdb->isWriting());
 
+    // an index left behind the object table would answer queries wrongly,
+    // the caller aborts the transaction
+    if (!applyPendingIndexUpdates()) {
+        qCritical() << JSONDB_ERROR << "index update failed, not committing" << mFilename;
+        return false;
+    }
+
     QByteArray baStateKey(5, 0);
     makeStateKey(baStateKey, stateNumber);
     bool ok = mBdb->writeTransaction()->put(baStateKey, mStateChanges);
@@ -129,18 +279,27 @@ bool JsonDbObjectTable::commit(quint32 stateNumber)
         const JsonDbUpdate &change = mStateObjectChanges.at(i);
         const JsonDbObject &oldObject = change.oldObject;
         if (!oldObject.isEmpty()) {
-            bool ok = mBdb->writeTransaction()->put(baStateKey + oldObject.uuid().toRfc4122(), oldObject.toBinaryData());
+            // only an update is sure to be followed by a version to rebuild its delta from
+            QByteArray baOldObject = change.action == JsonDbNotification::Update
+                    ? encodeReplacedVersion(oldObject, change.newObject) : oldObject.toBinaryData();
+            bool ok = mBdb->writeTransaction()->put(baStateKey + oldObject.uuid().toRfc4122(), baOldObject);
             if (!ok)
                 qDebug() << "putting state object ok" << ok << "baStateKey" << baStateKey.toHex()
                          << "object" << oldObject;
         }
-        if (mChangeCache.size())
+        if (mChangeCacheStart)
             mChangeCache.insert(stateNumber, change);
     }
+    if (mChangeCacheStart)
+        trimChangeCache();
     mStateChanges.clear();
     mStateObjectChanges.clear();
     mStateNumber = stateNumber;
 
+    for (QHash<QString, int>::const_iterator it = mTypeCountChanges.constBegin(); it != mTypeCountChanges.constEnd(); ++it)
+        mTypeCounts[it.key()] += it.value();
+    mTypeCountChanges.clear();
+
     for (int i = 0; i < mBdbTransactions.size(); i++) {
         JsonDbBtree::Transaction *txn = mBdbTransactions.at(i);
         if (!txn->commit(stateNumber)) {
@@ -156,6 +315,9 @@ bool JsonDbObjectTable::abort()
     Q_ASSERT(mBdb->isWriting());
     mStateChanges.clear();
     mStateObjectChanges.clear();
+    mTypeCountChanges.clear();
+    foreach (JsonDbIndex *index, mIndexes)
+        index->discardPendingUpdates();
     for (int i = 0; i < mBdbTransactions.size(); i++) {
         JsonDbBtree::Transaction *txn = mBdbTransactions.at(i);
         txn->abort();
@@ -232,6 +394,7 @@ void JsonDbObjectTable::flushCaches()
         index->bdb()->setCacheSize(jsondbSettings->cacheSize());
     }
     mChangeCache.clear();
+    mChangeCacheStart = 0;
 }
 
 void JsonDbObjectTable::closeIndexes()
@@ -250,7 +413,14 @@ QList<JsonDbIndex *> JsonDbObjectTable::indexes() const
     return mIndexes.values();
 }
 
-bool JsonDbObjectTable::addIndex(const JsonDbIndexSpec &indexSpec)
+/*!
+    Adds an index described by \a indexSpec and fills it if needed. With
+    BuildInBackground, an index that has to be filled from a table with at
+    least indexBuildThreshold entries is built by a JsonDbIndexBuilder while
+    the event loop keeps running. It is not used by queries or updated by
+    writes until it is complete, see isIndexBuilding().
+*/
+bool JsonDbObjectTable::addIndex(const JsonDbIndexSpec &indexSpec, IndexBuildMode mode)
 {
     Q_ASSERT(indexSpec.propertyName.isEmpty() ^ indexSpec.propertyFunction.isEmpty());
     Q_ASSERT(!indexSpec.name.isEmpty());
@@ -258,7 +428,7 @@ bool JsonDbObjectTable::addIndex(const JsonDbIndexSpec &indexSpec)
     if (indexSpec.name.isEmpty())
         return false;
 
-    if (mIndexes.contains(indexSpec.name))
+    if (mIndexes.contains(indexSpec.name) || mIndexBuilders.contains(indexSpec.name))
         return true;
 
     JsonDbIndex *index = new JsonDbIndex(mFilename, this);
@@ -270,19 +440,64 @@ bool JsonDbObjectTable::addIndex(const JsonDbIndexSpec &indexSpec)
         delete index;
         return false;
     }
-    mIndexes.insert(indexSpec.name, index);
 
     if (mStateNumber && (index->stateNumber() == 0 || index->stateNumber() != mStateNumber)) {
+        int threshold = jsondbSettings->indexBuildThreshold();
+        // property functions run in the script engine, which cannot move to the builder's threads
+        if (mode == BuildInBackground && threshold > 0 && !indexSpec.hasPropertyFunction()
+                && mBdb->count() >= quint64(threshold)) {
+            JsonDbIndexBuilder *builder = new JsonDbIndexBuilder(this, index);
+            connect(builder, SIGNAL(progress(QString,quint64,quint64)),
+                    this, SIGNAL(indexBuildProgress(QString,quint64,quint64)));
+            connect(builder, SIGNAL(finished(QString,bool)),
+                    this, SLOT(indexBuilt(QString,bool)));
+            mIndexBuilders.insert(indexSpec.name, builder);
+            builder->start();
+            return true;
+        }
+        {
+            SnapshotBarrier barrier(mPartition ? mPartition->d_func() : 0);
+            mIndexes.insert(indexSpec.name, index);
+        }
         if (jsondbSettings->verbose())
             qDebug() << JSONDB_INFO << "reindexing index" << indexSpec.name << "at stateNumber" << index->stateNumber() << ", objectTable.stateNumber at stateNumber" << mStateNumber;
         index->clearData();
         reindexObjects(indexSpec.name, stateNumber());
+    } else {
+        SnapshotBarrier barrier(mPartition ? mPartition->d_func() : 0);
+        mIndexes.insert(indexSpec.name, index);
     }
     index->close(); // close it until it's actually needed
 
     return true;
 }
 
+bool JsonDbObjectTable::isIndexBuilding(const QString &indexName) const
+{
+    return mIndexBuilders.contains(indexName);
+}
+
+void JsonDbObjectTable::indexBuilt(const QString &indexName, bool ok)
+{
+    JsonDbIndexBuilder *builder = mIndexBuilders.take(indexName);
+    if (!builder)
+        return;
+    JsonDbIndex *index = builder->index();
+    builder->deleteLater();
+
+    {
+        SnapshotBarrier barrier(mPartition ? mPartition->d_func() : 0);
+        mIndexes.insert(indexName, index);
+    }
+    if (!ok) {
+        // start over in one go, the index is usable but was not built in the background
+        index->clearData();
+        reindexObjects(indexName, stateNumber());
+    }
+    index->close();
+    emit indexBuildFinished(indexName, ok);
+}
+
 bool JsonDbObjectTable::addIndexOnProperty(const QString &propertyName,
                                            const QString &propertyType,
                                            const QString &objectType)
@@ -301,9 +516,20 @@ bool JsonDbObjectTable::removeIndex(const QString &indexName)
     if (indexName == JsonDbString::kUuidStr || indexName == JsonDbString::kTypeStr)
         return true;
 
+    if (JsonDbIndexBuilder *builder = mIndexBuilders.take(indexName)) {
+        JsonDbIndex *index = builder->index();
+        delete builder;
+        QFile::remove(index->fileName());
+        delete index;
+        emit indexBuildFinished(indexName, false);
+        return true;
+    }
+
+    SnapshotBarrier barrier(mPartition ? mPartition->d_func() : 0);
     JsonDbIndex *index = mIndexes.take(indexName);
     if (!index)
         return false;
+    index->discardPendingUpdates();
 
     if (index->bdb()
             && index->bdb()->isWriting()) { // Incase index is removed via Jdb::remove( _type=Index )
@@ -360,12 +586,19 @@ void JsonDbObjectTable::indexObject(JsonDbObject object, quint32 stateNumber)
 {
     if (jsondbSettings->debug())
         qDebug() << "ObjectTable::indexObject" << object << mIndexes.keys();
+    if (!object.isDeleted() && mTypeCounts.contains(object.type()))
+        mTypeCountChanges[object.type()]++;
+    // property functions run in the script engine, which stays on this thread
+    bool defer = jsondbSettings->indexThreadCount() > 0;
     foreach (JsonDbIndex *index, mIndexes) {
         Q_ASSERT(mBdb->isWriting());
         const JsonDbIndexSpec &indexSpec = index->indexSpec();
         if (indexSpec.propertyName == JsonDbString::kUuidStr)
             continue;
-        index->indexObject(object, stateNumber);
+        if (defer && !indexSpec.hasPropertyFunction())
+            index->deferIndexObject(object, stateNumber);
+        else
+            index->indexObject(object, stateNumber);
     }
 }
 
@@ -373,7 +606,10 @@ void JsonDbObjectTable::deindexObject(JsonDbObject object, quint32 stateNumber)
 {
     if (jsondbSettings->debug())
         qDebug() << "ObjectTable::deindexObject" << object << mIndexes.keys();
+    if (!object.isDeleted() && mTypeCounts.contains(object.type()))
+        mTypeCountChanges[object.type()]--;
 
+    bool defer = jsondbSettings->indexThreadCount() > 0;
     foreach (JsonDbIndex *index, mIndexes) {
         Q_ASSERT(mBdb->isWriting());
         const JsonDbIndexSpec &indexSpec = index->indexSpec();
@@ -381,7 +617,10 @@ void JsonDbObjectTable::deindexObject(JsonDbObject object, quint32 stateNumber)
             qDebug() << "ObjectTable::deindexObject" << indexSpec.propertyName;
         if (indexSpec.propertyName == JsonDbString::kUuidStr)
             continue;
-        index->deindexObject(object, stateNumber);
+        if (defer && !indexSpec.hasPropertyFunction())
+            index->deferDeindexObject(object, stateNumber);
+        else
+            index->deindexObject(object, stateNumber);
     }
 }
 
@@ -412,6 +651,28 @@ void JsonDbObjectTable::updateIndex(JsonDbIndex *index)
 }
 
 
+/*!
+    Returns the number of objects of type \a objectType in \a count if it
+    is known. Counts become known through setTypeCount() and are then kept up
+    to date by indexObject() and deindexObject() as transactions commit.
+*/
+bool JsonDbObjectTable::typeCount(const QString &objectType, int *count) const
+{
+    QHash<QString, int>::const_iterator it = mTypeCounts.constFind(objectType);
+    if (it == mTypeCounts.constEnd())
+        return false;
+    *count = it.value();
+    return true;
+}
+
+void JsonDbObjectTable::setTypeCount(const QString &objectType, int count)
+{
+    // a count taken inside a write transaction includes uncommitted objects
+    if (mBdb->isWriting())
+        return;
+    mTypeCounts.insert(objectType, count);
+}
+
 bool JsonDbObjectTable::get(const ObjectKey &objectKey, QJsonObject *object, bool includeDeleted)
 {
     QByteArray baObjectKey(objectKey.toByteArray());
@@ -426,6 +687,39 @@ bool JsonDbObjectTable::get(const ObjectKey &objectKey, QJsonObject *object, boo
     return true;
 }
 
+/*!
+    Reads the objects for \a objectKeys within one transaction, visiting the
+    keys in sorted order. \a objects receives one entry per key, empty when
+    the object is missing or deleted. Returns true if any object was found.
+*/
+bool JsonDbObjectTable::get(const QList<ObjectKey> &objectKeys, QList<QJsonObject> *objects, bool includeDeleted)
+{
+    QMap<QByteArray, int> sortedKeys;
+    for (int i = 0; i < objectKeys.size(); i++)
+        sortedKeys.insertMulti(objectKeys.at(i).toByteArray(), i);
+
+    objects->clear();
+    for (int i = 0; i < objectKeys.size(); i++)
+        objects->append(QJsonObject());
+
+    bool found = false;
+    bool inTransaction = mBdb->isWriting();
+    JsonDbBtree::Transaction *txn = inTransaction ? mBdb->writeTransaction() : mBdb->beginWrite();
+    for (QMap<QByteArray, int>::const_iterator it = sortedKeys.constBegin(); it != sortedKeys.constEnd(); ++it) {
+        QByteArray baObject;
+        if (!txn->get(it.key(), &baObject))
+            continue;
+        QJsonObject o(QJsonDocument::fromBinaryData(baObject).object());
+        if (!includeDeleted && o.value(JsonDbString::kDeletedStr).toBool())
+            continue;
+        (*objects)[it.value()] = o;
+        found = true;
+    }
+    if (!inTransaction)
+        txn->abort();
+    return found;
+}
+
 bool JsonDbObjectTable::put(const ObjectKey &objectKey, const JsonDbObject &object)
 {
     QByteArray baObjectKey(objectKey.toByteArray());
@@ -534,6 +828,144 @@ GetObjectsResult JsonDbObjectTable::getObjects(const QString &keyName, const QJs
     return result;
 }
 
+/*!
+    Returns the objects whose \a keyName matches any of \a keyValues, each
+    object at most once. The index is walked with one cursor and the objects
+    are then read with a single sorted multi-get.
+*/
+GetObjectsResult JsonDbObjectTable::getObjects(const QString &keyName, const QList<QJsonValue> &keyValues, const QString &objectType)
+{
+    GetObjectsResult result;
+    if (keyValues.isEmpty())
+        return result;
+
+    if (!mIndexes.contains(keyName)) {
+        QSet<QString> seen;
+        foreach (const QJsonValue &keyValue, keyValues) {
+            GetObjectsResult single = getObjects(keyName, keyValue, objectType);
+            if (!single.error.isNull())
+                result.error = single.error;
+            foreach (const JsonDbObject &object, single.data) {
+                QString uuid = object.value(JsonDbString::kUuidStr).toString();
+                if (seen.contains(uuid))
+                    continue;
+                seen.insert(uuid);
+                result.data.append(object);
+            }
+        }
+        return result;
+    }
+
+    JsonDbIndex *index = mIndexes.value(keyName);
+    QMap<QByteArray, QJsonValue> forwardKeys;
+    foreach (const QJsonValue &keyValue, keyValues) {
+        QJsonValue fieldValue = JsonDbIndexPrivate::makeFieldValue(keyValue, index->indexSpec().propertyType);
+        JsonDbIndexPrivate::truncateFieldValue(&fieldValue, index->indexSpec().propertyType);
+        forwardKeys.insert(JsonDbIndexPrivate::makeForwardKey(fieldValue, ObjectKey()), fieldValue);
+    }
+
+    QMap<QByteArray, ObjectKey> objectKeys;
+    bool isInTransaction = index->bdb()->writeTransaction();
+    JsonDbBtree::Transaction *txn = index->bdb()->writeTransaction() ? index->bdb()->writeTransaction() : index->bdb()->beginWrite();
+    JsonDbBtree::Cursor cursor(txn);
+    for (QMap<QByteArray, QJsonValue>::const_iterator it = forwardKeys.constBegin(); it != forwardKeys.constEnd(); ++it) {
+        if (!cursor.seekRange(it.key()))
+            continue;
+        do {
+            QByteArray checkKey;
+            QByteArray forwardValue;
+            if (!cursor.current(&checkKey, &forwardValue))
+                break;
+            QJsonValue checkValue;
+            JsonDbIndexPrivate::forwardKeySplit(checkKey, checkValue);
+            if (checkValue != it.value())
+                break;
+
+            ObjectKey objectKey;
+            JsonDbIndexPrivate::forwardValueSplit(forwardValue, objectKey);
+            objectKeys.insert(objectKey.toByteArray(), objectKey);
+        } while (cursor.next());
+    }
+    if (!isInTransaction)
+        txn->abort();
+
+    QList<QJsonObject> objects;
+    get(objectKeys.values(), &objects);
+    foreach (const QJsonObject &object, objects) {
+        if (object.isEmpty())
+            continue;
+        if (!objectType.isEmpty() && object.value(JsonDbString::kTypeStr).toString() != objectType)
+            continue;
+        result.data.append(object);
+    }
+    return result;
+}
+
+/*!
+    Returns the index on \a propertyName that holds the values of every
+    object as they are, without collation or case folding, or 0.
+*/
+JsonDbIndex *JsonDbObjectTable::exactIndex(const QString &propertyName) const
+{
+    foreach (JsonDbIndex *candidate, mIndexes) {
+        const JsonDbIndexSpec &spec = candidate->indexSpec();
+        if (spec.propertyName == propertyName && spec.objectTypes.isEmpty()
+                && spec.caseSensitivity == Qt::CaseSensitive && spec.collation.isEmpty() && !spec.isText())
+            return candidate;
+    }
+    return 0;
+}
+
+/*!
+    Adds to \a objectKeys the uuids of the objects whose \a propertyName
+    property has \a value, read from the index on that property without
+    fetching the objects. The result may include a few objects with other
+    values (after index type conversion or truncation) but never misses
+    one. Returns false if no index covers every object with that property
+    as is, or if more than \a limit objects have been collected.
+*/
+bool JsonDbObjectTable::findObjectKeys(const QString &propertyName, const QJsonValue &value, int limit, QSet<QUuid> *objectKeys)
+{
+    if (propertyName.isEmpty() || propertyName == JsonDbString::kUuidStr)
+        return false;
+
+    JsonDbIndex *index = exactIndex(propertyName);
+    if (!index)
+        return false;
+
+    QJsonValue fieldValue = JsonDbIndexPrivate::makeFieldValue(value, index->indexSpec().propertyType);
+    if (fieldValue.isUndefined())
+        return false;
+    JsonDbIndexPrivate::truncateFieldValue(&fieldValue, index->indexSpec().propertyType);
+    QByteArray forwardKey = JsonDbIndexPrivate::makeForwardKey(fieldValue, ObjectKey());
+
+    bool ok = true;
+    bool isInTransaction = index->bdb()->writeTransaction();
+    JsonDbBtree::Transaction *txn = isInTransaction ? index->bdb()->writeTransaction() : index->bdb()->beginWrite();
+    JsonDbBtree::Cursor cursor(txn);
+    if (cursor.seekRange(forwardKey)) {
+        do {
+            QByteArray checkKey;
+            QByteArray forwardValue;
+            cursor.current(&checkKey, &forwardValue);
+            QJsonValue checkValue;
+            JsonDbIndexPrivate::forwardKeySplit(checkKey, checkValue);
+            if (checkValue != fieldValue)
+                break;
+            ObjectKey objectKey;
+            JsonDbIndexPrivate::forwardValueSplit(forwardValue, objectKey);
+            objectKeys->insert(objectKey.key);
+            if (objectKeys->size() > limit) {
+                ok = false;
+                break;
+            }
+        } while (cursor.next());
+    }
+    if (!isInTransaction)
+        txn->abort();
+    return ok;
+}
+
 quint32 JsonDbObjectTable::storeStateChange(const ObjectKey &key, const JsonDbUpdate &change)
 {
     quint32 stateNumber = mStateNumber + 1;
@@ -548,6 +980,121 @@ quint32 JsonDbObjectTable::storeStateChange(const ObjectKey &key, const JsonDbUp
     return stateNumber;
 }
 
+/*!
+    Reads the changes committed to this table in states \a first to \a last
+    into \a changes, oldest first. The state log is walked with one cursor:
+    the key of each state sorts right before the keys of the versions its
+    changes replaced, so those are read along with it. The current versions
+    of the changed objects are then read in one pass over their sorted keys.
+
+    Replaced versions stored as deltas are rebuilt newest first from the
+    version that followed them. \a laterVersions holds that version for
+    the objects changed again after \a last, the current one is used for
+    the others.
+*/
+void JsonDbObjectTable::readChangeLog(quint32 first, quint32 last, const QHash<QByteArray, QJsonObject> &laterVersions,
+                                      QList<QPair<quint32, JsonDbUpdate> > *changes)
+{
+    bool inTransaction = mBdb->isWriting();
+    JsonDbBtree::Transaction *txn = inTransaction ? mBdb->writeTransaction() : mBdb->beginWrite();
+
+    QList<ObjectKey> objectKeys;
+    QList<QByteArray> replacedVersions;
+    QHash<QByteArray, int> stateChanges; // last change of the current state by object key
+    quint32 stateNumber = 0;
+
+    QByteArray baStateKey(5, 0);
+    makeStateKey(baStateKey, first);
+    JsonDbBtree::Cursor cursor(txn);
+    if (cursor.seekRange(baStateKey)) {
+        do {
+            QByteArray baKey;
+            QByteArray baValue;
+            cursor.current(&baKey, &baValue);
+            if (baKey.size() < 4)
+                continue;
+            // keys sort by their leading bytes, so no state up to last follows a key past it
+            quint32 keyStateNumber = qFromBigEndian<quint32>((const uchar *)baKey.constData());
+            if (keyStateNumber > last)
+                break;
+            // object keys are 16 bytes, the versions replaced in a state 21
+            if ((baKey.size() != 5 && baKey.size() != 21) || baKey.constData()[4] != 'S')
+                continue;
+
+            if (baKey.size() == 21) {
+                QHash<QByteArray, int>::const_iterator it = stateChanges.constFind(baKey.mid(5));
+                if (keyStateNumber == stateNumber && it != stateChanges.constEnd())
+                    replacedVersions[it.value()] = baValue;
+                continue;
+            }
+
+            if (baValue.size() % 20 != 0) {
+                qWarning() << __FUNCTION__ << __LINE__ << "state size must be a multiplier 20"
+                           << baValue.size() << baValue.toHex();
+                continue;
+            }
+            stateNumber = keyStateNumber;
+            stateChanges.clear();
+            for (int i = 0; i < baValue.size() / 20; ++i) {
+                const uchar *data = (const uchar *)baValue.constData() + i*20;
+                ObjectKey objectKey = qFromBigEndian<ObjectKey>(data);
+                quint32 action = qFromBigEndian<quint32>(data + 16);
+                stateChanges.insert(objectKey.toByteArray(), changes->size());
+                changes->append(qMakePair(stateNumber, JsonDbUpdate(JsonDbObject(), JsonDbObject(), JsonDbNotification::Action(action))));
+                objectKeys.append(objectKey);
+                replacedVersions.append(QByteArray());
+            }
+        } while (cursor.next());
+    }
+
+    QList<QJsonObject> objects;
+    get(objectKeys, &objects, true);
+
+    // the version that followed the change being looked at, by object key
+    QHash<QByteArray, QJsonObject> nextVersions(laterVersions);
+    QHash<QByteArray, quint32> nextStates;
+    for (int i = changes->size() - 1; i >= 0; i--) {
+        QPair<quint32, JsonDbUpdate> &change = (*changes)[i];
+        change.second.newObject = objects.at(i);
+        QByteArray baObjectKey = objectKeys.at(i).toByteArray();
+
+        QHash<QByteArray, quint32>::const_iterator nextState = nextStates.constFind(baObjectKey);
+        if (nextState != nextStates.constEnd() && nextState.value() == change.first) {
+            // changed more than once in this state, the replaced version is stored once
+            if (change.second.action != JsonDbNotification::Create)
+                change.second.oldObject = nextVersions.value(baObjectKey);
+            continue;
+        }
+        QHash<QByteArray, QJsonObject>::const_iterator next = nextVersions.constFind(baObjectKey);
+        QJsonObject replaced = decodeReplacedVersion(replacedVersions.at(i),
+                                                     next != nextVersions.constEnd() ? next.value() : objects.at(i));
+        if (change.second.action != JsonDbNotification::Create)
+            change.second.oldObject = replaced;
+        nextVersions.insert(baObjectKey, replaced);
+        nextStates.insert(baObjectKey, change.first);
+
+        if (jsondbSettings->debug())
+            qDebug() << "change" << change.second.action << endl << change.second.oldObject << endl << change.second.newObject;
+    }
+
+    if (!inTransaction)
+        txn->abort();
+}
+
+/*!
+    Drops the oldest states from the change cache until it holds no more
+    than JSONDB_CHANGE_LOG_CACHE_SIZE changes.
+*/
+void JsonDbObjectTable::trimChangeCache()
+{
+    int maxChanges = jsondbSettings->changeLogCacheSize();
+    while (!mChangeCache.isEmpty() && mChangeCache.size() > maxChanges) {
+        quint32 stateNumber = mChangeCache.begin().key();
+        mChangeCache.remove(stateNumber);
+        mChangeCacheStart = stateNumber + 1;
+    }
+}
+
 quint32 JsonDbObjectTable::changesSince(quint32 startingStateNumber, QMap<ObjectKey,JsonDbUpdate> *changes)
 {
     if (!changes)
@@ -561,105 +1108,71 @@ quint32 JsonDbObjectTable::changesSince(quint32 startingStateNumber, QMap<Object
 
     // prune older changes
     // TODO: should do this more systematically
-    if (!mChangeCache.isEmpty()) {
-        quint32 firstChangeInCache = mChangeCache.begin().key();
+    if (mChangeCacheStart) {
         quint32 extraVersions = jsondbSettings->changeLogCacheVersions();
-        if (firstChangeInCache + extraVersions < startingStateNumber) {
+        if (mChangeCacheStart + extraVersions < startingStateNumber) {
             if (jsondbSettings->verbose())
-                qDebug() << "ChangeCache" << "dropping" << firstChangeInCache
+                qDebug() << "ChangeCache" << "dropping" << mChangeCacheStart
                          << "to" << startingStateNumber - extraVersions << mFilename;
-            for (quint32 i = firstChangeInCache; i < startingStateNumber - extraVersions; i++)
-                while (mChangeCache.contains(i))
-                    mChangeCache.remove(i);
+            QMultiMap<quint32,JsonDbUpdate>::iterator it = mChangeCache.begin();
+            while (it != mChangeCache.end() && it.key() < startingStateNumber - extraVersions)
+                it = mChangeCache.erase(it);
+            mChangeCacheStart = startingStateNumber - extraVersions;
         }
     }
-    if (jsondbSettings->verbose() && !mChangeCache.contains(startingStateNumber) && startingStateNumber <= currentStateNumber) {
-        if (!mChangeCache.isEmpty())
-            qDebug() << "ChangesSince" << "fetching" << startingStateNumber << "to" << mChangeCache.begin().key() << "/" << currentStateNumber << mFilename;
-        else
-            qDebug() << "ChangesSince" << "fetching" << startingStateNumber << "to" << currentStateNumber << mFilename;
-    }
-    {
-        bool inTransaction = mBdb->writeTransaction();
-        JsonDbBtree::Transaction *txn = mBdb->writeTransaction() ? mBdb->writeTransaction() : mBdb->beginWrite();
-
-        // read in the changes we need
-        for (quint32 stateNumber = startingStateNumber; stateNumber <= currentStateNumber; stateNumber++) {
 
-            // skip this one if we've already fetched this state number
-            if (mChangeCache.contains(stateNumber))
-                continue;
-
-            QByteArray baStateKey(5, 0);
-            makeStateKey(baStateKey, stateNumber);
-            QByteArray baObject;
-            bool ok = txn->get(baStateKey, &baObject);
-            // if this table did not have a transaction on this state number, then continue
-            if (!ok)
-                continue;
+    QMap<ObjectKey,JsonDbUpdate> changeMap; // collect one change per uuid
+    quint32 cachedStateNumber = startingStateNumber; // the first state merged from the cache
 
-            if (baObject.size() % 20 != 0) {
-                qWarning() << __FUNCTION__ << __LINE__ << "state size must be a multiplier 20"
-                           << baObject.size() << baObject.toHex();
-                continue;
+    // the cache holds every change from mChangeCacheStart on, read the ones before from the state log
+    if (startingStateNumber <= currentStateNumber && (!mChangeCacheStart || startingStateNumber < mChangeCacheStart)) {
+        quint32 lastStateNumber = mChangeCacheStart ? mChangeCacheStart - 1 : currentStateNumber;
+        if (jsondbSettings->verbose())
+            qDebug() << "ChangesSince" << "fetching" << startingStateNumber << "to" << lastStateNumber << "/" << currentStateNumber << mFilename;
+
+        // the versions the cached changes replaced follow the ones in the log
+        QHash<QByteArray, QJsonObject> laterVersions;
+        if (mChangeCacheStart) {
+            for (QMultiMap<quint32,JsonDbUpdate>::const_iterator it = mChangeCache.constBegin(); it != mChangeCache.constEnd(); ++it) {
+                QByteArray baObjectKey = ObjectKey(it.value().newObject.uuid()).toByteArray();
+                if (!laterVersions.contains(baObjectKey))
+                    laterVersions.insert(baObjectKey, it.value().oldObject);
             }
+        }
 
-            for (int i = 0; i < baObject.size() / 20; ++i) {
-                const uchar *data = (const uchar *)baObject.constData() + i*20;
-                ObjectKey objectKey = qFromBigEndian<ObjectKey>(data);
-                QByteArray baObjectKey(objectKey.key.toRfc4122());
-                quint32 action = qFromBigEndian<quint32>(data + 16);
-                QByteArray baValue;
-                QJsonObject oldObject;
-                if ((action != JsonDbNotification::Create)
-                        && mBdb->getOne(baStateKey + baObjectKey, &baValue)) {
-                    oldObject = QJsonDocument::fromBinaryData(baValue).object();
-                    Q_ASSERT(objectKey == ObjectKey(oldObject.value(JsonDbString::kUuidStr).toString()));
-                }
-                QJsonObject newObject;
-                mBdb->getOne(baObjectKey, &baValue);
-                newObject = QJsonDocument::fromBinaryData(baValue).object();
-                if (jsondbSettings->debug())
-                    qDebug() << "change" << action << endl << oldObject << endl << newObject;
-
-                JsonDbUpdate change(oldObject, newObject, JsonDbNotification::Action(action));
-                mChangeCache.insert(stateNumber, change);
-            }
+        QList<QPair<quint32, JsonDbUpdate> > logChanges;
+        readChangeLog(startingStateNumber, lastStateNumber, laterVersions, &logChanges);
+        cachedStateNumber = lastStateNumber + 1;
+        for (int i = 0; i < logChanges.size(); i++) {
+            const JsonDbUpdate &change = logChanges.at(i).second;
+            ObjectKey objectKey(change.newObject.uuid());
+            QMap<ObjectKey,JsonDbUpdate>::iterator previous = changeMap.find(objectKey);
+            if (previous == changeMap.end())
+                changeMap.insert(objectKey, change);
+            else if (!previous.value().merge(change))
+                changeMap.erase(previous);
+        }
 
+        // keep them for the next caller if they fit
+        if (mChangeCache.size() + logChanges.size() <= jsondbSettings->changeLogCacheSize()) {
+            for (int i = 0; i < logChanges.size(); i++)
+                mChangeCache.insert(logChanges.at(i).first, logChanges.at(i).second);
+            mChangeCacheStart = startingStateNumber;
         }
-        if (!inTransaction)
-            txn->abort();
     }
 
-    QMap<ObjectKey,JsonDbUpdate> changeMap; // collect one change per uuid
-    for (QMultiMap<quint32,JsonDbUpdate>::const_iterator it = mChangeCache.lowerBound(startingStateNumber);
+    // the changes read from the log above are merged already, even if they are cached now
+    for (QMultiMap<quint32,JsonDbUpdate>::const_iterator it = mChangeCache.lowerBound(cachedStateNumber);
          it != mChangeCache.end(); ++it) {
         const JsonDbUpdate &change = it.value();
         const JsonDbObject newObject = change.newObject;
         ObjectKey objectKey(newObject.uuid());
 
-        if (changeMap.contains(objectKey)) {
-            const JsonDbUpdate &oldChange = changeMap.value(objectKey);
-            // create followed by delete cancels out
-            JsonDbNotification::Action newAction = change.action;
-            JsonDbNotification::Action oldAction = oldChange.action;
-
-            if ((oldAction == JsonDbNotification::Create)
-                && (newAction == JsonDbNotification::Remove)) {
-                changeMap.remove(objectKey);
-            } else {
-                JsonDbUpdate combinedChange;
-                if (newAction == JsonDbNotification::Remove)
-                    combinedChange.action = JsonDbNotification::Remove;
-                else
-                    combinedChange.action = JsonDbNotification::Update;
-                combinedChange.oldObject = oldChange.oldObject;
-                combinedChange.newObject = change.newObject;
-                changeMap.insert(objectKey, combinedChange);
-            }
-        } else {
+        QMap<ObjectKey,JsonDbUpdate>::iterator previous = changeMap.find(objectKey);
+        if (previous == changeMap.end())
             changeMap.insert(objectKey, change);
-        }
+        else if (!previous.value().merge(change))
+            changeMap.erase(previous);
     }
     *changes = changeMap;
 
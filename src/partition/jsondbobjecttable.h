@@ -46,6 +46,7 @@
 #include <QHash>
 #include <QList>
 #include <QPair>
+#include <QSet>
 #include <QtEndian>
 
 #include "jsondbobjectkey.h"
@@ -64,6 +65,7 @@ QT_BEGIN_HEADER
 QT_BEGIN_NAMESPACE_JSONDB_PARTITION
 
 class JsonDbBtree;
+class JsonDbIndexBuilder;
 
 inline QDebug &operator<<(QDebug &qdb, const JsonDbUpdate &oc)
 {
@@ -125,8 +127,12 @@ public:
 
     JsonDbIndex *index(const QString &indexName);
     QList<JsonDbIndex *> indexes() const;
+    bool isIndexBuilding(const QString &indexName) const;
 
-    bool addIndex(const JsonDbIndexSpec &indexSpec);
+    enum IndexBuildMode {
+        BuildNow, BuildInBackground
+    };
+    bool addIndex(const JsonDbIndexSpec &indexSpec, IndexBuildMode mode=BuildNow);
     bool addIndexOnProperty(const QString &propertyName,
                             const QString &propertyType = QLatin1String("string"),
                             const QString &objectType = QString());
@@ -136,33 +142,58 @@ public:
     void deindexObject(JsonDbObject object, quint32 stateNumber);
     void updateIndex(JsonDbIndex *index);    
 
+    bool typeCount(const QString &objectType, int *count) const;
+    void setTypeCount(const QString &objectType, int count);
+
     bool get(const ObjectKey &objectKey, QJsonObject *object, bool includeDeleted=false);
+    bool get(const QList<ObjectKey> &objectKeys, QList<QJsonObject> *objects, bool includeDeleted=false);
     bool put(const ObjectKey &objectKey, const JsonDbObject &object);
     bool remove(const ObjectKey &objectKey);
 
     QString errorMessage() const;
 
     GetObjectsResult getObjects(const QString &keyName, const QJsonValue &keyValue, const QString &objectType);
+    GetObjectsResult getObjects(const QString &keyName, const QList<QJsonValue> &keyValues, const QString &objectType);
+    JsonDbIndex *exactIndex(const QString &propertyName) const;
+    bool findObjectKeys(const QString &propertyName, const QJsonValue &value, int limit, QSet<QUuid> *objectKeys);
+
+Q_SIGNALS:
+    void indexBuildProgress(const QString &indexName, quint64 processedCount, quint64 totalCount);
+    void indexBuildFinished(const QString &indexName, bool built);
+
+private Q_SLOTS:
+    void indexBuilt(const QString &indexName, bool ok);
 
 private:
     quint32 changesSince(quint32 stateNumber, QMap<ObjectKey,JsonDbUpdate> *changes);
+    void readChangeLog(quint32 first, quint32 last, const QHash<QByteArray, QJsonObject> &laterVersions,
+                       QList<QPair<quint32, JsonDbUpdate> > *changes);
+    void trimChangeCache();
+    bool applyPendingIndexUpdates();
 
 private:
     JsonDbPartition *mPartition;
     QString             mFilename;
     JsonDbBtree      *mBdb;
     QHash<QString, JsonDbIndex *> mIndexes; // indexed by full path, e.g., _type or _name.first
+    QHash<QString, JsonDbIndexBuilder *> mIndexBuilders; // indexes being built, not yet in mIndexes
     QVector<JsonDbBtree::Transaction *> mBdbTransactions;
 
     quint32 mStateNumber;
 
     QMultiMap<quint32,JsonDbUpdate> mChangeCache;
+    quint32 mChangeCacheStart; // mChangeCache holds every change from this state on, 0 if none
+
+    // number of live objects per type, only for types that have been counted once
+    QHash<QString, int> mTypeCounts;
+    QHash<QString, int> mTypeCountChanges; // uncommitted changes to mTypeCounts
 
     // intermediate state changes until the commit is called
     QByteArray mStateChanges;
     QList<JsonDbUpdate> mStateObjectChanges;
 
     Q_DISABLE_COPY(JsonDbObjectTable)
+    friend class JsonDbIndexBuilder;
 };
 
 void makeStateKey(QByteArray &baStateKey, quint32 stateNumber);
@@ -142,20 +142,17 @@ bool JsonDbOwner::isAllowed(JsonDbObject &object, const QString &partition,
     else
         // Capability queries with _typeDomain should fail, if there is not long enough domain
         typeDomain = QStringLiteral("public.domain.fail.");
-    QJsonValue tdval = QJsonValue(typeDomain);
+    QMap<QString, QJsonValue> typeDomainBinding;
+    typeDomainBinding.insert(QStringLiteral("typeDomain"), QJsonValue(typeDomain));
 
-    QList<JsonDbQuery> queries = mAllowedObjectQueries[partition][op];
+    const QList<JsonDbQuery> &queries = mAllowedObjectQueries[partition][op];
     for (int i = 0; i < queries.size(); ++i) {
-        JsonDbQuery query = queries.at(i);
-        query.bindings.insert(QStringLiteral("typeDomain"), tdval);
-        if (query.match(object, NULL, NULL))
+        if (queries.at(i).match(object, NULL, NULL, typeDomainBinding))
             return true;
     }
-    queries = mAllowedObjectQueries[QStringLiteral("all")][op];
-    for (int i = 0; i < queries.size(); ++i) {
-        JsonDbQuery query = queries.at(i);
-        query.bindings.insert(QStringLiteral("typeDomain"), tdval);
-        if (query.match(object, NULL, NULL))
+    const QList<JsonDbQuery> &allQueries = mAllowedObjectQueries[QStringLiteral("all")][op];
+    for (int i = 0; i < allQueries.size(); ++i) {
+        if (allQueries.at(i).match(object, NULL, NULL, typeDomainBinding))
             return true;
     }
     if (jsondbSettings->verbose()) {
@@ -54,6 +54,7 @@
 #include <QTimerEvent>
 #include <QMap>
 #include <QByteArray>
+#include <QDataStream>
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -73,6 +74,7 @@
 #include "jsondberrors.h"
 #include "jsondbpartition.h"
 #include "jsondbpartition_p.h"
+#include "jsondbpartitionsnapshot.h"
 #include "jsondbindex.h"
 #include "jsondbindex_p.h"
 #include "jsondbindexquery.h"
@@ -96,6 +98,7 @@ JsonDbPartitionPrivate::JsonDbPartitionPrivate(JsonDbPartition *q)
     , mDefaultOwner(0)
     , mIsOpen(false)
     , mDiskSpaceStatus(JsonDbPartition::UnknownStatus)
+    , mSnapshotLock(QReadWriteLock::Recursive)
 {
     mMainSyncTimer = new QTimer(q);
     mMainSyncTimer->setInterval(jsondbSettings->syncInterval() < 1000 ? 5000 : jsondbSettings->syncInterval());
@@ -106,9 +109,15 @@ JsonDbPartitionPrivate::JsonDbPartitionPrivate(JsonDbPartition *q)
     mIndexSyncTimer->setInterval(jsondbSettings->indexSyncInterval() < 1000 ? 12000 : jsondbSettings->indexSyncInterval());
     mIndexSyncTimer->setTimerType(Qt::VeryCoarseTimer);
     QObject::connect(mIndexSyncTimer, SIGNAL(timeout()), q, SLOT(_q_indexSyncTimer()));
+
+    mReplayTimer = new QTimer(q);
+    mReplayTimer->setSingleShot(true);
+    mReplayTimer->setInterval(0);
+    QObject::connect(mReplayTimer, SIGNAL(timeout()), q, SLOT(_q_replayHistory()));
 }
 
 JsonDbPartitionPrivate::~JsonDbPartitionPrivate() {
+    qDeleteAll(mReplays);
 
 }
 
@@ -123,61 +132,91 @@ JsonDbObjectTable *JsonDbPartitionPrivate::findObjectTable(const QString &object
 
 void JsonDbPartitionPrivate::updateEagerViews(const QSet<QString> &eagerViewTypes, const JsonDbUpdateList &changes)
 {
-    QSet<QString> viewTypes(eagerViewTypes);
     JsonDbUpdateList changeList(changes);
 
-    QSet<QString> viewsUpdated;
-
     if (jsondbSettings->verbose())
-        qDebug() << JSONDB_INFO << " stateNumber" << mObjectTable->stateNumber() << "view types:" << viewTypes << "{";
+        qDebug() << JSONDB_INFO << " stateNumber" << mObjectTable->stateNumber() << "view types:" << eagerViewTypes << "{";
+
+    // the views to update are the eager views of the changed types and every
+    // eager view fed by one of those, directly or through other views
+    QSet<QString> viewTypes;
+    QList<QString> pending(eagerViewTypes.toList());
+    while (!pending.isEmpty()) {
+        QString targetType = pending.takeFirst();
+        if (viewTypes.contains(targetType))
+            continue;
+        if (!mViews.value(targetType)) {
+            if (jsondbSettings->verbose())
+                qWarning() << JSONDB_WARN << "non-view viewType?" << targetType << "eager views to update" << eagerViewTypes;
+            continue;
+        }
+        viewTypes.insert(targetType);
+        if (mEagerViewSourceGraph.contains(targetType)) {
+            const ViewEdgeWeights &edgeWeights = mEagerViewSourceGraph[targetType];
+            for (ViewEdgeWeights::const_iterator it = edgeWeights.begin(); it != edgeWeights.end(); ++it) {
+                if (it.value() == 0)
+                    continue;
+                pending.append(it.key());
+            }
+        }
+    }
+
+    // order them so that each view is updated after the views it reads from,
+    // one level of mutually independent views at a time
+    QHash<QString, int> sourcesPending;
+    QHash<QString, QStringList> dependentViews;
+    QList<QString> ready;
+    foreach (const QString &targetType, viewTypes) {
+        QSet<QString> typesNeeded(mViews.value(targetType)->sourceTypeSet());
+        typesNeeded.intersect(viewTypes);
+        sourcesPending.insert(targetType, typesNeeded.size());
+        foreach (const QString &sourceType, typesNeeded)
+            dependentViews[sourceType].append(targetType);
+        if (typesNeeded.isEmpty())
+            ready.append(targetType);
+    }
+
+    int level = 0;
+    int viewsUpdated = 0;
+    while (!ready.isEmpty()) {
+        qSort(ready);
+        if (jsondbSettings->verbose())
+            qDebug() << "updating eager views" << ready << "at level" << level;
 
-    while (!viewTypes.isEmpty()) {
-        bool madeProgress = false;
-        foreach (const QString &targetType, viewTypes) {
+        // views of one level do not read each other, so they all see the changes of the levels before
+        JsonDbUpdateList levelChanges;
+        QList<QString> next;
+        foreach (const QString &targetType, ready) {
             JsonDbView *view = mViews.value(targetType);
-            if (!view) {
-                if (jsondbSettings->verbose())
-                    qWarning() << JSONDB_WARN << "non-view viewType?" << targetType << "eager views to update" << viewTypes;
-                viewTypes.remove(targetType);
-                madeProgress = true;
-                continue;
-            }
-            QSet<QString> typesNeeded(view->sourceTypeSet());
-            typesNeeded.intersect(viewTypes);
-            if (!typesNeeded.isEmpty())
-                continue;
-            viewTypes.remove(targetType);
             QList<JsonDbUpdate> additionalChanges;
             view->updateEagerView(changeList, &additionalChanges);
-            viewsUpdated.insert(targetType);
+            viewsUpdated++;
             if (jsondbSettings->verbose())
                 qDebug() << "updated eager view" << targetType << "with" << additionalChanges.size() << "additional changes:" << additionalChanges;
-            changeList.append(additionalChanges);
-            // if this triggers other eager types, we need to update that also
-            if (mEagerViewSourceGraph.contains(targetType)) {
-                const ViewEdgeWeights &edgeWeights = mEagerViewSourceGraph[targetType];
-                for (ViewEdgeWeights::const_iterator it = edgeWeights.begin(); it != edgeWeights.end(); ++it) {
-                    if (it.value() == 0)
-                        continue;
-                    const QString &viewType = it.key();
-                    if (viewsUpdated.contains(viewType))
-                        qWarning() << JSONDB_WARN << "view update cycle detected. Target type" << targetType << "view type" << viewType << "views updated:" << viewsUpdated;
-                    else
-                        viewTypes.insert(viewType);
-                }
-            }
+            levelChanges.append(additionalChanges);
 
-            madeProgress = true;
+            foreach (const QString &viewType, dependentViews.value(targetType)) {
+                if (--sourcesPending[viewType] == 0)
+                    next.append(viewType);
+            }
         }
-        if (!madeProgress) {
-            qCritical() << JSONDB_ERROR << "failed to update any views" << viewTypes;
-            break;
+        changeList.append(levelChanges);
+        ready = next;
+        level++;
+    }
+
+    if (viewsUpdated < viewTypes.size()) {
+        QStringList cycle;
+        for (QHash<QString, int>::const_iterator it = sourcesPending.constBegin(); it != sourcesPending.constEnd(); ++it) {
+            if (it.value() > 0)
+                cycle.append(it.key());
         }
+        qCritical() << JSONDB_ERROR << "view update cycle detected, failed to update views" << cycle;
     }
 
     updateEagerViewStateNumbers();
-    foreach (JsonDbNotification *n, mKeyedNotifications.values()) {
-        if (n && n->lastStateNumber() == mObjectTable->stateNumber())
+    foreach (JsonDbNotification *n, mNotifications.notifications()) {
+        if (n->lastStateNumber() == mObjectTable->stateNumber())
             n->notifyStateChange();
     }
 
@@ -214,14 +253,56 @@ void JsonDbPartitionPrivate::updateEagerViewStateNumbers()
         qDebug() << "}";
 }
 
+/*!
+    Brings a new notification \a n up to date before it sees live changes.
+
+    Started from state 0, it replays the objects that match its query as
+    created, in chunks of JSONDB_HISTORICAL_REPLAY_CHUNK_SIZE read from a
+    snapshot of the partition, one chunk per turn of the event loop.
+    Started from a later state, it replays the changes since then in
+    chunks of the same size. Those are read from the change log on the
+    first turn rather than at registration, but all at once: replaced
+    versions are stored as deltas of the version that followed them, so
+    they can only be rebuilt newest first. Either way the state number the
+    replay starts from is recorded, and once the replay is done the changes
+    made since are caught up from the change log in one go, after which the
+    notification goes live. Live notifications of the commits up to then
+    are dropped.
+
+    Queries on views, joins and queries sorted outside of an index cannot
+    be read in chunks from a snapshot and are still replayed at once.
+*/
 void JsonDbPartitionPrivate::notifyHistoricalChanges(JsonDbNotification *n)
 {
     Q_Q(JsonDbPartition);
-    quint32 stateNumber = n->initialStateNumber();;
+    quint32 stateNumber = n->initialStateNumber();
     quint32 lastStateNumber = mObjectTable->stateNumber();
     const JsonDbQuery &parsedQuery = n->parsedQuery();
     QSet<QString> matchedTypes = parsedQuery.matchedTypes();
-    QList<JsonDbObjectTable*> objectTables;
+
+    if (n->objectTable() == mObjectTable) {
+        JsonDbHistoricalReplay *replay = new JsonDbHistoricalReplay;
+        replay->notification = n;
+        replay->stateNumber = lastStateNumber;
+
+        if (stateNumber == 0) {
+            if (q->isIndexOrdered(n->owner(), parsedQuery))
+                replay->snapshot = q->createSnapshot();
+            if (replay->snapshot && !replay->snapshot->canQuery(parsedQuery)) {
+                delete replay->snapshot;
+                replay->snapshot = 0;
+            }
+        }
+
+        if (stateNumber != 0 || replay->snapshot) {
+            mReplays.append(replay);
+            mReplayedUntil.insert(n, quint32(-1));
+            if (!mReplayTimer->isActive())
+                mReplayTimer->start();
+            return;
+        }
+        delete replay;
+    }
 
     if (stateNumber == 0) {
         JsonDbObject oldObject;
@@ -231,6 +312,7 @@ void JsonDbPartitionPrivate::notifyHistoricalChanges(JsonDbNotification *n)
             n->notifyIfMatches(queryRes.objectTable, oldObject, o, action, lastStateNumber);
         }
     } else {
+        QList<JsonDbObjectTable*> objectTables;
         foreach (const QString matchedType, matchedTypes) {
             JsonDbObjectTable *objectTable = findObjectTable(matchedType);
             if (objectTables.contains(objectTable))
@@ -240,27 +322,141 @@ void JsonDbPartitionPrivate::notifyHistoricalChanges(JsonDbNotification *n)
             quint32 objectTableStateNumber = objectTable->changesSince(stateNumber, matchedTypes, &updateList);
             if (jsondbSettings->verbose() && lastStateNumber != objectTableStateNumber)
                 qDebug() << JSONDB_INFO << "old object table for type" << matchedType << objectTableStateNumber << lastStateNumber;
-            foreach (const JsonDbUpdate &update, updateList) {
-                JsonDbObject before = update.oldObject;
-                JsonDbObject after = update.newObject;
-                bool beforeMatch = before.isEmpty() ? false : parsedQuery.match(before, 0, 0);
-                bool afterMatch = after.isDeleted() ? false : parsedQuery.match(after, 0, 0);
-                JsonDbNotification::Action action = JsonDbNotification::Update;
-
-                if (!beforeMatch && !afterMatch)
-                    continue;
-                if (!beforeMatch)
-                    action = JsonDbNotification::Create;
-                else if (!afterMatch)
-                    action = JsonDbNotification::Remove;
-
-                n->notifyIfMatches(objectTable, before, after, action, lastStateNumber);
-            }
+            replayChanges(n, objectTable, updateList, lastStateNumber);
         }
     }
     n->notifyStateChange();
 }
 
+/*!
+    Notifies \a n of \a count of \a changes starting at \a from, or of
+    the rest of them if \a count is -1, as of \a stateNumber.
+*/
+void JsonDbPartitionPrivate::replayChanges(JsonDbNotification *n, JsonDbObjectTable *objectTable,
+                                           const JsonDbUpdateList &changes, quint32 stateNumber, int from, int count)
+{
+    const JsonDbQuery &parsedQuery = n->parsedQuery();
+    int end = count < 0 ? changes.size() : qMin(changes.size(), from + count);
+    for (int i = from; i < end; i++) {
+        const JsonDbUpdate &update = changes.at(i);
+        const JsonDbObject &before = update.oldObject;
+        const JsonDbObject &after = update.newObject;
+        bool beforeMatch = before.isEmpty() ? false : parsedQuery.match(before, 0, 0);
+        bool afterMatch = after.isDeleted() ? false : parsedQuery.match(after, 0, 0);
+        JsonDbNotification::Action action = JsonDbNotification::Update;
+
+        if (!beforeMatch && !afterMatch)
+            continue;
+        if (!beforeMatch)
+            action = JsonDbNotification::Create;
+        else if (!afterMatch)
+            action = JsonDbNotification::Remove;
+
+        n->notifyIfMatches(objectTable, before, after, action, stateNumber);
+    }
+}
+
+/*!
+    Catches the notification of \a replay up with the changes since the
+    replay started and hands it over to live notifications.
+*/
+void JsonDbPartitionPrivate::finishReplay(JsonDbHistoricalReplay *replay)
+{
+    JsonDbNotification *n = replay->notification;
+    JsonDbUpdateList changes;
+    quint32 stateNumber = mObjectTable->changesSince(replay->stateNumber, n->parsedQuery().matchedTypes(), &changes);
+    replayChanges(n, mObjectTable, changes, stateNumber);
+    // the commits up to stateNumber may still be queued for _q_objectsUpdated()
+    mReplayedUntil.insert(n, stateNumber);
+    n->notifyStateChange();
+}
+
+/*!
+    Drops the replays of \a n, or all of them if \a n is 0.
+*/
+void JsonDbPartitionPrivate::removeReplays(JsonDbNotification *n)
+{
+    for (int i = mReplays.size() - 1; i >= 0; i--) {
+        JsonDbHistoricalReplay *replay = mReplays.at(i);
+        if (n && replay->notification != n)
+            continue;
+        mReplays.removeAt(i);
+        delete replay->snapshot;
+        delete replay;
+    }
+    if (n)
+        mReplayedUntil.remove(n);
+    else
+        mReplayedUntil.clear();
+    if (mReplays.isEmpty())
+        mReplayTimer->stop();
+}
+
+/*!
+    Replays the next chunk to the notification at the head of the queue,
+    which then goes to the back unless its replay is done.
+*/
+void JsonDbPartitionPrivate::_q_replayHistory()
+{
+    Q_Q(JsonDbPartition);
+
+    while (!mReplays.isEmpty() && !mReplays.first()->notification) {
+        JsonDbHistoricalReplay *replay = mReplays.takeFirst();
+        delete replay->snapshot;
+        delete replay;
+    }
+    if (mReplays.isEmpty())
+        return;
+    if (mTransactionDepth) {
+        mReplayTimer->start();
+        return;
+    }
+
+    JsonDbHistoricalReplay *replay = mReplays.takeFirst();
+    JsonDbNotification *n = replay->notification;
+    int chunkSize = qMax(1, jsondbSettings->historicalReplayChunkSize());
+    bool done = false;
+
+    if (n->initialStateNumber() == 0) {
+        JsonDbQueryResult queryRes;
+        if (!replay->snapshot
+                || !replay->snapshot->queryObjects(n->owner(), n->parsedQuery(), chunkSize, 0, replay->continuation, &queryRes)) {
+            // the snapshot was retired by a change to the indexes or views, read on from the partition;
+            // objects changed since the replay started may then be reported twice
+            delete replay->snapshot;
+            replay->snapshot = 0;
+            queryRes = q->queryObjects(n->owner(), n->parsedQuery(), chunkSize, 0, replay->continuation);
+        }
+        if (queryRes.code != JsonDbError::NoError && jsondbSettings->debug())
+            qDebug() << JSONDB_WARN << "replay of" << n->parsedQuery().query << "failed:" << queryRes.message;
+        foreach (const JsonDbObject &o, queryRes.data)
+            n->notifyIfMatches(queryRes.objectTable, JsonDbObject(), o, JsonDbNotification::Create, replay->stateNumber);
+        replay->continuation = queryRes.continuation;
+        done = replay->continuation.isEmpty();
+    } else {
+        if (!replay->changesRead) {
+            // registration does not wait for the change log, it is read on the first turn
+            replay->stateNumber = mObjectTable->changesSince(n->initialStateNumber(), n->parsedQuery().matchedTypes(),
+                                                             &replay->changes);
+            replay->changesRead = true;
+        }
+        replayChanges(n, mObjectTable, replay->changes, replay->stateNumber, replay->next, chunkSize);
+        replay->next += chunkSize;
+        done = replay->next >= replay->changes.size();
+    }
+
+    if (done) {
+        delete replay->snapshot;
+        replay->snapshot = 0;
+        finishReplay(replay);
+        delete replay;
+    } else {
+        mReplays.append(replay);
+    }
+    if (!mReplays.isEmpty())
+        mReplayTimer->start();
+}
+
 /*!
   Updates the per-partition information on eager views.
 
@@ -335,7 +531,7 @@ void JsonDbPartitionPrivate::_q_indexSyncTimer()
     mIndexSyncTimer->stop();
 }
 
-void JsonDbPartitionPrivate::_q_objectsUpdated(bool viewUpdated, const JsonDbUpdateList &changes)
+void JsonDbPartitionPrivate::_q_objectsUpdated(bool viewUpdated, const JsonDbUpdateList &changes, quint32 commitStateNumber)
 {
     QList<JsonDbUpdate> updatesToEagerViews;
     QSet<QString> eagerViewTypes;
@@ -346,6 +542,18 @@ void JsonDbPartitionPrivate::_q_objectsUpdated(bool viewUpdated, const JsonDbUpd
     if (jsondbSettings->debug())
         qDebug() << JSONDB_INFO << "objectsUpdated" << mSpec.name << partitionStateNumber;
 
+    if (!viewUpdated && !mReplayedUntil.isEmpty()) {
+        // notifications caught up to an earlier commit are live from now on, the
+        // others have this commit replayed or still to come from the change log
+        QHash<const JsonDbNotification *, quint32>::iterator it = mReplayedUntil.begin();
+        while (it != mReplayedUntil.end()) {
+            if (it.value() < commitStateNumber)
+                it = mReplayedUntil.erase(it);
+            else
+                ++it;
+        }
+    }
+
     foreach (const JsonDbUpdate &updated, changes) {
 
         JsonDbObject oldObject = updated.oldObject;
@@ -359,12 +567,7 @@ void JsonDbPartitionPrivate::_q_objectsUpdated(bool viewUpdated, const JsonDbUpd
         JsonDbObjectTable *objectTable = findObjectTable(objectType);
         stateNumber = objectTable->stateNumber();
 
-        QStringList notificationKeys;
         if (!oldObjectType.isEmpty() || !objectType.isEmpty()) {
-            notificationKeys << objectType;
-            if (!oldObjectType.isEmpty() && objectType.compare(oldObjectType))
-                notificationKeys << oldObjectType;
-
             // eagerly update views if this object that was created isn't a view type itself
             if (jsondbSettings->verbose())
                 qDebug() << JSONDB_INFO << "objectType" << oldObjectType << mEagerViewSourceGraph.contains(oldObjectType) << objectType << mEagerViewSourceGraph.contains(objectType);
@@ -407,19 +610,10 @@ void JsonDbPartitionPrivate::_q_objectsUpdated(bool viewUpdated, const JsonDbUpd
 
         }
 
-        if (object.contains(JsonDbString::kUuidStr))
-            notificationKeys << object.value(JsonDbString::kUuidStr).toString();
-        notificationKeys << QStringLiteral("__generic_notification__");
-
-        for (int i = 0; i < notificationKeys.size(); i++) {
-            QString key = notificationKeys[i];
-            for (QMultiHash<QString, QPointer<JsonDbNotification> >::const_iterator it = mKeyedNotifications.find(key);
-                 (it != mKeyedNotifications.end()) && (it.key() == key);
-                 ++it) {
-                JsonDbNotification *n = it.value();
-                if (n)
-                    n->notifyIfMatches(objectTable, oldObject, object, action, stateNumber);
-            }
+        foreach (JsonDbNotification *n, mNotifications.candidates(oldObject, object)) {
+            if (!viewUpdated && mReplayedUntil.contains(n))
+                continue;
+            n->notifyIfMatches(objectTable, oldObject, object, action, stateNumber);
         }
     }
 
@@ -431,8 +625,8 @@ void JsonDbPartitionPrivate::_q_objectsUpdated(bool viewUpdated, const JsonDbUpd
     } if (updatesToEagerViews.isEmpty()) {
         updateEagerViewStateNumbers();
 
-        foreach (JsonDbNotification *n, mKeyedNotifications.values()) {
-            if (n && n->lastStateNumber() == mObjectTable->stateNumber())
+        foreach (JsonDbNotification *n, mNotifications.notifications()) {
+            if (n->lastStateNumber() == mObjectTable->stateNumber() && !mReplayedUntil.contains(n))
                 n->notifyStateChange();
         }
     } else {
@@ -440,11 +634,32 @@ void JsonDbPartitionPrivate::_q_objectsUpdated(bool viewUpdated, const JsonDbUpd
     }
 }
 
+/*!
+    Combines this change with \a later, a change to the same object that
+    followed it, keeping the object as it was before the first and as it is
+    after the second. A create stays a create until the object is removed,
+    in which case the two cancel out and false is returned.
+*/
+bool JsonDbUpdate::merge(const JsonDbUpdate &later)
+{
+    if (action == JsonDbNotification::Create && later.action == JsonDbNotification::Remove)
+        return false;
+    if (later.action == JsonDbNotification::Remove)
+        action = JsonDbNotification::Remove;
+    else if (action != JsonDbNotification::Create)
+        action = JsonDbNotification::Update;
+    newObject = later.newObject;
+    return true;
+}
+
 JsonDbPartition::JsonDbPartition(QObject *parent)
     : QObject(parent), d_ptr(new JsonDbPartitionPrivate(this))
 {
     qRegisterMetaType<QSet<QString> >("QSet<QString>");
     qRegisterMetaType<JsonDbUpdateList>("JsonDbUpdateList");
+    qRegisterMetaType<JsonDbStat>("JsonDbStat");
+    qRegisterMetaType<JsonDbNotification*>("JsonDbNotification*");
+    qRegisterMetaType<JsonDbNotification::Action>("JsonDbNotification::Action");
 }
 
 JsonDbPartition::~JsonDbPartition()
@@ -517,9 +732,11 @@ bool JsonDbPartition::close()
     if (d->mIndexSyncTimer->isActive())
         d->mIndexSyncTimer->stop();
 
+    SnapshotBarrier barrier(d);
     d->mSchemas.clear();
     d->mViewTypes.clear();
-    d->mKeyedNotifications.clear();
+    d->mNotifications.clear();
+    d->removeReplays();
 
     foreach (JsonDbView *view, d->mViews.values()) {
         // sync the view object table, its indexes, and their state numbers to prevent reindexing on restart
@@ -608,12 +825,14 @@ JsonDbView *JsonDbPartitionPrivate::addView(const QString &viewType)
 
     view = new JsonDbView(q, viewType, q);
     view->open();
+    SnapshotBarrier barrier(this);
     mViews.insert(viewType, view);
     return view;
 }
 
 void JsonDbPartitionPrivate::removeView(const QString &viewType)
 {
+    SnapshotBarrier barrier(this);
     JsonDbView *view = mViews.take(viewType);
     Q_ASSERT(view);
     view->close();
@@ -775,7 +994,6 @@ void JsonDbPartition::addNotification(JsonDbNotification *notification)
     notification->setPartition(this);
 
     const JsonDbQuery &parsedQuery = notification->parsedQuery();
-    const QList<JsonDbOrQueryTerm> &orQueryTerms = parsedQuery.queryTerms;
     const QSet<QString> matchedTypes = parsedQuery.matchedTypes();
 
     if (!matchedTypes.isEmpty()) {
@@ -794,29 +1012,7 @@ void JsonDbPartition::addNotification(JsonDbNotification *notification)
         notification->setObjectTable(d->mObjectTable);
     }
 
-    bool generic = true;
-    for (int i = 0; i < orQueryTerms.size(); i++) {
-        const JsonDbOrQueryTerm &orQueryTerm = orQueryTerms[i];
-        const QList<JsonDbQueryTerm> &terms = orQueryTerm.terms();
-        if (terms.size() == 1) {
-            const JsonDbQueryTerm &term = terms[0];
-            if (term.op() == QLatin1Char('=')) {
-                if (term.propertyName() == JsonDbString::kUuidStr) {
-                    d->mKeyedNotifications.insert(parsedQuery.termValue(term).toString(), notification);
-                    generic = false;
-                    break;
-                } else if (term.propertyName() == JsonDbString::kTypeStr) {
-                    QString objectType = parsedQuery.termValue(term).toString();
-                    d->mKeyedNotifications.insert(objectType, notification);
-                    generic = false;
-                    break;
-                }
-            }
-        }
-    }
-
-    if (generic)
-        d->mKeyedNotifications.insert(QStringLiteral("__generic_notification__"), notification);
+    d->mNotifications.insert(notification);
 
     quint32 stateNumber = notification->initialStateNumber() > -1 ? notification->initialStateNumber() : d->mObjectTable->stateNumber();
     notification->setInitialStateNumber(stateNumber);
@@ -833,27 +1029,10 @@ void JsonDbPartition::removeNotification(JsonDbNotification *notification)
     if (!d->mIsOpen)
         return;
 
-    const JsonDbQuery &parsedQuery = notification->parsedQuery();
-    const QList<JsonDbOrQueryTerm> &orQueryTerms = parsedQuery.queryTerms;
-    for (int i = 0; i < orQueryTerms.size(); i++) {
-        const JsonDbOrQueryTerm &orQueryTerm = orQueryTerms[i];
-        const QList<JsonDbQueryTerm> &terms = orQueryTerm.terms();
-        if (terms.size() == 1) {
-            const JsonDbQueryTerm &term = terms[0];
-            if (term.op() == QLatin1Char('=')) {
-                if (term.propertyName() == JsonDbString::kTypeStr) {
-                    d->mKeyedNotifications.remove(parsedQuery.termValue(term).toString(), notification);
-                } else if (term.propertyName() == JsonDbString::kUuidStr) {
-                    QString objectType = parsedQuery.termValue(term).toString();
-                    d->mKeyedNotifications.remove(objectType, notification);
-                }
-            }
-        }
-    }
-
-    d->mKeyedNotifications.remove(QStringLiteral("__generic_notification__"), notification);
+    d->mNotifications.remove(notification);
+    d->removeReplays(notification);
 
-    foreach (const QString &objectType, parsedQuery.matchedTypes())
+    foreach (const QString &objectType, notification->parsedQuery().matchedTypes())
         d->updateEagerViewTypes(objectType, 0, -1);
 }
 
@@ -885,6 +1064,58 @@ bool JsonDbPartitionPrivate::getObject(const ObjectKey &objectKey, JsonDbObject
     return false;
 }
 
+/*!
+    Looks up several objects at once, as getObject() does for one. The main
+    object table is read in a single pass over the sorted keys; only objects
+    it does not hold are looked for in the views.
+*/
+void JsonDbPartitionPrivate::getObjects(const QList<ObjectKey> &objectKeys, QList<JsonDbObject> *objects) const
+{
+    QList<QJsonObject> found;
+    mObjectTable->get(objectKeys, &found);
+    objects->clear();
+    for (int i = 0; i < objectKeys.size(); i++) {
+        JsonDbObject object = found.at(i);
+        if (object.isEmpty())
+            getObject(objectKeys.at(i), object);
+        objects->append(object);
+    }
+}
+
+/*!
+    Collects the uuids of the objects getObject() can return whose
+    \a propertyName is \a value, from the indexes of the main object table
+    and of every view. Returns false when one of those tables has no index
+    to answer this, when a view cannot be brought up to date first, or when
+    more than \a limit objects match.
+*/
+bool JsonDbPartitionPrivate::findObjectKeys(const QString &propertyName, const QJsonValue &value, int limit, QSet<QUuid> *objectKeys)
+{
+    QList<JsonDbView *> views;
+    QHash<QString,QPointer<JsonDbView> >::const_iterator it = mViews.begin();
+    for (; it != mViews.end(); ++it) {
+        JsonDbView *view = it.value();
+        if (!view || !view->objectTable())
+            continue;
+        if (!view->objectTable()->exactIndex(propertyName))
+            return false;
+        views.append(view);
+    }
+
+    if (!mObjectTable->findObjectKeys(propertyName, value, limit, objectKeys))
+        return false;
+    foreach (JsonDbView *view, views) {
+        // a view index that is behind the partition would drop join candidates,
+        // a view that is being updated already is left alone
+        view->updateView();
+        if (!view->isUpToDate())
+            return false;
+        if (!view->objectTable()->findObjectKeys(propertyName, value, limit, objectKeys))
+            return false;
+    }
+    return true;
+}
+
 GetObjectsResult JsonDbPartitionPrivate::getObjects(const QString &keyName, const QJsonValue &keyValue, const QString &_objectType, bool updateViews)
 {
     Q_Q(JsonDbPartition);
@@ -996,15 +1227,15 @@ bool JsonDbPartitionPrivate::addIndex(const JsonDbIndexSpec &indexSpec)
     }
     if (!table)
         return false;
-    if (table->index(indexSpec.name))
+    if (table->index(indexSpec.name) || table->isIndexBuilding(indexSpec.name))
         return true;
-    return table->addIndex(indexSpec);
+    return table->addIndex(indexSpec, JsonDbObjectTable::BuildInBackground);
 }
 
 bool JsonDbPartitionPrivate::removeIndex(const QString &indexName, const QString &objectType)
 {
     JsonDbObjectTable *table = findObjectTable(objectType);
-    if (!table->index(indexName))
+    if (!table->index(indexName) && !table->isIndexBuilding(indexName))
         return false;
     return table->removeIndex(indexName);
 }
@@ -1135,10 +1366,34 @@ JsonDbIndexQuery *JsonDbPartitionPrivate::compileIndexQuery(const JsonDbOwner *o
         table = view->objectTable();
     }
 
+    // contains is looked up in a multikey index, one entry per array element,
+    // and matches in a text index, one entry per word; a text index answers
+    // nothing else
+    for (int i = 0; i < orQueryTerms.size(); i++) {
+        foreach (const JsonDbQueryTerm &queryTerm, orQueryTerms[i].terms()) {
+            if (!queryTerm.joinField().isEmpty())
+                continue;
+            QString propertyName = queryTerm.propertyName();
+            JsonDbIndex *index = table->index(propertyName);
+            bool textIndex = index && index->indexSpec().isText();
+            QJsonValue value = query.termValue(queryTerm);
+            bool indexable = true;
+            if (queryTerm.opCode() == JsonDbQueryTerm::ContainsOp)
+                indexable = index && !textIndex && index->indexSpec().isMultiKey()
+                        && (value.isString() || value.isDouble() || value.isBool());
+            else if (queryTerm.opCode() == JsonDbQueryTerm::MatchesOp)
+                indexable = textIndex && value.isString();
+            else
+                indexable = !textIndex;
+            if (!indexable && !unindexablePropertyNames.contains(propertyName))
+                unindexablePropertyNames.append(propertyName);
+        }
+    }
+
     for (int i = 0; i < orderTerms.size(); i++) {
         const JsonDbOrderTerm &orderTerm = orderTerms[i];
         QString propertyName = orderTerm.propertyName;
-        if (!table->index(propertyName)) {
+        if (!table->index(propertyName) || table->index(propertyName)->indexSpec().isText()) {
             if (jsondbSettings->verbose() || jsondbSettings->performanceLog())
                 qDebug() << JSONDB_WARN << "unindexed sort term" << propertyName << orderTerm.ascending;
             residualQuery.orderTerms.append(orderTerm);
@@ -1245,22 +1500,65 @@ JsonDbIndexQuery *JsonDbPartitionPrivate::compileIndexQuery(const JsonDbOwner *o
     indexQuery->setAggregateOperation(query.aggregateOperation);
     indexQuery->setResultExpressionList(query.mapExpressionList);
     indexQuery->setResultKeyList(query.mapKeyList);
+    JsonDbIndex *queryIndex = table->index(indexQuery->propertyName());
+    if (queryIndex)
+        indexQuery->compileIndexOnly(queryIndex->indexSpec());
     return indexQuery;
 }
 
+/*!
+    Returns true if \a query is a plain [?_type="X"][count] with no other
+    terms, and sets \a objectType to X.
+*/
+static bool isTypeCountQuery(const JsonDbQuery &query, QString *objectType)
+{
+    if (query.aggregateOperation != QLatin1String("count") || query.queryTerms.size() != 1)
+        return false;
+    const QList<JsonDbQueryTerm> &terms = query.queryTerms.at(0).terms();
+    if (terms.size() != 1)
+        return false;
+    const JsonDbQueryTerm &term = terms.at(0);
+    if (term.propertyName() != JsonDbString::kTypeStr || term.opCode() != JsonDbQueryTerm::EqualsOp
+            || !term.joinField().isEmpty())
+        return false;
+    QJsonValue value = query.termValue(term);
+    if (!value.isString())
+        return false;
+    *objectType = value.toString();
+    return true;
+}
+
 void JsonDbPartitionPrivate::doIndexQuery(const JsonDbOwner *owner, JsonDbObjectList &results, int &limit, int &offset,
-                                      JsonDbIndexQuery *indexQuery)
+                                      JsonDbIndexQuery *indexQuery, const QByteArray &resumeKey, QByteArray *lastKey)
 {
     if (jsondbSettings->debugQuery())
         qDebug() << JSONDB_INFO << "limit" << limit << "offset" << offset;
 
     bool countOnly = (indexQuery->aggregateOperation() == QLatin1String("count"));
     int count = 0;
+
+    // type counts do not depend on the owner unless access control filters objects,
+    // and belong to the live table rather than to a snapshot
+    QString countedType;
+    bool typeCount = !JsonDbBtree::isSnapshotRead() && limit < 0 && offset == 0 && resumeKey.isEmpty()
+            && (owner->allowAll() || !jsondbSettings->enforceAccessControl())
+            && isTypeCountQuery(indexQuery->query(), &countedType);
+    if (typeCount && indexQuery->objectTable()->typeCount(countedType, &count)) {
+        QJsonObject countObject;
+        countObject.insert(QLatin1String("count"), count);
+        results.append(countObject);
+        return;
+    }
+
     JsonDbObject object;
     QByteArray indexKey;
     int cacheOffset = 0;
     JsonDbIndex *index = indexQuery->objectTable()->index(indexQuery->propertyName());
-    if (index && offset > 0) {
+    if (!resumeKey.isEmpty()) {
+        // offsets are relative to the continuation, so the offset cache does not apply
+        index = 0;
+        object = indexQuery->seekAfter(resumeKey, &indexKey);
+    } else if (index && offset > 0) {
         int cacheMatchOffset = offset;
         indexKey = index->lowerBoundKey(indexQuery->query().query, cacheMatchOffset);
         if (!indexKey.isEmpty()) {
@@ -1291,6 +1589,8 @@ void JsonDbPartitionPrivate::doIndexQuery(const JsonDbOwner *owner, JsonDbObject
                     qDebug() << JSONDB_INFO << "appending result" << object << endl;
                 JsonDbObject result = indexQuery->resultObject(object);
                 results.append(result);
+                if (lastKey)
+                    *lastKey = indexKey;
             }
             limit--;
             count++;
@@ -1307,13 +1607,45 @@ void JsonDbPartitionPrivate::doIndexQuery(const JsonDbOwner *owner, JsonDbObject
     if (index)
         index->addOffsetToCache(indexQuery->query().query, cacheOffset, indexKey);
     if (countOnly) {
+        if (typeCount)
+            indexQuery->objectTable()->setTypeCount(countedType, count);
         QJsonObject countObject;
         countObject.insert(QLatin1String("count"), count);
         results.append(countObject);
     }
 }
 
-JsonDbQueryResult JsonDbPartition::queryObjects(const JsonDbOwner *owner, const JsonDbQuery &query, int limit, int offset)
+/*!
+    Continuation tokens let a client fetch the next page of a query without
+    an offset: the next page starts right after the index key of the last
+    object returned, so it is found with a single seek and is not shifted by
+    objects added or removed in front of it. The token records the index it
+    came from so that a token is never applied to a different index.
+*/
+QByteArray JsonDbPartitionPrivate::makeContinuation(const JsonDbIndexQuery *indexQuery, const QByteArray &lastKey)
+{
+    QByteArray continuation;
+    QDataStream stream(&continuation, QIODevice::WriteOnly);
+    stream << quint8(1) << indexQuery->propertyName() << indexQuery->query().isAscending() << lastKey;
+    return continuation;
+}
+
+bool JsonDbPartitionPrivate::splitContinuation(const JsonDbIndexQuery *indexQuery, const QByteArray &continuation, QByteArray *resumeKey)
+{
+    QDataStream stream(continuation);
+    quint8 version = 0;
+    QString propertyName;
+    bool ascending = true;
+    stream >> version >> propertyName >> ascending >> *resumeKey;
+    return stream.status() == QDataStream::Ok
+            && version == 1
+            && propertyName == indexQuery->propertyName()
+            && ascending == indexQuery->query().isAscending()
+            && !resumeKey->isEmpty();
+}
+
+JsonDbQueryResult JsonDbPartition::queryObjects(const JsonDbOwner *owner, const JsonDbQuery &query, int limit, int offset,
+                                                const QByteArray &continuation)
 {
     Q_D(JsonDbPartition);
 
@@ -1338,15 +1670,30 @@ JsonDbQueryResult JsonDbPartition::queryObjects(const JsonDbOwner *owner, const
     time.start();
     JsonDbIndexQuery *indexQuery = d->compileIndexQuery(owner, query);
 
+    const JsonDbQuery &residualQuery = indexQuery->residualQuery();
+    bool residualSort = !residualQuery.isEmpty() && residualQuery.orderTerms.size();
+
+    QByteArray resumeKey;
+    if (!continuation.isEmpty()
+            && (residualSort || !d->splitContinuation(indexQuery, continuation, &resumeKey))) {
+        delete indexQuery;
+        result.code = JsonDbError::InvalidRequest;
+        result.message = QStringLiteral("Continuation does not match query: %1").arg(query.query);
+        return result;
+    }
+
     int elapsedToCompile = time.elapsed();
-    d->doIndexQuery(owner, results, limit, offset, indexQuery);
+    QByteArray lastKey;
+    d->doIndexQuery(owner, results, limit, offset, indexQuery, resumeKey, &lastKey);
     int elapsedToQuery = time.elapsed();
     quint32 stateNumber = indexQuery->stateNumber();
-    const JsonDbQuery &residualQuery = indexQuery->residualQuery();
-    if (!residualQuery.isEmpty() && residualQuery.orderTerms.size()) {
+    if (residualSort) {
         if (jsondbSettings->verbose())
             qDebug() << JSONDB_INFO << "sorting";
         d->sortValues(residualQuery, results, joinedResults);
+    } else if (limit == 0 && !lastKey.isEmpty()) {
+        // the page was cut short by the limit, so there may be more
+        result.continuation = d->makeContinuation(indexQuery, lastKey);
     }
 
     QStringList sortKeys;
@@ -1368,6 +1715,23 @@ JsonDbQueryResult JsonDbPartition::queryObjects(const JsonDbOwner *owner, const
     return result;
 }
 
+/*!
+    Returns true if the results of \a query are read in the order of an
+    index rather than sorted afterwards, so that they can be read page by
+    page with continuation tokens.
+*/
+bool JsonDbPartition::isIndexOrdered(const JsonDbOwner *owner, const JsonDbQuery &query)
+{
+    Q_D(JsonDbPartition);
+    if (!d->mIsOpen || query.isEmpty())
+        return false;
+    JsonDbIndexQuery *indexQuery = d->compileIndexQuery(owner, query);
+    const JsonDbQuery &residualQuery = indexQuery->residualQuery();
+    bool residualSort = !residualQuery.isEmpty() && residualQuery.orderTerms.size();
+    delete indexQuery;
+    return !residualSort;
+}
+
 JsonDbWriteResult JsonDbPartition::updateObjects(const JsonDbOwner *owner, const JsonDbObjectList &objects, JsonDbPartition::ConflictResolutionMode mode,
                                                  JsonDbUpdateList *changeList)
 {
@@ -1583,7 +1947,8 @@ JsonDbWriteResult JsonDbPartition::updateObjects(const JsonDbOwner *owner, const
     transaction.commit();
 
     QMetaObject::invokeMethod(this, "_q_objectsUpdated", Qt::QueuedConnection,
-                              Q_ARG(bool, mode == ViewObject), Q_ARG(JsonDbUpdateList, updated));
+                              Q_ARG(bool, mode == ViewObject), Q_ARG(JsonDbUpdateList, updated),
+                              Q_ARG(quint32, result.state));
     return result;
 }
 
@@ -1609,6 +1974,30 @@ bool JsonDbPartition::compact()
     return result;
 }
 
+/*!
+    Returns a snapshot of the last commit that other threads can query while
+    the partition keeps writing, or 0 within a transaction or when the
+    partition is closed. The caller owns the snapshot and may delete it on
+    any thread, but before the partition.
+
+    \sa JsonDbPartitionSnapshot
+*/
+JsonDbPartitionSnapshot *JsonDbPartition::createSnapshot()
+{
+    Q_D(JsonDbPartition);
+    if (!d->mIsOpen || d->mTransactionDepth || !d->mTableTransactions.isEmpty())
+        return 0;
+    return new JsonDbPartitionSnapshot(this);
+}
+
+void JsonDbPartitionPrivate::retireSnapshots()
+{
+    QMutexLocker locker(&mSnapshotsMutex);
+    foreach (JsonDbPartitionSnapshot *snapshot, mSnapshots)
+        snapshot->retire();
+    mSnapshots.clear();
+}
+
 JsonDbStat JsonDbPartition::stat() const
 {
     Q_D(const JsonDbPartition);
@@ -1625,6 +2014,23 @@ JsonDbStat JsonDbPartition::stat() const
     return result;
 }
 
+/*!
+    Returns the update count and update times of each view, keyed by view type.
+*/
+QJsonObject JsonDbPartition::viewStats() const
+{
+    Q_D(const JsonDbPartition);
+
+    QJsonObject result;
+    for (QHash<QString,QPointer<JsonDbView> >::const_iterator it = d->mViews.begin();
+         it != d->mViews.end();
+         ++it) {
+        if (it.value())
+            result.insert(it.key(), it.value()->updateStats());
+    }
+    return result;
+}
+
 struct QJsonSortable {
     QJsonValue key;
     QJsonObject result;
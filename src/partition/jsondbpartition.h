@@ -64,11 +64,16 @@ class JsonDbOwner;
 class JsonDbObjectTable;
 class JsonDbIndex;
 class JsonDbView;
+class JsonDbPartitionSnapshot;
 
 struct Q_JSONDB_PARTITION_EXPORT JsonDbUpdate {
     JsonDbUpdate(const JsonDbObject &oldObj, const JsonDbObject &newObj, JsonDbNotification::Action act) :
         oldObject(oldObj), newObject(newObj), action(act) { }
     JsonDbUpdate() : action(JsonDbNotification::None) {}
+
+    // folds a later change to the same object into this one, false if the two cancel out
+    bool merge(const JsonDbUpdate &later);
+
     JsonDbObject oldObject;
     JsonDbObject newObject;
     JsonDbNotification::Action action;
@@ -103,6 +108,7 @@ struct Q_JSONDB_PARTITION_EXPORT JsonDbQueryResult {
     JsonDbError::ErrorCode code;
     QString message;
     JsonDbObjectTable *objectTable;
+    QByteArray continuation;
 };
 
 class JsonDbPartitionPrivate;
@@ -139,31 +145,43 @@ public:
     JsonDbOwner *defaultOwner() const;
 
     QString filename() const;
-    bool open();
-    bool close();
-    bool isOpen() const;
 
-    bool clear();
-    void closeIndexes();
-    void flushCaches();
-    bool compact();
+    // invokable so a server that runs the partition on a thread of its own can call them
+    Q_INVOKABLE bool open();
+    Q_INVOKABLE bool close();
+    Q_INVOKABLE bool isOpen() const;
+
+    Q_INVOKABLE bool clear();
+    Q_INVOKABLE void closeIndexes();
+    Q_INVOKABLE void flushCaches();
+    Q_INVOKABLE bool compact();
 
-    JsonDbQueryResult queryObjects(const JsonDbOwner *owner, const JsonDbQuery &query, int limit = -1, int offset = 0);
+    JsonDbQueryResult queryObjects(const JsonDbOwner *owner, const JsonDbQuery &query, int limit = -1, int offset = 0,
+                                   const QByteArray &continuation = QByteArray());
+    bool isIndexOrdered(const JsonDbOwner *owner, const JsonDbQuery &query);
     JsonDbWriteResult updateObjects(const JsonDbOwner *owner, const JsonDbObjectList &objects, ConflictResolutionMode mode = RejectStale, JsonDbUpdateList *changeList = 0);
     JsonDbWriteResult updateObject(const JsonDbOwner *owner, const JsonDbObject &object, ConflictResolutionMode mode = RejectStale, JsonDbUpdateList *changeList = 0);
     JsonDbChangesSinceResult changesSince(quint32 stateNumber, const QSet<QString> &limitTypes = QSet<QString>());
     int flush(bool *ok);
 
-    void addNotification(JsonDbNotification *notification);
-    void removeNotification(JsonDbNotification *notification);
+    JsonDbPartitionSnapshot *createSnapshot();
+
+    Q_INVOKABLE void addNotification(JsonDbNotification *notification);
+    Q_INVOKABLE void removeNotification(JsonDbNotification *notification);
 
     JsonDbObjectTable *mainObjectTable() const;
     JsonDbObjectTable *findObjectTable(const QString &objectType) const;
     JsonDbView *findView(const QString &objectType) const;
 
-    JsonDbStat stat() const;
+    Q_INVOKABLE JsonDbStat stat() const;
+    Q_INVOKABLE QJsonObject viewStats() const;
     QHash<QString, qint64> fileSizes() const;
 
+Q_SIGNALS:
+    // an index too large to build in its write transaction is built in the background
+    void indexBuildProgress(const QString &indexName, quint64 processedCount, quint64 totalCount);
+    void indexBuildFinished(const QString &indexName, bool built);
+
 public Q_SLOTS:
     void updateView(const QString &objectType, quint32 stateNumber=0);
 
@@ -172,7 +190,8 @@ private:
     Q_DISABLE_COPY(JsonDbPartition)
     Q_PRIVATE_SLOT(d_func(), void _q_mainSyncTimer())
     Q_PRIVATE_SLOT(d_func(), void _q_indexSyncTimer())
-    Q_PRIVATE_SLOT(d_func(), void _q_objectsUpdated(bool,JsonDbUpdateList))
+    Q_PRIVATE_SLOT(d_func(), void _q_objectsUpdated(bool,JsonDbUpdateList,quint32))
+    Q_PRIVATE_SLOT(d_func(), void _q_replayHistory())
     QScopedPointer<JsonDbPartitionPrivate> d_ptr;
 
     friend class JsonDbIndexQuery;
@@ -182,6 +201,7 @@ private:
     friend class JsonDbMapDefinition;
     friend class JsonDbReduceDefinition;
     friend class JsonDbView;
+    friend class JsonDbPartitionSnapshot;
 
     friend class ::TestPartition;
     friend class ::TestJsonDb;
@@ -43,6 +43,8 @@
 #define JSONDB_PARTITION_P_H
 
 #include <QMultiHash>
+#include <QMutex>
+#include <QReadWriteLock>
 #include <QStringList>
 #include <QSet>
 #include <QTimer>
@@ -51,6 +53,7 @@
 
 #include "jsondberrors.h"
 #include "jsondbnotification.h"
+#include "jsondbnotificationindex.h"
 #include "jsondbobjectkey.h"
 #include "jsondbowner.h"
 #include "jsondbpartition.h"
@@ -69,6 +72,23 @@ class JsonDbIndexSpec;
 class JsonDbIndex;
 class JsonDbIndexQuery;
 class JsonDbView;
+class JsonDbPartitionSnapshot;
+
+/*
+    A notification catching up with the partition, see
+    JsonDbPartitionPrivate::notifyHistoricalChanges().
+*/
+struct JsonDbHistoricalReplay {
+    JsonDbHistoricalReplay() : snapshot(0), stateNumber(0), changesRead(false), next(0) { }
+
+    QPointer<JsonDbNotification> notification;
+    JsonDbPartitionSnapshot *snapshot; // pinned at stateNumber while the query results are replayed
+    quint32 stateNumber;               // changes after it are caught up from the change log
+    QByteArray continuation;
+    bool changesRead;
+    JsonDbUpdateList changes;          // when replaying the changes since the initial state number
+    int next;
+};
 
 class Q_JSONDB_PARTITION_EXPORT JsonDbPartitionPrivate
 {
@@ -94,6 +114,8 @@ public:
 
     bool getObject(const QString &uuid, JsonDbObject &object, const QString &objectType = QString(), bool includeDeleted = false) const;
     bool getObject(const ObjectKey & objectKey, JsonDbObject &object, const QString &objectType = QString(), bool includeDeleted = false) const;
+    void getObjects(const QList<ObjectKey> &objectKeys, QList<JsonDbObject> *objects) const;
+    bool findObjectKeys(const QString &propertyName, const QJsonValue &value, int limit, QSet<QUuid> *objectKeys);
 
     GetObjectsResult getObjects(const QString &keyName, const QJsonValue &key, const QString &type = QString(),
                                 bool updateViews = true);
@@ -101,7 +123,10 @@ public:
     JsonDbIndexQuery *compileIndexQuery(const JsonDbOwner *owner, const JsonDbQuery &query);
 
     void doIndexQuery(const JsonDbOwner *owner, JsonDbObjectList &results, int &limit, int &offset,
-                      JsonDbIndexQuery *indexQuery);
+                      JsonDbIndexQuery *indexQuery, const QByteArray &resumeKey = QByteArray(),
+                      QByteArray *lastKey = 0);
+    static QByteArray makeContinuation(const JsonDbIndexQuery *indexQuery, const QByteArray &lastKey);
+    static bool splitContinuation(const JsonDbIndexQuery *indexQuery, const QByteArray &continuation, QByteArray *resumeKey);
 
     static void sortValues(const JsonDbQuery &query, JsonDbObjectList &results, JsonDbObjectList &joinedResults);
 
@@ -123,10 +148,16 @@ public:
     void updateEagerViewTypes(const QString &viewType, quint32 stateNumber, int increment = 1);
     void updateEagerViewStateNumbers();
     void notifyHistoricalChanges(JsonDbNotification *n);
+    void replayChanges(JsonDbNotification *n, JsonDbObjectTable *objectTable, const JsonDbUpdateList &changes,
+                       quint32 stateNumber, int from = 0, int count = -1);
+    void finishReplay(JsonDbHistoricalReplay *replay);
+    void removeReplays(JsonDbNotification *n = 0);
+    void retireSnapshots();
 
     void _q_mainSyncTimer();
     void _q_indexSyncTimer();
-    void _q_objectsUpdated(bool viewUpdated, const JsonDbUpdateList &changes);
+    void _q_objectsUpdated(bool viewUpdated, const JsonDbUpdateList &changes, quint32 stateNumber);
+    void _q_replayHistory();
 
     class EdgeCount {
     public:
@@ -149,7 +180,11 @@ public:
     bool         mTransactionOk;
     QHash<QString,QPointer<JsonDbView> > mViews;
     QSet<QString> mViewTypes;
-    QMultiHash<QString, QPointer<JsonDbNotification> > mKeyedNotifications;
+    JsonDbNotificationIndex mNotifications;
+    QList<JsonDbHistoricalReplay *> mReplays;
+    // live notifications of commits up to the state number were replayed already
+    QHash<const JsonDbNotification *, quint32> mReplayedUntil;
+    QTimer      *mReplayTimer;
     WeightedSourceViewGraph mEagerViewSourceGraph;
     JsonDbSchemaManager   mSchemas;
     QTimer      *mMainSyncTimer;
@@ -158,6 +193,38 @@ public:
     bool         mIsOpen;
     JsonDbPartition::DiskSpaceStatus mDiskSpaceStatus;
 
+    // readers of snapshots hold mSnapshotLock for reading, see SnapshotBarrier
+    QReadWriteLock mSnapshotLock;
+    QMutex       mSnapshotsMutex;
+    QSet<JsonDbPartitionSnapshot *> mSnapshots;
+};
+
+/*
+    Waits for the queries running on snapshots of the partition and keeps new
+    ones out while the tables, indexes or views they look at change. The
+    snapshots taken before are retired, their queries fall back to the
+    partition thread.
+*/
+class SnapshotBarrier {
+public:
+    SnapshotBarrier(JsonDbPartitionPrivate *partition)
+        : mPartition(partition)
+    {
+        if (!mPartition)
+            return;
+        mPartition->mSnapshotLock.lockForWrite();
+        mPartition->retireSnapshots();
+    }
+
+    ~SnapshotBarrier()
+    {
+        if (mPartition)
+            mPartition->mSnapshotLock.unlock();
+    }
+
+private:
+    JsonDbPartitionPrivate *mPartition;
+    Q_DISABLE_COPY(SnapshotBarrier)
 };
 
 class WithTransaction {
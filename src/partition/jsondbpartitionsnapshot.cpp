@@ -0,0 +1,208 @@
+/****************************************************************************
+**
+** Copyright (C) 2012 Digia Plc and/or its subsidiary(-ies).
+** Contact: http://www.qt-project.org/legal
+**
+** This file is part of the QtAddOn.JsonDb module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include <QJsonArray>
+#include <QMutexLocker>
+#include <QReadLocker>
+
+#include "jsondbpartitionsnapshot.h"
+#include "jsondbpartition_p.h"
+#include "jsondbbtree.h"
+#include "jsondbindex.h"
+#include "jsondbobjecttable.h"
+#include "jsondbquery.h"
+#include "jsondbstrings.h"
+
+QT_BEGIN_NAMESPACE_JSONDB_PARTITION
+
+/*!
+    \class JsonDbPartitionSnapshot
+    \brief The JsonDbPartitionSnapshot class queries a partition from other threads.
+
+    A snapshot is taken with JsonDbPartition::createSnapshot() on the
+    partition's thread, between transactions. It pins the last commit of
+    the main object table and of its open indexes, so that the partition
+    appends pages rather than overwrite the ones the snapshot reads.
+
+    queryObjects() may then be called on any thread. It runs the usual query
+    code against read-only views of the pinned btrees that are private to
+    the calling thread. Whenever the tables, indexes or views of the
+    partition change, the snapshots taken before are retired.
+*/
+
+JsonDbPartitionSnapshot::JsonDbPartitionSnapshot(JsonDbPartition *partition)
+    : mPartition(partition)
+    , mStateNumber(0)
+    , mRetired(false)
+{
+    JsonDbPartitionPrivate *d = partition->d_func();
+    JsonDbObjectTable *table = d->mObjectTable;
+
+    mStateNumber = table->stateNumber();
+    mViewTypes = QSet<QString>::fromList(d->mViews.keys());
+    mRevisions.insert(table->bdb(), table->bdb()->pinSnapshot());
+    foreach (JsonDbIndex *index, table->indexes()) {
+        // closed indexes are left out, queries that use them run on the partition's thread
+        if (!index->isOpen())
+            continue;
+        JsonDbBtree *bdb = index->bdb();
+        if (bdb)
+            mRevisions.insert(bdb, bdb->pinSnapshot());
+    }
+
+    QMutexLocker locker(&d->mSnapshotsMutex);
+    d->mSnapshots.insert(this);
+}
+
+JsonDbPartitionSnapshot::~JsonDbPartitionSnapshot()
+{
+    JsonDbPartitionPrivate *d = mPartition->d_func();
+    QMutexLocker locker(&d->mSnapshotsMutex);
+    if (!mRetired) {
+        d->mSnapshots.remove(this);
+        retire();
+    }
+}
+
+/*!
+    Releases the pins. Called with the partition's snapshot mutex held.
+*/
+void JsonDbPartitionSnapshot::retire()
+{
+    QHash<const JsonDbBtree *, quint32>::const_iterator it = mRevisions.constBegin();
+    for (; it != mRevisions.constEnd(); ++it)
+        const_cast<JsonDbBtree *>(it.key())->unpinSnapshot(it.value());
+    mRevisions.clear();
+    mRetired = true;
+}
+
+/*!
+    Returns true if nothing was committed to the main object table since the
+    snapshot was taken and it covers every open index.
+*/
+bool JsonDbPartitionSnapshot::isCurrent() const
+{
+    JsonDbPartitionPrivate *d = mPartition->d_func();
+    if (mRetired || !d->mIsOpen || d->mObjectTable->stateNumber() != mStateNumber)
+        return false;
+    foreach (JsonDbIndex *index, d->mObjectTable->indexes()) {
+        if (!index->isOpen())
+            continue;
+        JsonDbBtree *bdb = index->bdb();
+        if (bdb && !mRevisions.contains(bdb))
+            return false;
+    }
+    return true;
+}
+
+/*!
+    Returns true unless \a query involves a view or a join, which read
+    tables outside the snapshot.
+*/
+bool JsonDbPartitionSnapshot::canQuery(const JsonDbQuery &query) const
+{
+    foreach (const JsonDbOrQueryTerm &orQueryTerm, query.queryTerms) {
+        foreach (const JsonDbQueryTerm &term, orQueryTerm.terms()) {
+            if (!term.joinField().isEmpty())
+                return false;
+            if (term.propertyName() != JsonDbString::kTypeStr)
+                continue;
+            QJsonValue value = query.termValue(term);
+            if (value.isArray()) {
+                QJsonArray types = value.toArray();
+                for (int i = 0; i < types.size(); i++) {
+                    if (mViewTypes.contains(types.at(i).toString()))
+                        return false;
+                }
+            } else if (mViewTypes.contains(value.toString())) {
+                return false;
+            }
+        }
+    }
+    foreach (const QString &expression, query.mapExpressionList) {
+        if (expression.contains(QLatin1String("->")))
+            return false;
+    }
+    return true;
+}
+
+/*!
+    Runs JsonDbPartition::queryObjects() against the snapshot and stores its
+    outcome in \a result. Returns false if the query has to run on the
+    partition's thread instead, in which case \a result is to be ignored.
+*/
+bool JsonDbPartitionSnapshot::queryObjects(const JsonDbOwner *owner, const JsonDbQuery &query, int limit, int offset,
+                                           const QByteArray &continuation, JsonDbQueryResult *result)
+{
+    if (!canQuery(query))
+        return false;
+
+    JsonDbPartitionPrivate *d = mPartition->d_func();
+    QReadLocker locker(&d->mSnapshotLock);
+    if (mRetired)
+        return false;
+
+    JsonDbBtree::SnapshotRead read(mRevisions);
+    *result = mPartition->queryObjects(owner, query, limit, offset, continuation);
+    return read.isValid();
+}
+
+/*!
+    Runs JsonDbPartition::isIndexOrdered() against the snapshot and stores
+    its outcome in \a indexOrdered. Returns false if the query has to run on
+    the partition's thread instead.
+*/
+bool JsonDbPartitionSnapshot::isIndexOrdered(const JsonDbOwner *owner, const JsonDbQuery &query, bool *indexOrdered)
+{
+    if (!canQuery(query))
+        return false;
+
+    JsonDbPartitionPrivate *d = mPartition->d_func();
+    QReadLocker locker(&d->mSnapshotLock);
+    if (mRetired)
+        return false;
+
+    JsonDbBtree::SnapshotRead read(mRevisions);
+    *indexOrdered = mPartition->isIndexOrdered(owner, query);
+    return read.isValid();
+}
+
+QT_END_NAMESPACE_JSONDB_PARTITION
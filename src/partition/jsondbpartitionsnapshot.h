@@ -0,0 +1,102 @@
+/****************************************************************************
+**
+** Copyright (C) 2012 Digia Plc and/or its subsidiary(-ies).
+** Contact: http://www.qt-project.org/legal
+**
+** This file is part of the QtAddOn.JsonDb module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef JSONDB_PARTITIONSNAPSHOT_H
+#define JSONDB_PARTITIONSNAPSHOT_H
+
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+
+#include "jsondbpartition.h"
+#include "jsondbpartitionglobal.h"
+
+QT_BEGIN_HEADER
+
+QT_BEGIN_NAMESPACE_JSONDB_PARTITION
+
+class JsonDbBtree;
+class JsonDbOwner;
+class JsonDbQuery;
+
+/*
+    A committed state of a partition that other threads can query while the
+    partition's own thread keeps writing. The main object table and its open
+    indexes are pinned at their last commit, see JsonDbBtree::pinSnapshot().
+    Queries on views, joins, and anything that changed the structure of the
+    partition since, are left to the partition's thread.
+*/
+class Q_JSONDB_PARTITION_EXPORT JsonDbPartitionSnapshot
+{
+public:
+    ~JsonDbPartitionSnapshot();
+
+    JsonDbPartition *partition() const { return mPartition; }
+    quint32 stateNumber() const { return mStateNumber; }
+
+    // called on the partition's thread
+    bool isCurrent() const;
+
+    bool canQuery(const JsonDbQuery &query) const;
+    bool queryObjects(const JsonDbOwner *owner, const JsonDbQuery &query, int limit, int offset,
+                      const QByteArray &continuation, JsonDbQueryResult *result);
+    bool isIndexOrdered(const JsonDbOwner *owner, const JsonDbQuery &query, bool *indexOrdered);
+
+private:
+    friend class JsonDbPartition;
+    friend class JsonDbPartitionPrivate;
+    explicit JsonDbPartitionSnapshot(JsonDbPartition *partition);
+    void retire();
+
+    JsonDbPartition *mPartition;
+    quint32 mStateNumber;
+    QSet<QString> mViewTypes;
+    QHash<const JsonDbBtree *, quint32> mRevisions;
+    bool mRetired;
+
+    Q_DISABLE_COPY(JsonDbPartitionSnapshot)
+};
+
+QT_END_NAMESPACE_JSONDB_PARTITION
+
+QT_END_HEADER
+
+#endif // JSONDB_PARTITIONSNAPSHOT_H
@@ -43,6 +43,7 @@
 #include <QString>
 
 #include "jsondbstrings.h"
+#include "jsondbindex_p.h"
 #include "jsondbindexquery.h"
 #include "jsondbpartition.h"
 #include "jsondbpartition_p.h"
@@ -53,8 +54,14 @@
 
 QT_BEGIN_NAMESPACE_JSONDB_PARTITION
 
+// "in" and "notIn" arrays with at least this many elements are matched via a hash set
+static const int kValueSetThreshold = 8;
+
 JsonDbQueryTerm::JsonDbQueryTerm()
     : mValue(QJsonValue::Undefined)
+    , mOpCode(UnknownOp)
+    , mBound(false)
+    , mBoundValue(QJsonValue::Undefined)
 {
 }
 
@@ -68,6 +75,127 @@ QJsonValue JsonDbQueryTerm::value() const
     return mValue;
 }
 
+JsonDbQueryTerm::Op JsonDbQueryTerm::opFromString(const QString &op)
+{
+    if (op == QLatin1Char('=') || op == QLatin1String("=="))
+        return EqualsOp;
+    if (op == QLatin1String("<>") || op == QLatin1String("!="))
+        return NotEqualsOp;
+    if (op == QLatin1String("=~"))
+        return RegExpOp;
+    if (op == QLatin1String("!=~"))
+        return NotRegExpOp;
+    if (op == QLatin1String("<="))
+        return LessEqualOp;
+    if (op == QLatin1Char('<'))
+        return LessThanOp;
+    if (op == QLatin1String(">="))
+        return GreaterEqualOp;
+    if (op == QLatin1Char('>'))
+        return GreaterThanOp;
+    if (op == QLatin1String("exists"))
+        return ExistsOp;
+    if (op == QLatin1String("notExists"))
+        return NotExistsOp;
+    if (op == QLatin1String("in"))
+        return InOp;
+    if (op == QLatin1String("notIn"))
+        return NotInOp;
+    if (op == QLatin1String("contains"))
+        return ContainsOp;
+    if (op == QLatin1String("notContains"))
+        return NotContainsOp;
+    if (op == QLatin1String("startsWith"))
+        return StartsWithOp;
+    if (op == QLatin1String("matches"))
+        return MatchesOp;
+    return UnknownOp;
+}
+
+/*!
+    Builds a type tagged key for \a v such that two scalar values have the
+    same key if and only if they compare equal as QJsonValues. Returns false
+    for arrays and objects, which have to be compared structurally.
+*/
+bool JsonDbQueryTerm::makeValueSetKey(const QJsonValue &v, QString *key)
+{
+    switch (v.type()) {
+    case QJsonValue::String:
+        *key = QLatin1Char('s') + v.toString();
+        return true;
+    case QJsonValue::Double: {
+        double d = v.toDouble();
+        if (d == 0)
+            d = 0; // -0 == 0
+        *key = QLatin1Char('d') + QString::number(d, 'g', 17);
+        return true;
+    }
+    case QJsonValue::Bool:
+        *key = v.toBool() ? QStringLiteral("bt") : QStringLiteral("bf");
+        return true;
+    case QJsonValue::Null:
+        *key = QStringLiteral("n");
+        return true;
+    case QJsonValue::Undefined:
+        *key = QStringLiteral("u");
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*!
+    Resolves the value of the term against \a bindings so that match() does
+    not have to look it up for every object. Terms whose variable is not
+    bound yet are resolved at match time. Large "in" and "notIn" arrays of
+    scalar values are converted to a hash set.
+*/
+void JsonDbQueryTerm::compile(const QMap<QString, QJsonValue> &bindings)
+{
+    mValueSet.clear();
+    mTextTokens.clear();
+    mBound = false;
+    mBoundValue = QJsonValue(QJsonValue::Undefined);
+
+    if (hasValue()) {
+        mBoundValue = mValue;
+        mBound = true;
+    } else if (!mVariable.isEmpty() && bindings.contains(mVariable)) {
+        mBoundValue = bindings.value(mVariable);
+        mBound = true;
+    }
+
+    if (mBound && mOpCode == MatchesOp && mBoundValue.isString())
+        mTextTokens = JsonDbIndexPrivate::textTokens(mBoundValue.toString());
+
+    if (!mBound || (mOpCode != InOp && mOpCode != NotInOp) || !mBoundValue.isArray())
+        return;
+
+    QJsonArray array = mBoundValue.toArray();
+    if (array.size() < kValueSetThreshold)
+        return;
+    QSet<QString> *valueSet = new QSet<QString>;
+    valueSet->reserve(array.size());
+    for (int i = 0; i < array.size(); i++) {
+        QString key;
+        if (!makeValueSetKey(array.at(i), &key)) {
+            delete valueSet;
+            return;
+        }
+        valueSet->insert(key);
+    }
+    mValueSet = QSharedPointer<const QSet<QString> >(valueSet);
+}
+
+bool JsonDbQueryTerm::valueSetContains(const QJsonValue &v) const
+{
+    Q_ASSERT(hasValueSet());
+    QString key;
+    if (!makeValueSetKey(v, &key))
+        return false;
+    return mValueSet->contains(key);
+}
+
 // JsonDbOrQueryTerm
 
 JsonDbOrQueryTerm::JsonDbOrQueryTerm()
@@ -104,9 +232,9 @@ QList<QString> JsonDbOrQueryTerm::findUnindexablePropertyNames() const
         const QString propertyName = term.propertyName();
         const QString op = term.op();
         // notExists is unindexable because there would be no value to index
-        // contains and notContains are unindexable because JsonDbIndex does not support array values
+        // notContains is unindexable because objects whose arrays lack the value have no entry for it
+        // contains is only indexable with a multikey index, which the partition checks
         if ((op == QLatin1String("notExists")
-             || op == QLatin1String("contains")
              || op == QLatin1String("notContains"))
              && !unindexablePropertyNames.contains(propertyName))
             unindexablePropertyNames.append(propertyName);
@@ -127,93 +255,31 @@ JsonDbQuery::~JsonDbQuery()
 {
 }
 
+/*!
+    Resolves the term values against the query bindings and prepares the
+    terms for repeated evaluation by match().
+*/
+void JsonDbQuery::compile()
+{
+    for (int i = 0; i < queryTerms.size(); i++) {
+        JsonDbOrQueryTerm &orQueryTerm = queryTerms[i];
+        QList<JsonDbQueryTerm> terms = orQueryTerm.terms();
+        orQueryTerm = JsonDbOrQueryTerm();
+        for (int j = 0; j < terms.size(); j++) {
+            terms[j].compile(bindings);
+            orQueryTerm.addTerm(terms[j]);
+        }
+    }
+}
+
 bool JsonDbQuery::match(const JsonDbObject &object, QHash<QString, JsonDbObject> *objectCache, JsonDbPartition *partition) const
 {
     for (int i = 0; i < queryTerms.size(); i++) {
-        const JsonDbOrQueryTerm &orQueryTerm = queryTerms[i];
+        const QList<JsonDbQueryTerm> &terms = queryTerms.at(i).terms();
         bool matches = false;
-        foreach (const JsonDbQueryTerm &term, orQueryTerm.terms()) {
-            const QString &joinPropertyName = term.joinField();
-            const QString &op = term.op();
-            QJsonValue value = termValue(term);
-
-            QJsonValue objectFieldValue;
-            if (!joinPropertyName.isEmpty()) {
-                JsonDbObject joinedObject = object;
-                const QVector<QStringList> &joinPaths = term.joinPaths();
-                for (int j = 0; j < joinPaths.size(); j++) {
-                    if (!joinPaths[j].size()) {
-                        if (jsondbSettings->debug())
-                            qDebug() << term.joinField() << term.joinPaths();
-                    }
-                    QString uuidValue = joinedObject.valueByPath(joinPaths[j]).toString();
-                    if (objectCache && objectCache->contains(uuidValue))
-                        joinedObject = objectCache->value(uuidValue);
-                    else if (partition) {
-                        ObjectKey objectKey(uuidValue);
-                        partition->d_func()->getObject(objectKey, joinedObject);
-                        if (objectCache) objectCache->insert(uuidValue, joinedObject);
-                    }
-                }
-                objectFieldValue = joinedObject.valueByPath(term.propertyName());
-            } else {
-                if (!term.hasPropertyName())
-                    objectFieldValue = bindings.value(term.propertyVariable());
-                else
-                    objectFieldValue = object.valueByPath(term.propertyName());
-            }
-            if (op == QLatin1Char('=') || op == QLatin1String("==")) {
-                matches = (objectFieldValue == value);
-            } else if (op == QLatin1String("<>") || op == QLatin1String("!=")) {
-                matches = (objectFieldValue != value);
-            } else if (op == QLatin1String("=~")) {
-                QRegExp rx = term.regExpConst();
-                if (jsondbSettings->debug())
-                    qDebug() << "=~" << objectFieldValue.toString() << rx.exactMatch(objectFieldValue.toString());
-                matches = rx.exactMatch(objectFieldValue.toString());
-            } else if (op == QLatin1String("!=~")) {
-                QRegExp rx = term.regExpConst();
-                if (jsondbSettings->debug())
-                    qDebug() << "!=~" << objectFieldValue.toString() << rx.exactMatch(objectFieldValue.toString());
-                matches = !rx.exactMatch(objectFieldValue.toString());
-            } else if (op == QLatin1String("<=")) {
-                matches = JsonDbIndexQuery::lessThan(objectFieldValue, value) || (objectFieldValue == value);
-            } else if (op == QLatin1Char('<')) {
-                matches = JsonDbIndexQuery::lessThan(objectFieldValue, value);
-            } else if (op == QLatin1String(">=")) {
-                matches = JsonDbIndexQuery::greaterThan(objectFieldValue, value) || (objectFieldValue == value);
-            } else if (op == QLatin1Char('>')) {
-                matches = JsonDbIndexQuery::greaterThan(objectFieldValue, value);
-            } else if (op == QLatin1String("exists")) {
-                matches = (objectFieldValue.type() != QJsonValue::Undefined);
-            } else if (op == QLatin1String("notExists")) {
-                matches = (objectFieldValue.type() == QJsonValue::Undefined);
-            } else if (op == QLatin1String("in")) {
-                if (0) qDebug() << __FUNCTION__ << __LINE__ << objectFieldValue << "in" << value
-                                << value.toArray().contains(objectFieldValue);
-                matches = value.toArray().contains(objectFieldValue);
-            } else if (op == QLatin1String("notIn")) {
-                if (0) qDebug() << __FUNCTION__ << __LINE__ << objectFieldValue << "notIn" << value
-                                << !value.toArray().contains(objectFieldValue);
-                matches = !value.toArray().contains(objectFieldValue);
-            } else if (op == QLatin1String("contains")) {
-                if (0) qDebug() << __FUNCTION__ << __LINE__ << objectFieldValue << "contains" << value
-                                << objectFieldValue.toArray().contains(value);
-                matches = objectFieldValue.toArray().contains(value);
-            } else if (op == QLatin1String("notContains")) {
-                if (0) qDebug() << __FUNCTION__ << __LINE__ << objectFieldValue << "notContains" << value
-                                << !objectFieldValue.toArray().contains(value);
-                matches = !objectFieldValue.toArray().contains(value);
-            } else if (op == QLatin1String("startsWith")) {
-                matches = (objectFieldValue.type() == QJsonValue::String
-                           && objectFieldValue.toString().startsWith(value.toString()));
-            } else {
-                qCritical() << "match" << "unhandled term" << term.propertyName() << term.op() << term.value() << term.joinField();
-            }
-            // if any of the OR query terms match, we continue to the next AND query term
-            if (matches)
-                break;
-        }
+        // if any of the OR query terms match, we continue to the next AND query term
+        for (int j = 0; j < terms.size() && !matches; j++)
+            matches = matchTerm(terms.at(j), object, objectCache, partition, 0);
         // if any of the AND query terms fail, it's not a match
         if (!matches)
             return false;
@@ -221,6 +287,136 @@ bool JsonDbQuery::match(const JsonDbObject &object, QHash<QString, JsonDbObject>
     return true;
 }
 
+/*!
+    Same as above, but variables that are not bound in the query itself are
+    looked up in \a extraBindings. This avoids copying the query to add a
+    per-object binding.
+*/
+bool JsonDbQuery::match(const JsonDbObject &object, QHash<QString, JsonDbObject> *objectCache, JsonDbPartition *partition,
+                        const QMap<QString, QJsonValue> &extraBindings) const
+{
+    for (int i = 0; i < queryTerms.size(); i++) {
+        const QList<JsonDbQueryTerm> &terms = queryTerms.at(i).terms();
+        bool matches = false;
+        for (int j = 0; j < terms.size() && !matches; j++)
+            matches = matchTerm(terms.at(j), object, objectCache, partition, &extraBindings);
+        if (!matches)
+            return false;
+    }
+    return true;
+}
+
+/*!
+    Adds \a object to \a objectCache under \a uuid. The cache is emptied
+    first once it holds JsonDbSettings::joinCacheSize() objects, so that
+    joins over many objects do not keep all of them in memory.
+*/
+void JsonDbQuery::cacheObject(QHash<QString, JsonDbObject> *objectCache, const QString &uuid, const JsonDbObject &object)
+{
+    if (objectCache->size() >= jsondbSettings->joinCacheSize() && !objectCache->contains(uuid))
+        objectCache->clear();
+    objectCache->insert(uuid, object);
+}
+
+bool JsonDbQuery::matchTerm(const JsonDbQueryTerm &term, const JsonDbObject &object, QHash<QString, JsonDbObject> *objectCache,
+                            JsonDbPartition *partition, const QMap<QString, QJsonValue> *extraBindings) const
+{
+    QJsonValue value;
+    if (term.isBound())
+        value = term.boundValue();
+    else if (term.hasValue())
+        value = term.value();
+    else if (extraBindings && extraBindings->contains(term.variable()))
+        value = extraBindings->value(term.variable());
+    else
+        value = bindings.value(term.variable(), QJsonValue(QJsonValue::Undefined));
+
+    QJsonValue objectFieldValue;
+    const QVector<QStringList> &joinPaths = term.joinPaths();
+    if (!joinPaths.isEmpty()) {
+        JsonDbObject joinedObject = object;
+        for (int j = 0; j < joinPaths.size(); j++) {
+            if (!joinPaths[j].size()) {
+                if (jsondbSettings->debug())
+                    qDebug() << term.joinField() << term.joinPaths();
+            }
+            QString uuidValue = joinedObject.valueByPath(joinPaths[j]).toString();
+            if (objectCache && objectCache->contains(uuidValue))
+                joinedObject = objectCache->value(uuidValue);
+            else if (partition) {
+                ObjectKey objectKey(uuidValue);
+                partition->d_func()->getObject(objectKey, joinedObject);
+                if (objectCache)
+                    cacheObject(objectCache, uuidValue, joinedObject);
+            }
+        }
+        objectFieldValue = joinedObject.valueByPath(term.fieldPath());
+    } else if (!term.hasPropertyName()) {
+        if (extraBindings && extraBindings->contains(term.propertyVariable()))
+            objectFieldValue = extraBindings->value(term.propertyVariable());
+        else
+            objectFieldValue = bindings.value(term.propertyVariable());
+    } else {
+        objectFieldValue = object.valueByPath(term.fieldPath());
+    }
+
+    switch (term.opCode()) {
+    case JsonDbQueryTerm::EqualsOp:
+        return objectFieldValue == value;
+    case JsonDbQueryTerm::NotEqualsOp:
+        return objectFieldValue != value;
+    case JsonDbQueryTerm::RegExpOp: {
+        QRegExp rx = term.regExpConst();
+        bool matches = rx.exactMatch(objectFieldValue.toString());
+        if (jsondbSettings->debug())
+            qDebug() << "=~" << objectFieldValue.toString() << matches;
+        return matches;
+    }
+    case JsonDbQueryTerm::NotRegExpOp: {
+        QRegExp rx = term.regExpConst();
+        bool matches = rx.exactMatch(objectFieldValue.toString());
+        if (jsondbSettings->debug())
+            qDebug() << "!=~" << objectFieldValue.toString() << matches;
+        return !matches;
+    }
+    case JsonDbQueryTerm::LessEqualOp:
+        return JsonDbIndexQuery::lessThan(objectFieldValue, value) || (objectFieldValue == value);
+    case JsonDbQueryTerm::LessThanOp:
+        return JsonDbIndexQuery::lessThan(objectFieldValue, value);
+    case JsonDbQueryTerm::GreaterEqualOp:
+        return JsonDbIndexQuery::greaterThan(objectFieldValue, value) || (objectFieldValue == value);
+    case JsonDbQueryTerm::GreaterThanOp:
+        return JsonDbIndexQuery::greaterThan(objectFieldValue, value);
+    case JsonDbQueryTerm::ExistsOp:
+        return objectFieldValue.type() != QJsonValue::Undefined;
+    case JsonDbQueryTerm::NotExistsOp:
+        return objectFieldValue.type() == QJsonValue::Undefined;
+    case JsonDbQueryTerm::InOp:
+        if (term.hasValueSet())
+            return term.valueSetContains(objectFieldValue);
+        return value.toArray().contains(objectFieldValue);
+    case JsonDbQueryTerm::NotInOp:
+        if (term.hasValueSet())
+            return !term.valueSetContains(objectFieldValue);
+        return !value.toArray().contains(objectFieldValue);
+    case JsonDbQueryTerm::ContainsOp:
+        return objectFieldValue.toArray().contains(value);
+    case JsonDbQueryTerm::NotContainsOp:
+        return !objectFieldValue.toArray().contains(value);
+    case JsonDbQueryTerm::StartsWithOp:
+        return objectFieldValue.type() == QJsonValue::String
+                && objectFieldValue.toString().startsWith(value.toString());
+    case JsonDbQueryTerm::MatchesOp:
+        if (!term.isBound() && value.isString())
+            return JsonDbIndexPrivate::textMatches(objectFieldValue, JsonDbIndexPrivate::textTokens(value.toString()));
+        return JsonDbIndexPrivate::textMatches(objectFieldValue, term.textTokens());
+    case JsonDbQueryTerm::UnknownOp:
+        break;
+    }
+    qCritical() << "match" << "unhandled term" << term.propertyName() << term.op() << value << term.joinField();
+    return false;
+}
+
 bool JsonDbQuery::isAscending() const
 {
     return orderTerms.isEmpty() || orderTerms.at(0).ascending;
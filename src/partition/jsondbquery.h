@@ -45,6 +45,9 @@
 #include <QDebug>
 #include <QObject>
 #include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QSharedPointer>
 #include <QStringList>
 #include <QVariant>
 #include "jsondberrors.h"
@@ -64,6 +67,26 @@ class JsonDbPartition;
 class Q_JSONDB_PARTITION_EXPORT JsonDbQueryTerm
 {
 public:
+    enum Op {
+        UnknownOp,
+        EqualsOp,
+        NotEqualsOp,
+        RegExpOp,
+        NotRegExpOp,
+        LessEqualOp,
+        LessThanOp,
+        GreaterEqualOp,
+        GreaterThanOp,
+        ExistsOp,
+        NotExistsOp,
+        InOp,
+        NotInOp,
+        ContainsOp,
+        NotContainsOp,
+        StartsWithOp,
+        MatchesOp
+    };
+
     JsonDbQueryTerm();
     ~JsonDbQueryTerm();
 
@@ -77,7 +100,11 @@ public:
     { mPropertyName = propertyName; mFieldPath = propertyName.split(QLatin1Char('.')); }
 
     QString op() const { return mOp; }
-    void setOp(QString op) { mOp = op; }
+    void setOp(QString op) { mOp = op; mOpCode = opFromString(op); }
+    Op opCode() const { return mOpCode; }
+    static Op opFromString(const QString &op);
+
+    const QStringList &fieldPath() const { return mFieldPath; }
 
     QString joinField() const { return mJoinField; }
     void setJoinField(QString joinField)
@@ -103,6 +130,16 @@ public:
     void setRegExp(const QRegExp &regExp) { mRegExp = regExp; }
     const QRegExp &regExpConst() const { return mRegExp; }
 
+    void compile(const QMap<QString, QJsonValue> &bindings);
+    inline bool isBound() const { return mBound; }
+    inline const QJsonValue &boundValue() const { return mBoundValue; }
+    bool valueSetContains(const QJsonValue &v) const;
+    inline bool hasValueSet() const { return !mValueSet.isNull(); }
+    // words of the bound value of a "matches" term
+    inline const QStringList &textTokens() const { return mTextTokens; }
+
+    static bool makeValueSetKey(const QJsonValue &v, QString *key);
+
  private:
     QString mPropertyVariable;
     QString mPropertyName;
@@ -111,8 +148,13 @@ public:
     QRegExp mRegExp;
     QStringList mFieldPath;
     QString mOp;
+    Op mOpCode;
     QString mJoinField;
     QVector<QStringList> mJoinPaths;
+    bool mBound;
+    QJsonValue mBoundValue;
+    QSharedPointer<const QSet<QString> > mValueSet;
+    QStringList mTextTokens;
 };
 
 class Q_JSONDB_PARTITION_EXPORT JsonDbOrQueryTerm
@@ -158,14 +200,22 @@ public:
     inline bool isEmpty() const { return queryTerms.isEmpty() && orderTerms.isEmpty(); }
 
     QSet<QString> matchedTypes() const { return mMatchedTypes; }
+    void compile();
     bool match(const JsonDbObject &object, QHash<QString, JsonDbObject> *objectCache, JsonDbPartition *partition = 0) const;
+    bool match(const JsonDbObject &object, QHash<QString, JsonDbObject> *objectCache, JsonDbPartition *partition,
+               const QMap<QString, QJsonValue> &extraBindings) const;
 
     inline QJsonValue termValue(const JsonDbQueryTerm &term) const
     { return term.hasValue() ? term.value() : bindings.value(term.variable(), QJsonValue(QJsonValue::Undefined)); }
 
     bool isAscending() const;
 
+    static void cacheObject(QHash<QString, JsonDbObject> *objectCache, const QString &uuid, const JsonDbObject &object);
+
 private:
+    bool matchTerm(const JsonDbQueryTerm &term, const JsonDbObject &object, QHash<QString, JsonDbObject> *objectCache,
+                   JsonDbPartition *partition, const QMap<QString, QJsonValue> *extraBindings) const;
+
     QSet<QString> mMatchedTypes;
     friend class JsonDbQueryParserPrivate;
 };
@@ -397,6 +397,8 @@ bool JsonDbQueryParserPrivate::parse()
         spec.orderTerms.append(term);
     }
 
+    spec.compile();
+
     return true;
 }
 
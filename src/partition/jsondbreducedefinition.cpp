@@ -43,6 +43,8 @@
 #include <QElapsedTimer>
 #include <QJSValue>
 #include <QJSValueIterator>
+#include <QJsonArray>
+#include <QJsonDocument>
 #include <QStringList>
 
 #include <fcntl.h>
@@ -86,13 +88,19 @@ JsonDbReduceDefinition::JsonDbReduceDefinition(const JsonDbOwner *owner, JsonDbP
             mTargetValueName = mDefinition.value(QStringLiteral("targetValueName")).toString();
     } else
         mTargetValueName = QLatin1String("value");
-
+    if (mDefinition.contains(QStringLiteral("aggregate"))) {
+        mAggregate = mDefinition.value(QStringLiteral("aggregate")).toString();
+        mSourceValueName = mDefinition.value(QStringLiteral("sourceValueName")).toString();
+        mSourceValueNameList = mSourceValueName.split(QStringLiteral("."));
+    }
 }
 
 void JsonDbReduceDefinition::definitionCreated()
 {
     initScriptEngine();
     initIndexes();
+    // any reduced objects were removed with the previous version of the definition
+    mReducedObjects.clear();
 
     GetObjectsResult getObjectResponse = mPartition->d_func()->getObjects(JsonDbString::kTypeStr, mSourceType);
     if (!getObjectResponse.error.isNull()) {
@@ -101,8 +109,10 @@ void JsonDbReduceDefinition::definitionCreated()
         setError(getObjectResponse.error.toString());
     }
     JsonDbObjectList objects = getObjectResponse.data;
+    JsonDbUpdateList changes;
     for (int i = 0; i < objects.size(); i++)
-        updateObject(QJsonObject(), objects.at(i));
+        changes.append(JsonDbUpdate(JsonDbObject(), objects.at(i), JsonDbNotification::Create));
+    updateObjects(changes);
 }
 
 void JsonDbReduceDefinition::definitionRemoved(JsonDbPartition *partition, JsonDbObjectTable *table, const QString targetType, const QString &definitionUuid)
@@ -132,8 +142,8 @@ void JsonDbReduceDefinition::initScriptEngine()
     if (!status)
         setError(message);
 
-    Q_ASSERT(!mDefinition.value(QStringLiteral("add")).toString().isEmpty());
-    Q_ASSERT(!mDefinition.value(QStringLiteral("subtract")).toString().isEmpty());
+    Q_ASSERT(!mAggregate.isEmpty() || !mDefinition.value(QStringLiteral("add")).toString().isEmpty());
+    Q_ASSERT(!mAggregate.isEmpty() || !mDefinition.value(QStringLiteral("subtract")).toString().isEmpty());
 }
 
 void JsonDbReduceDefinition::releaseScriptEngine()
@@ -155,84 +165,160 @@ void JsonDbReduceDefinition::initIndexes()
 
 void JsonDbReduceDefinition::updateObject(JsonDbObject before, JsonDbObject after, JsonDbUpdateList *changeList)
 {
-    initScriptEngine();
-
-    QJsonValue beforeKeyValue = sourceKeyValue(before);
-    QJsonValue afterKeyValue = sourceKeyValue(after);
-
-    if (jsondbSettings->debug())
-        qDebug() << "JsonDbReduceDefinition::updateObject"
-                 << "beforeKeyValue" << beforeKeyValue
-                 << "afterKeyValue" << afterKeyValue;
-    if (!after.isEmpty() && !after.isDeleted() && !before.isEmpty() && (beforeKeyValue != afterKeyValue)) {
-        // do a subtract only on the before key
-        if (!beforeKeyValue.isUndefined())
-          updateObject(before, QJsonObject(), changeList);
-
-        // and then continue here with the add with the after key
-        before = QJsonObject();
-    }
+    JsonDbUpdateList changes;
+    changes.append(JsonDbUpdate(before, after, JsonDbNotification::Update));
+    updateObjects(changes, changeList);
+}
 
-    const QJsonValue keyValue((after.isEmpty() || after.isDeleted()) ? beforeKeyValue : afterKeyValue);
-    if (keyValue.isUndefined())
-        return;
+static QByteArray reduceKey(const QJsonValue &keyValue)
+{
+    QJsonArray array;
+    array.append(keyValue);
+    return QJsonDocument(array).toBinaryData();
+}
 
-    GetObjectsResult getObjectResponse = mTargetTable->getObjects(mTargetKeyName, keyValue, mTargetType);
-    if (!getObjectResponse.error.isNull())
-        setError(getObjectResponse.error.toString());
+/*!
+    Reduces the source object \a changes in batches of viewUpdateBatchSize.
+    The reduced objects for the keys of a batch that are not in the
+    write-back cache are looked up together. The subtract and add functions,
+    or the built-in aggregate, are applied in order of the changes, and every
+    reduced object that changed is written once at the end.
+*/
+void JsonDbReduceDefinition::updateObjects(const JsonDbUpdateList &changes, JsonDbUpdateList *changeList)
+{
+    initScriptEngine();
+    int batchSize = qMax(1, jsondbSettings->viewUpdateBatchSize());
+
+    QList<QByteArray> touchedKeys;
+    QHash<QByteArray, QJsonValue> keyValues;
+    QHash<QByteArray, QJsonValue> values;
+    QSet<QByteArray> recomputeKeys;
+
+    for (int start = 0; start < changes.size(); start += batchSize) {
+        // each step subtracts or adds one object to the key at the same position in stepKeys
+        QList<QByteArray> stepKeys;
+        QList<FunctionNumber> stepFunctions;
+        JsonDbObjectList stepObjects;
+        QList<QJsonValue> uncachedKeyValues;
+
+        for (int i = start; i < changes.size() && i < start + batchSize; i++) {
+            const JsonDbObject &before = changes.at(i).oldObject;
+            const JsonDbObject &after = changes.at(i).newObject;
+            QJsonValue beforeKeyValue = sourceKeyValue(before);
+            QJsonValue afterKeyValue = sourceKeyValue(after);
+
+            if (jsondbSettings->debug())
+                qDebug() << "JsonDbReduceDefinition::updateObjects"
+                         << "beforeKeyValue" << beforeKeyValue
+                         << "afterKeyValue" << afterKeyValue;
+
+            for (int j = 0; j < 2; j++) {
+                const QJsonValue &keyValue = j ? afterKeyValue : beforeKeyValue;
+                if (keyValue.isUndefined())
+                    continue;
+                QByteArray key = reduceKey(keyValue);
+                if (!keyValues.contains(key)) {
+                    touchedKeys.append(key);
+                    keyValues.insert(key, keyValue);
+                    if (!mReducedObjects.contains(key))
+                        uncachedKeyValues.append(keyValue);
+                }
+                stepKeys.append(key);
+                stepFunctions.append(j ? JsonDbReduceDefinition::Add : JsonDbReduceDefinition::Subtract);
+                stepObjects.append(j ? after : before);
+            }
+        }
 
-    JsonDbObject previousObject;
-    QJsonValue previousValue(QJsonValue::Undefined);
+        if (!uncachedKeyValues.isEmpty()) {
+            GetObjectsResult getObjectResponse = mTargetTable->getObjects(mTargetKeyName, uncachedKeyValues, mTargetType);
+            if (!getObjectResponse.error.isNull())
+                setError(getObjectResponse.error.toString());
+            foreach (const QJsonValue &keyValue, uncachedKeyValues)
+                mReducedObjects.insert(reduceKey(keyValue), JsonDbObject());
+            foreach (const JsonDbObject &previous, getObjectResponse.data) {
+                if (previous.value(QStringLiteral("_reduceUuid")).toString() != mUuid)
+                    continue;
+                QByteArray key = reduceKey(previous.value(mTargetKeyName));
+                if (keyValues.contains(key))
+                    mReducedObjects.insert(key, previous);
+            }
+        }
 
-    JsonDbObjectList previousResults = getObjectResponse.data;
-    for (int k = 0; k < previousResults.size(); ++k) {
-        JsonDbObject previous = previousResults.at(k);
-        if (previous.value(QStringLiteral("_reduceUuid")).toString() == mUuid) {
-            previousObject = previous;
-            previousValue = previousObject;
-            break;
+        for (int i = 0; i < stepKeys.size(); i++) {
+            const QByteArray &key = stepKeys.at(i);
+            if (!values.contains(key)) {
+                const JsonDbObject &previous = mReducedObjects.value(key);
+                values.insert(key, previous.isEmpty() ? QJsonValue(QJsonValue::Undefined) : QJsonValue(previous));
+            }
+            if (mAggregate.isEmpty()) {
+                values[key] = addObject(stepFunctions.at(i), keyValues.value(key), values.value(key), stepObjects.at(i));
+            } else {
+                bool recompute = false;
+                values[key] = aggregateObject(stepFunctions.at(i), values.value(key), stepObjects.at(i), &recompute);
+                if (recompute)
+                    recomputeKeys.insert(key);
+            }
         }
     }
 
-    QJsonValue value = previousValue;
-    if (!before.isEmpty())
-        value = addObject(JsonDbReduceDefinition::Subtract, keyValue, value, before);
-    if (!after.isEmpty() && !after.isDeleted())
-        value = addObject(JsonDbReduceDefinition::Add, keyValue, value, after);
+    // a min or max lost its extreme value, so aggregate what is left for the key
+    foreach (const QByteArray &key, recomputeKeys)
+        values[key] = aggregateSources(keyValues.value(key));
 
     JsonDbObjectList objectsToUpdate;
-    // if we had a previous object to reduce
-    if (previousObject.contains(JsonDbString::kUuidStr)) {
-        // and now the value is undefined
-        if (value.isUndefined()) {
-            // then remove it
-            previousObject.markDeleted();
-            objectsToUpdate.append(previousObject);
-        } else {
-            //otherwise update it
+    foreach (const QByteArray &key, touchedKeys) {
+        JsonDbObject previousObject = mReducedObjects.value(key);
+        const QJsonValue &value = values.value(key);
+        const QJsonValue &keyValue = keyValues.value(key);
+        // if we had a previous object to reduce
+        if (previousObject.contains(JsonDbString::kUuidStr)) {
+            // and now the value is undefined
+            if (value.isUndefined()) {
+                // then remove it
+                previousObject.markDeleted();
+                objectsToUpdate.append(previousObject);
+            } else {
+                //otherwise update it
+                JsonDbObject reduced(value.toObject());
+                reduced.insert(JsonDbString::kTypeStr, mTargetType);
+                reduced.insert(JsonDbString::kUuidStr,
+                             previousObject.value(JsonDbString::kUuidStr));
+                reduced.insert(JsonDbString::kVersionStr,
+                             previousObject.value(JsonDbString::kVersionStr));
+                reduced.insert(mTargetKeyName, keyValue);
+                reduced.insert(QStringLiteral("_reduceUuid"), mUuid);
+                objectsToUpdate.append(reduced);
+            }
+        } else if (!value.isUndefined()) {
+            // otherwise create the new object
             JsonDbObject reduced(value.toObject());
             reduced.insert(JsonDbString::kTypeStr, mTargetType);
-            reduced.insert(JsonDbString::kUuidStr,
-                         previousObject.value(JsonDbString::kUuidStr));
-            reduced.insert(JsonDbString::kVersionStr,
-                         previousObject.value(JsonDbString::kVersionStr));
             reduced.insert(mTargetKeyName, keyValue);
             reduced.insert(QStringLiteral("_reduceUuid"), mUuid);
+
             objectsToUpdate.append(reduced);
         }
-    } else if (!value.isUndefined()) {
-        // otherwise create the new object
-        JsonDbObject reduced(value.toObject());
-        reduced.insert(JsonDbString::kTypeStr, mTargetType);
-        reduced.insert(mTargetKeyName, keyValue);
-        reduced.insert(QStringLiteral("_reduceUuid"), mUuid);
-
-        objectsToUpdate.append(reduced);
     }
 
     JsonDbWriteResult res = mPartition->updateObjects(mOwner, objectsToUpdate, JsonDbPartition::ViewObject, changeList);
-    if (res.code != JsonDbError::NoError)
+    if (res.code != JsonDbError::NoError) {
+        mReducedObjects.clear();
         setError(QString::fromLatin1("Error executing add function: %1").arg(res.message));
+        return;
+    }
+
+    // keep what was written, with the uuids and versions the partition assigned
+    foreach (const JsonDbObject &written, res.objectsWritten) {
+        QByteArray key = reduceKey(written.value(mTargetKeyName));
+        mReducedObjects.insert(key, written.isDeleted() ? JsonDbObject() : written);
+    }
+    if (mReducedObjects.size() > jsondbSettings->reduceCacheSize())
+        mReducedObjects.clear();
+}
+
+void JsonDbReduceDefinition::flushCaches()
+{
+    mReducedObjects.clear();
 }
 
 QJsonValue JsonDbReduceDefinition::addObject(JsonDbReduceDefinition::FunctionNumber functionNumber,
@@ -267,6 +353,72 @@ QJsonValue JsonDbReduceDefinition::addObject(JsonDbReduceDefinition::FunctionNum
     }
 }
 
+/*!
+    Applies the built-in aggregate of a declarative Reduce to \a object,
+    adding or subtracting it from \a previousValue. Besides the aggregate
+    under targetValueName, the reduced object keeps the number of objects
+    in _count, and their sum in _sum for sum and avg. Returns undefined
+    once no objects are left. Sets \a recompute when a min or max loses
+    its extreme value and has to be aggregated again from the sources.
+*/
+QJsonValue JsonDbReduceDefinition::aggregateObject(JsonDbReduceDefinition::FunctionNumber functionNumber,
+                                                   const QJsonValue &previousValue, const JsonDbObject &object, bool *recompute)
+{
+    QJsonObject previous = previousValue.toObject();
+    double count = previous.value(QStringLiteral("_count")).toDouble();
+    double sum = previous.value(QStringLiteral("_sum")).toDouble();
+    QJsonValue value = previous.value(mTargetValueName);
+    double sign = (functionNumber == JsonDbReduceDefinition::Add) ? 1 : -1;
+
+    if (mAggregate == QLatin1String("count")) {
+        count += sign;
+        value = count;
+    } else {
+        QJsonValue sourceValue = JsonDbObject(object).valueByPath(mSourceValueNameList);
+        // only numbers take part in the other aggregates
+        if (!sourceValue.isDouble())
+            return previousValue;
+        double number = sourceValue.toDouble();
+        count += sign;
+        sum += sign * number;
+        if (mAggregate == QLatin1String("sum")) {
+            value = sum;
+        } else if (mAggregate == QLatin1String("avg")) {
+            value = count > 0 ? sum / count : 0;
+        } else if (functionNumber == JsonDbReduceDefinition::Add) {
+            if (!value.isDouble()
+                || (mAggregate == QLatin1String("min") ? number < value.toDouble() : number > value.toDouble()))
+                value = number;
+        } else if (value.isDouble() && number == value.toDouble()) {
+            *recompute = true;
+        }
+    }
+
+    if (count <= 0)
+        return QJsonValue(QJsonValue::Undefined);
+    QJsonObject reduced;
+    reduced.insert(mTargetValueName, value);
+    reduced.insert(QStringLiteral("_count"), count);
+    if (mAggregate == QLatin1String("sum") || mAggregate == QLatin1String("avg"))
+        reduced.insert(QStringLiteral("_sum"), sum);
+    return reduced;
+}
+
+QJsonValue JsonDbReduceDefinition::aggregateSources(const QJsonValue &keyValue)
+{
+    GetObjectsResult getObjectResponse = mPartition->d_func()->getObjects(mSourceKeyName, keyValue, mSourceType, false);
+    if (!getObjectResponse.error.isNull())
+        setError(getObjectResponse.error.toString());
+
+    QJsonValue value(QJsonValue::Undefined);
+    bool recompute = false;
+    foreach (const JsonDbObject &object, getObjectResponse.data) {
+        if (sourceKeyValue(object) == keyValue)
+            value = aggregateObject(JsonDbReduceDefinition::Add, value, object, &recompute);
+    }
+    return value;
+}
+
 bool JsonDbReduceDefinition::isActive() const
 {
     return !mDefinition.contains(JsonDbString::kActiveStr) || mDefinition.value(JsonDbString::kActiveStr).toBool();
@@ -304,14 +456,14 @@ bool JsonDbReduceDefinition::validateDefinition(const JsonDbObject &reduce, Json
         message = QLatin1Literal("sourceKeyName or sourceKeyFunction must be provided for Reduce");
     else if (!reduce.value(QStringLiteral("sourceKeyName")).toString().isEmpty() && !reduce.value(QStringLiteral("sourceKeyFunction")).toString().isEmpty())
         message = QLatin1Literal("Only one of sourceKeyName and sourceKeyFunction may be provided for Reduce");
-    else if (reduce.value(QStringLiteral("add")).toString().isEmpty())
+    else if (!reduce.contains(QStringLiteral("aggregate")) && reduce.value(QStringLiteral("add")).toString().isEmpty())
         message = QLatin1Literal("add function for Reduce not specified");
-    else if (reduce.value(QStringLiteral("subtract")).toString().isEmpty())
+    else if (!reduce.contains(QStringLiteral("aggregate")) && reduce.value(QStringLiteral("subtract")).toString().isEmpty())
         message = QLatin1Literal("subtract function for Reduce not specified");
     else if (reduce.contains(QStringLiteral("targetValueName"))
              && !(reduce.value(QStringLiteral("targetValueName")).isString() || reduce.value(QStringLiteral("targetValueName")).isNull()))
         message = QLatin1Literal("targetValueName for Reduce must be a string or null");
-    else {
+    else if (!reduce.contains(QStringLiteral("aggregate")) || validateAggregate(reduce, message)) {
         QJSEngine *scriptEngine = JsonDbScriptEngine::scriptEngine();
         QVector<QJSValue> functions;
         // check for script errors
@@ -320,6 +472,24 @@ bool JsonDbReduceDefinition::validateDefinition(const JsonDbObject &reduce, Json
     return message.isEmpty();
 }
 
+bool JsonDbReduceDefinition::validateAggregate(const JsonDbObject &reduce, QString &message)
+{
+    QString aggregate = reduce.value(QStringLiteral("aggregate")).toString();
+    if (!(QStringList() << QStringLiteral("count") << QStringLiteral("sum") << QStringLiteral("min")
+          << QStringLiteral("max") << QStringLiteral("avg")).contains(aggregate))
+        message = QLatin1Literal("aggregate for Reduce must be one of count, sum, min, max or avg");
+    else if (reduce.contains(QStringLiteral("add")) || reduce.contains(QStringLiteral("subtract")))
+        message = QLatin1Literal("aggregate and add or subtract functions are mutually exclusive for Reduce");
+    else if (aggregate != QLatin1String("count") && reduce.value(QStringLiteral("sourceValueName")).toString().isEmpty())
+        message = QString::fromLatin1("sourceValueName must be provided for %1 aggregate").arg(aggregate);
+    else if ((aggregate == QLatin1String("min") || aggregate == QLatin1String("max"))
+             && reduce.value(QStringLiteral("sourceKeyName")).toString().isEmpty())
+        message = QString::fromLatin1("sourceKeyName must be provided for %1 aggregate").arg(aggregate);
+    else if (reduce.contains(QStringLiteral("targetValueName")) && !reduce.value(QStringLiteral("targetValueName")).isString())
+        message = QLatin1Literal("targetValueName for Reduce with aggregate must be a string");
+    return message.isEmpty();
+}
+
 bool JsonDbReduceDefinition::compileFunctions(QJSEngine *scriptEngine, QJsonObject definition, JsonDbJoinProxy *proxy,
                                               QVector<QJSValue> &functions, QString &message)
 {
@@ -86,6 +86,8 @@ public:
     void initIndexes();
 
     void updateObject(JsonDbObject before, JsonDbObject after, JsonDbUpdateList *changeList = 0);
+    void updateObjects(const JsonDbUpdateList &changes, JsonDbUpdateList *changeList = 0);
+    void flushCaches();
 
     void setError(const QString &errorMsg);
 
@@ -104,6 +106,9 @@ private:
     static bool compileFunctions(QJSEngine *scriptEngine, QJsonObject definition, JsonDbJoinProxy *joinProxy, QVector<QJSValue> &mFunctions, QString &message);
     QJsonValue sourceKeyValue(const JsonDbObject &object);
     QJsonValue addObject(FunctionNumber fn, const QJsonValue &keyValue, QJsonValue previousResult, JsonDbObject object);
+    QJsonValue aggregateObject(FunctionNumber fn, const QJsonValue &previousValue, const JsonDbObject &object, bool *recompute);
+    QJsonValue aggregateSources(const QJsonValue &keyValue);
+    static bool validateAggregate(const JsonDbObject &reduce, QString &message);
 
 private:
     const JsonDbOwner *mOwner;
@@ -120,6 +125,12 @@ private:
     QString        mSourceKeyName;
     // mSourceKeyName split on .
     QStringList    mSourceKeyNameList;
+    // built-in aggregate of a declarative Reduce, empty for add and subtract functions
+    QString        mAggregate;
+    QString        mSourceValueName;
+    QStringList    mSourceValueNameList;
+    // write-back cache of the stored reduced objects by key, empty when a key has none
+    QHash<QByteArray,JsonDbObject> mReducedObjects;
 };
 
 QT_END_NAMESPACE_JSONDB_PARTITION
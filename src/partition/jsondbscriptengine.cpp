@@ -45,15 +45,18 @@
 #include <QJSEngine>
 #include <QDebug>
 #include <QFile>
+#include <QThreadStorage>
 
 #include "jsondbsettings.h"
 #include "jsondbproxy.h"
 
 QT_BEGIN_NAMESPACE_JSONDB_PARTITION
 
-static QJSEngine *sScriptEngine;
+// QJSEngine is not thread-safe, so every thread that evaluates map, reduce or
+// index functions gets an engine of its own.
+static QThreadStorage<QJSEngine *> sScriptEngines;
 
-static void injectScript()
+static void injectScript(QJSEngine *engine)
 {
     QString fileName =jsondbSettings->injectionScript();
     if (fileName.isEmpty())
@@ -74,34 +77,35 @@ static void injectScript()
     QString contents = QString::fromUtf8(scriptFile.readAll());
     scriptFile.close();
 
-    QJSValue result = sScriptEngine->evaluate(contents, fileName);
+    QJSValue result = engine->evaluate(contents, fileName);
     if (result.isError() && jsondbSettings->verbose())
         qDebug() << "QtJsonDb::Partition::injectScript error evaluating script:" << fileName;
 }
 
 QJSEngine *JsonDbScriptEngine::scriptEngine()
 {
-    if (!sScriptEngine) {
+    if (!sScriptEngines.hasLocalData()) {
         if (jsondbSettings->useStrictMode()) {
             // require 'use strict';
             QByteArray v8Args = qgetenv("V8ARGS");
             v8Args.append(" --use_strict");
             qputenv("V8ARGS", v8Args);
         }
-        sScriptEngine = new QJSEngine();
-        QJSValue globalObject = sScriptEngine->globalObject();
-        globalObject.setProperty(QStringLiteral("console"), sScriptEngine->newQObject(new Console()));
-        injectScript();
+        QJSEngine *engine = new QJSEngine();
+        QJSValue globalObject = engine->globalObject();
+        globalObject.setProperty(QStringLiteral("console"), engine->newQObject(new Console()));
+        injectScript(engine);
+        sScriptEngines.setLocalData(engine);
     }
-    return sScriptEngine;
+    return sScriptEngines.localData();
 }
 
 void JsonDbScriptEngine::releaseScriptEngine()
 {
     if (jsondbSettings->verbose())
         qDebug() << "JsonDbScriptEngine::releaseScriptEngine";
-    delete sScriptEngine;
-    sScriptEngine = 0;
+    // deletes the calling thread's engine
+    sScriptEngines.setLocalData(0);
 }
 
 QT_END_NAMESPACE_JSONDB_PARTITION
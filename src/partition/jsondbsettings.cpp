@@ -73,6 +73,20 @@ JsonDbSettings::JsonDbSettings() :
   , mUseStrictMode(false)
   , mOffsetCacheSize(512)
   , mMaxQueriesInOffsetCache(16)
+  , mQueryStreamBufferSize(65536) // pause streamed query results while this many bytes are unsent
+  , mJoinCacheSize(1024) // joined objects kept per query
+  , mJoinBatchSize(64) // outer rows whose joined objects are fetched together
+  , mIndexThreadCount(4) // threads applying the index updates of a transaction at commit, 0 updates indexes as objects are written
+  , mIndexBuildThreshold(10000) // tables with at least this many entries build new indexes in the background, 0 builds them in the write transaction
+  , mPartitionThreads(true) // run each partition on a thread of its own, false serves every partition on the server thread
+  , mSnapshotReadThreads(4) // threads per partition serving reads from a snapshot while the partition thread writes, 0 serves all reads on the partition thread
+  , mNotificationBatchSize(1000) // notifications sent to a connection in one message at most, 0 sends each on its own
+  , mNotificationBatchLatency(0) // milliseconds notifications wait for more to batch with
+  , mHistoricalReplayChunkSize(500) // objects replayed to a new notification per turn of the event loop
+  , mChangeLogCacheSize(10000) // changes each object table keeps in memory for changesSince
+  , mViewUpdateBatchSize(500) // source changes mapped or reduced per view object write
+  , mMapThreadCount(4) // threads mapping the source objects of a view update batch, 0 maps them on the partition thread
+  , mReduceCacheSize(10000) // reduced objects each Reduce keeps in memory between view updates
 {
     loadEnvironment();
 }
@@ -79,6 +79,20 @@ class Q_JSONDB_PARTITION_EXPORT JsonDbSettings : public QObject
     Q_PROPERTY(QString injectionScript READ injectionScript WRITE setInjectionScript)
     Q_PROPERTY(int offsetCacheSize READ offsetCacheSize WRITE setOffsetCacheSize)
     Q_PROPERTY(int maxQueriesInOffsetCache READ maxQueriesInOffsetCache WRITE setMaxQueriesInOffsetCache)
+    Q_PROPERTY(int queryStreamBufferSize READ queryStreamBufferSize WRITE setQueryStreamBufferSize)
+    Q_PROPERTY(int joinCacheSize READ joinCacheSize WRITE setJoinCacheSize)
+    Q_PROPERTY(int joinBatchSize READ joinBatchSize WRITE setJoinBatchSize)
+    Q_PROPERTY(int indexThreadCount READ indexThreadCount WRITE setIndexThreadCount)
+    Q_PROPERTY(int indexBuildThreshold READ indexBuildThreshold WRITE setIndexBuildThreshold)
+    Q_PROPERTY(bool partitionThreads READ partitionThreads WRITE setPartitionThreads)
+    Q_PROPERTY(int snapshotReadThreads READ snapshotReadThreads WRITE setSnapshotReadThreads)
+    Q_PROPERTY(int notificationBatchSize READ notificationBatchSize WRITE setNotificationBatchSize)
+    Q_PROPERTY(int notificationBatchLatency READ notificationBatchLatency WRITE setNotificationBatchLatency)
+    Q_PROPERTY(int historicalReplayChunkSize READ historicalReplayChunkSize WRITE setHistoricalReplayChunkSize)
+    Q_PROPERTY(int changeLogCacheSize READ changeLogCacheSize WRITE setChangeLogCacheSize)
+    Q_PROPERTY(int viewUpdateBatchSize READ viewUpdateBatchSize WRITE setViewUpdateBatchSize)
+    Q_PROPERTY(int mapThreadCount READ mapThreadCount WRITE setMapThreadCount)
+    Q_PROPERTY(int reduceCacheSize READ reduceCacheSize WRITE setReduceCacheSize)
 
 public:
     static JsonDbSettings *instance();
@@ -155,6 +169,48 @@ public:
     inline int maxQueriesInOffsetCache() const { return mMaxQueriesInOffsetCache; }
     inline void setMaxQueriesInOffsetCache(int size) { mMaxQueriesInOffsetCache = size; }
 
+    inline int queryStreamBufferSize() const { return mQueryStreamBufferSize; }
+    inline void setQueryStreamBufferSize(int value) { mQueryStreamBufferSize = value; }
+
+    inline int joinCacheSize() const { return mJoinCacheSize; }
+    inline void setJoinCacheSize(int value) { mJoinCacheSize = value; }
+
+    inline int joinBatchSize() const { return mJoinBatchSize; }
+    inline void setJoinBatchSize(int value) { mJoinBatchSize = value; }
+
+    inline int indexThreadCount() const { return mIndexThreadCount; }
+    inline void setIndexThreadCount(int value) { mIndexThreadCount = value; }
+
+    inline int indexBuildThreshold() const { return mIndexBuildThreshold; }
+    inline void setIndexBuildThreshold(int value) { mIndexBuildThreshold = value; }
+
+    inline bool partitionThreads() const { return mPartitionThreads; }
+    inline void setPartitionThreads(bool value) { mPartitionThreads = value; }
+
+    inline int snapshotReadThreads() const { return mSnapshotReadThreads; }
+    inline void setSnapshotReadThreads(int value) { mSnapshotReadThreads = value; }
+
+    inline int notificationBatchSize() const { return mNotificationBatchSize; }
+    inline void setNotificationBatchSize(int value) { mNotificationBatchSize = value; }
+
+    inline int notificationBatchLatency() const { return mNotificationBatchLatency; }
+    inline void setNotificationBatchLatency(int value) { mNotificationBatchLatency = value; }
+
+    inline int historicalReplayChunkSize() const { return mHistoricalReplayChunkSize; }
+    inline void setHistoricalReplayChunkSize(int value) { mHistoricalReplayChunkSize = value; }
+
+    inline int changeLogCacheSize() const { return mChangeLogCacheSize; }
+    inline void setChangeLogCacheSize(int value) { mChangeLogCacheSize = value; }
+
+    inline int viewUpdateBatchSize() const { return mViewUpdateBatchSize; }
+    inline void setViewUpdateBatchSize(int value) { mViewUpdateBatchSize = value; }
+
+    inline int mapThreadCount() const { return mMapThreadCount; }
+    inline void setMapThreadCount(int value) { mMapThreadCount = value; }
+
+    inline int reduceCacheSize() const { return mReduceCacheSize; }
+    inline void setReduceCacheSize(int value) { mReduceCacheSize = value; }
+
     JsonDbSettings();
 
 private:
@@ -183,6 +239,20 @@ private:
     QString mInjectionScript;
     int mOffsetCacheSize;
     int mMaxQueriesInOffsetCache;
+    int mQueryStreamBufferSize;
+    int mJoinCacheSize;
+    int mJoinBatchSize;
+    int mIndexThreadCount;
+    int mIndexBuildThreshold;
+    bool mPartitionThreads;
+    int mSnapshotReadThreads;
+    int mNotificationBatchSize;
+    int mNotificationBatchLatency;
+    int mHistoricalReplayChunkSize;
+    int mChangeLogCacheSize;
+    int mViewUpdateBatchSize;
+    int mMapThreadCount;
+    int mReduceCacheSize;
 };
 
 QT_END_NAMESPACE_JSONDB_PARTITION
@@ -56,6 +56,7 @@ const QString JsonDbString::kCountStr   = QString::fromLatin1("count");
 const QString JsonDbString::kCurrentStr = QString::fromLatin1("_current");
 const QString JsonDbString::kDomainStr    = QString::fromLatin1("domain");
 const QString JsonDbString::kIndexValueStr = QString::fromLatin1("_indexValue");
+const QString JsonDbString::kIndexSortKeyStr = QString::fromLatin1("_indexSortKey");
 const QString JsonDbString::kOwnerStr   = QString::fromLatin1("_owner");
 const QString JsonDbString::kTypeStr    = QString::fromLatin1("_type");
 const QString JsonDbString::kTypesStr   = QString::fromLatin1("types");
@@ -66,6 +67,7 @@ const QString JsonDbString::kActionStr   = QString::fromLatin1("action");
 const QString JsonDbString::kActionsStr  = QString::fromLatin1("actions");
 const QString JsonDbString::kActiveStr   = QString::fromLatin1("active");
 const QString JsonDbString::kAddIndexStr = QString::fromLatin1("addIndex");
+const QString JsonDbString::kBatchedStr  = QString::fromLatin1("batched");
 const QString JsonDbString::kCreateStr   = QString::fromLatin1("create");
 const QString JsonDbString::kDropStr   = QString::fromLatin1("drop");
 const QString JsonDbString::kConflictsStr = QString::fromLatin1("conflicts");
@@ -112,6 +114,7 @@ const QString JsonDbString::kLocaleStr = QString::fromLatin1("locale");
 const QString JsonDbString::kCollationStr = QString::fromLatin1("collation");
 const QString JsonDbString::kCaseSensitiveStr = QString::fromLatin1("caseSensitive");
 const QString JsonDbString::kCasePreferenceStr = QString::fromLatin1("casePreference");
+const QString JsonDbString::kIncludeStr = QString::fromLatin1("include");
 const QString JsonDbString::kDatabaseSchemaVersionStr = QString::fromLatin1("databaseSchemaVersion");
 const QString JsonDbString::kPathStr = QString::fromLatin1("path");
 const QString JsonDbString::kDefaultStr = QString::fromLatin1("default");
@@ -121,5 +124,10 @@ const QString JsonDbString::kSourceUuidsDotStarStr = QString::fromLatin1("_sourc
 const QString JsonDbString::kCapabilityTypeStr = QString::fromLatin1("Capability");
 const QString JsonDbString::kRemovableStr = QString::fromLatin1("removable");
 const QString JsonDbString::kAvailableStr = QString::fromLatin1("available");
+const QString JsonDbString::kChunkSizeStr = QString::fromLatin1("chunkSize");
+const QString JsonDbString::kCursorStr = QString::fromLatin1("cursor");
+const QString JsonDbString::kCloseCursorStr = QString::fromLatin1("closeCursor");
+const QString JsonDbString::kMoreStr = QString::fromLatin1("more");
+const QString JsonDbString::kContinuationStr = QString::fromLatin1("continuation");
 
 QT_END_NAMESPACE_JSONDB_PARTITION
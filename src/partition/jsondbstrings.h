@@ -53,6 +53,7 @@ public:
     static const QString kActionsStr;
     static const QString kActiveStr;
     static const QString kAddIndexStr;
+    static const QString kBatchedStr;
     static const QString kCodeStr;
     static const QString kConflictsStr;
     static const QString kConnectStr;
@@ -71,6 +72,7 @@ public:
     static const QString kNameStr;
     static const QString kIdStr;
     static const QString kIndexValueStr;
+    static const QString kIndexSortKeyStr;
     static const QString kLengthStr;
     static const QString kLimitStr;
     static const QString kMapTypeStr;
@@ -117,6 +119,7 @@ public:
     static const QString kCollationStr;
     static const QString kCaseSensitiveStr;
     static const QString kCasePreferenceStr;
+    static const QString kIncludeStr;
     static const QString kDatabaseSchemaVersionStr;
     static const QString kPathStr;
     static const QString kDefaultStr;
@@ -126,6 +129,11 @@ public:
     static const QString kCapabilityTypeStr;
     static const QString kRemovableStr;
     static const QString kAvailableStr;
+    static const QString kChunkSizeStr;
+    static const QString kCursorStr;
+    static const QString kCloseCursorStr;
+    static const QString kMoreStr;
+    static const QString kContinuationStr;
 };
 
 QT_END_NAMESPACE_JSONDB_PARTITION
@@ -67,6 +67,10 @@ JsonDbView::JsonDbView(JsonDbPartition *partition, const QString &viewType, QObj
   , mViewStateNumber(0)
   , mViewType(viewType)
   , mUpdating(false)
+  , mUpdateCount(0)
+  , mUpdateUsecs(0)
+  , mMaxUpdateUsecs(0)
+  , mLastUpdateUsecs(0)
 {
     mViewObjectTable = new JsonDbObjectTable(mPartition);
 }
@@ -268,8 +272,7 @@ void JsonDbView::updateSourceTypesList()
 void JsonDbView::updateView(quint32 desiredStateNumber, JsonDbUpdateList *resultingChanges)
 {
     QElapsedTimer timer;
-    if (jsondbSettings->performanceLog())
-        timer.start();
+    timer.start();
     if (jsondbSettings->verbose())
         qDebug() << "updateView" << mViewType << "{";
     // current state of the main object table of the partition
@@ -338,6 +341,7 @@ void JsonDbView::updateView(quint32 desiredStateNumber, JsonDbUpdateList *result
         mViewObjectTable->commit(partitionStateNumber);
     if (jsondbSettings->verbose())
         qDebug() << "}" << "updateView" << mViewType << partitionStateNumber;
+    recordUpdateTime(timer.nsecsElapsed() / 1000);
     if (jsondbSettings->performanceLog())
         qDebug() << "updateView" << "stateNumber" << mViewStateNumber << mViewType << timer.elapsed() << "ms";
 
@@ -362,8 +366,7 @@ void JsonDbView::updateEagerView(const JsonDbUpdateList &objectsUpdated, JsonDbU
     }
 
     QElapsedTimer timer;
-    if (jsondbSettings->performanceLog())
-        timer.start();
+    timer.start();
     if (jsondbSettings->verbose())
         qDebug() << "updateEagerView" << mViewType << "{";
 
@@ -378,6 +381,7 @@ void JsonDbView::updateEagerView(const JsonDbUpdateList &objectsUpdated, JsonDbU
     mViewObjectTable->commit(partitionStateNumber);
     mViewStateNumber = partitionStateNumber;
 
+    recordUpdateTime(timer.nsecsElapsed() / 1000);
     if (jsondbSettings->verbose())
         qDebug() << "updateEagerView" << mViewType << viewStateNumber << "}";
     if (jsondbSettings->performanceLog())
@@ -419,36 +423,49 @@ void JsonDbView::updateViewOnChanges(const JsonDbUpdateList &objectsUpdated,
                                      QSet<QString> &processedDefinitionUuids,
                                      JsonDbUpdateList *changeList)
 {
+    // group the changes by definition so each one maps or reduces them in batches
+    QList<JsonDbMapDefinition*> mapDefinitions;
+    QHash<JsonDbMapDefinition*, JsonDbUpdateList> mapUpdates;
+    QList<JsonDbReduceDefinition*> reduceDefinitions;
+    QHash<JsonDbReduceDefinition*, JsonDbUpdateList> reduceUpdates;
+
     foreach (const JsonDbUpdate &update, objectsUpdated) {
         QJsonObject beforeObject = update.oldObject;
         QJsonObject afterObject = update.newObject;
         QString beforeType = beforeObject.value(JsonDbString::kTypeStr).toString();
         QString afterType = afterObject.value(JsonDbString::kTypeStr).toString();
 
-        if (mMapDefinitionsBySource.contains(beforeType)) {
-            JsonDbMapDefinition *def = mMapDefinitionsBySource.value(beforeType);
-            if (processedDefinitionUuids.contains(def->uuid()))
-                continue;
-            def->updateObject(beforeObject, afterObject, changeList);
-        } else if (mMapDefinitionsBySource.contains(afterType)) {
-            JsonDbMapDefinition *def = mMapDefinitionsBySource.value(afterType);
-            if (processedDefinitionUuids.contains(def->uuid()))
+        JsonDbMapDefinition *mapDefinition = 0;
+        if (mMapDefinitionsBySource.contains(beforeType))
+            mapDefinition = mMapDefinitionsBySource.value(beforeType);
+        else if (mMapDefinitionsBySource.contains(afterType))
+            mapDefinition = mMapDefinitionsBySource.value(afterType);
+        if (mapDefinition) {
+            if (processedDefinitionUuids.contains(mapDefinition->uuid()))
                 continue;
-            def->updateObject(beforeObject, afterObject, changeList);
+            if (!mapUpdates.contains(mapDefinition))
+                mapDefinitions.append(mapDefinition);
+            mapUpdates[mapDefinition].append(update);
         }
 
-        if (mReduceDefinitionsBySource.contains(beforeType)) {
-            JsonDbReduceDefinition *def = mReduceDefinitionsBySource.value(beforeType);
-            if (processedDefinitionUuids.contains(def->uuid()))
+        JsonDbReduceDefinition *reduceDefinition = 0;
+        if (mReduceDefinitionsBySource.contains(beforeType))
+            reduceDefinition = mReduceDefinitionsBySource.value(beforeType);
+        else if (mReduceDefinitionsBySource.contains(afterType))
+            reduceDefinition = mReduceDefinitionsBySource.value(afterType);
+        if (reduceDefinition) {
+            if (processedDefinitionUuids.contains(reduceDefinition->uuid()))
                 continue;
-            def->updateObject(beforeObject, afterObject, changeList);
-        } else if (mReduceDefinitionsBySource.contains(afterType)) {
-            JsonDbReduceDefinition *def = mReduceDefinitionsBySource.value(afterType);
-            if (processedDefinitionUuids.contains(def->uuid()))
-                continue;
-            def->updateObject(beforeObject, afterObject, changeList);
+            if (!reduceUpdates.contains(reduceDefinition))
+                reduceDefinitions.append(reduceDefinition);
+            reduceUpdates[reduceDefinition].append(update);
         }
     }
+
+    foreach (JsonDbMapDefinition *def, mapDefinitions)
+        def->updateObjects(mapUpdates.value(def), changeList);
+    foreach (JsonDbReduceDefinition *def, reduceDefinitions)
+        def->updateObjects(reduceUpdates.value(def), changeList);
 }
 
 bool JsonDbView::processUpdatedDefinitions(const QString &viewType, quint32 targetStateNumber,
@@ -510,9 +527,34 @@ bool JsonDbView::processUpdatedDefinitions(const QString &viewType, quint32 targ
     return inTransaction;
 }
 
+void JsonDbView::recordUpdateTime(qint64 usecs)
+{
+    mUpdateCount++;
+    mUpdateUsecs += usecs;
+    mLastUpdateUsecs = usecs;
+    mMaxUpdateUsecs = qMax(mMaxUpdateUsecs, usecs);
+}
+
+/*!
+    Returns how many times the view has been brought up to date and how long
+    that took in microseconds, in total, at most and the last time. An
+    update includes the time spent updating the views it reads from.
+*/
+QJsonObject JsonDbView::updateStats() const
+{
+    QJsonObject stats;
+    stats.insert(QStringLiteral("updates"), mUpdateCount);
+    stats.insert(QStringLiteral("totalUsecs"), static_cast<double>(mUpdateUsecs));
+    stats.insert(QStringLiteral("maxUsecs"), static_cast<double>(mMaxUpdateUsecs));
+    stats.insert(QStringLiteral("lastUsecs"), static_cast<double>(mLastUpdateUsecs));
+    return stats;
+}
+
 void JsonDbView::reduceMemoryUsage()
 {
     mViewObjectTable->flushCaches();
+    foreach (JsonDbReduceDefinition *def, mReduceDefinitions)
+        def->flushCaches();
 }
 
 void JsonDbView::closeIndexes()
@@ -520,6 +562,15 @@ void JsonDbView::closeIndexes()
     mViewObjectTable->closeIndexes();
 }
 
+/*!
+    Returns true if the view has processed every change to the partition.
+*/
+bool JsonDbView::isUpToDate() const
+{
+    quint32 viewStateNumber = (mViewStateNumber ? mViewStateNumber : mViewObjectTable->stateNumber());
+    return viewStateNumber == mMainObjectTable->stateNumber();
+}
+
 bool JsonDbView::isActive() const
 {
     foreach (JsonDbMapDefinition *mapDef, mMapDefinitions) {
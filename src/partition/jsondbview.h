@@ -81,8 +81,10 @@ public:
     void updateViewStateNumber(quint32 partitionStateNumber);
     void reduceMemoryUsage();
     void closeIndexes();
+    QJsonObject updateStats() const;
 
     bool isActive() const;
+    bool isUpToDate() const;
 
 Q_SIGNALS:
     void updated(const QString &type);
@@ -97,6 +99,7 @@ private:
     void updateSourceTypesList();
     bool viewDefinitionUpdated(const JsonDbUpdateList &objectsUpdated) const;
     void updateViewOnChanges(const JsonDbUpdateList &objectsUpdated, QSet<QString> &processedDefinitionUuids, JsonDbUpdateList *changeList);
+    void recordUpdateTime(qint64 usecs);
 
 private:
     JsonDbPartition *mPartition;
@@ -112,6 +115,10 @@ private:
     QMap<QString,JsonDbReduceDefinition*> mReduceDefinitions;      // maps uuid to view definition
     QMap<QString,JsonDbReduceDefinition*> mReduceDefinitionsBySource; // maps reduce source type to view definition
     bool mUpdating;
+    int            mUpdateCount;
+    qint64         mUpdateUsecs;
+    qint64         mMaxUpdateUsecs;
+    qint64         mLastUpdateUsecs;
 
     friend class JsonDbMapDefinition;
     friend class JsonDbReduceDefinition;
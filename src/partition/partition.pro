@@ -24,6 +24,7 @@ HEADERS += \
     jsondbview.h \
     jsondbmapdefinition.h \
     jsondbnotification.h \
+    jsondbnotificationindex.h \
     jsondbobjectkey.h \
     jsondbobjecttable.h \
     jsondbbtree.h \
@@ -35,12 +36,14 @@ HEADERS += \
     jsondbscriptengine.h \
     jsondbsettings.h \
     jsondbindexquery.h \
+    jsondbindexbuilder.h \
     jsondberrors.h \
     jsondbstrings.h \
     jsondbpartitionglobal.h \
     jsondbcollator.h \
     jsondbcollator_p.h \
     jsondbpartition_p.h \
+    jsondbpartitionsnapshot.h \
     jsondbpartitionspec.h \
     jsondbquerytokenizer_p.h \
     jsondbqueryparser.h \
@@ -53,16 +56,19 @@ SOURCES += \
     jsondbindex.cpp \
     jsondbobject.cpp \
     jsondbpartition.cpp \
+    jsondbpartitionsnapshot.cpp \
     jsondbquery.cpp \
     jsondbview.cpp \
     jsondbmapdefinition.cpp \
     jsondbnotification.cpp \
+    jsondbnotificationindex.cpp \
     jsondbobjecttable.cpp \
     jsondbbtree.cpp \
     jsondbreducedefinition.cpp \
     jsondbscriptengine.cpp \
     jsondbsettings.cpp \
     jsondbindexquery.cpp \
+    jsondbindexbuilder.cpp \
     jsondberrors.cpp \
     jsondbstrings.cpp \
     jsondbcollator.cpp \
@@ -562,6 +562,7 @@ private slots:
     void deleteAlotNoSyncReopen();
     void customBlockSize();
     void clearData();
+    void pinnedSnapshot();
     void failedCommits_data();
     void failedCommits();
 
@@ -2786,6 +2787,52 @@ void TestHBtree::clearData()
     }
 }
 
+void TestHBtree::pinnedSnapshot()
+{
+    const int numItems = 200;
+    const QByteArray value(200, 'a');
+
+    for (int i = 0; i < numItems; ++i) {
+        HBtreeTransaction *transaction = db->beginTransaction(HBtreeTransaction::ReadWrite);
+        QVERIFY(transaction);
+        QVERIFY(transaction->put(QByteArray::number(i), value));
+        QVERIFY(transaction->commit(i));
+    }
+
+    quint32 revision = db->pinSnapshot();
+    HBtree snapshot;
+    QVERIFY(snapshot.openSnapshot(db, revision));
+    db->unpinSnapshot(revision);
+    QCOMPARE(snapshot.tag(), (quint32)numItems - 1);
+    QCOMPARE(snapshot.count(), numItems);
+
+    // rewrite and then remove everything, which would reuse the pages of the snapshot if they were not pinned
+    const QByteArray newValue(200, 'b');
+    for (int i = 0; i < numItems; ++i) {
+        HBtreeTransaction *transaction = db->beginTransaction(HBtreeTransaction::ReadWrite);
+        QVERIFY(transaction);
+        QVERIFY(transaction->put(QByteArray::number(i), newValue));
+        QVERIFY(transaction->commit(numItems + i));
+    }
+    for (int i = 0; i < numItems; ++i) {
+        HBtreeTransaction *transaction = db->beginTransaction(HBtreeTransaction::ReadWrite);
+        QVERIFY(transaction);
+        QVERIFY(transaction->remove(QByteArray::number(i)));
+        QVERIFY(transaction->commit(2 * numItems + i));
+    }
+
+    HBtreeTransaction *transaction = snapshot.beginRead();
+    QVERIFY(transaction);
+    for (int i = 0; i < numItems; ++i)
+        QCOMPARE(transaction->get(QByteArray::number(i)), value);
+    transaction->abort();
+    snapshot.close();
+
+    // with the snapshot gone, collected pages are reused again
+    QVERIFY(d->pinned_.isEmpty());
+    QVERIFY(!d->pagesPinned());
+}
+
 void TestHBtree::failedCommits_data()
 {
     QList<int> itemCounts = QList<int>() << 100 << 1000;
@@ -832,6 +832,51 @@ void TestJsonDbCachingListModel::orderingCaseSensitive()
         QCOMPARE(result[i], stringList2[i]);
 }
 
+void TestJsonDbCachingListModel::orderingCollatedCaseInsensitive()
+{
+    resetWaitFlags();
+    QStringList values = QStringList() << "delta" << "Alpha" << "echo" << "charlie" << "Bravo" << "foxtrot";
+    for (int i = 0; i < values.size(); i++) {
+        QVariantMap item;
+        item.insert("_type", __FUNCTION__);
+        item.insert("ordering", values.at(i));
+        int id = create(item, i % 2 ? "com.nokia.shared.2" : "com.nokia.shared.1");
+        waitForResponse1(id);
+    }
+
+    // the model orders the items of a collated index by their sort keys,
+    // which are binary and must not be compared ignoring case
+    QVariantMap index;
+    index.insert("_type", "Index");
+    index.insert("name", "collatedCaseInsensitive");
+    index.insert("propertyName", "ordering");
+    index.insert("propertyType", "string");
+    index.insert("caseSensitive", false);
+    index.insert("locale", "en_US");
+    index.insert("collation", "standard");
+    int id = create(index, "com.nokia.shared.1");
+    waitForResponse1(id);
+    id = create(index, "com.nokia.shared.2");
+    waitForResponse1(id);
+
+    QAbstractListModel *listModel = createModel();
+    if (!listModel) return;
+
+    listModel->setProperty("sortOrder", "[/collatedCaseInsensitive]");
+    listModel->setProperty("roleNames", QStringList() << "_type" << "_uuid" << "name" << "ordering" << "_version");
+    listModel->setProperty("query", QString("[?_type=\"%1\"]").arg(__FUNCTION__));
+    connectListModel(listModel);
+
+    mWaitingForReset = true;
+    waitForExitOrTimeout();
+    QCOMPARE(mWaitingForReset, false);
+
+    QStringList expectedOrder = QStringList() << "Alpha" << "Bravo" << "charlie" << "delta" << "echo" << "foxtrot";
+    QCOMPARE(getOrderValues(listModel), expectedOrder);
+
+    deleteModel(listModel);
+}
+
 void TestJsonDbCachingListModel::checkRemoveNotification()
 {
     resetWaitFlags();
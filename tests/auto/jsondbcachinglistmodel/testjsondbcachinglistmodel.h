@@ -93,6 +93,7 @@ private slots:
     void sortedQuery();
     void ordering();
     void orderingCaseSensitive();
+    void orderingCollatedCaseInsensitive();
     void checkRemoveNotification();
     void checkUpdateNotification();
     void totalRowCount();
@@ -53,6 +53,9 @@
 #include "jsondbobjecttable.h"
 #include "jsondbpartition.h"
 #include "private/jsondbpartition_p.h"
+#include "jsondbpartitionsnapshot.h"
+#include "jsondbnotification.h"
+#include "jsondbnotificationindex.h"
 #include "jsondbindex.h"
 #include "jsondbsettings.h"
 #include "jsondbstrings.h"
@@ -73,6 +76,18 @@ QT_USE_NAMESPACE_JSONDB_PARTITION
 
 static QString kContactStr = "com.example.unittest.contact";
 
+class NotificationRecorder : public QObject
+{
+    Q_OBJECT
+public:
+    int count(JsonDbNotification::Action action) const { return actions.count(action); }
+
+    QList<JsonDbNotification::Action> actions;
+
+public Q_SLOTS:
+    void notified(const QJsonObject &, quint32, JsonDbNotification::Action action) { actions.append(action); }
+};
+
 /*
   Ensure that a good result object contains the correct fields
  */
@@ -178,6 +193,7 @@ private slots:
     void mapMultipleEmitNoTargetKeyName();
     void mapArrayConversion();
     void mapConsole();
+    void mapParallel();
     void reduce();
     void reduceFlattened();
     void reduceSourceKeyFunction();
@@ -188,7 +204,12 @@ private slots:
     void reduceSchemaViolation();
     void reduceSubObjectProp();
     void reduceArray();
+    void reduceBatched();
+    void reduceCachedAcrossUpdates();
+    void viewUpdateStats();
+    void declarativeMapReduce();
     void changesSinceCreate();
+    void changesSinceFromLog();
 
     void addIndex();
     void addSchema();
@@ -244,7 +265,13 @@ private slots:
     void typeChangeSchema();
 
     void updateListWithIndex();
+    void updateListParallelIndexes();
+    void addIndexInBackground();
     void addBigIndex();
+    void snapshotRead();
+    void notificationIndex();
+    void mergeUpdates();
+    void historicalReplay();
     void ensureBadPartitionFunctionCalls_data();
     void ensureBadPartitionFunctionCalls();
 
@@ -1570,6 +1597,18 @@ void TestPartition::mapDefinitionInvalid()
     verifyErrorResult(res);
     QVERIFY(res.message.contains("View"));
 
+    // fail because a projection property is not a source property path
+    mapDefinition = JsonDbObject();
+    mapDefinition.insert(JsonDbString::kTypeStr, JsonDbString::kMapTypeStr);
+    mapDefinition.insert("targetType", QLatin1String("MyViewType"));
+    QJsonObject projection;
+    projection.insert(QLatin1String("key"), 1);
+    map = JsonDbObject();
+    map.insert(QLatin1String("Contact"), projection);
+    mapDefinition.insert("map", map);
+    res = create(mOwner, mapDefinition);
+    verifyErrorResult(res);
+
     res = remove(mOwner, schema);
     verifyGoodResult(res);
 }
@@ -1682,6 +1721,21 @@ void TestPartition::reduceDefinitionInvalid()
     res = create(mOwner, reduceDefinition);
     verifyErrorResult(res);
 
+    // fail because the aggregate is unknown
+    reduceDefinition = JsonDbObject();
+    reduceDefinition.insert(JsonDbString::kTypeStr, QLatin1String("Reduce"));
+    reduceDefinition.insert("targetType", QLatin1String("MyViewType"));
+    reduceDefinition.insert("sourceType", QLatin1String("Contact"));
+    reduceDefinition.insert("sourceKeyName", QLatin1String("phoneNumber"));
+    reduceDefinition.insert("aggregate", QLatin1String("median"));
+    res = create(mOwner, reduceDefinition);
+    verifyErrorResult(res);
+
+    // fail because sum has no value to aggregate
+    reduceDefinition.insert("aggregate", QLatin1String("sum"));
+    res = create(mOwner, reduceDefinition);
+    verifyErrorResult(res);
+
     //schemaRes.value("result").toObject()
     verifyGoodResult(remove(mOwner, schema));
 }
@@ -2409,6 +2463,70 @@ void TestPartition::mapConsole()
         verifyGoodResult(remove(mOwner, toDelete.at(ii)));
 }
 
+void TestPartition::mapParallel()
+{
+    int mapThreadCount = jsondbSettings->mapThreadCount();
+    jsondbSettings->setMapThreadCount(4);
+
+    JsonDbObject schema;
+    schema.insert(JsonDbString::kTypeStr, QLatin1String("_schemaType"));
+    schema.insert(JsonDbString::kNameStr, QLatin1String("ParallelView"));
+    QJsonObject schemaSub;
+    schemaSub.insert("type", QLatin1String("object"));
+    schemaSub.insert("extends", QLatin1String("View"));
+    schema.insert("schema", schemaSub);
+    verifyGoodResult(create(mOwner, schema));
+
+    const int count = 300;
+    JsonDbObjectList sources;
+    for (int i = 0; i < count; i++) {
+        JsonDbObject source;
+        source.insert(JsonDbString::kTypeStr, QLatin1String("ParallelSource"));
+        source.insert("n", i);
+        sources.append(source);
+    }
+    verifyGoodResult(mJsonDbPartition->updateObjects(mOwner, sources));
+
+    // the existing sources are mapped when the definition is created
+    JsonDbObject mapDefinition;
+    mapDefinition.insert(JsonDbString::kTypeStr, QLatin1String("Map"));
+    mapDefinition.insert("targetType", QLatin1String("ParallelView"));
+    QJsonObject sourceToMapFunctions;
+    sourceToMapFunctions.insert("ParallelSource", QLatin1String("function map (o) { jsondb.emit({key: o.n, value: 2 * o.n}); }"));
+    mapDefinition.insert("map", sourceToMapFunctions);
+    verifyGoodResult(create(mOwner, mapDefinition));
+
+    JsonDbQueryResult queryResult = find(mOwner, QLatin1String("[?_type=\"ParallelView\"]"));
+    verifyGoodQueryResult(queryResult);
+    QCOMPARE(queryResult.data.size(), count);
+    foreach (const JsonDbObject &mapped, queryResult.data)
+        QCOMPARE(mapped.value("value").toDouble(), 2 * mapped.value("key").toDouble());
+
+    // and later changes are mapped as one batch
+    queryResult = find(mOwner, QLatin1String("[?_type=\"ParallelSource\"]"));
+    verifyGoodQueryResult(queryResult);
+    sources = queryResult.data;
+    for (int i = 0; i < sources.size(); i++)
+        sources[i].insert("n", sources.at(i).value("n").toDouble() + count);
+    verifyGoodResult(mJsonDbPartition->updateObjects(mOwner, sources));
+
+    queryResult = find(mOwner, QLatin1String("[?_type=\"ParallelView\"]"));
+    verifyGoodQueryResult(queryResult);
+    QCOMPARE(queryResult.data.size(), count);
+    foreach (const JsonDbObject &mapped, queryResult.data) {
+        QVERIFY(mapped.value("key").toDouble() >= count);
+        QCOMPARE(mapped.value("value").toDouble(), 2 * mapped.value("key").toDouble());
+    }
+
+    verifyGoodResult(remove(mOwner, mapDefinition));
+    queryResult = find(mOwner, QLatin1String("[?_type=\"ParallelSource\"]"));
+    foreach (const JsonDbObject &source, queryResult.data)
+        verifyGoodResult(remove(mOwner, source));
+    verifyGoodResult(remove(mOwner, schema));
+
+    jsondbSettings->setMapThreadCount(mapThreadCount);
+}
+
 void TestPartition::reduce()
 {
     QJsonArray objects(readJsonFile(":/partition/json/reduce-data.json").toArray());
@@ -2928,6 +3046,327 @@ void TestPartition::reduceArray()
     mJsonDbPartition->d_func()->removeIndex("ArrayView");
 }
 
+void TestPartition::reduceBatched()
+{
+    int batchSize = jsondbSettings->viewUpdateBatchSize();
+    jsondbSettings->setViewUpdateBatchSize(2);
+
+    QJsonArray objects(readJsonFile(":/partition/json/reduce.json").toArray());
+    JsonDbObjectList definitions;
+    for (int ii = 0; ii < objects.size(); ii++) {
+        JsonDbObject object(objects.at(ii).toObject());
+        verifyGoodResult(create(mOwner, object));
+        definitions.prepend(object);
+    }
+
+    // write all the source objects together so the view sees them as one set of changes
+    objects = readJsonFile(":/partition/json/reduce-data.json").toArray();
+    JsonDbObjectList contacts;
+    QHash<QString, int> firstNameCount;
+    for (int ii = 0; ii < objects.size(); ii++) {
+        JsonDbObject object(objects.at(ii).toObject());
+        firstNameCount[object.value("firstName").toString()]++;
+        contacts.append(object);
+    }
+    verifyGoodResult(mJsonDbPartition->updateObjects(mOwner, contacts));
+
+    JsonDbQueryResult queryResult = find(mOwner, QLatin1String("[?_type=\"MyContactCount\"]"));
+    verifyGoodQueryResult(queryResult);
+    QCOMPARE(queryResult.data.size(), firstNameCount.keys().count());
+    foreach (const JsonDbObject &reduced, queryResult.data)
+        QCOMPARE((int)reduced.value("count").toDouble(), firstNameCount[reduced.value("firstName").toString()]);
+
+    // move every John to Harry and remove one other contact in a single write
+    queryResult = find(mOwner, QLatin1String("[?_type=\"MyContact\"]"));
+    verifyGoodQueryResult(queryResult);
+    contacts.clear();
+    bool removedOne = false;
+    foreach (JsonDbObject contact, queryResult.data) {
+        QString firstName = contact.value("firstName").toString();
+        if (firstName == QLatin1String("John")) {
+            contact.insert("firstName", QLatin1String("Harry"));
+            firstNameCount["John"]--;
+            firstNameCount["Harry"]++;
+        } else if (!removedOne && firstName != QLatin1String("Harry")) {
+            contact.markDeleted();
+            firstNameCount[firstName]--;
+            removedOne = true;
+        } else {
+            continue;
+        }
+        contacts.append(contact);
+    }
+    QVERIFY(removedOne);
+    verifyGoodResult(mJsonDbPartition->updateObjects(mOwner, contacts));
+
+    foreach (const QString &firstName, firstNameCount.keys()) {
+        if (!firstNameCount.value(firstName))
+            firstNameCount.remove(firstName);
+    }
+    queryResult = find(mOwner, QLatin1String("[?_type=\"MyContactCount\"]"));
+    verifyGoodQueryResult(queryResult);
+    QCOMPARE(queryResult.data.size(), firstNameCount.keys().count());
+    foreach (const JsonDbObject &reduced, queryResult.data)
+        QCOMPARE((int)reduced.value("count").toDouble(), firstNameCount[reduced.value("firstName").toString()]);
+
+    queryResult = find(mOwner, QLatin1String("[?_type=\"MyContact\"]"));
+    foreach (const JsonDbObject &contact, queryResult.data)
+        verifyGoodResult(remove(mOwner, contact));
+    foreach (const JsonDbObject &definition, definitions)
+        verifyGoodResult(remove(mOwner, definition));
+    mJsonDbPartition->d_func()->removeIndex("MyContactCount");
+
+    jsondbSettings->setViewUpdateBatchSize(batchSize);
+}
+
+void TestPartition::reduceCachedAcrossUpdates()
+{
+    QJsonArray objects(readJsonFile(":/partition/json/reduce.json").toArray());
+    JsonDbObjectList definitions;
+    for (int ii = 0; ii < objects.size(); ii++) {
+        JsonDbObject object(objects.at(ii).toObject());
+        verifyGoodResult(create(mOwner, object));
+        definitions.prepend(object);
+    }
+
+    // every query brings the view up to date, so the hot key is reduced once per write
+    JsonDbObjectList contacts;
+    for (int i = 0; i < 10; i++) {
+        JsonDbObject contact;
+        contact.insert(JsonDbString::kTypeStr, QLatin1String("MyContact"));
+        contact.insert("firstName", QLatin1String("Hot"));
+        verifyGoodResult(create(mOwner, contact));
+        contacts.append(contact);
+
+        if (i == 5)
+            mJsonDbPartition->flushCaches();
+
+        JsonDbQueryResult queryResult = find(mOwner, QLatin1String("[?_type=\"MyContactCount\"][?firstName=\"Hot\"]"));
+        verifyGoodQueryResult(queryResult);
+        QCOMPARE(queryResult.data.size(), 1);
+        QCOMPARE((int)queryResult.data.at(0).value("count").toDouble(), i + 1);
+    }
+
+    // removing them all removes the reduced object, and the key can be reduced again afterwards
+    foreach (const JsonDbObject &contact, contacts)
+        verifyGoodResult(remove(mOwner, contact));
+    JsonDbQueryResult queryResult = find(mOwner, QLatin1String("[?_type=\"MyContactCount\"][?firstName=\"Hot\"]"));
+    verifyGoodQueryResult(queryResult);
+    QCOMPARE(queryResult.data.size(), 0);
+
+    JsonDbObject contact;
+    contact.insert(JsonDbString::kTypeStr, QLatin1String("MyContact"));
+    contact.insert("firstName", QLatin1String("Hot"));
+    verifyGoodResult(create(mOwner, contact));
+    queryResult = find(mOwner, QLatin1String("[?_type=\"MyContactCount\"][?firstName=\"Hot\"]"));
+    verifyGoodQueryResult(queryResult);
+    QCOMPARE(queryResult.data.size(), 1);
+    QCOMPARE((int)queryResult.data.at(0).value("count").toDouble(), 1);
+
+    verifyGoodResult(remove(mOwner, contact));
+    foreach (const JsonDbObject &definition, definitions)
+        verifyGoodResult(remove(mOwner, definition));
+    mJsonDbPartition->d_func()->removeIndex("MyContactCount");
+}
+
+void TestPartition::viewUpdateStats()
+{
+    QJsonArray objects(readJsonFile(":/partition/json/reduce.json").toArray());
+    JsonDbObjectList definitions;
+    for (int ii = 0; ii < objects.size(); ii++) {
+        JsonDbObject object(objects.at(ii).toObject());
+        verifyGoodResult(create(mOwner, object));
+        definitions.prepend(object);
+    }
+
+    JsonDbObject contact;
+    contact.insert(JsonDbString::kTypeStr, QLatin1String("MyContact"));
+    contact.insert("firstName", QLatin1String("Stats"));
+    verifyGoodResult(create(mOwner, contact));
+
+    JsonDbQueryResult queryResult = find(mOwner, QLatin1String("[?_type=\"MyContactCount\"][?firstName=\"Stats\"]"));
+    verifyGoodQueryResult(queryResult);
+    QCOMPARE(queryResult.data.size(), 1);
+
+    QJsonObject stats = mJsonDbPartition->viewStats().value(QLatin1String("MyContactCount")).toObject();
+    QVERIFY(stats.value(QLatin1String("updates")).toDouble() >= 1);
+    QVERIFY(stats.value(QLatin1String("maxUsecs")).toDouble() >= stats.value(QLatin1String("lastUsecs")).toDouble());
+    QVERIFY(stats.value(QLatin1String("totalUsecs")).toDouble() >= stats.value(QLatin1String("maxUsecs")).toDouble());
+
+    verifyGoodResult(remove(mOwner, contact));
+    foreach (const JsonDbObject &definition, definitions)
+        verifyGoodResult(remove(mOwner, definition));
+    mJsonDbPartition->d_func()->removeIndex("MyContactCount");
+}
+
+void TestPartition::declarativeMapReduce()
+{
+    QStringList viewTypes;
+    viewTypes << QLatin1String("AgeByName") << QLatin1String("AgeStats");
+    JsonDbObjectList definitions;
+    foreach (const QString &viewType, viewTypes) {
+        JsonDbObject schema;
+        schema.insert(JsonDbString::kTypeStr, QLatin1String("_schemaType"));
+        schema.insert(JsonDbString::kNameStr, viewType);
+        QJsonObject schemaSub;
+        schemaSub.insert("type", QLatin1String("object"));
+        schemaSub.insert("extends", QLatin1String("View"));
+        schema.insert("schema", schemaSub);
+        verifyGoodResult(create(mOwner, schema));
+        definitions.prepend(schema);
+    }
+
+    JsonDbObject mapDefinition;
+    mapDefinition.insert(JsonDbString::kTypeStr, QLatin1String("Map"));
+    mapDefinition.insert("targetType", QLatin1String("AgeByName"));
+    QJsonObject projection;
+    projection.insert("key", QLatin1String("name.first"));
+    projection.insert("value", QLatin1String("age"));
+    QJsonObject sourceToMapFunctions;
+    sourceToMapFunctions.insert("AgedContact", projection);
+    mapDefinition.insert("map", sourceToMapFunctions);
+    verifyGoodResult(create(mOwner, mapDefinition));
+    definitions.prepend(mapDefinition);
+
+    QStringList aggregates;
+    aggregates << "count" << "sum" << "min" << "max" << "avg";
+    foreach (const QString &aggregate, aggregates) {
+        JsonDbObject reduceDefinition;
+        reduceDefinition.insert(JsonDbString::kTypeStr, QLatin1String("Reduce"));
+        reduceDefinition.insert("targetType", QLatin1String("AgeStats"));
+        reduceDefinition.insert("sourceType", QLatin1String("AgedContact") + aggregate);
+        reduceDefinition.insert("sourceKeyName", QLatin1String("lastName"));
+        reduceDefinition.insert("sourceValueName", QLatin1String("age"));
+        reduceDefinition.insert("targetValueName", aggregate);
+        reduceDefinition.insert("aggregate", aggregate);
+        verifyGoodResult(create(mOwner, reduceDefinition));
+        definitions.prepend(reduceDefinition);
+    }
+
+    // each reduce has its own source type, so write every contact once per aggregate
+    QList<int> ages;
+    ages << 30 << 20 << 40 << 10;
+    JsonDbObjectList sources;
+    for (int i = 0; i < ages.size(); i++) {
+        JsonDbObject contact;
+        contact.insert(JsonDbString::kTypeStr, QLatin1String("AgedContact"));
+        QJsonObject name;
+        name.insert("first", QString::fromLatin1("First%1").arg(i));
+        contact.insert("name", name);
+        contact.insert("lastName", QLatin1String("Smith"));
+        contact.insert("age", ages.at(i));
+        sources.append(contact);
+        foreach (const QString &aggregate, aggregates) {
+            contact.insert(JsonDbString::kTypeStr, QLatin1String("AgedContact") + aggregate);
+            sources.append(contact);
+        }
+    }
+    verifyGoodResult(mJsonDbPartition->updateObjects(mOwner, sources));
+
+    JsonDbQueryResult queryResult = find(mOwner, QLatin1String("[?_type=\"AgeByName\"][/key]"));
+    verifyGoodQueryResult(queryResult);
+    QCOMPARE(queryResult.data.size(), ages.size());
+    for (int i = 0; i < ages.size(); i++) {
+        QCOMPARE(queryResult.data.at(i).value("key").toString(), QString::fromLatin1("First%1").arg(i));
+        QCOMPARE((int)queryResult.data.at(i).value("value").toDouble(), ages.at(i));
+    }
+
+    queryResult = find(mOwner, QLatin1String("[?_type=\"AgeStats\"][?key=\"Smith\"]"));
+    verifyGoodQueryResult(queryResult);
+    QHash<QString, double> stats;
+    foreach (const JsonDbObject &reduced, queryResult.data) {
+        foreach (const QString &aggregate, aggregates) {
+            if (reduced.contains(aggregate))
+                stats.insert(aggregate, reduced.value(aggregate).toDouble());
+        }
+    }
+    QCOMPARE(stats.value("count"), 4.0);
+    QCOMPARE(stats.value("sum"), 100.0);
+    QCOMPARE(stats.value("min"), 10.0);
+    QCOMPARE(stats.value("max"), 40.0);
+    QCOMPARE(stats.value("avg"), 25.0);
+
+    // removing the youngest and oldest contacts makes min and max aggregate the rest again
+    JsonDbObjectList removed;
+    foreach (const QString &aggregate, aggregates) {
+        queryResult = find(mOwner, QString::fromLatin1("[?_type=\"AgedContact%1\"]").arg(aggregate));
+        foreach (JsonDbObject contact, queryResult.data) {
+            int age = (int)contact.value("age").toDouble();
+            if (age == 10 || age == 40) {
+                contact.markDeleted();
+                removed.append(contact);
+            }
+        }
+    }
+    verifyGoodResult(mJsonDbPartition->updateObjects(mOwner, removed));
+
+    queryResult = find(mOwner, QLatin1String("[?_type=\"AgeStats\"][?key=\"Smith\"]"));
+    verifyGoodQueryResult(queryResult);
+    stats.clear();
+    foreach (const JsonDbObject &reduced, queryResult.data) {
+        foreach (const QString &aggregate, aggregates) {
+            if (reduced.contains(aggregate))
+                stats.insert(aggregate, reduced.value(aggregate).toDouble());
+        }
+    }
+    QCOMPARE(stats.value("count"), 2.0);
+    QCOMPARE(stats.value("sum"), 50.0);
+    QCOMPARE(stats.value("min"), 20.0);
+    QCOMPARE(stats.value("max"), 30.0);
+    QCOMPARE(stats.value("avg"), 25.0);
+
+    // min and max are aggregated again once per update, after every batch of
+    // changes; here the youngest is removed in the first batch and the
+    // contacts added later, whose uuids sort after every other, must not be
+    // added again to the recomputed value
+    int batchSize = jsondbSettings->viewUpdateBatchSize();
+    jsondbSettings->setViewUpdateBatchSize(1);
+    JsonDbObjectList replaced;
+    foreach (const QString &aggregate, QStringList() << "min" << "max") {
+        queryResult = find(mOwner, QString::fromLatin1("[?_type=\"AgedContact%1\"][?age=20]").arg(aggregate));
+        QCOMPARE(queryResult.data.size(), 1);
+        JsonDbObject youngest = queryResult.data.at(0);
+        youngest.markDeleted();
+        replaced.append(youngest);
+        for (int i = 0; i < 2; i++) {
+            JsonDbObject contact;
+            contact.insert(JsonDbString::kUuidStr,
+                           QString::fromLatin1("{ffffffff-ffff-4fff-bfff-%1%2}")
+                           .arg(QLatin1String(aggregate == QLatin1String("min") ? "ffffffffff" : "fffffffffe"))
+                           .arg(i, 2, 10, QLatin1Char('0')));
+            contact.insert(JsonDbString::kTypeStr, QLatin1String("AgedContact") + aggregate);
+            contact.insert("lastName", QLatin1String("Smith"));
+            contact.insert("age", 5 + 20 * i);
+            replaced.append(contact);
+        }
+    }
+    verifyGoodResult(mJsonDbPartition->updateObjects(mOwner, replaced));
+
+    queryResult = find(mOwner, QLatin1String("[?_type=\"AgeStats\"][?key=\"Smith\"]"));
+    jsondbSettings->setViewUpdateBatchSize(batchSize);
+    verifyGoodQueryResult(queryResult);
+    stats.clear();
+    foreach (const JsonDbObject &reduced, queryResult.data) {
+        foreach (const QString &aggregate, QStringList() << "min" << "max") {
+            if (reduced.contains(aggregate)) {
+                stats.insert(aggregate, reduced.value(aggregate).toDouble());
+                QCOMPARE(reduced.value(QStringLiteral("_count")).toDouble(), 3.0);
+            }
+        }
+    }
+    QCOMPARE(stats.value("min"), 5.0);
+    QCOMPARE(stats.value("max"), 30.0);
+
+    aggregates << QString();
+    foreach (const QString &aggregate, aggregates) {
+        queryResult = find(mOwner, QString::fromLatin1("[?_type=\"AgedContact%1\"]").arg(aggregate));
+        foreach (const JsonDbObject &contact, queryResult.data)
+            verifyGoodResult(remove(mOwner, contact));
+    }
+    foreach (const JsonDbObject &definition, definitions)
+        verifyGoodResult(remove(mOwner, definition));
+}
+
 void TestPartition::changesSinceCreate()
 {
     JsonDbChangesSinceResult csRes = mJsonDbPartition->changesSince(0);
@@ -2955,6 +3394,67 @@ void TestPartition::changesSinceCreate()
     QCOMPARE(after.value("lastName").toString(), toCreate.value("lastName").toString());
 }
 
+void TestPartition::changesSinceFromLog()
+{
+    QSet<QString> limitTypes;
+    limitTypes << QLatin1String("changesSinceFromLog");
+    quint32 start = mJsonDbPartition->mainObjectTable()->stateNumber();
+
+    JsonDbObject first;
+    first.insert(JsonDbString::kTypeStr, QLatin1String("changesSinceFromLog"));
+    first.insert(QLatin1String("value"), 0);
+    first.insert(QLatin1String("removed"), QString(256, QLatin1Char('x')));
+    verifyGoodResult(create(mOwner, first));
+    JsonDbObject created = first;
+    quint32 afterCreate = mJsonDbPartition->mainObjectTable()->stateNumber();
+    // the replaced versions are stored as deltas against the next ones
+    for (int i = 1; i <= 5; i++) {
+        first.insert(QLatin1String("value"), i);
+        if (i == 3) {
+            first.remove(QLatin1String("removed"));
+            first.insert(QLatin1String("added"), true);
+        }
+        verifyGoodResult(update(mOwner, first));
+    }
+    JsonDbObject second;
+    second.insert(JsonDbString::kTypeStr, QLatin1String("changesSinceFromLog"));
+    verifyGoodResult(create(mOwner, second));
+    verifyGoodResult(remove(mOwner, second));
+
+    // read the state log rather than the cache, keeping no more than a few changes in it
+    int cacheSize = jsondbSettings->changeLogCacheSize();
+    jsondbSettings->setChangeLogCacheSize(3);
+    for (int pass = 0; pass < 2; pass++) {
+        mJsonDbPartition->flushCaches();
+
+        JsonDbChangesSinceResult csRes = mJsonDbPartition->changesSince(start, limitTypes);
+        QCOMPARE(csRes.code, JsonDbError::NoError);
+        QCOMPARE(csRes.changes.size(), 1);
+        QCOMPARE(csRes.changes.at(0).action, JsonDbNotification::Create);
+        QCOMPARE(csRes.changes.at(0).newObject.value(QLatin1String("value")).toDouble(), 5.0);
+
+        csRes = mJsonDbPartition->changesSince(afterCreate, limitTypes);
+        QCOMPARE(csRes.changes.size(), 1);
+        QCOMPARE(csRes.changes.at(0).action, JsonDbNotification::Update);
+        QCOMPARE(csRes.changes.at(0).oldObject.value(QLatin1String("value")).toDouble(), 0.0);
+        QCOMPARE(csRes.changes.at(0).oldObject.uuid(), created.uuid());
+        QCOMPARE(csRes.changes.at(0).oldObject.value(QLatin1String("removed")), created.value(QLatin1String("removed")));
+        QVERIFY(!csRes.changes.at(0).oldObject.contains(QLatin1String("added")));
+
+        csRes = mJsonDbPartition->changesSince(afterCreate + 4, limitTypes);
+        QCOMPARE(csRes.changes.size(), 1);
+        QCOMPARE(csRes.changes.at(0).oldObject.value(QLatin1String("value")).toDouble(), 4.0);
+        QVERIFY(!csRes.changes.at(0).oldObject.contains(QLatin1String("removed")));
+        QVERIFY(csRes.changes.at(0).oldObject.contains(QLatin1String("added")));
+
+        csRes = mJsonDbPartition->changesSince(afterCreate + 6, limitTypes);
+        QCOMPARE(csRes.changes.size(), 1);
+        QCOMPARE(csRes.changes.at(0).action, JsonDbNotification::Remove);
+
+        jsondbSettings->setChangeLogCacheSize(cacheSize);
+    }
+}
+
 void TestPartition::addIndex()
 {
     addIndex(QLatin1String("subject"));
@@ -4241,6 +4741,12 @@ void TestPartition::indexCollation()
     QCOMPARE(queryResult1.data.at(4).value("lastName").toString(), QLatin1String("6-Liu"));
     QCOMPARE(queryResult1.data.at(5).value("lastName").toString(), QLatin1String("3-San"));
     QCOMPARE(queryResult1.data.at(6).value("lastName").toString(), QLatin1String("1-Yi"));
+    // the index holds sort keys, but reports the strings
+    for (int i = 0; i < queryResult1.data.size(); i++) {
+        const JsonDbObject &o = queryResult1.data.at(i);
+        QCOMPARE(o.value("_indexValue").toString(), o.value("firstName").toString());
+        QVERIFY(o.value("_indexSortKey").isString());
+    }
 
     JsonDbQueryResult queryResult2 = find(mOwner, QLatin1String("[?_type=\"IndexCollation\"][/strokeIndex]"));
     QCOMPARE(queryResult2.data.size(), 7);
@@ -4837,6 +5343,134 @@ void TestPartition::updateListWithIndex()
     }
 }
 
+void TestPartition::updateListParallelIndexes()
+{
+    // enough objects and indexes that the commit applies the index updates in parallel
+    addIndex(QLatin1String("parallelName"), QLatin1String("string"), QLatin1String("updateListParallelIndexes"));
+    addIndex(QLatin1String("parallelNumber"), QLatin1String("number"), QLatin1String("updateListParallelIndexes"));
+    addIndex(QLatin1String("parallelTags"), QLatin1String("string"), QLatin1String("updateListParallelIndexes"));
+
+    const int count = 100;
+    QList<JsonDbObject> list;
+    for (int i = 0; i < count; i++) {
+        JsonDbObject item;
+        item.insert(JsonDbString::kTypeStr, QLatin1String("updateListParallelIndexes"));
+        item.insert(QLatin1String("parallelName"), QString::fromLatin1("name-%1").arg(count - i, 3, 10, QLatin1Char('0')));
+        item.insert(QLatin1String("parallelNumber"), i);
+        item.insert(QLatin1String("parallelTags"), QString::fromLatin1(i % 2 ? "odd" : "even"));
+        list.append(item);
+    }
+    JsonDbWriteResult result = mJsonDbPartition->updateObjects(mOwner, list);
+    verifyGoodResult(result);
+    QCOMPARE(result.objectsWritten.count(), count);
+
+    JsonDbQueryResult findResult = find(mOwner, QLatin1String("[?_type=\"updateListParallelIndexes\"][/parallelName]"));
+    QCOMPARE(findResult.data.size(), count);
+    QCOMPARE(findResult.data.at(0).value(QLatin1String("parallelNumber")).toDouble(), double(count - 1));
+    findResult = find(mOwner, QLatin1String("[?_type=\"updateListParallelIndexes\"][?parallelNumber >= 90][/parallelNumber]"));
+    QCOMPARE(findResult.data.size(), 10);
+    QCOMPARE(findResult.data.at(0).value(QLatin1String("parallelNumber")).toDouble(), 90.0);
+    findResult = find(mOwner, QLatin1String("[?_type=\"updateListParallelIndexes\"][?parallelTags=\"odd\"][/parallelTags]"));
+    QCOMPARE(findResult.data.size(), count / 2);
+
+    // update every object in one transaction, so each one is deindexed and indexed again
+    list.clear();
+    findResult = find(mOwner, QLatin1String("[?_type=\"updateListParallelIndexes\"][/parallelNumber]"));
+    for (int i = 0; i < findResult.data.size(); i++) {
+        JsonDbObject item = findResult.data.at(i);
+        item.insert(QLatin1String("parallelNumber"), i + count);
+        list.append(item);
+    }
+    result = mJsonDbPartition->updateObjects(mOwner, list);
+    verifyGoodResult(result);
+    findResult = find(mOwner, QLatin1String("[?_type=\"updateListParallelIndexes\"][?parallelNumber < 100][/parallelNumber]"));
+    QCOMPARE(findResult.data.size(), 0);
+    findResult = find(mOwner, QLatin1String("[?_type=\"updateListParallelIndexes\"][?parallelNumber >= 100][/parallelNumber]"));
+    QCOMPARE(findResult.data.size(), count);
+
+    // and remove them the same way
+    list.clear();
+    for (int i = 0; i < findResult.data.size(); i++) {
+        JsonDbObject item = findResult.data.at(i);
+        item.markDeleted();
+        list.append(item);
+    }
+    result = mJsonDbPartition->updateObjects(mOwner, list);
+    verifyGoodResult(result);
+    findResult = find(mOwner, QLatin1String("[?_type=\"updateListParallelIndexes\"][/parallelName]"));
+    QCOMPARE(findResult.data.size(), 0);
+    findResult = find(mOwner, QLatin1String("[?_type=\"updateListParallelIndexes\"][?parallelTags=\"odd\"][/parallelTags]"));
+    QCOMPARE(findResult.data.size(), 0);
+}
+
+void TestPartition::addIndexInBackground()
+{
+    int oldThreshold = jsondbSettings->indexBuildThreshold();
+    jsondbSettings->setIndexBuildThreshold(1);
+
+    QList<JsonDbObject> list;
+    for (int i = 0; i < 50; i++) {
+        JsonDbObject item;
+        item.insert(JsonDbString::kTypeStr, QLatin1String("addIndexInBackground"));
+        item.insert(QLatin1String("backgroundKey"), i);
+        list.append(item);
+    }
+    JsonDbWriteResult result = mJsonDbPartition->updateObjects(mOwner, list);
+    verifyGoodResult(result);
+    list = result.objectsWritten;
+
+    QSignalSpy progressSpy(mJsonDbPartition, SIGNAL(indexBuildProgress(QString,quint64,quint64)));
+    QSignalSpy finishedSpy(mJsonDbPartition, SIGNAL(indexBuildFinished(QString,bool)));
+
+    JsonDbObject index;
+    index.insert(JsonDbString::kTypeStr, JsonDbString::kIndexTypeStr);
+    index.insert(JsonDbString::kNameStr, QLatin1String("backgroundKey"));
+    index.insert(JsonDbString::kPropertyNameStr, QLatin1String("backgroundKey"));
+    index.insert(JsonDbString::kPropertyTypeStr, QLatin1String("number"));
+    verifyGoodResult(create(mOwner, index));
+
+    JsonDbObjectTable *table = mJsonDbPartition->findObjectTable(QLatin1String("addIndexInBackground"));
+    QVERIFY(table->isIndexBuilding(QLatin1String("backgroundKey")));
+    QVERIFY(!table->index(QLatin1String("backgroundKey")));
+
+    // queries do without the index until it is built
+    JsonDbQueryResult findResult = find(mOwner, QLatin1String("[?_type=\"addIndexInBackground\"][?backgroundKey >= 40]"));
+    QCOMPARE(findResult.data.size(), 10);
+
+    // writes during the build are caught up before the index is used
+    JsonDbObject created;
+    created.insert(JsonDbString::kTypeStr, QLatin1String("addIndexInBackground"));
+    created.insert(QLatin1String("backgroundKey"), 100);
+    verifyGoodResult(create(mOwner, created));
+    JsonDbObject updated = list.at(0);
+    updated.insert(QLatin1String("backgroundKey"), 200);
+    verifyGoodResult(mJsonDbPartition->updateObject(mOwner, updated));
+    verifyGoodResult(remove(mOwner, list.at(49)));
+
+    QTRY_VERIFY(table->index(QLatin1String("backgroundKey")) != 0);
+    QVERIFY(!table->isIndexBuilding(QLatin1String("backgroundKey")));
+    QCOMPARE(finishedSpy.count(), 1);
+    QCOMPARE(finishedSpy.at(0).at(1).toBool(), true);
+
+    // progress counts the objects read, not the state log entries next to them
+    QVERIFY(progressSpy.count() >= 2);
+    QList<QVariant> lastProgress = progressSpy.last();
+    quint64 processedCount = lastProgress.at(1).toULongLong();
+    QCOMPARE(processedCount, lastProgress.at(2).toULongLong());
+    QVERIFY(processedCount >= 50);
+    QVERIFY(processedCount < table->bdb()->count());
+
+    findResult = find(mOwner, QLatin1String("[?_type=\"addIndexInBackground\"][/backgroundKey]"));
+    QCOMPARE(findResult.data.size(), 50);
+    QCOMPARE(findResult.data.at(0).value(QLatin1String("backgroundKey")).toDouble(), 1.0);
+    QCOMPARE(findResult.data.at(47).value(QLatin1String("backgroundKey")).toDouble(), 48.0);
+    QCOMPARE(findResult.data.at(48).value(QLatin1String("backgroundKey")).toDouble(), 100.0);
+    QCOMPARE(findResult.data.at(49).value(QLatin1String("backgroundKey")).toDouble(), 200.0);
+
+    jsondbSettings->setIndexBuildThreshold(oldThreshold);
+    verifyGoodResult(remove(mOwner, index));
+}
+
 void TestPartition::addBigIndex()
 {
     addIndex(QLatin1String("subject"));
@@ -4868,6 +5502,216 @@ void TestPartition::addBigIndex()
     remove(mOwner, indexObject);
 }
 
+void TestPartition::snapshotRead()
+{
+    addIndex(QLatin1String("snapshotKey"), QLatin1String("number"), QLatin1String("snapshotRead"));
+
+    QList<JsonDbObject> list;
+    for (int i = 0; i < 20; i++) {
+        JsonDbObject item;
+        item.insert(JsonDbString::kTypeStr, QLatin1String("snapshotRead"));
+        item.insert(QLatin1String("snapshotKey"), i);
+        list.append(item);
+    }
+    JsonDbWriteResult result = mJsonDbPartition->updateObjects(mOwner, list);
+    verifyGoodResult(result);
+    list = result.objectsWritten;
+
+    QScopedPointer<JsonDbPartitionSnapshot> snapshot(mJsonDbPartition->createSnapshot());
+    QVERIFY(snapshot);
+    QVERIFY(snapshot->isCurrent());
+
+    JsonDbQueryParser parser;
+    parser.setQuery(QLatin1String("[?_type=\"snapshotRead\"][?snapshotKey >= 10][/snapshotKey]"));
+    QVERIFY(parser.parse());
+    JsonDbQuery query = parser.result();
+    QVERIFY(snapshot->canQuery(query));
+
+    // writes after the snapshot was taken are not seen by it
+    for (int i = 0; i < list.size(); i++)
+        list[i].insert(QLatin1String("snapshotKey"), i + 100);
+    list[0].markDeleted();
+    verifyGoodResult(mJsonDbPartition->updateObjects(mOwner, list));
+    QVERIFY(!snapshot->isCurrent());
+
+    JsonDbQueryResult snapshotResult;
+    QVERIFY(snapshot->queryObjects(mOwner, query, -1, 0, QByteArray(), &snapshotResult));
+    verifyGoodQueryResult(snapshotResult);
+    QCOMPARE(snapshotResult.data.size(), 10);
+    QCOMPARE(snapshotResult.data.at(0).value(QLatin1String("snapshotKey")).toDouble(), 10.0);
+    QCOMPARE(snapshotResult.state, snapshot->stateNumber());
+
+    JsonDbQueryResult findResult = mJsonDbPartition->queryObjects(mOwner, query);
+    QCOMPARE(findResult.data.size(), 19);
+    QCOMPARE(findResult.data.at(0).value(QLatin1String("snapshotKey")).toDouble(), 101.0);
+
+    // joins read other objects and are left to the partition's thread
+    JsonDbQueryParser joinParser;
+    joinParser.setQuery(QLatin1String("[?_type=\"snapshotRead\"][?otherUuid->snapshotKey=1]"));
+    QVERIFY(joinParser.parse());
+    QVERIFY(!snapshot->canQuery(joinParser.result()));
+
+    // changing the indexes retires the snapshot
+    addIndex(QLatin1String("snapshotOther"), QLatin1String("string"), QLatin1String("snapshotRead"));
+    QVERIFY(!snapshot->queryObjects(mOwner, query, -1, 0, QByteArray(), &snapshotResult));
+
+    snapshot.reset(mJsonDbPartition->createSnapshot());
+    QVERIFY(snapshot->isCurrent());
+    QVERIFY(snapshot->queryObjects(mOwner, query, -1, 0, QByteArray(), &snapshotResult));
+    QCOMPARE(snapshotResult.data.size(), 19);
+}
+
+void TestPartition::notificationIndex()
+{
+    QStringList queries;
+    queries << QLatin1String("[?_type=\"notificationIndex\"][?color=\"red\"]")
+            << QLatin1String("[?_type=\"notificationIndex\"][?size > 10][?size <= 20]")
+            << QLatin1String("[?_type in [\"notificationIndex\", \"other\"]][?color in [\"blue\", \"green\"]]")
+            << QLatin1String("[?color=\"red\"]")
+            << QLatin1String("[?_type=\"notificationIndex\"][?color=~\"/gr.*/\"]");
+    QStringList actions;
+    actions << JsonDbString::kCreateStr << JsonDbString::kUpdateStr << JsonDbString::kRemoveStr;
+
+    QList<JsonDbNotification *> notifications;
+    JsonDbNotificationIndex index;
+    foreach (const QString &query, queries) {
+        JsonDbQueryParser parser;
+        parser.setQuery(query);
+        QVERIFY(parser.parse());
+        notifications.append(new JsonDbNotification(mOwner, parser.result(), actions));
+        index.insert(notifications.last());
+    }
+
+    JsonDbObject object;
+    object.insert(JsonDbString::kTypeStr, QLatin1String("notificationIndex"));
+    object.insert(JsonDbString::kUuidStr, QLatin1String("{6b9f6a3c-5e4b-4d5c-9a47-0c5c7c2b1f10}"));
+    object.insert(QLatin1String("color"), QLatin1String("red"));
+    object.insert(QLatin1String("size"), 5);
+
+    // the regular expression is not indexed, so its notification is always visited
+    QVector<JsonDbNotification *> candidates = index.candidates(JsonDbObject(), object);
+    QCOMPARE(candidates.size(), 3);
+    QVERIFY(candidates.contains(notifications.at(0)));
+    QVERIFY(candidates.contains(notifications.at(3)));
+    QVERIFY(candidates.contains(notifications.at(4)));
+
+    JsonDbObject changed = object;
+    changed.insert(QLatin1String("color"), QLatin1String("blue"));
+    changed.insert(QLatin1String("size"), 20);
+    candidates = index.candidates(JsonDbObject(), changed);
+    QCOMPARE(candidates.size(), 3);
+    QVERIFY(candidates.contains(notifications.at(1)));
+    QVERIFY(candidates.contains(notifications.at(2)));
+
+    // both versions are looked up, each notification once
+    candidates = index.candidates(object, changed);
+    QCOMPARE(candidates.size(), 5);
+
+    changed.insert(QLatin1String("size"), 21);
+    changed.insert(JsonDbString::kTypeStr, QLatin1String("other"));
+    candidates = index.candidates(JsonDbObject(), changed);
+    QCOMPARE(candidates.size(), 1);
+    QCOMPARE(candidates.at(0), notifications.at(2));
+
+    index.remove(notifications.at(2));
+    QVERIFY(index.candidates(JsonDbObject(), changed).isEmpty());
+    QCOMPARE(index.notifications().size(), 4);
+
+    // notifications deleted without being removed are skipped
+    delete notifications.takeAt(4);
+    QCOMPARE(index.candidates(JsonDbObject(), object).size(), 2);
+    qDeleteAll(notifications);
+    QVERIFY(index.candidates(JsonDbObject(), object).isEmpty());
+}
+
+void TestPartition::mergeUpdates()
+{
+    JsonDbObject before;
+    before.insert(QLatin1String("value"), 1);
+    JsonDbObject after;
+    after.insert(QLatin1String("value"), 2);
+    JsonDbObject tombstone(after);
+    tombstone.insert(JsonDbString::kDeletedStr, true);
+
+    // a create stays a create with the latest contents
+    JsonDbUpdate change(JsonDbObject(), before, JsonDbNotification::Create);
+    QVERIFY(change.merge(JsonDbUpdate(before, after, JsonDbNotification::Update)));
+    QCOMPARE(change.action, JsonDbNotification::Create);
+    QCOMPARE(change.newObject, after);
+    QVERIFY(change.oldObject.isEmpty());
+
+    // and cancels out with a remove
+    QVERIFY(!change.merge(JsonDbUpdate(after, tombstone, JsonDbNotification::Remove)));
+
+    change = JsonDbUpdate(before, after, JsonDbNotification::Update);
+    QVERIFY(change.merge(JsonDbUpdate(after, tombstone, JsonDbNotification::Remove)));
+    QCOMPARE(change.action, JsonDbNotification::Remove);
+    QCOMPARE(change.oldObject, before);
+    QCOMPARE(change.newObject, tombstone);
+
+    // removed and created again is an update
+    change = JsonDbUpdate(before, tombstone, JsonDbNotification::Remove);
+    QVERIFY(change.merge(JsonDbUpdate(JsonDbObject(), after, JsonDbNotification::Create)));
+    QCOMPARE(change.action, JsonDbNotification::Update);
+    QCOMPARE(change.newObject, after);
+}
+
+void TestPartition::historicalReplay()
+{
+    int chunkSize = jsondbSettings->historicalReplayChunkSize();
+    jsondbSettings->setHistoricalReplayChunkSize(4);
+
+    JsonDbObjectList list;
+    for (int i = 0; i < 10; i++) {
+        JsonDbObject item;
+        item.insert(JsonDbString::kTypeStr, QLatin1String("historicalReplay"));
+        item.insert(QLatin1String("replayKey"), i);
+        list.append(item);
+    }
+    JsonDbWriteResult result = mJsonDbPartition->updateObjects(mOwner, list);
+    verifyGoodResult(result);
+    list = result.objectsWritten;
+    QCoreApplication::processEvents();
+
+    JsonDbQueryParser parser;
+    parser.setQuery(QLatin1String("[?_type=\"historicalReplay\"]"));
+    QVERIFY(parser.parse());
+    QStringList actions;
+    actions << JsonDbString::kCreateStr << JsonDbString::kUpdateStr << JsonDbString::kRemoveStr;
+    JsonDbNotification *notification = new JsonDbNotification(mOwner, parser.result(), actions, 0);
+    NotificationRecorder recorder;
+    connect(notification, SIGNAL(notified(QJsonObject,quint32,JsonDbNotification::Action)),
+            &recorder, SLOT(notified(QJsonObject,quint32,JsonDbNotification::Action)));
+
+    // the objects are replayed from the event loop
+    mJsonDbPartition->addNotification(notification);
+    QVERIFY(recorder.actions.isEmpty());
+
+    // changes made during the replay are caught up once, not also delivered live
+    JsonDbObject changed = list.at(0);
+    changed.insert(QLatin1String("replayKey"), 100);
+    verifyGoodResult(update(mOwner, changed));
+    JsonDbObject item;
+    item.insert(JsonDbString::kTypeStr, QLatin1String("historicalReplay"));
+    item.insert(QLatin1String("replayKey"), 10);
+    verifyGoodResult(create(mOwner, item));
+
+    QTRY_VERIFY(recorder.count(JsonDbNotification::StateChange) == 1);
+    QCoreApplication::processEvents();
+    QCOMPARE(recorder.count(JsonDbNotification::Create), 11);
+    QCOMPARE(recorder.count(JsonDbNotification::Update), 1);
+    QCOMPARE(recorder.actions.last(), JsonDbNotification::StateChange);
+
+    // afterwards changes are delivered live
+    verifyGoodResult(remove(mOwner, item));
+    QTRY_VERIFY(recorder.count(JsonDbNotification::Remove) == 1);
+    QCOMPARE(recorder.count(JsonDbNotification::Create), 11);
+
+    mJsonDbPartition->removeNotification(notification);
+    delete notification;
+    jsondbSettings->setHistoricalReplayChunkSize(chunkSize);
+}
+
 void TestPartition::ensureBadPartitionFunctionCalls_data()
 {
     QTest::addColumn<bool>("callOpen");
@@ -98,6 +98,7 @@ private slots:
     void removablePartition();
     void readRequest_data();
     void readRequest();
+    void chunkedReadRequest();
     void writeRequest_data();
     void writeRequest();
     void createRequest_data();
@@ -114,6 +115,8 @@ private slots:
     void bindings();
     void replaceFromNull();
     void multiplerequests();
+    void partitionRequests_data();
+    void partitionRequests();
     void defaultConnection();
     void privatePartitionFlushRequest();
     void multipleThreads_data();
@@ -122,6 +125,8 @@ private slots:
 
 private:
     bool writeTestObject(QObject* parent, const QString &type, int value, const QString &partition = QString());
+
+    bool mRelaunchDaemon;
 };
 
 void TestQJsonDbRequest::initTestCase()
@@ -131,6 +136,7 @@ void TestQJsonDbRequest::initTestCase()
 
     QStringList arg_list = QStringList() << "-validate-schemas";
     launchJsonDbDaemon(arg_list, __FILE__);
+    mRelaunchDaemon = false;
 }
 
 void TestQJsonDbRequest::cleanupTestCase()
@@ -152,6 +158,13 @@ void TestQJsonDbRequest::init()
 void TestQJsonDbRequest::cleanup()
 {
     disconnectFromServer();
+
+    // restore the daemon as launched by initTestCase
+    if (mRelaunchDaemon) {
+        mRelaunchDaemon = false;
+        stopDaemon();
+        launchJsonDbDaemon(QStringList() << "-validate-schemas", __FILE__);
+    }
 }
 
 void TestQJsonDbRequest::modifyPartitions()
@@ -530,6 +543,55 @@ void TestQJsonDbRequest::severalWrites()
     QCOMPARE(obj.value(typeStr()).toString(), QStringLiteral("test"));
 }
 
+/*!
+    Checking that large read results are delivered in several chunks.
+*/
+void TestQJsonDbRequest::chunkedReadRequest()
+{
+    QVERIFY(mConnection);
+
+    QObject parent;
+    const int numObjects = 25;
+    for (int i = 0; i < numObjects; i++)
+        QVERIFY(writeTestObject(&parent, QStringLiteral("chunkedReadTest"), i));
+
+    QJsonDbReadRequest request(QStringLiteral("[?_type=\"chunkedReadTest\"]"));
+    request.setProperty("queryChunkSize", 10);
+    QSignalSpy startedSpy(&request, SIGNAL(started()));
+    QSignalSpy resultsSpy(&request, SIGNAL(resultsAvailable(int)));
+    mConnection->send(&request);
+    QVERIFY(waitForResponse(&request));
+    QVERIFY(!mRequestErrors.contains(&request));
+
+    QCOMPARE(startedSpy.count(), 1);
+    QCOMPARE(resultsSpy.count(), 3);
+    QCOMPARE(resultsSpy.at(0).at(0).toInt(), 10);
+    QCOMPARE(resultsSpy.at(2).at(0).toInt(), numObjects);
+    QList<QJsonObject> results = request.takeResults();
+    QCOMPARE(results.count(), numObjects);
+
+    // -- limit is honored across chunks
+    QJsonDbReadRequest limited(QStringLiteral("[?_type=\"chunkedReadTest\"]"));
+    limited.setProperty("queryChunkSize", 10);
+    limited.setQueryLimit(15);
+    mConnection->send(&limited);
+    QVERIFY(waitForResponse(&limited));
+    QVERIFY(!mRequestErrors.contains(&limited));
+    QCOMPARE(limited.takeResults().count(), 15);
+
+    // -- requests queued behind a streamed read still get served
+    QJsonDbReadRequest first(QStringLiteral("[?_type=\"chunkedReadTest\"]"));
+    first.setProperty("queryChunkSize", 5);
+    QJsonDbReadRequest second(QStringLiteral("[?_type=\"chunkedReadTest\"][/val]"));
+    second.setProperty("queryChunkSize", 5);
+    mConnection->send(&first);
+    mConnection->send(&second);
+    QVERIFY(waitForResponse(&second));
+    QCOMPARE(first.status(), QJsonDbRequest::Finished);
+    QCOMPARE(first.takeResults().count(), numObjects);
+    QCOMPARE(second.takeResults().count(), numObjects);
+}
+
 void TestQJsonDbRequest::readRequest_data()
 {
     QTest::addColumn<QString>("partition");
@@ -1202,6 +1264,108 @@ void TestQJsonDbRequest::multiplerequests()
     QCOMPARE(results.size(), 0);
 }
 
+void TestQJsonDbRequest::partitionRequests_data()
+{
+    QTest::addColumn<bool>("partitionThreads");
+
+    QTest::newRow("partition threads") << true;
+    QTest::newRow("server thread") << false;
+}
+
+void TestQJsonDbRequest::partitionRequests()
+{
+    QFETCH(bool, partitionThreads);
+
+    const QString otherPartition = QStringLiteral("com.qt-project.partitionRequests");
+    const QString type = QStringLiteral("partitionRequests_%1").arg(QLatin1String(partitionThreads ? "threads" : "server"));
+
+    // relaunch the daemon with a second partition and, unless testing threads, JSONDB_PARTITION_THREADS=false
+    QJsonObject def;
+    def.insert(QLatin1String("name"), otherPartition);
+    def.insert(QLatin1String("path"), QLatin1String("."));
+    QJsonArray defs;
+    defs.append(def);
+
+    QFile partitionsFile(QFileInfo(QFINDTESTDATA("partitions.json")).absoluteDir().absoluteFilePath(QLatin1String("partitions-test.json")));
+    partitionsFile.open(QFile::WriteOnly);
+    partitionsFile.write(QJsonDocument(defs).toJson());
+    partitionsFile.close();
+
+    disconnectFromServer();
+    stopDaemon();
+    if (!partitionThreads)
+        ::setenv("JSONDB_PARTITION_THREADS", "false", 1);
+    launchJsonDbDaemon(QStringList() << "-validate-schemas", __FILE__);
+    ::unsetenv("JSONDB_PARTITION_THREADS");
+    partitionsFile.remove();
+    mRelaunchDaemon = true;
+    connectToServer();
+
+    QObject parent;
+
+    // a read sent right after a write on the same connection sees that write
+    {
+        QList<QJsonDbRequest *> requests;
+        QList<QJsonDbReadRequest *> reads;
+        for (int i = 0; i < 20; i++) {
+            QJsonDbObject object;
+            object.setUuid(QUuid::createUuid());
+            object.insert(typeStr(), type);
+            object.insert(QStringLiteral("val"), i);
+            QJsonDbCreateRequest *write = new QJsonDbCreateRequest(object, &parent);
+            mConnection->send(write);
+
+            QJsonDbReadRequest *read = new QJsonDbReadRequest(QString::fromLatin1("[?_type=\"%1\"]").arg(type), &parent);
+            mConnection->send(read);
+
+            requests << write << read;
+            reads << read;
+        }
+        QVERIFY(waitForResponse(requests));
+        QVERIFY(mRequestErrors.isEmpty());
+
+        for (int i = 0; i < reads.size(); i++)
+            QCOMPARE(reads.at(i)->takeResults().size(), i + 1);
+    }
+
+    // interleaved requests to two partitions are all served, each partition in order
+    {
+        const QString concurrentType = type + QStringLiteral("_concurrent");
+        QStringList partitions = QStringList() << QString() << otherPartition;
+
+        QList<QJsonDbRequest *> requests;
+        QList<QJsonDbReadRequest *> reads;
+        for (int i = 0; i < 20; i++) {
+            foreach (const QString &partition, partitions) {
+                QJsonDbObject object;
+                object.setUuid(QUuid::createUuid());
+                object.insert(typeStr(), concurrentType);
+                object.insert(QStringLiteral("val"), i);
+                QJsonDbCreateRequest *write = new QJsonDbCreateRequest(object, &parent);
+                write->setPartition(partition);
+                mConnection->send(write);
+                requests << write;
+            }
+        }
+        foreach (const QString &partition, partitions) {
+            QJsonDbReadRequest *read = new QJsonDbReadRequest(QString::fromLatin1("[?_type=\"%1\"][/val]").arg(concurrentType), &parent);
+            read->setPartition(partition);
+            mConnection->send(read);
+            requests << read;
+            reads << read;
+        }
+        QVERIFY(waitForResponse(requests));
+        QVERIFY(mRequestErrors.isEmpty());
+
+        foreach (QJsonDbReadRequest *read, reads) {
+            QList<QJsonObject> results = read->takeResults();
+            QCOMPARE(results.size(), 20);
+            for (int i = 0; i < results.size(); i++)
+                QCOMPARE(results.at(i).value(QStringLiteral("val")).toDouble(), double(i));
+        }
+    }
+}
+
 void TestQJsonDbRequest::defaultConnection()
 {
     // make sure that the default connection connects automatically
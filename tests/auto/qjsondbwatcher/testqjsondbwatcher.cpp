@@ -42,6 +42,7 @@
 #include <QCoreApplication>
 #include <QFile>
 #include <QList>
+#include <QSet>
 #include <QTest>
 #include <QProcess>
 #include <QEventLoop>
@@ -96,6 +97,8 @@ private slots:
     void addAndRemove();
     void removeWatcherStatus();
     void uuidQuery();
+    void bulkWrite_data();
+    void bulkWrite();
 };
 
 TestQJsonDbWatcher::TestQJsonDbWatcher()
@@ -1000,6 +1003,63 @@ void TestQJsonDbWatcher::uuidQuery()
     QVERIFY(waitForStatus(&watcher, QJsonDbWatcher::Inactive));
 }
 
+void TestQJsonDbWatcher::bulkWrite_data()
+{
+    QTest::addColumn<QString>("partition");
+
+    QTest::newRow("persistent") << "";
+    QTest::newRow("ephemeral") << "Ephemeral";
+}
+
+/*
+ * The notifications of a bulk write arrive in batches, each object once
+ */
+void TestQJsonDbWatcher::bulkWrite()
+{
+    QFETCH(QString, partition);
+
+    QJsonDbWatcher watcher;
+    watcher.setWatchedActions(QJsonDbWatcher::All);
+    watcher.setQuery(QLatin1String("[?_type=\"bulkWrite\"]"));
+    watcher.setPartition(partition);
+    mConnection->addWatcher(&watcher);
+    QVERIFY(waitForStatus(&watcher, QJsonDbWatcher::Active));
+
+    const int count = 200;
+    QList<QJsonObject> objects;
+    for (int i = 0; i < count; i++) {
+        QJsonObject object;
+        object.insert(JsonDbStrings::Property::type(), QLatin1String("bulkWrite"));
+        object.insert(QLatin1String("i"), i);
+        objects.append(object);
+    }
+    QJsonDbWriteRequest write;
+    write.setObjects(objects);
+    write.setPartition(partition);
+    mConnection->send(&write);
+    QVERIFY(waitForResponseAndNotifications(&write, &watcher, count));
+
+    QList<QJsonDbNotification> notifications = watcher.takeNotifications();
+    QCOMPARE(notifications.size(), count);
+    QSet<QString> uuids;
+    foreach (const QJsonDbNotification &n, notifications) {
+        QCOMPARE(n.action(), QJsonDbWatcher::Created);
+        uuids.insert(n.object().value(JsonDbStrings::Property::uuid()).toString());
+    }
+    QCOMPARE(uuids.size(), count);
+
+    QList<QJsonObject> results = write.takeResults();
+    for (int i = 0; i < results.size(); i++)
+        results[i].insert(JsonDbStrings::Property::type(), QLatin1String("bulkWrite"));
+    QJsonDbRemoveRequest remove(results);
+    remove.setPartition(partition);
+    mConnection->send(&remove);
+    QVERIFY(waitForResponseAndNotifications(&remove, &watcher, count));
+    QCOMPARE(watcher.takeNotifications().size(), count);
+
+    mConnection->removeWatcher(&watcher);
+}
+
 QTEST_MAIN(TestQJsonDbWatcher)
 
 #include "testqjsondbwatcher.moc"
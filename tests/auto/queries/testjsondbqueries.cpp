@@ -52,6 +52,7 @@
 #include "jsondbpartition.h"
 #include "jsondbquery.h"
 #include "jsondbqueryparser.h"
+#include "jsondbsettings.h"
 #include "jsondbstrings.h"
 #include "jsondberrors.h"
 
@@ -89,6 +90,7 @@ private slots:
     void queryOneType();
     void queryOneOrOtherType();
     void queryTypesIn();
+    void queryManyValuesIn();
     void queryUnion();
     void queryFieldExists();
     void queryFieldNotExists();
@@ -99,12 +101,20 @@ private slots:
     void queryNotEqual();
     void queryQuotedProperties();
     void querySortedByIndexName();
+    void queryContinuation();
+    void queryCoveringIndex();
+    void queryTypeCount();
+    void queryPrefixRange();
+    void queryMultiKeyContains();
+    void queryInPointValues();
     void queryContains();
     void queryInvalid();
     void queryRegExp();
     void queryExtract();
     void queryExtractLink();
     void queryJoinedObject();
+    void queryJoinBatched();
+    void queryTextIndex();
 
 private:
     void removeDbFiles();
@@ -306,6 +316,29 @@ void TestJsonDbQueries::queryTypesIn()
     QVERIFY(confirmEachObject(queryResult.data, CheckObjectFieldEqualTo<QString>("_type", QStringList() << "dragon" << "bunny")));
 }
 
+void TestJsonDbQueries::queryManyValuesIn()
+{
+    // large arrays are matched through a hash set rather than a linear scan
+    JsonDbQueryResult queryResult = find(mOwner, QLatin1String("[?_type=\"bunny\"][?age in [8, 100, 101, 102, 103, 104, 105, 106, \"8\"]]"));
+    QCOMPARE(queryResult.code, JsonDbError::NoError);
+    QCOMPARE(queryResult.data.size(), mDataStats["num-bunnies-age-8"].toInt());
+
+    queryResult = find(mOwner, QLatin1String("[?_type=\"bunny\"][?age notIn [8, 100, 101, 102, 103, 104, 105, 106, \"8\"]]"));
+    QCOMPARE(queryResult.code, JsonDbError::NoError);
+    QCOMPARE(queryResult.data.size(), mDataStats["num-bunnies"].toInt() - mDataStats["num-bunnies-age-8"].toInt());
+
+    QJsonArray types;
+    for (int i = 0; i < 16; i++)
+        types.append(QString::fromLatin1("unicorn%1").arg(i));
+    types.append(QLatin1String("dragon"));
+    QJsonObject bindings;
+    bindings.insert(QLatin1String("types"), types);
+    queryResult = find(mOwner, QLatin1String("[?_type in %types]"), bindings);
+    QCOMPARE(queryResult.code, JsonDbError::NoError);
+    QCOMPARE(queryResult.data.size(), mDataStats["num-dragons"].toInt());
+    QVERIFY(confirmEachObject(queryResult.data, CheckObjectFieldEqualTo<QString>("_type", "dragon")));
+}
+
 void TestJsonDbQueries::queryUnion()
 {
     JsonDbQueryResult queryResult = find(mOwner, QLatin1String("[?_type=\"bunny\"][?age=8|type=\"demon\"]"));
@@ -472,6 +505,299 @@ void TestJsonDbQueries::querySortedByIndexName()
     verifyGoodWriteResult(result);
 }
 
+void TestJsonDbQueries::queryContinuation()
+{
+    JsonDbObject index;
+    index.insert("_uuid", QString("{8a3b0b8e-4b6d-4a4c-9b55-8bde7bbc6e4f}"));
+    index.insert("_type", QString("Index"));
+    index.insert("name", QString("age"));
+    index.insert("propertyName", QString("age"));
+    index.insert("propertyType", QString("number"));
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, index));
+
+    JsonDbQueryParser parser;
+    parser.setQuery(QLatin1String("[?_type = \"dragon\"][/age]"));
+    QVERIFY(parser.parse());
+    JsonDbQuery parsedQuery = parser.result();
+    JsonDbQueryResult queryResult = mJsonDbPartition->queryObjects(mOwner, parsedQuery, 3);
+    QCOMPARE(queryResult.data.size(), 3);
+    QVERIFY(!queryResult.continuation.isEmpty());
+    QVERIFY(confirmEachObject(queryResult.data, CheckSortOrder<double>("age", QList<double>() << 0 << 0 << 2)));
+
+    // objects inserted before the resume point do not shift the next page
+    JsonDbObject early;
+    early.insert("_uuid", QString("{0f6a1f36-2f4e-4d7c-a8a8-54c1f6a0c5d2}"));
+    early.insert("_type", QString("dragon"));
+    early.insert("age", -1);
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, early));
+
+    QList<double> ages;
+    QByteArray continuation = queryResult.continuation;
+    while (!continuation.isEmpty()) {
+        queryResult = mJsonDbPartition->queryObjects(mOwner, parsedQuery, 3, 0, continuation);
+        QCOMPARE(queryResult.code, JsonDbError::NoError);
+        foreach (const JsonDbObject &object, queryResult.data)
+            ages.append(object.value("age").toDouble());
+        continuation = queryResult.continuation;
+    }
+    QCOMPARE(ages, QList<double>() << 2 << 4 << 4 << 6 << 6 << 8 << 8);
+
+    // a continuation only applies to queries on the same index and direction
+    queryResult = mJsonDbPartition->queryObjects(mOwner, parsedQuery, 3);
+    JsonDbQueryParser descendingParser;
+    descendingParser.setQuery(QLatin1String("[?_type = \"dragon\"][\\age]"));
+    QVERIFY(descendingParser.parse());
+    JsonDbQuery descending = descendingParser.result();
+    queryResult = mJsonDbPartition->queryObjects(mOwner, descending, 3, 0, queryResult.continuation);
+    QCOMPARE(queryResult.code, JsonDbError::InvalidRequest);
+
+    queryResult = mJsonDbPartition->queryObjects(mOwner, descending, 4);
+    QVERIFY(confirmEachObject(queryResult.data, CheckSortOrder<double>("age", QList<double>() << 8 << 8 << 6 << 6)));
+    queryResult = mJsonDbPartition->queryObjects(mOwner, descending, -1, 0, queryResult.continuation);
+    QVERIFY(confirmEachObject(queryResult.data, CheckSortOrder<double>("age", QList<double>() << 4 << 4 << 2 << 2 << 0 << 0 << -1)));
+    QVERIFY(queryResult.continuation.isEmpty());
+
+    early.markDeleted();
+    index.markDeleted();
+    QList<JsonDbObject> objects;
+    objects << early << index;
+    verifyGoodWriteResult(mJsonDbPartition->updateObjects(mOwner, objects, JsonDbPartition::Replace));
+}
+
+void TestJsonDbQueries::queryCoveringIndex()
+{
+    JsonDbObject index;
+    index.insert("_uuid", QString("{5d0c2b57-7a29-4f0e-b3a4-2f64b8e1c9a1}"));
+    index.insert("_type", QString("Index"));
+    index.insert("name", QString("age"));
+    index.insert("propertyName", QString("age"));
+    index.insert("propertyType", QString("number"));
+    QJsonArray includes;
+    includes.append(QLatin1String("name"));
+    index.insert("include", includes);
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, index));
+
+    JsonDbQueryResult fullResult = find(mOwner, QLatin1String("[?_type = \"dragon\"][/age]"));
+    QCOMPARE(fullResult.data.size(), mDataStats["num-dragons"].toInt());
+
+    // projections of included properties are read from the index entries
+    JsonDbQueryResult queryResult = find(mOwner, QLatin1String("[?_type = \"dragon\"][/age][={first:name.first, uuid:_uuid}]"));
+    QCOMPARE(queryResult.code, JsonDbError::NoError);
+    QCOMPARE(queryResult.data.size(), fullResult.data.size());
+    for (int i = 0; i < queryResult.data.size(); i++) {
+        QCOMPARE(queryResult.data.at(i).keys().size(), 2);
+        QCOMPARE(queryResult.data.at(i).value("uuid").toString(), fullResult.data.at(i).value("_uuid").toString());
+        QCOMPARE(queryResult.data.at(i).value("first").toString(),
+                 fullResult.data.at(i).value("name").toObject().value("first").toString());
+    }
+
+    QString firstName = fullResult.data.at(0).value("name").toObject().value("first").toString();
+    int sameFirstName = 0;
+    foreach (const JsonDbObject &dragon, fullResult.data)
+        if (dragon.value("name").toObject().value("first").toString() == firstName)
+            sameFirstName++;
+    queryResult = find(mOwner, QString::fromLatin1("[?_type = \"dragon\"][/age][?name.first = \"%1\"][count]").arg(firstName));
+    QCOMPARE(queryResult.data.size(), 1);
+    QCOMPARE(queryResult.data.at(0).value("count").toDouble(), double(sameFirstName));
+
+    queryResult = find(mOwner, QLatin1String("[?_type = \"dragon\"][count]"));
+    QCOMPARE(queryResult.data.at(0).value("count").toDouble(), mDataStats["num-dragons"].toDouble());
+
+    // a residual term on a %variable property is not on an included property
+    QJsonObject bindings;
+    bindings.insert(QLatin1String("who"), QLatin1String("dragon"));
+    queryResult = find(mOwner, QLatin1String("[?_type = \"dragon\"][/age][?%who = \"dragon\"][count]"), bindings);
+    QCOMPARE(queryResult.code, JsonDbError::NoError);
+    QCOMPARE(queryResult.data.size(), 1);
+    QCOMPARE(queryResult.data.at(0).value("count").toDouble(), mDataStats["num-dragons"].toDouble());
+
+    // included properties follow updates of the object
+    JsonDbObject dragon = fullResult.data.at(0);
+    dragon.remove("_indexValue");
+    JsonDbObject renamed = dragon;
+    QJsonObject name = renamed.value("name").toObject();
+    name.insert("first", QLatin1String("renamed"));
+    renamed.insert("name", name);
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, renamed, JsonDbPartition::Replace));
+    queryResult = find(mOwner, QLatin1String("[?_type = \"dragon\"][/age][?name.first = \"renamed\"][={uuid:_uuid}]"));
+    QCOMPARE(queryResult.data.size(), 1);
+    QCOMPARE(queryResult.data.at(0).value("uuid").toString(), dragon.value("_uuid").toString());
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, dragon, JsonDbPartition::Replace));
+
+    // the include list cannot change once the index is built
+    JsonDbObject changedIndex = index;
+    includes.append(QLatin1String("age"));
+    changedIndex.insert("include", includes);
+    QVERIFY(mJsonDbPartition->updateObject(mOwner, changedIndex, JsonDbPartition::Replace).code != JsonDbError::NoError);
+
+    index.markDeleted();
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, index, JsonDbPartition::Replace));
+}
+
+void TestJsonDbQueries::queryTypeCount()
+{
+    int dragons = mDataStats["num-dragons"].toInt();
+    JsonDbQueryResult queryResult = find(mOwner, QLatin1String("[?_type = \"dragon\"][count]"));
+    QCOMPARE(queryResult.data.at(0).value("count").toDouble(), double(dragons));
+
+    // the count is maintained as objects of the type come and go
+    JsonDbObject dragon;
+    dragon.insert("_uuid", QString("{c3f0e8a4-51d2-4d35-8f3c-7b6a2f9e1d40}"));
+    dragon.insert("_type", QString("dragon"));
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, dragon));
+    queryResult = find(mOwner, QLatin1String("[?_type = \"dragon\"][count]"));
+    QCOMPARE(queryResult.data.at(0).value("count").toDouble(), double(dragons + 1));
+
+    dragon.insert("_type", QString("bunny"));
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, dragon, JsonDbPartition::Replace));
+    queryResult = find(mOwner, QLatin1String("[?_type = \"dragon\"][count]"));
+    QCOMPARE(queryResult.data.at(0).value("count").toDouble(), double(dragons));
+
+    dragon.markDeleted();
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, dragon, JsonDbPartition::Replace));
+    queryResult = find(mOwner, QLatin1String("[?_type = \"bunny\"][count]"));
+    QCOMPARE(queryResult.data.at(0).value("count").toDouble(), mDataStats["num-bunnies"].toDouble());
+    queryResult = find(mOwner, QLatin1String("[?_type = \"dragon\"][count]"));
+    QCOMPARE(queryResult.data.at(0).value("count").toDouble(), double(dragons));
+}
+
+void TestJsonDbQueries::queryPrefixRange()
+{
+    JsonDbObject index;
+    index.insert("_uuid", QString("{8e5b7a0c-3f61-4c2d-9a84-1b0f6d2e7c53}"));
+    index.insert("_type", QString("Index"));
+    index.insert("name", QString("firstName"));
+    index.insert("propertyName", QString("name.first"));
+    index.insert("propertyType", QString("string"));
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, index));
+
+    JsonDbQueryResult fullResult = find(mOwner, QLatin1String("[?_type = \"dragon\"]"));
+    QVERIFY(fullResult.data.size() > 0);
+    QString firstName = fullResult.data.at(0).value("name").toObject().value("first").toString();
+    QString prefix = firstName.left(2);
+    int expected = 0;
+    foreach (const JsonDbObject &dragon, fullResult.data)
+        if (dragon.value("name").toObject().value("first").toString().startsWith(prefix))
+            expected++;
+
+    // the scan is bounded to [prefix, successor of prefix) in either direction
+    QStringList queries;
+    queries << QString::fromLatin1("[?_type = \"dragon\"][?name.first startsWith \"%1\"][/name.first]").arg(prefix)
+            << QString::fromLatin1("[?_type = \"dragon\"][?name.first startsWith \"%1\"][\\name.first]").arg(prefix)
+            << QString::fromLatin1("[?_type = \"dragon\"][?name.first =~ \"/^%1.*/\"][/name.first]").arg(prefix)
+            << QString::fromLatin1("[?_type = \"dragon\"][?name.first =~ \"/%1*/w\"][\\name.first]").arg(prefix);
+    foreach (const QString &query, queries) {
+        JsonDbQueryResult queryResult = find(mOwner, query);
+        QCOMPARE(queryResult.code, JsonDbError::NoError);
+        QCOMPARE(queryResult.data.size(), expected);
+        foreach (const JsonDbObject &dragon, queryResult.data)
+            QVERIFY(dragon.value("name").toObject().value("first").toString().startsWith(prefix));
+    }
+
+    // a quantifier makes the last literal character optional
+    JsonDbQueryResult queryResult = find(mOwner, QString::fromLatin1("[?_type = \"dragon\"][?name.first =~ \"/^%1?%2.*/\"][/name.first]")
+                                         .arg(firstName.left(1)).arg(firstName.mid(1, 1)));
+    QCOMPARE(queryResult.code, JsonDbError::NoError);
+    QVERIFY(queryResult.data.size() >= expected);
+
+    // the negated match is not narrowed to the prefix
+    queryResult = find(mOwner, QString::fromLatin1("[?_type = \"dragon\"][?name.first !=~ \"/^%1.*/\"][/name.first]").arg(prefix));
+    QCOMPARE(queryResult.code, JsonDbError::NoError);
+    QCOMPARE(queryResult.data.size(), fullResult.data.size() - expected);
+
+    index.markDeleted();
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, index, JsonDbPartition::Replace));
+}
+
+void TestJsonDbQueries::queryMultiKeyContains()
+{
+    JsonDbObject index;
+    index.insert("_uuid", QString("{0b7f3c2e-9d14-4a6b-8e52-c1f0a3d7e689}"));
+    index.insert("_type", QString("Index"));
+    index.insert("name", QString("tags"));
+    index.insert("propertyName", QString("tags.*"));
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, index));
+
+    QList<QStringList> tagLists;
+    tagLists << (QStringList() << "red" << "green")
+             << (QStringList() << "green" << "blue" << "green")
+             << (QStringList() << "blue")
+             << QStringList();
+    JsonDbObjectList tagged;
+    for (int i = 0; i < tagLists.size(); i++) {
+        JsonDbObject object;
+        object.insert("_uuid", QUuid::createUuid().toString());
+        object.insert("_type", QString("tagged"));
+        object.insert("tags", QJsonArray::fromStringList(tagLists.at(i)));
+        verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, object));
+        tagged.append(object);
+    }
+
+    // contains is looked up in the multikey index
+    JsonDbQueryResult queryResult = find(mOwner, QLatin1String("[?_type = \"tagged\"][?tags contains \"green\"]"));
+    QCOMPARE(queryResult.code, JsonDbError::NoError);
+    QCOMPARE(queryResult.sortKeys.at(0), QLatin1String("tags"));
+    QCOMPARE(queryResult.data.size(), 2);
+    queryResult = find(mOwner, QLatin1String("[?_type = \"tagged\"][?tags contains \"blue\"][\\tags]"));
+    QCOMPARE(queryResult.data.size(), 2);
+    queryResult = find(mOwner, QLatin1String("[?_type = \"tagged\"][?tags contains \"purple\"]"));
+    QCOMPARE(queryResult.data.size(), 0);
+
+    // values that have no index entry still need the residual check
+    queryResult = find(mOwner, QLatin1String("[?_type = \"tagged\"][?tags contains [\"red\"]]"));
+    QCOMPARE(queryResult.code, JsonDbError::NoError);
+    QCOMPARE(queryResult.sortKeys.at(0), QLatin1String("_type"));
+    queryResult = find(mOwner, QLatin1String("[?_type = \"tagged\"][?tags notContains \"green\"]"));
+    QCOMPARE(queryResult.sortKeys.at(0), QLatin1String("_type"));
+    QCOMPARE(queryResult.data.size(), 2);
+
+    foreach (JsonDbObject object, tagged) {
+        object.markDeleted();
+        verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, object, JsonDbPartition::Replace));
+    }
+    index.markDeleted();
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, index, JsonDbPartition::Replace));
+}
+
+void TestJsonDbQueries::queryInPointValues()
+{
+    JsonDbObject index;
+    index.insert("_uuid", QString("{6a2d9e41-5c3b-4f87-b0e6-9d18c4a7f235}"));
+    index.insert("_type", QString("Index"));
+    index.insert("name", QString("age"));
+    index.insert("propertyName", QString("age"));
+    index.insert("propertyType", QString("number"));
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, index));
+
+    JsonDbQueryResult fullResult = find(mOwner, QLatin1String("[?_type = \"dragon\"][/age]"));
+    QVERIFY(fullResult.data.size() > 2);
+    QList<double> ages;
+    ages << fullResult.data.first().value("age").toDouble()
+         << fullResult.data.last().value("age").toDouble()
+         << -1;
+    int expected = 0;
+    foreach (const JsonDbObject &dragon, fullResult.data)
+        if (ages.contains(dragon.value("age").toDouble()))
+            expected++;
+
+    // the values are visited in index order whatever their order in the query
+    QString values = QString::fromLatin1("[%1, %2, %3]").arg(ages.at(1)).arg(ages.at(2)).arg(ages.at(0));
+    JsonDbQueryResult queryResult = find(mOwner, QString::fromLatin1("[?_type = \"dragon\"][?age in %1][/age]").arg(values));
+    QCOMPARE(queryResult.code, JsonDbError::NoError);
+    QCOMPARE(queryResult.sortKeys.at(0), QLatin1String("age"));
+    QCOMPARE(queryResult.data.size(), expected);
+    for (int i = 1; i < queryResult.data.size(); i++)
+        QVERIFY(queryResult.data.at(i - 1).value("age").toDouble() <= queryResult.data.at(i).value("age").toDouble());
+
+    queryResult = find(mOwner, QString::fromLatin1("[?_type = \"dragon\"][?age in %1][\\age]").arg(values));
+    QCOMPARE(queryResult.data.size(), expected);
+    for (int i = 1; i < queryResult.data.size(); i++)
+        QVERIFY(queryResult.data.at(i - 1).value("age").toDouble() >= queryResult.data.at(i).value("age").toDouble());
+
+    index.markDeleted();
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, index, JsonDbPartition::Replace));
+}
+
 void TestJsonDbQueries::queryContains()
 {
     JsonDbQueryResult queryResult = find(mOwner, QLatin1String("[?_type = \"dog\"][?friends contains \"spike\" ]"));
@@ -678,5 +1004,119 @@ void TestJsonDbQueries::queryJoinedObject()
     }
 }
 
+void TestJsonDbQueries::queryJoinBatched()
+{
+    QStringList queries;
+    queries << QLatin1String("[?_type = \"bunny\"][?link exists][?link->name = \"spike\"]")
+            << QLatin1String("[?_type = \"bunny\"][?link exists][?link->name = \"spike\"][?link->friends exists]")
+            << QLatin1String("[?_type = \"bunny\"][?link exists][={uuid:_uuid, linkedName:link->name}]")
+            << QLatin1String("[?_type = \"bunny\"][?link exists][={type:link->link2->link2->type}]");
+
+    int batchSize = jsondbSettings->joinBatchSize();
+    int cacheSize = jsondbSettings->joinCacheSize();
+
+    // reference results, following the joins one object at a time
+    jsondbSettings->setJoinBatchSize(1);
+    QList<JsonDbObjectList> expected;
+    foreach (const QString &query, queries) {
+        JsonDbQueryResult queryResult = find(mOwner, query);
+        QCOMPARE(queryResult.code, JsonDbError::NoError);
+        expected.append(queryResult.data);
+    }
+    QCOMPARE(expected.at(0).size(), 1);
+
+    // small batches and a small cache exercise batch boundaries and cache eviction
+    JsonDbObject index;
+    index.insert("_uuid", QString("{f1c3a5e7-2b4d-4f60-8a9c-0e1d2c3b4a59}"));
+    index.insert("_type", QString("Index"));
+    index.insert("name", QString("name"));
+    index.insert("propertyName", QString("name"));
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, index));
+    jsondbSettings->setJoinBatchSize(2);
+    jsondbSettings->setJoinCacheSize(1);
+    for (int i = 0; i < queries.size(); i++) {
+        JsonDbQueryResult queryResult = find(mOwner, queries.at(i));
+        QCOMPARE(queryResult.code, JsonDbError::NoError);
+        QCOMPARE(queryResult.data, expected.at(i));
+    }
+
+    // with the index on the joined property, link->name is looked up before the scan
+    jsondbSettings->setJoinCacheSize(cacheSize);
+    for (int i = 0; i < queries.size(); i++) {
+        JsonDbQueryResult queryResult = find(mOwner, queries.at(i));
+        QCOMPARE(queryResult.data, expected.at(i));
+    }
+
+    jsondbSettings->setJoinBatchSize(batchSize);
+    index.markDeleted();
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, index, JsonDbPartition::Replace));
+}
+
+void TestJsonDbQueries::queryTextIndex()
+{
+    JsonDbObject index;
+    index.insert("_uuid", QString("{c3e81f5a-2b7d-4d90-a6f4-58e1b92c0d37}"));
+    index.insert("_type", QString("Index"));
+    index.insert("name", QString("body"));
+    index.insert("propertyName", QString("body"));
+    index.insert("propertyType", QString("text"));
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, index));
+
+    QStringList bodies;
+    bodies << "The red car is fast"
+           << QString::fromUtf8("R\xc3\xa9" "d cars everywhere")
+           << "A blue car"
+           << "Redundant cargo";
+    JsonDbObjectList notes;
+    for (int i = 0; i < bodies.size(); i++) {
+        JsonDbObject object;
+        object.insert("_uuid", QUuid::createUuid().toString());
+        object.insert("_type", QString("note"));
+        object.insert("body", bodies.at(i));
+        verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, object));
+        notes.append(object);
+    }
+
+    // every word has to match, exact words rank above prefixes
+    JsonDbQueryResult queryResult = find(mOwner, QLatin1String("[?_type = \"note\"][?body matches \"red car\"]"));
+    QCOMPARE(queryResult.code, JsonDbError::NoError);
+    QCOMPARE(queryResult.sortKeys.at(0), QLatin1String("body"));
+    QCOMPARE(queryResult.data.size(), 3);
+    QCOMPARE(queryResult.data.at(0).value("body").toString(), bodies.at(0));
+    QCOMPARE(queryResult.data.at(1).value("body").toString(), bodies.at(1));
+    QCOMPARE(queryResult.data.at(2).value("body").toString(), bodies.at(3));
+    queryResult = find(mOwner, QLatin1String("[?_type = \"note\"][?body matches \"BLUE, car!\"]"));
+    QCOMPARE(queryResult.data.size(), 1);
+    queryResult = find(mOwner, QLatin1String("[?_type = \"note\"][?body matches \"   \"]"));
+    QCOMPARE(queryResult.data.size(), 0);
+
+    // sorting on another property leaves the match to the residual query
+    queryResult = find(mOwner, QLatin1String("[?_type = \"note\"][?body matches \"red car\"][/_uuid]"));
+    QCOMPARE(queryResult.code, JsonDbError::NoError);
+    QCOMPARE(queryResult.sortKeys.at(0), QLatin1String("_uuid"));
+    QCOMPARE(queryResult.data.size(), 3);
+    queryResult = find(mOwner, QLatin1String("[?_type = \"note\"][?body startsWith \"Red\"]"));
+    QCOMPARE(queryResult.sortKeys.at(0), QLatin1String("_type"));
+    QCOMPARE(queryResult.data.size(), 1);
+
+    // the index follows updates and removals
+    notes[2].insert("body", QString("A red blue car"));
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, notes[2], JsonDbPartition::Replace));
+    notes[0].markDeleted();
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, notes[0], JsonDbPartition::Replace));
+    queryResult = find(mOwner, QLatin1String("[?_type = \"note\"][?body matches \"red car\"]"));
+    QCOMPARE(queryResult.data.size(), 3);
+    QCOMPARE(queryResult.data.at(0).value("body").toString(), QString("A red blue car"));
+    queryResult = find(mOwner, QLatin1String("[?_type = \"note\"][?body matches \"fast\"]"));
+    QCOMPARE(queryResult.data.size(), 0);
+
+    for (int i = 1; i < notes.size(); i++) {
+        notes[i].markDeleted();
+        verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, notes[i], JsonDbPartition::Replace));
+    }
+    index.markDeleted();
+    verifyGoodWriteResult(mJsonDbPartition->updateObject(mOwner, index, JsonDbPartition::Replace));
+}
+
 QTEST_MAIN(TestJsonDbQueries)
 #include "testjsondbqueries.moc"
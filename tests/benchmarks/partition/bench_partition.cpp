@@ -52,10 +52,13 @@
 #include "jsondbindex.h"
 #include "private/jsondbindex_p.h"
 #include "jsondbindexquery.h"
+#include "jsondbcollator.h"
 #include "jsondbsettings.h"
 #include "jsondbstrings.h"
 #include "jsondberrors.h"
 #include "jsondbqueryparser.h"
+#include "jsondbnotification.h"
+#include "jsondbnotificationindex.h"
 #include "private/jsondbquerytokenizer_p.h"
 
 #include <qjsonobject.h>
@@ -97,8 +100,17 @@ private slots:
     void benchmarkParseQuery_data();
     void benchmarkParseQuery();
     void benchmarkFieldMatch();
+    void benchmarkQueryMatchIn();
+    void benchmarkNotificationDispatch_data();
+    void benchmarkNotificationDispatch();
     void benchmarkTokenizer();
     void benchmarkForwardKeyCmp();
+    void benchmarkCollatedKeyCmp_data();
+    void benchmarkCollatedKeyCmp();
+    void benchmarkCollatedIndex_data();
+    void benchmarkCollatedIndex();
+    void benchmarkBatchIndexUpdate_data();
+    void benchmarkBatchIndexUpdate();
     void benchmarkParsedQuery();
 
     void benchmarkSchemaValidation_data();
@@ -472,6 +484,82 @@ void TestPartition::benchmarkFieldMatch()
     }
 }
 
+void TestPartition::benchmarkQueryMatchIn()
+{
+    int count = mContactList.size();
+    if (!count)
+        return;
+
+    QJsonArray lastNames;
+    for (int i = 0; i < count && lastNames.size() < 64; i += 7)
+        lastNames.append(mContactList.at(i).value("name").toObject().value("last"));
+    QJsonObject bindings;
+    bindings.insert(QLatin1String("lastNames"), lastNames);
+
+    JsonDbQueryParser parser;
+    parser.setQuery(QString("[?%1=\"contact\"][?name.last in %lastNames]").arg(JsonDbString::kTypeStr));
+    parser.setBindings(bindings);
+    QVERIFY(parser.parse());
+    JsonDbQuery parsedQuery = parser.result();
+
+    QBENCHMARK {
+        int matched = 0;
+        for (int i = 0; i < count; i++)
+            if (parsedQuery.match(mContactList.at(i), 0))
+                matched++;
+        QVERIFY(matched >= lastNames.size());
+    }
+}
+
+void TestPartition::benchmarkNotificationDispatch_data()
+{
+    QTest::addColumn<bool>("indexed");
+    QTest::newRow("match each") << false;
+    QTest::newRow("notification index") << true;
+}
+
+void TestPartition::benchmarkNotificationDispatch()
+{
+    QFETCH(bool, indexed);
+
+    int count = mContactList.size();
+    if (!count)
+        return;
+
+    // one watcher per contact on the same busy type
+    QStringList actions;
+    actions << JsonDbString::kCreateStr << JsonDbString::kUpdateStr << JsonDbString::kRemoveStr;
+    QList<JsonDbNotification *> notifications;
+    JsonDbNotificationIndex index;
+    for (int i = 0; i < count; i++) {
+        QString last = mContactList.at(i).value("name").toObject().value("last").toString();
+        JsonDbQueryParser parser;
+        parser.setQuery(QString("[?%1=\"contact\"][?name.last=\"%2\"]").arg(JsonDbString::kTypeStr).arg(last));
+        QVERIFY(parser.parse());
+        notifications.append(new JsonDbNotification(mOwner, parser.result(), actions));
+        index.insert(notifications.last());
+    }
+
+    QBENCHMARK {
+        int matched = 0;
+        for (int i = 0; i < count; i++) {
+            const JsonDbObject &object = mContactList.at(i);
+            if (indexed) {
+                foreach (JsonDbNotification *n, index.candidates(JsonDbObject(), object))
+                    if (n->parsedQuery().match(object, 0))
+                        matched++;
+            } else {
+                foreach (JsonDbNotification *n, notifications)
+                    if (n->parsedQuery().match(object, 0))
+                        matched++;
+            }
+        }
+        QVERIFY(matched >= count);
+    }
+
+    qDeleteAll(notifications);
+}
+
 void TestPartition::benchmarkTokenizer()
 {
     QStringList queries = (QStringList()
@@ -526,6 +614,163 @@ void TestPartition::benchmarkForwardKeyCmp()
     }
 }
 
+void TestPartition::benchmarkCollatedKeyCmp_data()
+{
+    QTest::addColumn<bool>("sortKeys");
+    QTest::newRow("collator") << false;
+    QTest::newRow("sortKeys") << true;
+}
+
+void TestPartition::benchmarkCollatedKeyCmp()
+{
+#ifndef NO_COLLATION_SUPPORT
+    QFETCH(bool, sortKeys);
+    int count = qMin(mContactList.size(), 1000);
+
+    // what a collated index compared before: strings, through the collator,
+    // against the sort keys it stores now
+    JsonDbCollator collator(QLocale(QLatin1String("en_US")), JsonDbCollator::Standard);
+    QStringList names;
+    QVector<QByteArray> keys;
+    for (int ii = 0; ii < count; ii++) {
+        QString name = mContactList.at(ii).value("name").toObject().value("last").toString();
+        names.append(name);
+        QByteArray sortKey = collator.sortKey(name);
+        sortKey.chop(1);
+        QString key = QString::fromLatin1(sortKey.constData(), sortKey.size());
+        keys.append(JsonDbIndexPrivate::makeForwardKey(key, ObjectKey()));
+    }
+
+    int less = 0;
+    QBENCHMARK {
+        less = 0;
+        for (int j = 0; j < count; j++) {
+            for (int i = 0; i < count; i++) {
+                int cmp = sortKeys ? JsonDbIndexPrivate::indexCompareFunction(keys.at(j), keys.at(i))
+                                   : collator.compare(names.at(j), names.at(i));
+                if (cmp < 0)
+                    less++;
+            }
+        }
+    }
+    QVERIFY(less > 0);
+#else
+    QSKIP("This benchmark requires NO_COLLATION_SUPPORT is not defined!");
+#endif
+}
+
+void TestPartition::benchmarkCollatedIndex_data()
+{
+    QTest::addColumn<bool>("collated");
+    QTest::newRow("plain") << false;
+    QTest::newRow("collated") << true;
+}
+
+void TestPartition::benchmarkCollatedIndex()
+{
+    QFETCH(bool, collated);
+#ifdef NO_COLLATION_SUPPORT
+    if (collated)
+        QSKIP("This benchmark requires NO_COLLATION_SUPPORT is not defined!");
+#endif
+    QString objectType = collated ? QLatin1String("CollatedContact") : QLatin1String("PlainContact");
+    QString indexName = objectType + QLatin1String("LastName");
+
+    JsonDbObject index;
+    index.insert(JsonDbString::kTypeStr, JsonDbString::kIndexTypeStr);
+    index.insert(JsonDbString::kNameStr, indexName);
+    index.insert(JsonDbString::kPropertyNameStr, QLatin1String("name.last"));
+    index.insert(JsonDbString::kObjectTypeStr, objectType);
+    if (collated) {
+        index.insert(JsonDbString::kLocaleStr, QLatin1String("en_US"));
+        index.insert(JsonDbString::kCollationStr, QLatin1String("standard"));
+    }
+    JsonDbWriteResult result = mJsonDbPartition->updateObject(mOwner, index);
+    QVERIFY(result.code == JsonDbError::NoError);
+
+    JsonDbObjectList contacts;
+    foreach (JsonDbObject contact, mContactList) {
+        contact.remove(JsonDbString::kUuidStr);
+        contact.remove(JsonDbString::kVersionStr);
+        contact.insert(JsonDbString::kTypeStr, objectType);
+        contacts.append(contact);
+    }
+
+    QElapsedTimer time;
+    time.start();
+    int chunksize = 100;
+    for (int count = 0; count < contacts.size(); count += chunksize) {
+        result = mJsonDbPartition->updateObjects(mOwner, contacts.mid(count, chunksize));
+        QVERIFY(result.code == JsonDbError::NoError);
+    }
+    long elapsed = time.elapsed();
+    qDebug() << "insert. Time per item (ms):" << (double)elapsed / contacts.size() << "elapsed" << elapsed << "ms";
+
+    JsonDbQueryParser parser;
+    parser.setQuery(QString("[?%1=\"%2\"][/%3]").arg(JsonDbString::kTypeStr).arg(objectType).arg(indexName));
+    QVERIFY(parser.parse());
+    JsonDbQuery parsedQuery = parser.result();
+    QBENCHMARK {
+        JsonDbQueryResult queryResult = mJsonDbPartition->queryObjects(mOwner, parsedQuery);
+        verifyGoodQueryResult(queryResult);
+        QCOMPARE(queryResult.data.size(), contacts.size());
+    }
+}
+
+void TestPartition::benchmarkBatchIndexUpdate_data()
+{
+    QTest::addColumn<int>("indexThreadCount");
+    QTest::newRow("immediate") << 0;
+    QTest::newRow("sorted at commit") << 4;
+}
+
+void TestPartition::benchmarkBatchIndexUpdate()
+{
+    QFETCH(int, indexThreadCount);
+    int oldIndexThreadCount = jsondbSettings->indexThreadCount();
+    jsondbSettings->setIndexThreadCount(indexThreadCount);
+
+    QString objectType = QString::fromLatin1("BatchIndexUpdate%1").arg(indexThreadCount);
+    QStringList properties = QStringList() << QLatin1String("key") << QLatin1String("serial");
+    foreach (const QString &property, properties) {
+        JsonDbObject index;
+        index.insert(JsonDbString::kTypeStr, JsonDbString::kIndexTypeStr);
+        index.insert(JsonDbString::kNameStr, objectType + property);
+        index.insert(JsonDbString::kPropertyNameStr, property);
+        index.insert(JsonDbString::kObjectTypeStr, objectType);
+        JsonDbWriteResult result = mJsonDbPartition->updateObject(mOwner, index);
+        QVERIFY(result.code == JsonDbError::NoError);
+    }
+
+    // scattered keys, so that consecutive writes land on different leaves
+    const int count = 10000;
+    JsonDbObjectList objects;
+    qsrand(count);
+    for (int i = 0; i < count; i++) {
+        JsonDbObject object;
+        object.insert(JsonDbString::kTypeStr, objectType);
+        object.insert(QLatin1String("key"), QString::number(qrand(), 16));
+        object.insert(QLatin1String("serial"), i);
+        objects.append(object);
+    }
+
+    QElapsedTimer time;
+    time.start();
+    JsonDbWriteResult result = mJsonDbPartition->updateObjects(mOwner, objects);
+    QVERIFY(result.code == JsonDbError::NoError);
+    long elapsed = time.elapsed();
+    qDebug() << "insert. Time per item (ms):" << (double)elapsed / count << "elapsed" << elapsed << "ms";
+
+    jsondbSettings->setIndexThreadCount(oldIndexThreadCount);
+
+    JsonDbQueryParser parser;
+    parser.setQuery(QString("[?%1=\"%2\"][/%3]").arg(JsonDbString::kTypeStr).arg(objectType).arg(objectType + QLatin1String("key")));
+    QVERIFY(parser.parse());
+    JsonDbQueryResult queryResult = mJsonDbPartition->queryObjects(mOwner, parser.result());
+    verifyGoodQueryResult(queryResult);
+    QCOMPARE(queryResult.data.size(), count);
+}
+
 void TestPartition::benchmarkParsedQuery()
 {
     int count = mContactList.size();
@@ -15,4 +15,10 @@ include(../../../src/hbtree/hbtree.pri)
 SOURCES += \
     bench_partition.cpp \
 
+config_icu {
+    LIBS += -licuuc -licui18n
+} else {
+    DEFINES += NO_COLLATION_SUPPORT
+}
+
 DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0